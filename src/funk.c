@@ -1,8 +1,28 @@
 #include "funk.h"
+#include "funk_parallel.h"
+#include "funk_jit.h"
+#include "funk_generator.h"
+#include "funk_snapshot.h"
 
 #include <string.h>
-#include <printf.h>
+#include <stdio.h>
+#include <stdarg.h>
 #include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+// Freed slots are poisoned, so that AddressSanitizer still catches the use of freed objects
+#if defined(__SANITIZE_ADDRESS__)
+	#include <sanitizer/asan_interface.h>
+
+	#define POISON_MEMORY(pointer, size) ASAN_POISON_MEMORY_REGION((pointer), (size))
+	#define UNPOISON_MEMORY(pointer, size) ASAN_UNPOISON_MEMORY_REGION((pointer), (size))
+#else
+	#define POISON_MEMORY(pointer, size) ((void) 0)
+	#define UNPOISON_MEMORY(pointer, size) ((void) 0)
+#endif
 
 void funk_init_scanner(FunkScanner* scanner, const char* code) {
 	scanner->start = code;
@@ -153,24 +173,38 @@ void funk_free_object(sFunkVm* vm, FunkObject* object) {
 		case FUNK_OBJECT_BASIC_FUNCTION: {
 			FunkBasicFunction* function = (FunkBasicFunction*) object;
 
-			if (function->argumentNames != NULL) {
-				vm->freeFn((void*) function->argumentNames);
-			}
+			if (function->prototype != NULL) {
+				FUNK_FREE_ARRAY(vm, FunkFunction*, function->upvalues, function->upvalueCount);
+				funk_free_slab(vm, object, sizeof(FunkBasicFunction));
 
-			if (function->code != NULL) {
-				vm->freeFn((void *) function->code);
+				break;
 			}
 
-			if (function->constants != NULL) {
-				vm->freeFn((void *) function->constants);
+			FUNK_FREE_ARRAY(vm, FunkString*, function->argumentNames, function->argumentCount);
+			FUNK_FREE_ARRAY(vm, uint8_t, function->code, function->codeAllocated);
+			FUNK_FREE_ARRAY(vm, FunkObject*, function->constants, function->constantsAllocated);
+			FUNK_FREE_ARRAY(vm, FunkString*, function->localNames, function->localCount);
+			FUNK_FREE_ARRAY(vm, uint16_t, function->upvalueSources, function->upvalueCount);
+
+			// Code without a size wasn't made by the jit, funkc links it into the program
+			if (function->jitCode != NULL && function->jitSize > 0) {
+				funk_jit_free(function->jitCode, function->jitSize);
 			}
 
+			funk_free_slab(vm, object, sizeof(FunkBasicFunction));
+
 			break;
 		}
 
 		case FUNK_OBJECT_STRING: {
 			FunkString* string = (FunkString*) object;
-			vm->freeFn((void*) string->chars);
+
+			if (string->chars == (const char*) (string + 1)) {
+				funk_free_slab(vm, object, sizeof(FunkString) + string->length + 1);
+			} else {
+				FUNK_FREE_ARRAY(vm, char, string->chars, string->length + 1);
+				funk_free_slab(vm, object, sizeof(FunkString));
+			}
 
 			break;
 		}
@@ -182,6 +216,7 @@ void funk_free_object(sFunkVm* vm, FunkObject* object) {
 				function->cleanupFn(vm, function);
 			}
 
+			funk_free_slab(vm, object, sizeof(FunkNativeFunction));
 			break;
 		}
 
@@ -189,17 +224,18 @@ void funk_free_object(sFunkVm* vm, FunkObject* object) {
 			UNREACHABLE
 		}
 	}
-
-	vm->freeFn((void*) object);
 }
 
 static FunkObject* allocate_object(FunkVm* vm, size_t size) {
-	FunkObject* object = (FunkObject*) vm->allocFn(size);
+	FunkObject* object = (FunkObject*) funk_allocate_slab(vm, size);
 
-	object->next = vm->objects;
+	object->next = vm->youngObjects;
 	object->marked = false;
+	object->young = true;
+	object->remembered = false;
+	object->level = vm->level;
 
-	vm->objects = object;
+	vm->youngObjects = object;
 
 	return object;
 }
@@ -219,13 +255,26 @@ FunkString* funk_create_string(sFunkVm* vm, const char* chars, uint16_t length)
 	uint32_t hash = hash_string(chars, length);
 	FunkString* interned = funk_table_find_string(&vm->strings, chars, length, hash);
 
+	for (FunkVm* owner = vm->parent; interned == NULL && owner != NULL; owner = owner->parent) {
+		interned = funk_table_find_string(&owner->strings, chars, length, hash);
+	}
+
 	if (interned != NULL) {
+		// Nothing referenced the string, when the marking ended, so the sweep in progress has to be told to keep it
+		if (vm->gcPhase == FUNK_GC_SWEEPING && !interned->object.young) {
+			interned->object.marked = true;
+		}
+
 		return interned;
 	}
 
-	FunkString* string = (FunkString*) allocate_object(vm, sizeof(FunkString));
+	// Short strings keep their characters right after the object, in the same slab slot
+	size_t size = sizeof(FunkString) + length + 1;
+	bool isInline = size <= FUNK_SLAB_MAX_SIZE;
+
+	FunkString* string = (FunkString*) allocate_object(vm, isInline ? size : sizeof(FunkString));
+	char* buffer = isInline ? (char*) (string + 1) : FUNK_ALLOCATE(vm, char, length + 1);
 
-	char* buffer = vm->allocFn(length + 1);
 	memcpy((void*) buffer, chars, length);
 	buffer[length] = '\0';
 
@@ -259,6 +308,21 @@ FunkBasicFunction* funk_create_basic_function(sFunkVm* vm, FunkString* name) {
 	function->constantsAllocated = 0;
 	function->constantsLength = 0;
 
+	function->lexical = false;
+	function->localNames = NULL;
+	function->localCount = 0;
+	function->upvalueSources = NULL;
+	function->upvalueCount = 0;
+	function->inlineDepth = 0;
+
+	function->prototype = NULL;
+	function->upvalues = NULL;
+	function->scope = NULL;
+
+	function->calls = 0;
+	function->jitCode = NULL;
+	function->jitSize = 0;
+
 	return function;
 }
 
@@ -269,14 +333,9 @@ FunkBasicFunction* funk_create_empty_function(sFunkVm* vm, const char* name) {
 
 void funk_write_instruction(sFunkVm* vm, FunkBasicFunction* function, uint8_t instruction) {
 	if (function->codeAllocated < function->codeLength + 1) {
-		uint16_t newSize = FUNK_GROW_CAPACITY(function->codeAllocated);
-		size_t totalSize = sizeof(uint8_t) * newSize;
-		uint8_t* newChunk = (uint8_t*) vm->allocFn(totalSize);
+		uint32_t newSize = FUNK_GROW_CAPACITY(function->codeAllocated);
 
-		memcpy((void*) newChunk, (void*) function->code, sizeof(uint8_t) * function->codeAllocated);
-		vm->freeFn((void*) function->code);
-
-		function->code = newChunk;
+		function->code = FUNK_GROW_ARRAY(vm, uint8_t, function->code, function->codeAllocated, newSize);
 		function->codeAllocated = newSize;
 	}
 
@@ -291,14 +350,19 @@ uint16_t funk_add_constant(sFunkVm* vm, FunkBasicFunction* function, FunkObject*
 	}
 
 	if (function->constantsAllocated < function->constantsLength + 1) {
-		uint16_t newSize = FUNK_GROW_CAPACITY(function->constantsAllocated);
-		FunkObject** newConstants = (FunkObject**) vm->allocFn(sizeof(FunkObject*) * newSize);
+		if (function->constantsLength == UINT16_MAX) {
+			funk_error(vm, "Too many constants in function %s", function->parent.name->chars);
+		}
 
-		memcpy((void*) newConstants, (void*) function->constants, sizeof(FunkObject*) * function->constantsAllocated);
-		vm->freeFn((void*) function->constants);
+		// Constant indexes are 16 bit wide
+		uint32_t newSize = FUNK_GROW_CAPACITY((uint32_t) function->constantsAllocated);
+
+		if (newSize > UINT16_MAX) {
+			newSize = UINT16_MAX;
+		}
 
-		function->constants = newConstants;
-		function->constantsAllocated = newSize;
+		function->constants = FUNK_GROW_ARRAY(vm, FunkObject*, function->constants, function->constantsAllocated, newSize);
+		function->constantsAllocated = (uint16_t) newSize;
 	}
 
 	function->constants[function->constantsLength++] = (FunkObject*) constant;
@@ -314,6 +378,7 @@ FunkNativeFunction* funk_create_native_function(sFunkVm* vm, FunkString* name, F
 	function->fn = fn;
 	function->data = NULL;
 	function->cleanupFn = NULL;
+	function->traceFn = NULL;
 
 	return function;
 }
@@ -345,29 +410,191 @@ static uint16_t add_string_constant(FunkCompiler* compiler, const char* string,
 	return funk_add_constant(compiler->vm, compiler->function, (FunkObject*) string_object);
 }
 
-static uint16_t add_string_constant_for_previous_token(FunkCompiler* compiler) {
-	return add_string_constant(compiler, compiler->previous.start, compiler->previous.length);
-}
-
 static void write_uint8_t(FunkCompiler* compiler, uint8_t byte) {
 	funk_write_instruction(compiler->vm, compiler->function, byte);
 }
 
 static void write_uint16_t(FunkCompiler* compiler, uint16_t byte) {
-	funk_write_instruction(compiler->vm, compiler->function, (uint8_t) ((byte << 8) & 0xff));
+	funk_write_instruction(compiler->vm, compiler->function, (uint8_t) ((byte >> 8) & 0xff));
 	funk_write_instruction(compiler->vm, compiler->function, (uint8_t) (byte & 0xff));
 }
 
+// The body of a lambda, that is compiled straight into the function, that calls an intrinsic
+typedef struct FunkInlineBody {
+	// The operand of the jump of the first return, the others jump back to it. UINT32_MAX, until there is one
+	uint32_t returnJump;
+	// The slots from here on belong to the body, like they would belong to the frame of its call
+	uint8_t localStart;
+	uint8_t depth;
+	struct FunkInlineBody* enclosing;
+} FunkInlineBody;
+
+// Writes a jump forward, returns the offset of its operand, that patch_jump() fills in
+static uint32_t write_jump(FunkCompiler* compiler, uint8_t instruction) {
+	write_uint8_t(compiler, instruction);
+	write_uint16_t(compiler, UINT16_MAX);
+
+	return compiler->function->codeLength - 2;
+}
+
+// Makes the jump land on the next instruction, that is written
+static void patch_jump(FunkCompiler* compiler, uint32_t operand) {
+	FunkBasicFunction* function = compiler->function;
+	uint32_t distance = function->codeLength - operand - 2;
+
+	if (distance > UINT16_MAX) {
+		funk_error(compiler->vm, "Too much code to jump over in %s", function->parent.name->chars);
+	}
+
+	function->code[operand] = (uint8_t) ((distance >> 8) & 0xff);
+	function->code[operand + 1] = (uint8_t) (distance & 0xff);
+}
+
+static void write_loop(FunkCompiler* compiler, uint32_t start) {
+	write_uint8_t(compiler, FUNK_INSTRUCTION_LOOP);
+	uint32_t distance = compiler->function->codeLength + 2 - start;
+
+	if (distance > UINT16_MAX) {
+		funk_error(compiler->vm, "Too much code to loop over in %s", compiler->function->parent.name->chars);
+	}
+
+	write_uint16_t(compiler, (uint16_t) distance);
+}
+
 static void compile_expression(FunkCompiler* compiler);
 static void compile_declaration(FunkCompiler* compiler, bool topLevel);
 
+// Names are interned, so comparing the pointers is enough
+static int16_t resolve_local(FunkLexicalScope* scope, FunkString* name) {
+	for (int16_t i = scope->function->localCount - 1; i >= 0; i--) {
+		if (scope->locals[i] == name && !scope->hidden[i]) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static uint8_t add_local(FunkCompiler* compiler, FunkString* name) {
+	FunkLexicalScope* scope = compiler->scope;
+	int16_t local = resolve_local(scope, name);
+	// An inlined body gets a new slot for a name, that the function around it has already
+	uint8_t firstLocal = compiler->inlineBody != NULL ? compiler->inlineBody->localStart : 0;
+
+	if (local != -1 && local >= firstLocal) {
+		return (uint8_t) local;
+	}
+
+	if (scope->function->localCount == UINT8_MAX) {
+		funk_error(compiler->vm, "Too many arguments and functions in %s", scope->function->parent.name->chars);
+	}
+
+	scope->locals[scope->function->localCount] = name;
+	scope->hidden[scope->function->localCount] = false;
+	return scope->function->localCount++;
+}
+
+static int16_t add_upvalue(FunkCompiler* compiler, FunkLexicalScope* scope, uint16_t source) {
+	FunkBasicFunction* function = scope->function;
+
+	for (uint8_t i = 0; i < function->upvalueCount; i++) {
+		if (scope->upvalues[i] == source) {
+			return i;
+		}
+	}
+
+	if (function->upvalueCount == UINT8_MAX) {
+		funk_error(compiler->vm, "Too many captured names in %s", function->parent.name->chars);
+	}
+
+	scope->upvalues[function->upvalueCount] = source;
+	return function->upvalueCount++;
+}
+
+// Captures the name from the enclosing functions, that keep it in a slot, through every function in between
+static int16_t resolve_upvalue(FunkCompiler* compiler, FunkLexicalScope* scope, FunkString* name) {
+	if (scope->enclosing == NULL) {
+		return -1;
+	}
+
+	int16_t local = resolve_local(scope->enclosing, name);
+
+	if (local != -1) {
+		return add_upvalue(compiler, scope, (uint16_t) (0x100 | local));
+	}
+
+	int16_t upvalue = resolve_upvalue(compiler, scope->enclosing, name);
+
+	if (upvalue != -1) {
+		return add_upvalue(compiler, scope, (uint16_t) upvalue);
+	}
+
+	return -1;
+}
+
+static void compile_lexical_name(FunkCompiler* compiler, FunkToken* token, bool isACall) {
+	FunkString* name = funk_create_string(compiler->vm, token->start, token->length);
+	int16_t local = resolve_local(compiler->scope, name);
+
+	if (local != -1) {
+		write_uint8_t(compiler, FUNK_INSTRUCTION_GET_LOCAL);
+		write_uint8_t(compiler, (uint8_t) local);
+
+		return;
+	}
+
+	int16_t upvalue = resolve_upvalue(compiler, compiler->scope, name);
+
+	if (upvalue != -1) {
+		write_uint8_t(compiler, FUNK_INSTRUCTION_GET_UPVALUE);
+		write_uint8_t(compiler, (uint8_t) upvalue);
+
+		return;
+	}
+
+	// Variables, made by set(), and globals are only known at runtime
+	write_uint8_t(compiler, isACall ? FUNK_INSTRUCTION_GET_LEXICAL : FUNK_INSTRUCTION_GET_LEXICAL_STRING);
+	write_uint16_t(compiler, funk_add_constant(compiler->vm, compiler->function, (FunkObject*) name));
+}
+
+static void finish_lexical_scope(FunkCompiler* compiler, FunkLexicalScope* scope) {
+	FunkBasicFunction* function = scope->function;
+
+	function->lexical = true;
+
+	if (function->localCount > 0) {
+		function->localNames = FUNK_ALLOCATE(compiler->vm, FunkString*, function->localCount);
+		memcpy((void*) function->localNames, scope->locals, sizeof(FunkString*) * function->localCount);
+	}
+
+	if (function->upvalueCount > 0) {
+		function->upvalueSources = FUNK_ALLOCATE(compiler->vm, uint16_t, function->upvalueCount);
+		memcpy((void*) function->upvalueSources, scope->upvalues, sizeof(uint16_t) * function->upvalueCount);
+	}
+
+	compiler->scope = scope->enclosing;
+}
+
 static FunkFunction* compile_function(FunkCompiler* compiler, FunkString* name, bool lambda) {
 	FunkBasicFunction* oldFunction = compiler->function;
 	FunkVm* vm = compiler->vm;
 	bool compiledBody = false;
 
+	// A return in the new function belongs to it, not to a body, that is being inlined
+	FunkInlineBody* oldInlineBody = compiler->inlineBody;
+	compiler->inlineBody = NULL;
+
 	compiler->function = funk_create_basic_function(vm,  name);
 
+	FunkLexicalScope scope;
+
+	if (compiler->lexical) {
+		scope.function = compiler->function;
+		scope.enclosing = compiler->scope;
+
+		compiler->scope = &scope;
+	}
+
 	if (!lambda || compiler->current.type != FUNK_TOKEN_LEFT_BRACE) {
 		consume_token(compiler, FUNK_TOKEN_LEFT_PAREN, "Expected '(' after function name");
 
@@ -379,10 +606,17 @@ static FunkFunction* compile_function(FunkCompiler* compiler, FunkString* name,
 				argumentNames[compiler->function->argumentCount++] = funk_create_string(vm, compiler->previous.start, compiler->previous.length);
 			} while (match_token(compiler, FUNK_TOKEN_COMMA));
 
-			size_t size = sizeof(FunkString*) * compiler->function->argumentCount;
-			compiler->function->argumentNames = (FunkString**) vm->allocFn(size);
+			compiler->function->argumentNames = FUNK_ALLOCATE(vm, FunkString*, compiler->function->argumentCount);
+			memcpy((void*) compiler->function->argumentNames, argumentNames, sizeof(FunkString*) * compiler->function->argumentCount);
+
+			if (compiler->lexical) {
+				for (uint8_t i = 0; i < compiler->function->argumentCount; i++) {
+					scope.locals[i] = argumentNames[i];
+					scope.hidden[i] = false;
+				}
 
-			memcpy((void*) compiler->function->argumentNames, argumentNames, size);
+				compiler->function->localCount = compiler->function->argumentCount;
+			}
 
 			consume_token(compiler, FUNK_TOKEN_RIGHT_PAREN, "Expected ')' after function arguments");
 		}
@@ -410,966 +644,3441 @@ static FunkFunction* compile_function(FunkCompiler* compiler, FunkString* name,
 		write_uint8_t(compiler, FUNK_INSTRUCTION_RETURN);
 	}
 
+	if (compiler->lexical) {
+		finish_lexical_scope(compiler, &scope);
+	}
+
 	FunkObject* newFunction = (FunkObject*) compiler->function;
+
+	compiler->inlineBody = oldInlineBody;
 	compiler->function = oldFunction;
 
 	return (FunkFunction*) newFunction;
 }
 
-static void compile_expression(FunkCompiler* compiler) {
-	if (match_token(compiler, FUNK_TOKEN_RETURN)) {
-		compile_expression(compiler);
-		write_uint8_t(compiler, FUNK_INSTRUCTION_RETURN);
-
-		return;
+// Tells, if the name is an argument or an inner function of this function, or of any function around it
+static bool is_lexical_name(FunkLexicalScope* scope, FunkString* name) {
+	for (; scope != NULL; scope = scope->enclosing) {
+		if (resolve_local(scope, name) != -1) {
+			return true;
+		}
 	}
 
-	if (compiler->current.type == FUNK_TOKEN_LEFT_PAREN || compiler->current.type == FUNK_TOKEN_LEFT_BRACE) {
-		char buffer[256];
-		sprintf(buffer, "lambda %s %u", compiler->function->parent.name->chars, compiler->previous.line);
+	return false;
+}
 
-		FunkString* name = funk_create_string(compiler->vm, buffer, strlen(buffer));
-		FunkFunction* lambda = compile_function(compiler, name, true);
+static int16_t find_intrinsic(FunkCompiler* compiler, FunkToken* token) {
+	if (!compiler->lowerIntrinsics || compiler->current.type != FUNK_TOKEN_LEFT_PAREN) {
+		return -1;
+	}
 
-		write_uint8_t(compiler, FUNK_INSTRUCTION_PUSH_CONSTANT);
-		write_uint16_t(compiler, funk_add_constant(compiler->vm, compiler->function, (FunkObject*) lambda));
+	for (uint8_t i = 0; i < FUNK_INTRINSIC_COUNT; i++) {
+		FunkString* name = compiler->vm->intrinsicNames[i];
 
-		return;
+		if (name != NULL && token->length == name->length && memcmp(token->start, name->chars, name->length) == 0) {
+			// Names in slots are known to be something else already
+			if (compiler->lexical && is_lexical_name(compiler->scope, name)) {
+				return -1;
+			}
+
+			return i;
+		}
 	}
 
-	consume_token(compiler, FUNK_TOKEN_NAME, "Function name expected");
+	return -1;
+}
 
-	uint16_t name = add_string_constant_for_previous_token(compiler);
-	bool isACall = match_token(compiler, FUNK_TOKEN_LEFT_PAREN);
+// Checks, if the argument, that starts with the token, is a lambda, that takes argumentCount arguments,
+// and that can be compiled into the current function. The scanner is right after the token
+static bool is_inline_lambda(FunkScanner* scanner, FunkToken token, uint8_t argumentCount) {
+	if (token.type == FUNK_TOKEN_LEFT_BRACE) {
+		return argumentCount == 0;
+	}
 
-	write_uint8_t(compiler, isACall ? FUNK_INSTRUCTION_GET : FUNK_INSTRUCTION_GET_STRING);
-	write_uint16_t(compiler, name);
+	if (token.type != FUNK_TOKEN_LEFT_PAREN) {
+		return false;
+	}
 
-	while (isACall) {
-		uint8_t argumentCount = 0;
+	token = funk_scan_token(scanner);
 
-		if (!match_token(compiler, FUNK_TOKEN_RIGHT_PAREN)) {
-			do {
-				compile_expression(compiler);
-				argumentCount++;
-			} while (match_token(compiler, FUNK_TOKEN_COMMA));
+	for (uint8_t i = 0; i < argumentCount; i++) {
+		if (i > 0) {
+			if (token.type != FUNK_TOKEN_COMMA) {
+				return false;
+			}
 
-			consume_token(compiler, FUNK_TOKEN_RIGHT_PAREN, "')' expected after function arguments");
+			token = funk_scan_token(scanner);
 		}
 
-		write_uint8_t(compiler, FUNK_INSTRUCTION_CALL);
-		write_uint8_t(compiler, argumentCount);
+		if (token.type != FUNK_TOKEN_NAME) {
+			return false;
+		}
 
-		isACall = match_token(compiler, FUNK_TOKEN_LEFT_PAREN);
+		token = funk_scan_token(scanner);
 	}
-}
-
-static void compile_declaration(FunkCompiler* compiler, bool topLevel) {
-	if (match_token(compiler, FUNK_TOKEN_FUNCTION)) {
-		consume_token(compiler, FUNK_TOKEN_NAME, "Expected function name");
 
-		FunkVm* vm = compiler->vm;
-		FunkString* name = funk_create_string(vm, compiler->previous.start, compiler->previous.length);
+	return token.type == FUNK_TOKEN_RIGHT_PAREN && funk_scan_token(scanner).type == FUNK_TOKEN_ARROW;
+}
 
-		FunkFunction* newFunction = compile_function(compiler, name, false);
+#define FUNK_MAX_LOWERED_ARGUMENTS 3
 
-		write_uint8_t(compiler, topLevel ? FUNK_INSTRUCTION_DEFINE_GLOBAL : FUNK_INSTRUCTION_DEFINE);
-		write_uint16_t(compiler, funk_add_constant(vm, compiler->function, (FunkObject *) newFunction));
+// Finds where the arguments of the call start, the current token is its '('. Returns how many there are,
+// or -1, if there are too many for an intrinsic, or the call doesn't end
+static int8_t scan_arguments(FunkCompiler* compiler, FunkScanner* scanners, FunkToken* tokens) {
+	FunkScanner scanner = *compiler->scanner;
+	FunkToken token = funk_scan_token(&scanner);
 
-		return;
+	if (token.type == FUNK_TOKEN_RIGHT_PAREN) {
+		return 0;
 	}
 
-	compile_expression(compiler);
-	write_uint8_t(compiler, FUNK_INSTRUCTION_POP);
-}
+	int8_t count = 0;
+	uint16_t depth = 0;
 
-FunkFunction* funk_compile_string(sFunkVm* vm, const char* name, const char* string) {
-	if (setjmp(vm->errorJumpBuffer) != 0) {
-		return NULL;
-	}
+	tokens[0] = token;
+	scanners[0] = scanner;
 
-	FunkString* string_name = funk_create_string(vm, name, strlen(name));
-	FunkBasicFunction* function = funk_create_basic_function(vm, string_name);
+	while (true) {
+		switch (token.type) {
+			case FUNK_TOKEN_EOF: return -1;
 
-	FunkScanner scanner;
-	funk_init_scanner(&scanner, string);
+			case FUNK_TOKEN_LEFT_PAREN:
+			case FUNK_TOKEN_LEFT_BRACE: depth++; break;
 
-	FunkCompiler compiler;
+			case FUNK_TOKEN_RIGHT_PAREN:
+			case FUNK_TOKEN_RIGHT_BRACE: {
+				if (depth == 0) {
+					return (int8_t) (count + 1);
+				}
 
-	compiler.vm = vm;
-	compiler.scanner = &scanner;
-	compiler.function = function;
+				depth--;
+				break;
+			}
 
-	advance_token(&compiler);
+			case FUNK_TOKEN_COMMA: {
+				if (depth > 0) {
+					break;
+				}
 
-	while (compiler.current.type != FUNK_TOKEN_EOF) {
-		compile_declaration(&compiler, true);
-	}
+				if (++count == FUNK_MAX_LOWERED_ARGUMENTS) {
+					return -1;
+				}
 
-	write_uint8_t(&compiler, FUNK_INSTRUCTION_RETURN);
+				token = funk_scan_token(&scanner);
+				tokens[count] = token;
+				scanners[count] = scanner;
 
-	return &function->parent;
-}
+				continue;
+			}
 
-void funk_init_table(FunkTable* table) {
-	table->capacity = -1;
-	table->count = 0;
-	table->entries = NULL;
-}
+			default: break;
+		}
 
-void funk_free_table(FunkVm* vm, FunkTable* table) {
-	if (table->capacity > 0) {
-		vm->freeFn(table->entries);
+		token = funk_scan_token(&scanner);
 	}
-
-	funk_init_table(table);
 }
 
-static FunkTableEntry* find_entry(FunkTableEntry* entries, int capacity, FunkString* key) {
-	uint32_t index = key->hash % capacity;
-	FunkTableEntry* tombstone = NULL;
+// Decides from the tokens alone, so that nothing is compiled, that is thrown away again
+static bool can_lower(FunkCompiler* compiler, FunkIntrinsic intrinsic) {
+	if (compiler->inlineBody != NULL && compiler->inlineBody->depth == UINT8_MAX) {
+		return false;
+	}
 
-	while (true) {
-		FunkTableEntry* entry = &entries[index];
+	FunkScanner scanners[FUNK_MAX_LOWERED_ARGUMENTS];
+	FunkToken tokens[FUNK_MAX_LOWERED_ARGUMENTS];
+	int8_t count = scan_arguments(compiler, scanners, tokens);
 
-		if (entry->key == NULL) {
-			if (entry->value == NULL) {
-				return tombstone != NULL ? tombstone : entry;
-			} else if (tombstone == NULL) {
-				tombstone = entry;
-			}
-		} if (entry->key == key) {
-			return entry;
+	switch (intrinsic) {
+		case FUNK_INTRINSIC_IF: {
+			return (count == 2 || count == 3) && is_inline_lambda(&scanners[1], tokens[1], 0)
+				&& (count == 2 || is_inline_lambda(&scanners[2], tokens[2], 0));
 		}
 
-		index = (index + 1) % capacity;
+		case FUNK_INTRINSIC_WHILE: return count == 2 && is_inline_lambda(&scanners[0], tokens[0], 0) && is_inline_lambda(&scanners[1], tokens[1], 0);
+		case FUNK_INTRINSIC_FOR: return count == 3 && is_inline_lambda(&scanners[2], tokens[2], 1);
+		default: UNREACHABLE
 	}
+
+	return false;
 }
 
-static void adjust_capacity(FunkVm* vm, FunkTable* table, int capacity) {
-	FunkTableEntry* entries = (FunkTableEntry*) vm->allocFn(sizeof(FunkTableEntry) * (capacity + 1));
+// Compiles the lambda, that can_lower() agreed to, into the current function, leaving its value on the stack.
+// Its argument, if there is one, is taken from the stack. The body gets a frame of its own, like its call would
+static void compile_inline_body(FunkCompiler* compiler, FunkInlineBody* body) {
+	FunkBasicFunction* function = compiler->function;
 
-	for (int i = 0; i <= capacity; i++) {
-		entries[i].key = NULL;
-		entries[i].value = NULL;
-	}
+	body->returnJump = UINT32_MAX;
+	body->localStart = function->localCount;
+	body->enclosing = compiler->inlineBody;
+	body->depth = (uint8_t) (body->enclosing != NULL ? body->enclosing->depth + 1 : 1);
 
-	table->count = 0;
+	if (body->depth > function->inlineDepth) {
+		function->inlineDepth = body->depth;
+	}
 
-	for (int i = 0; i <= table->capacity; i++) {
-		FunkTableEntry* entry = &table->entries[i];
+	compiler->inlineBody = body;
+	bool block = true;
+	bool hasArgument = false;
+	FunkToken argument;
 
-		if (entry->key == NULL) {
-			continue;
+	if (match_token(compiler, FUNK_TOKEN_LEFT_PAREN)) {
+		if (match_token(compiler, FUNK_TOKEN_NAME)) {
+			argument = compiler->previous;
+			hasArgument = true;
 		}
 
-		FunkTableEntry* destination = find_entry(entries, capacity, entry->key);
-
-		destination->key = entry->key;
-		destination->value = entry->value;
+		consume_token(compiler, FUNK_TOKEN_RIGHT_PAREN, "Expected ')' after function arguments");
+		consume_token(compiler, FUNK_TOKEN_ARROW, "Expected '=>' after function arguments");
 
-		table->count++;
+		block = compiler->current.type == FUNK_TOKEN_LEFT_BRACE;
 	}
 
-	vm->freeFn(table->entries);
-	table->capacity = capacity;
-	table->entries = entries;
-}
-
-bool funk_table_set(FunkVm* vm, FunkTable* table, FunkString* key, FunkObject* value) {
-	if (table->count + 1 > (table->capacity + 1) * TABLE_MAX_LOAD) {
-		int capacity = FUNK_GROW_CAPACITY(table->capacity + 1) - 1;
-		adjust_capacity(vm, table, capacity);
-	}
+	write_uint8_t(compiler, FUNK_INSTRUCTION_PUSH_SCOPE);
+	write_uint8_t(compiler, hasArgument ? 1 : 0);
+	write_uint16_t(compiler, UINT16_MAX);
 
-	FunkTableEntry* entry = find_entry(table->entries, table->capacity, key);
-	bool isNew = entry->key == NULL;
+	uint32_t exit = function->codeLength - 2;
 
-	if (isNew && entry->value == NULL) {
-		table->count++;
+	if (hasArgument) {
+		if (compiler->lexical) {
+			write_uint8_t(compiler, FUNK_INSTRUCTION_SET_LOCAL);
+			write_uint8_t(compiler, add_local(compiler, funk_create_string(compiler->vm, argument.start, argument.length)));
+		} else {
+			write_uint8_t(compiler, FUNK_INSTRUCTION_SET);
+			write_uint16_t(compiler, add_string_constant(compiler, argument.start, argument.length));
+		}
 	}
 
-	entry->key = key;
-	entry->value = value;
+	if (block) {
+		consume_token(compiler, FUNK_TOKEN_LEFT_BRACE, "Expected '{' after function arguments");
 
-	return isNew;
-}
+		while (!match_token(compiler, FUNK_TOKEN_RIGHT_BRACE)) {
+			compile_declaration(compiler, false);
+		}
 
-bool funk_table_get(FunkTable* table, FunkString* key, FunkObject** value) {
-	if (table->count == 0) {
-		return false;
+		write_uint8_t(compiler, FUNK_INSTRUCTION_PUSH_NULL);
+	} else {
+		compile_expression(compiler);
 	}
 
-	FunkTableEntry* entry = find_entry(table->entries, table->capacity, key);
+	write_uint8_t(compiler, FUNK_INSTRUCTION_POP_SCOPE);
 
-	if (entry->key == NULL) {
-		return false;
+	if (body->returnJump != UINT32_MAX) {
+		patch_jump(compiler, body->returnJump);
 	}
 
-	*value = entry->value;
-	return true;
-}
+	// An error in the body goes on from here
+	patch_jump(compiler, exit);
 
-FunkString* funk_table_find_string(FunkTable* table, const char* chars, uint16_t length, uint32_t hash) {
-	if (table->count == 0) {
-		return NULL;
+	if (compiler->lexical) {
+		for (uint8_t i = body->localStart; i < function->localCount; i++) {
+			compiler->scope->hidden[i] = true;
+		}
 	}
 
-	uint32_t index = hash % table->capacity;
+	compiler->inlineBody = body->enclosing;
+}
 
-	while (true) {
-		FunkTableEntry* entry = &table->entries[index];
+// if(condition, then, else), the branches are only run, if they are picked
+static void lower_if(FunkCompiler* compiler) {
+	FunkInlineBody body;
+	FunkScanner scanner = *compiler->scanner;
 
-		if (entry->key == NULL) {
-			if (entry->value == NULL) {
-				return NULL;
-			}
-		} else if (entry->key->length == length &&
-       entry->key->hash == hash &&
-       memcmp(entry->key->chars, chars, length) == 0) {
+	if (is_inline_lambda(&scanner, compiler->current, 0)) {
+		compile_inline_body(compiler, &body);
+	} else {
+		compile_expression(compiler);
+	}
 
-			return entry->key;
-		}
+	consume_token(compiler, FUNK_TOKEN_COMMA, "Expected ',' after the condition");
 
-		index = (index + 1) % table->capacity;
+	uint32_t elseJump = write_jump(compiler, FUNK_INSTRUCTION_JUMP_IF_FALSE);
+	compile_inline_body(compiler, &body);
+
+	uint32_t endJump = write_jump(compiler, FUNK_INSTRUCTION_JUMP);
+	patch_jump(compiler, elseJump);
+
+	if (match_token(compiler, FUNK_TOKEN_COMMA)) {
+		compile_inline_body(compiler, &body);
+	} else {
+		write_uint8_t(compiler, FUNK_INSTRUCTION_PUSH_NULL);
 	}
+
+	patch_jump(compiler, endJump);
 }
 
-bool funk_table_delete(FunkTable* table, FunkString* key) {
-	if (table->count == 0) {
-		return false;
+// while(condition, body), a return in the body only ends the current round
+static void lower_while(FunkCompiler* compiler) {
+	FunkInlineBody body;
+
+	uint32_t start = compiler->function->codeLength;
+	compile_inline_body(compiler, &body);
+	consume_token(compiler, FUNK_TOKEN_COMMA, "Expected ',' after the condition");
+
+	uint32_t exitJump = write_jump(compiler, FUNK_INSTRUCTION_JUMP_IF_FALSE);
+	compile_inline_body(compiler, &body);
+
+	write_uint8_t(compiler, FUNK_INSTRUCTION_POP);
+	write_loop(compiler, start);
+
+	patch_jump(compiler, exitJump);
+	write_uint8_t(compiler, FUNK_INSTRUCTION_PUSH_NULL);
+}
+
+// for(from, to, (number) => body), only the form with a range is known at compile time
+static void lower_for(FunkCompiler* compiler) {
+	FunkInlineBody body;
+
+	compile_expression(compiler);
+	consume_token(compiler, FUNK_TOKEN_COMMA, "Expected ',' after the start");
+	compile_expression(compiler);
+	consume_token(compiler, FUNK_TOKEN_COMMA, "Expected ',' after the end");
+
+	write_uint8_t(compiler, FUNK_INSTRUCTION_FOR_PREPARE);
+
+	uint32_t start = compiler->function->codeLength;
+	uint32_t exitJump = write_jump(compiler, FUNK_INSTRUCTION_FOR_NEXT);
+
+	compile_inline_body(compiler, &body);
+
+	write_uint8_t(compiler, FUNK_INSTRUCTION_POP);
+	write_uint8_t(compiler, FUNK_INSTRUCTION_FOR_STEP);
+	write_loop(compiler, start);
+
+	patch_jump(compiler, exitJump);
+	write_uint8_t(compiler, FUNK_INSTRUCTION_PUSH_NULL);
+}
+
+static void compile_call_arguments(FunkCompiler* compiler) {
+	uint8_t argumentCount = 0;
+
+	if (!match_token(compiler, FUNK_TOKEN_RIGHT_PAREN)) {
+		do {
+			compile_expression(compiler);
+			argumentCount++;
+		} while (match_token(compiler, FUNK_TOKEN_COMMA));
+
+		consume_token(compiler, FUNK_TOKEN_RIGHT_PAREN, "')' expected after function arguments");
 	}
 
-	FunkTableEntry* entry = find_entry(table->entries, table->capacity, key);
+	write_uint8_t(compiler, FUNK_INSTRUCTION_CALL);
+	write_uint8_t(compiler, argumentCount);
+}
 
-	if (entry->key == NULL) {
+static void compile_name(FunkCompiler* compiler, FunkToken* token, bool isACall) {
+	if (compiler->lexical) {
+		compile_lexical_name(compiler, token, isACall);
+		return;
+	}
+
+	write_uint8_t(compiler, isACall ? FUNK_INSTRUCTION_GET : FUNK_INSTRUCTION_GET_STRING);
+	write_uint16_t(compiler, add_string_constant(compiler, token->start, token->length));
+}
+
+// The lowered call is guarded by a check, that the name still means the intrinsic, otherwise the call runs as it is.
+// Returns false, if the call can't be lowered, nothing is written then
+static bool compile_intrinsic(FunkCompiler* compiler, FunkIntrinsic intrinsic, FunkToken* name) {
+	if (!can_lower(compiler, intrinsic)) {
 		return false;
 	}
 
-	entry->key = NULL;
-	entry->value = NULL;
+	FunkScanner scanner = *compiler->scanner;
+	FunkToken previous = compiler->previous;
+	FunkToken current = compiler->current;
 
-	table->count--;
+	write_uint8_t(compiler, FUNK_INSTRUCTION_JUMP_IF_REDEFINED);
+	write_uint8_t(compiler, (uint8_t) intrinsic);
+	write_uint16_t(compiler, UINT16_MAX);
+
+	uint32_t callJump = compiler->function->codeLength - 2;
+	consume_token(compiler, FUNK_TOKEN_LEFT_PAREN, "Expected '('");
+
+	switch (intrinsic) {
+		case FUNK_INTRINSIC_IF: lower_if(compiler); break;
+		case FUNK_INTRINSIC_WHILE: lower_while(compiler); break;
+		case FUNK_INTRINSIC_FOR: lower_for(compiler); break;
+		default: UNREACHABLE
+	}
+
+	consume_token(compiler, FUNK_TOKEN_RIGHT_PAREN, "')' expected after function arguments");
+
+	*compiler->scanner = scanner;
+	compiler->previous = previous;
+	compiler->current = current;
+
+	uint32_t endJump = write_jump(compiler, FUNK_INSTRUCTION_JUMP);
+	patch_jump(compiler, callJump);
+
+	// The lambdas of the call are left alone, they only run, once the intrinsic was redefined
+	compile_name(compiler, name, true);
+	consume_token(compiler, FUNK_TOKEN_LEFT_PAREN, "Expected '('");
+
+	compiler->lowerIntrinsics = false;
+	compile_call_arguments(compiler);
+	compiler->lowerIntrinsics = true;
+
+	patch_jump(compiler, endJump);
 	return true;
 }
 
+static void compile_expression(FunkCompiler* compiler) {
+	if (match_token(compiler, FUNK_TOKEN_RETURN)) {
+		compile_expression(compiler);
+		FunkInlineBody* body = compiler->inlineBody;
+
+		if (body == NULL) {
+			write_uint8_t(compiler, FUNK_INSTRUCTION_RETURN);
+			return;
+		}
 
-FunkVm* funk_create_vm(FunkAllocFn allocFn, FunkFreeFn freeFn, FunkErrorFn errorFn) {
-	FunkVm* vm = (FunkVm*) allocFn(sizeof(FunkVm));
+		// Leaving the frame of the body drops everything but the value, even inside the arguments of a call
+		write_uint8_t(compiler, FUNK_INSTRUCTION_POP_SCOPE);
 
-	if (vm == NULL) {
-		errorFn(NULL, "Failed to allocate the vm");
-		return NULL;
+		if (body->returnJump == UINT32_MAX) {
+			body->returnJump = write_jump(compiler, FUNK_INSTRUCTION_JUMP);
+		} else {
+			write_loop(compiler, body->returnJump - 1);
+		}
+
+		return;
 	}
 
-	vm->allocFn = allocFn;
-	vm->freeFn = freeFn;
-	vm->errorFn = errorFn;
-	vm->stackTop = vm->stack;
-	vm->callFrame = NULL;
+	if (compiler->current.type == FUNK_TOKEN_LEFT_PAREN || compiler->current.type == FUNK_TOKEN_LEFT_BRACE) {
+		char buffer[256];
+		sprintf(buffer, "lambda %s %u", compiler->function->parent.name->chars, compiler->previous.line);
 
-	funk_init_table(&vm->strings);
-	funk_init_table(&vm->globals);
-	funk_init_table(&vm->modules);
+		FunkString* name = funk_create_string(compiler->vm, buffer, strlen(buffer));
+		FunkFunction* lambda = compile_function(compiler, name, true);
 
-	return vm;
-}
+		write_uint8_t(compiler, compiler->lexical ? FUNK_INSTRUCTION_CLOSURE : FUNK_INSTRUCTION_PUSH_CONSTANT);
+		write_uint16_t(compiler, funk_add_constant(compiler->vm, compiler->function, (FunkObject*) lambda));
 
-void funk_free_vm(FunkVm* vm) {
-	if (vm == NULL) {
 		return;
 	}
 
-	funk_free_table(vm, &vm->strings);
-	funk_free_table(vm, &vm->globals);
-	funk_free_table(vm, &vm->modules);
+	consume_token(compiler, FUNK_TOKEN_NAME, "Function name expected");
 
-	FunkObject* object = vm->objects;
+	FunkToken name = compiler->previous;
+	int16_t intrinsic = find_intrinsic(compiler, &name);
+	bool isACall;
 
-	while (object != NULL) {
-		FunkObject* next = object->next;
-		funk_free_object(vm, object);
-		object = next;
+	if (intrinsic != -1 && compile_intrinsic(compiler, (FunkIntrinsic) intrinsic, &name)) {
+		isACall = match_token(compiler, FUNK_TOKEN_LEFT_PAREN);
+	} else {
+		isACall = match_token(compiler, FUNK_TOKEN_LEFT_PAREN);
+		compile_name(compiler, &name, isACall);
+
+		if (isACall) {
+			compile_call_arguments(compiler);
+			isACall = match_token(compiler, FUNK_TOKEN_LEFT_PAREN);
+		}
 	}
 
-	vm->freeFn((void*) vm);
+	while (isACall) {
+		compile_call_arguments(compiler);
+		isACall = match_token(compiler, FUNK_TOKEN_LEFT_PAREN);
+	}
 }
 
-FunkFunction* funk_run_function(FunkVm* vm, FunkFunction* function, uint8_t argCount) {
-	if (function == NULL) {
-		return function;
+static void compile_declaration(FunkCompiler* compiler, bool topLevel) {
+	if (match_token(compiler, FUNK_TOKEN_FUNCTION)) {
+		consume_token(compiler, FUNK_TOKEN_NAME, "Expected function name");
+
+		FunkVm* vm = compiler->vm;
+		FunkString* name = funk_create_string(vm, compiler->previous.start, compiler->previous.length);
+
+		if (compiler->lexical && !topLevel) {
+			// The slot is taken before the body is compiled, so that the function can call itself
+			uint8_t slot = add_local(compiler, name);
+			FunkFunction* newFunction = compile_function(compiler, name, false);
+
+			write_uint8_t(compiler, FUNK_INSTRUCTION_DEFINE_LOCAL);
+			write_uint8_t(compiler, slot);
+			write_uint16_t(compiler, funk_add_constant(vm, compiler->function, (FunkObject *) newFunction));
+
+			return;
+		}
+
+		FunkFunction* newFunction = compile_function(compiler, name, false);
+
+		write_uint8_t(compiler, topLevel ? FUNK_INSTRUCTION_DEFINE_GLOBAL : FUNK_INSTRUCTION_DEFINE);
+		write_uint16_t(compiler, funk_add_constant(vm, compiler->function, (FunkObject *) newFunction));
+
+		return;
 	}
 
+	compile_expression(compiler);
+	write_uint8_t(compiler, FUNK_INSTRUCTION_POP);
+}
+
+FunkFunction* funk_compile_string(sFunkVm* vm, const char* name, const char* string) {
+	// The frames of whoever compiles are still running
+	FunkCallFrame* previousErrorFrame = vm->errorFrame;
+	vm->errorFrame = vm->callFrame;
+
 	if (setjmp(vm->errorJumpBuffer) != 0) {
+		vm->errorFrame = previousErrorFrame;
 		return NULL;
 	}
 
-	if (function->object.type == FUNK_OBJECT_NATIVE_FUNCTION) {
-		FunkNativeFunction* nativeFunction = (FunkNativeFunction*) function;
-		return nativeFunction->fn(vm, nativeFunction, vm->stackTop + 1, argCount);
+	FunkString* string_name = funk_create_string(vm, name, strlen(name));
+	FunkBasicFunction* function = funk_create_basic_function(vm, string_name);
+
+	FunkScanner scanner;
+	funk_init_scanner(&scanner, string);
+
+	FunkCompiler compiler;
+
+	compiler.vm = vm;
+	compiler.scanner = &scanner;
+	compiler.function = function;
+
+	size_t pragmaLength = strlen(FUNK_LEXICAL_PRAGMA);
+	bool hasPragma = strncmp(string, FUNK_LEXICAL_PRAGMA, pragmaLength) == 0
+		&& (string[pragmaLength] == '\0' || string[pragmaLength] == '\n' || string[pragmaLength] == '\r');
+
+	FunkLexicalScope scope;
+
+	compiler.lexical = vm->lexicalScoping || hasPragma;
+	compiler.scope = NULL;
+	compiler.lowerIntrinsics = true;
+	compiler.inlineBody = NULL;
+
+	if (compiler.lexical) {
+		scope.function = function;
+		scope.enclosing = NULL;
+
+		compiler.scope = &scope;
 	}
 
-	FunkBasicFunction* fn = (FunkBasicFunction*) function;
+	advance_token(&compiler);
 
-	if (fn->codeLength == 0) {
-		return function;
+	while (compiler.current.type != FUNK_TOKEN_EOF) {
+		compile_declaration(&compiler, true);
 	}
 
-	register uint8_t* ip = fn->code;
-	FunkObject** constants = fn->constants;
-	FunkFunction** initialStackTop = vm->stackTop;
+	// The script returns null, like a function without a return does
+	write_uint8_t(&compiler, FUNK_INSTRUCTION_PUSH_NULL);
+	write_uint8_t(&compiler, FUNK_INSTRUCTION_RETURN);
 
-	FunkCallFrame callFrame;
+	if (compiler.lexical) {
+		finish_lexical_scope(&compiler, &scope);
+	}
 
-	callFrame.function = fn;
-	callFrame.previous = vm->callFrame;
+	vm->errorFrame = previousErrorFrame;
+	return &function->parent;
+}
 
-	funk_init_table(&callFrame.variables);
+void funk_init_table(FunkTable* table) {
+	table->capacity = -1;
+	table->count = 0;
+	table->tombstones = 0;
+	table->entries = NULL;
+}
 
-	for (uint8_t i = 0; i < fn->argumentCount; i++) {
-		funk_table_set(vm, &callFrame.variables, fn->argumentNames[i], (FunkObject*) *(vm->stackTop + 1 + i));
+void funk_free_table(FunkVm* vm, FunkTable* table) {
+	if (table->capacity > 0) {
+		FUNK_FREE_ARRAY(vm, FunkTableEntry, table->entries, table->capacity + 1);
 	}
 
-	vm->callFrame = &callFrame;
+	funk_init_table(table);
+}
 
-	#ifdef FUNK_TRACE_STACK
-		printf("\n=+ %s +=\n", function->name->chars);
+static FunkTableEntry* find_entry(FunkTableEntry* entries, int capacity, FunkString* key) {
+	uint32_t index = key->hash % capacity;
+	FunkTableEntry* tombstone = NULL;
 
-		for (uint16_t i = 0; i < fn->constantsLength; i++) {
-			FunkObject* object = fn->constants[i];
-			printf("%i: %s\n", i, object->type == FUNK_OBJECT_STRING ? ((FunkString*) object)->chars : funk_to_string(object));
+	while (true) {
+		FunkTableEntry* entry = &entries[index];
+
+		if (entry->key == NULL) {
+			if (entry->value == NULL) {
+				return tombstone != NULL ? tombstone : entry;
+			} else if (tombstone == NULL) {
+				tombstone = entry;
+			}
+		} if (entry->key == key) {
+			return entry;
 		}
-	#endif
 
-	#define READ_UINT8() (*ip++)
-	#define READ_UINT16() (ip += 2, (uint16_t) ((ip[-2] << 8) | ip[-1]))
-	#define READ_CONSTANT() (constants[READ_UINT16()])
-	#define PUSH(value) (*vm->stackTop = value, vm->stackTop++)
-	#define POP() (*(--vm->stackTop))
+		index = (index + 1) % capacity;
+	}
+}
 
-	while (true) {
-		#ifdef FUNK_TRACE_STACK
-			printf("%s ", funkInstructionNames[*ip]);
+static void adjust_capacity(FunkVm* vm, FunkTable* table, int capacity) {
+	// Entries have to be rehashed into the new array, so growing in place would not help here
+	FunkTableEntry* entries = FUNK_ALLOCATE(vm, FunkTableEntry, capacity + 1);
 
-			for (FunkFunction** slot = vm->stack; slot < vm->stackTop; slot++) {
-				if (*slot == NULL) {
-					printf("[ null ]");
-					continue;
-				}
+	for (int i = 0; i <= capacity; i++) {
+		entries[i].key = NULL;
+		entries[i].value = NULL;
+	}
 
-				printf("[ %s ]", (*slot)->name->chars);
+	table->count = 0;
+	table->tombstones = 0;
+
+	for (int i = 0; i <= table->capacity; i++) {
+		FunkTableEntry* entry = &table->entries[i];
+
+		if (entry->key == NULL) {
+			continue;
+		}
+
+		FunkTableEntry* destination = find_entry(entries, capacity, entry->key);
+
+		destination->key = entry->key;
+		destination->value = entry->value;
+
+		table->count++;
+	}
+
+	if (table->capacity > 0) {
+		FUNK_FREE_ARRAY(vm, FunkTableEntry, table->entries, table->capacity + 1);
+	}
+
+	table->capacity = capacity;
+	table->entries = entries;
+}
+
+bool funk_table_set(FunkVm* vm, FunkTable* table, FunkString* key, FunkObject* value) {
+	if (table->count + table->tombstones + 1 > (table->capacity + 1) * TABLE_MAX_LOAD) {
+		int capacity = FUNK_GROW_CAPACITY(table->capacity + 1) - 1;
+		adjust_capacity(vm, table, capacity);
+	}
+
+	FunkTableEntry* entry = find_entry(table->entries, table->capacity, key);
+	bool isNew = entry->key == NULL;
+
+	if (isNew) {
+		table->count++;
+
+		if (entry->value != NULL) {
+			table->tombstones--;
+		}
+	}
+
+	entry->key = key;
+	entry->value = value;
+
+	return isNew;
+}
+
+bool funk_table_get(FunkTable* table, FunkString* key, FunkObject** value) {
+	if (table->count == 0) {
+		return false;
+	}
+
+	FunkTableEntry* entry = find_entry(table->entries, table->capacity, key);
+
+	if (entry->key == NULL) {
+		return false;
+	}
+
+	*value = entry->value;
+	return true;
+}
+
+FunkString* funk_table_find_string(FunkTable* table, const char* chars, uint16_t length, uint32_t hash) {
+	if (table->count == 0) {
+		return NULL;
+	}
+
+	uint32_t index = hash % table->capacity;
+
+	while (true) {
+		FunkTableEntry* entry = &table->entries[index];
+
+		if (entry->key == NULL) {
+			if (entry->value == NULL) {
+				return NULL;
+			}
+		} else if (entry->key->length == length &&
+       entry->key->hash == hash &&
+       memcmp(entry->key->chars, chars, length) == 0) {
+
+			return entry->key;
+		}
+
+		index = (index + 1) % table->capacity;
+	}
+}
+
+bool funk_table_delete(FunkTable* table, FunkString* key) {
+	if (table->count == 0) {
+		return false;
+	}
+
+	FunkTableEntry* entry = find_entry(table->entries, table->capacity, key);
+
+	if (entry->key == NULL) {
+		return false;
+	}
+
+	// Leaves a tombstone, so that the probing for the keys after this one does not stop here
+	entry->key = NULL;
+	entry->value = (FunkObject*) table;
+
+	table->count--;
+	table->tombstones++;
+
+	return true;
+}
+
+
+static void* reallocate_with_legacy_functions(void* userData, void* pointer, size_t oldSize, size_t newSize) {
+	FunkVm* vm = (FunkVm*) userData;
+	void* result = vm->allocFn(newSize);
+
+	if (pointer != NULL) {
+		if (result != NULL) {
+			memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+		}
+
+		vm->freeFn(pointer);
+	}
+
+	return result;
+}
+
+static void free_with_legacy_functions(void* userData, void* pointer, size_t size) {
+	((FunkVm*) userData)->freeFn(pointer);
+}
+
+static void* reallocate_with_libc(void* userData, void* pointer, size_t oldSize, size_t newSize) {
+	return realloc(pointer, newSize);
+}
+
+static void free_with_libc(void* userData, void* pointer, size_t size) {
+	free(pointer);
+}
+
+// The vm buffers already, so stdio gets every buffer in one write
+static void write_to_stdout(void* userData, const char* data, size_t length) {
+	fwrite((const void*) data, 1, length, stdout);
+	fflush(stdout);
+}
+
+static size_t get_slab_class(size_t size) {
+	return (size + FUNK_SLAB_CLASS_SIZE - 1) / FUNK_SLAB_CLASS_SIZE - 1;
+}
+
+static void add_slab_page(FunkVm* vm, size_t slabClass) {
+	FunkSlabPage* page = vm->spareSlabPages;
+
+	if (page != NULL) {
+		UNPOISON_MEMORY(page, sizeof(FunkSlabPage));
+		vm->spareSlabPages = page->next;
+	} else {
+		page = (FunkSlabPage*) vm->allocator.reallocateFn(vm->allocator.userData, NULL, 0, FUNK_SLAB_PAGE_SIZE);
+
+		if (page == NULL) {
+			funk_error(vm, "Out of memory");
+		}
+	}
+
+	page->next = vm->slabPages;
+	vm->slabPages = page;
+	vm->slabBytes += FUNK_SLAB_PAGE_SIZE;
+
+	// The header is padded to a whole class, so that the slots stay aligned
+	vm->slabNext[slabClass] = (char*) page + FUNK_SLAB_CLASS_SIZE;
+	vm->slabEnd[slabClass] = (char*) page + FUNK_SLAB_PAGE_SIZE;
+
+	POISON_MEMORY(vm->slabNext[slabClass], FUNK_SLAB_PAGE_SIZE - FUNK_SLAB_CLASS_SIZE);
+}
+
+void* funk_allocate_slab(FunkVm* vm, size_t size) {
+	if (size > FUNK_SLAB_MAX_SIZE) {
+		return funk_reallocate(vm, NULL, 0, size);
+	}
+
+	size_t slabClass = get_slab_class(size);
+	size_t slotSize = (slabClass + 1) * FUNK_SLAB_CLASS_SIZE;
+	void* slot = vm->slabFree[slabClass];
+
+	if (slot != NULL) {
+		UNPOISON_MEMORY(slot, slotSize);
+		vm->slabFree[slabClass] = vm->slabFree[slabClass]->next;
+	} else {
+		if (vm->slabNext[slabClass] == NULL || vm->slabNext[slabClass] + slotSize > vm->slabEnd[slabClass]) {
+			add_slab_page(vm, slabClass);
+		}
+
+		slot = (void*) vm->slabNext[slabClass];
+		vm->slabNext[slabClass] += slotSize;
+
+		UNPOISON_MEMORY(slot, slotSize);
+	}
+
+	vm->bytesAllocated += slotSize;
+	vm->nurseryBytes += slotSize;
+	vm->slabUsed += slotSize;
+
+	return slot;
+}
+
+void funk_free_slab(FunkVm* vm, void* pointer, size_t size) {
+	if (size > FUNK_SLAB_MAX_SIZE) {
+		funk_deallocate(vm, pointer, size);
+		return;
+	}
+
+	size_t slabClass = get_slab_class(size);
+	size_t slotSize = (slabClass + 1) * FUNK_SLAB_CLASS_SIZE;
+	FunkSlabSlot* slot = (FunkSlabSlot*) pointer;
+
+	slot->next = vm->slabFree[slabClass];
+	vm->slabFree[slabClass] = slot;
+
+	POISON_MEMORY(slot, slotSize);
+
+	vm->bytesAllocated -= slotSize > vm->bytesAllocated ? vm->bytesAllocated : slotSize;
+	vm->slabUsed -= slotSize;
+}
+
+static void init_slabs(FunkVm* vm) {
+	vm->slabPages = NULL;
+	vm->slabBytes = 0;
+	vm->slabUsed = 0;
+
+	for (size_t i = 0; i < FUNK_SLAB_CLASSES; i++) {
+		vm->slabFree[i] = NULL;
+		vm->slabNext[i] = NULL;
+		vm->slabEnd[i] = NULL;
+	}
+}
+
+// The pages stay with the vm, a cleared one, that runs the same work again, doesn't touch the allocator, nor fresh memory
+static void recycle_slabs(FunkVm* vm) {
+	FunkSlabPage* page = vm->slabPages;
+
+	while (page != NULL) {
+		FunkSlabPage* next = page->next;
+
+		UNPOISON_MEMORY(page, sizeof(FunkSlabPage));
+		page->next = vm->spareSlabPages;
+		vm->spareSlabPages = page;
+		POISON_MEMORY(page, FUNK_SLAB_PAGE_SIZE);
+
+		page = next;
+	}
+
+	init_slabs(vm);
+}
+
+static void free_slabs(FunkVm* vm) {
+	recycle_slabs(vm);
+
+	FunkSlabPage* page = vm->spareSlabPages;
+
+	while (page != NULL) {
+		UNPOISON_MEMORY(page, FUNK_SLAB_PAGE_SIZE);
+
+		FunkSlabPage* next = page->next;
+		vm->allocator.freeFn(vm->allocator.userData, (void*) page, FUNK_SLAB_PAGE_SIZE);
+		page = next;
+	}
+
+	vm->spareSlabPages = NULL;
+}
+
+static void cleanup_scope_data(FunkVm* vm, FunkNativeFunction* function);
+static void save_scope_data(FunkVm* vm, FunkNativeFunction* function, FunkSnapshotWriter* writer);
+static void load_scope_data(FunkVm* vm, FunkNativeFunction* function, FunkSnapshotReader* reader);
+
+static void init_vm(FunkVm* vm, FunkErrorFn errorFn) {
+	vm->errorFn = errorFn;
+	vm->stackTop = vm->stack;
+	vm->callFrame = NULL;
+	vm->stackBase = vm->stack;
+	vm->resumerStacks = NULL;
+	vm->generator = NULL;
+	vm->cStackLimit = NULL;
+	vm->errorFrame = NULL;
+	vm->loop = NULL;
+	vm->youngObjects = NULL;
+	vm->promotionSegment = 0;
+	init_slabs(vm);
+	vm->spareSlabPages = NULL;
+
+	for (uint8_t i = 0; i < FUNK_HEAP_SEGMENTS; i++) {
+		vm->objects[i] = NULL;
+	}
+
+	vm->bytesAllocated = 0;
+	vm->collections = 0;
+	vm->nurseryCollections = 0;
+	vm->bytesFreed = 0;
+	vm->markEpoch = 0;
+	funk_set_gc_trigger(vm, FUNK_DEFAULT_MIN_HEAP, FUNK_DEFAULT_HEAP_GROWTH);
+
+	vm->nurseryBytes = 0;
+	vm->collectingNursery = false;
+	funk_set_nursery_size(vm, FUNK_DEFAULT_NURSERY_SIZE);
+
+	vm->remembered = NULL;
+	vm->rememberedCount = 0;
+	vm->rememberedAllocated = 0;
+
+	vm->grey = NULL;
+	vm->greyCount = 0;
+	vm->greyAllocated = 0;
+
+	vm->gcPhase = FUNK_GC_IDLE;
+	vm->sweepSegment = 0;
+	vm->sweepCursor = NULL;
+	funk_reset_pause_histogram(vm);
+
+	vm->gcThreads = 1;
+	vm->gcPool = NULL;
+	vm->heapDump = NULL;
+	vm->lexicalScoping = false;
+	vm->jitThreshold = funk_jit_is_supported() ? FUNK_DEFAULT_JIT_THRESHOLD : 0;
+
+	for (uint8_t i = 0; i < FUNK_INTRINSIC_COUNT; i++) {
+		vm->intrinsicFns[i] = NULL;
+		vm->intrinsicNames[i] = NULL;
+	}
+
+	vm->outputFn = write_to_stdout;
+	vm->outputUserData = NULL;
+	vm->flushMode = isatty(STDOUT_FILENO) ? FUNK_FLUSH_LINES : FUNK_FLUSH_FULL;
+	vm->outputLength = 0;
+
+	vm->snapshotTypeCount = 0;
+	funk_register_snapshot_type(vm, "$scopeData", cleanup_scope_data, save_scope_data, load_scope_data);
+
+	#ifdef FUNK_STRESS_GC
+		funk_set_gc_step(vm, 4);
+	#else
+		funk_set_gc_step(vm, FUNK_DEFAULT_GC_STEP);
+	#endif
+
+	vm->parent = NULL;
+	vm->level = 0;
+	vm->workerPool = NULL;
+	vm->userData = NULL;
+
+	funk_init_table(&vm->strings);
+	funk_init_table(&vm->globals);
+	funk_init_table(&vm->modules);
+}
+
+FunkVm* funk_create_vm(FunkAllocFn allocFn, FunkFreeFn freeFn, FunkErrorFn errorFn) {
+	FunkVm* vm = (FunkVm*) allocFn(sizeof(FunkVm));
+
+	if (vm == NULL) {
+		errorFn(NULL, "Failed to allocate the vm");
+		return NULL;
+	}
+
+	vm->allocFn = allocFn;
+	vm->freeFn = freeFn;
+
+	vm->allocator.reallocateFn = reallocate_with_legacy_functions;
+	vm->allocator.freeFn = free_with_legacy_functions;
+	vm->allocator.userData = (void*) vm;
+
+	init_vm(vm, errorFn);
+	return vm;
+}
+
+FunkVm* funk_create_vm_ex(const FunkAllocator* allocator, FunkErrorFn errorFn) {
+	static const FunkAllocator libcAllocator = { reallocate_with_libc, free_with_libc, NULL };
+
+	if (allocator == NULL) {
+		allocator = &libcAllocator;
+	}
+
+	FunkVm* vm = (FunkVm*) allocator->reallocateFn(allocator->userData, NULL, 0, sizeof(FunkVm));
+
+	if (vm == NULL) {
+		errorFn(NULL, "Failed to allocate the vm");
+		return NULL;
+	}
+
+	vm->allocFn = NULL;
+	vm->freeFn = NULL;
+	vm->allocator = *allocator;
+
+	init_vm(vm, errorFn);
+	return vm;
+}
+
+FunkVm* funk_create_child_vm(FunkVm* parent, FunkErrorFn errorFn) {
+	// The parent allocator might not be thread safe, so children always use the C library
+	FunkVm* vm = funk_create_vm_ex(NULL, errorFn);
+
+	if (vm == NULL) {
+		return NULL;
+	}
+
+	vm->parent = parent;
+	vm->level = (uint8_t) (parent->level + 1);
+	// Children never mark the objects of the parent, and collect their own all at once, so they need no write barriers
+	funk_set_gc_step(vm, 0);
+	funk_set_nursery_size(vm, 0);
+	// Children run the machine code of the parent, but never compile themselves
+	funk_set_jit_threshold(vm, 0);
+
+	// The lowered calls in the code of the parent check against its natives
+	for (uint8_t i = 0; i < FUNK_INTRINSIC_COUNT; i++) {
+		vm->intrinsicFns[i] = parent->intrinsicFns[i];
+		vm->intrinsicNames[i] = parent->intrinsicNames[i];
+	}
+
+	vm->outputFn = parent->outputFn;
+	vm->outputUserData = parent->outputUserData;
+	vm->flushMode = parent->flushMode;
+
+	return vm;
+}
+
+static void free_objects(FunkVm* vm, FunkObject* object) {
+	while (object != NULL) {
+		FunkObject* next = object->next;
+		funk_free_object(vm, object);
+		object = next;
+	}
+}
+
+void funk_clear_vm(FunkVm* vm) {
+	funk_flush_output(vm);
+
+	funk_free_table(vm, &vm->strings);
+	funk_free_table(vm, &vm->globals);
+	funk_free_table(vm, &vm->modules);
+
+	for (uint8_t i = 0; i < FUNK_HEAP_SEGMENTS; i++) {
+		free_objects(vm, vm->objects[i]);
+		vm->objects[i] = NULL;
+	}
+
+	free_objects(vm, vm->youngObjects);
+	recycle_slabs(vm);
+	FUNK_FREE_ARRAY(vm, FunkObject*, vm->remembered, vm->rememberedAllocated);
+	FUNK_FREE_ARRAY(vm, FunkObject*, vm->grey, vm->greyAllocated);
+
+	vm->youngObjects = NULL;
+	vm->remembered = NULL;
+	vm->rememberedCount = 0;
+	vm->rememberedAllocated = 0;
+	vm->grey = NULL;
+	vm->greyCount = 0;
+	vm->greyAllocated = 0;
+	vm->nurseryBytes = 0;
+	vm->gcPhase = FUNK_GC_IDLE;
+	vm->sweepCursor = NULL;
+	vm->stackTop = vm->stack;
+	vm->callFrame = NULL;
+	vm->stackBase = vm->stack;
+	vm->resumerStacks = NULL;
+	vm->generator = NULL;
+	vm->cStackLimit = NULL;
+	vm->errorFrame = NULL;
+	vm->loop = NULL;
+}
+
+void funk_free_vm(FunkVm* vm) {
+	if (vm == NULL) {
+		return;
+	}
+
+	if (vm->workerPool != NULL) {
+		funk_free_worker_pool(vm->workerPool);
+	}
+
+	if (vm->gcPool != NULL) {
+		funk_free_worker_pool(vm->gcPool);
+	}
+
+	funk_clear_vm(vm);
+	free_slabs(vm);
+
+	if (vm->freeFn != NULL) {
+		vm->freeFn((void*) vm);
+	} else {
+		vm->allocator.freeFn(vm->allocator.userData, (void*) vm, sizeof(FunkVm));
+	}
+}
+
+void* funk_reallocate(FunkVm* vm, void* pointer, size_t oldSize, size_t newSize) {
+	void* result = vm->allocator.reallocateFn(vm->allocator.userData, pointer, oldSize, newSize);
+
+	if (result == NULL && newSize > 0) {
+		funk_error(vm, "Out of memory");
+	}
+
+	vm->bytesAllocated += newSize;
+	vm->bytesAllocated -= oldSize > vm->bytesAllocated ? vm->bytesAllocated : oldSize;
+
+	if (newSize > oldSize) {
+		vm->nurseryBytes += newSize - oldSize;
+	}
+
+	return result;
+}
+
+void funk_deallocate(FunkVm* vm, void* pointer, size_t size) {
+	if (pointer != NULL) {
+		vm->allocator.freeFn(vm->allocator.userData, pointer, size);
+		vm->bytesAllocated -= size > vm->bytesAllocated ? vm->bytesAllocated : size;
+	}
+}
+
+// Walks the call frames, then the globals of the vm and of its parents
+static bool find_variable(FunkVm* vm, FunkCallFrame* frame, FunkString* name, FunkFunction** result) {
+	// funk_table_get() writes a FunkObject*, writing it straight through a FunkFunction** breaks strict aliasing
+	FunkObject* value;
+
+	for (; frame != NULL; frame = frame->previous) {
+		if (funk_table_get(frame->variables, name, &value)) {
+			*result = (FunkFunction*) value;
+			return true;
+		}
+	}
+
+	for (; vm != NULL; vm = vm->parent) {
+		if (funk_table_get(&vm->globals, name, &value)) {
+			*result = (FunkFunction*) value;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+typedef struct FunkScopeData {
+	FunkTable variables;
+	// The scope of the closure, whose call made this one
+	FunkFunction* enclosing;
+	// Scopes, that a worker made, go away with the worker
+	FunkVm* vm;
+} FunkScopeData;
+
+static FunkScopeData* get_scope_data(FunkFunction* scope) {
+	return (FunkScopeData*) ((FunkNativeFunction*) scope)->data;
+}
+
+static FunkFunction* scope_callback(FunkVm* vm, FunkNativeFunction* self, FunkFunction** args, uint8_t argCount) {
+	return NULL;
+}
+
+static void cleanup_scope_data(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data != NULL) {
+		FunkScopeData* data = (FunkScopeData*) function->data;
+
+		funk_free_table(vm, &data->variables);
+		FUNK_FREE(vm, FunkScopeData, data);
+
+		function->data = NULL;
+	}
+}
+
+static void trace_scope_data(FunkVm* vm, FunkNativeFunction* function) {
+	FunkScopeData* data = (FunkScopeData*) function->data;
+
+	funk_mark_table(vm, &data->variables);
+	funk_mark_object(vm, (FunkObject*) data->enclosing);
+}
+
+static void save_scope_data(FunkVm* vm, FunkNativeFunction* function, FunkSnapshotWriter* writer) {
+	FunkScopeData* data = (FunkScopeData*) function->data;
+
+	funk_snapshot_write_object(writer, (FunkObject*) data->enclosing);
+	funk_snapshot_write_uint32(writer, (uint32_t) data->variables.count);
+
+	for (int i = 0; i <= data->variables.capacity; i++) {
+		FunkTableEntry* entry = &data->variables.entries[i];
+
+		if (entry->key != NULL) {
+			funk_snapshot_write_object(writer, (FunkObject*) entry->key);
+			funk_snapshot_write_object(writer, entry->value);
+		}
+	}
+}
+
+static void load_scope_data(FunkVm* vm, FunkNativeFunction* function, FunkSnapshotReader* reader) {
+	FunkScopeData* data = FUNK_ALLOCATE(vm, FunkScopeData, 1);
+
+	funk_init_table(&data->variables);
+	data->enclosing = (FunkFunction*) funk_snapshot_read_object(reader);
+	data->vm = vm;
+
+	function->fn = (FunkNativeFn) scope_callback;
+	function->cleanupFn = cleanup_scope_data;
+	function->traceFn = trace_scope_data;
+	function->data = (void*) data;
+
+	uint32_t count = funk_snapshot_read_count(reader, 2 * sizeof(uint32_t));
+
+	for (uint32_t i = 0; i < count; i++) {
+		FunkString* name = funk_snapshot_read_string(reader);
+		FunkObject* value = funk_snapshot_read_object(reader);
+
+		if (name != NULL) {
+			funk_table_set(vm, &data->variables, name, value);
+		}
+	}
+}
+
+// The variables of a call move into a scope object, once a closure needs them to outlive the call
+static FunkFunction* capture_scope(FunkVm* vm, FunkCallFrame* frame) {
+	if (frame->scope == NULL) {
+		FunkNativeFunction* scope = funk_create_native_function(vm, funk_create_string(vm, "$scopeData", 10), (FunkNativeFn) scope_callback);
+		FunkScopeData* data = FUNK_ALLOCATE(vm, FunkScopeData, 1);
+
+		data->variables = *frame->variables;
+		// An inlined lambda sees the variables of the function around it, like its closure would
+		data->enclosing = frame->enclosing != NULL ? capture_scope(vm, frame->enclosing) : frame->function->scope;
+		data->vm = vm;
+
+		scope->cleanupFn = cleanup_scope_data;
+		scope->traceFn = trace_scope_data;
+		scope->data = (void*) data;
+
+		frame->variables = &data->variables;
+		frame->scope = (FunkFunction*) scope;
+	}
+
+	return frame->scope;
+}
+
+// Closures share everything with their prototype, but the captured values and the scope
+static FunkBasicFunction* instantiate_prototype(FunkVm* vm, FunkBasicFunction* prototype) {
+	FunkBasicFunction* closure = funk_create_basic_function(vm, prototype->parent.name);
+
+	closure->argumentNames = prototype->argumentNames;
+	closure->argumentCount = prototype->argumentCount;
+	closure->code = prototype->code;
+	closure->codeLength = prototype->codeLength;
+	closure->constants = prototype->constants;
+	closure->constantsLength = prototype->constantsLength;
+
+	closure->lexical = true;
+	closure->localNames = prototype->localNames;
+	closure->localCount = prototype->localCount;
+	closure->upvalueSources = prototype->upvalueSources;
+	closure->upvalueCount = prototype->upvalueCount;
+	closure->inlineDepth = prototype->inlineDepth;
+
+	closure->prototype = prototype;
+	closure->upvalues = prototype->upvalueCount > 0 ? FUNK_ALLOCATE(vm, FunkFunction*, prototype->upvalueCount) : NULL;
+
+	return closure;
+}
+
+static FunkBasicFunction* create_closure(FunkVm* vm, FunkBasicFunction* prototype, FunkCallFrame* frame) {
+	FunkBasicFunction* closure = instantiate_prototype(vm, prototype);
+	closure->scope = capture_scope(vm, frame);
+
+	return closure;
+}
+
+// The scopes, that another vm made, are left out, so only the ones without variables can be
+bool funk_can_copy_closure(FunkVm* vm, FunkBasicFunction* closure) {
+	for (FunkFunction* scope = closure->scope; scope != NULL && get_scope_data(scope)->vm != vm; scope = get_scope_data(scope)->enclosing) {
+		if (get_scope_data(scope)->variables.count > 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+FunkBasicFunction* funk_copy_closure(FunkVm* vm, FunkBasicFunction* closure) {
+	FunkBasicFunction* copy = instantiate_prototype(vm, closure->prototype);
+
+	if (copy->upvalueCount > 0) {
+		memcpy((void*) copy->upvalues, (void*) closure->upvalues, sizeof(FunkFunction*) * copy->upvalueCount);
+	}
+
+	FunkFunction* scope = closure->scope;
+
+	while (scope != NULL && get_scope_data(scope)->vm != vm) {
+		scope = get_scope_data(scope)->enclosing;
+	}
+
+	copy->scope = scope;
+	return copy;
+}
+
+// Runs after the closure got its slot, so that a function, that calls itself, captures itself too
+static void capture_upvalues(FunkBasicFunction* closure, FunkCallFrame* frame) {
+	for (uint8_t i = 0; i < closure->upvalueCount; i++) {
+		uint16_t source = closure->upvalueSources[i];
+		closure->upvalues[i] = (source & 0x100) != 0 ? frame->slots[source & 0xff] : frame->function->upvalues[source];
+	}
+}
+
+// Looks in the variables of the call and of the inlined lambdas it runs, then in the scopes, that the closure captured,
+// and the globals last
+static bool find_lexical_variable(FunkVm* vm, FunkCallFrame* frame, FunkString* name, FunkFunction** result) {
+	FunkObject* value;
+
+	for (FunkCallFrame* variableFrame = frame; variableFrame != NULL; variableFrame = variableFrame->enclosing) {
+		if (funk_table_get(variableFrame->variables, name, &value)) {
+			*result = (FunkFunction*) value;
+			return true;
+		}
+	}
+
+	for (FunkFunction* scope = frame->function->scope; scope != NULL; scope = get_scope_data(scope)->enclosing) {
+		if (funk_table_get(&get_scope_data(scope)->variables, name, &value)) {
+			*result = (FunkFunction*) value;
+			return true;
+		}
+	}
+
+	return find_variable(vm, NULL, name, result);
+}
+
+static void set_frame_variable(FunkVm* vm, FunkCallFrame* frame, FunkString* name, FunkFunction* value) {
+	funk_table_set(vm, frame->variables, name, (FunkObject*) value);
+
+	// Scopes are objects on the heap, that can be old already
+	if (frame->scope != NULL) {
+		funk_write_barrier(vm, frame->scope, (FunkObject*) name);
+		funk_write_barrier(vm, frame->scope, (FunkObject*) value);
+	}
+}
+
+// Natives, like get(), can also ask for the arguments and inner functions by their name
+static bool get_lexical_variable(FunkVm* vm, FunkCallFrame* frame, FunkString* name, FunkFunction** result) {
+	FunkBasicFunction* function = frame->function;
+
+	for (uint8_t i = 0; i < function->localCount; i++) {
+		if (function->localNames[i] == name) {
+			*result = frame->slots[i];
+			return true;
+		}
+	}
+
+	return find_lexical_variable(vm, frame, name, result);
+}
+
+// Changes the variable in the call or in one of the captured scopes, where it was made,
+// the globals are only changed, if no scope has it, and otherwise it is made in the call
+static void set_lexical_variable(FunkVm* vm, FunkCallFrame* frame, FunkString* name, FunkFunction* value) {
+	FunkObject* result;
+
+	for (FunkCallFrame* variableFrame = frame; variableFrame != NULL; variableFrame = variableFrame->enclosing) {
+		if (funk_table_get(variableFrame->variables, name, &result)) {
+			set_frame_variable(vm, variableFrame, name, value);
+			return;
+		}
+	}
+
+	for (FunkFunction* scope = frame->function->scope; scope != NULL; scope = get_scope_data(scope)->enclosing) {
+		FunkTable* variables = &get_scope_data(scope)->variables;
+
+		if (funk_table_get(variables, name, &result)) {
+			funk_table_set(vm, variables, name, (FunkObject*) value);
+			funk_write_barrier(vm, scope, (FunkObject*) value);
+
+			return;
+		}
+	}
+
+	if (funk_table_get(&vm->globals, name, &result)) {
+		funk_table_set(vm, &vm->globals, name, (FunkObject*) value);
+		return;
+	}
+
+	set_frame_variable(vm, frame, name, value);
+}
+
+static void free_frame_variables(FunkVm* vm, FunkCallFrame* frame) {
+	if (frame->scope == NULL) {
+		funk_free_table(vm, &frame->ownVariables);
+	}
+}
+
+// The instructions, that both the interpreter and the helpers of the jit run
+
+static inline void push_value(FunkVm* vm, FunkFunction* value) {
+	*vm->stackTop = value;
+	vm->stackTop++;
+}
+
+// Unknown names become strings, if asString is set
+static inline FunkFunction* get_name(FunkVm* vm, FunkCallFrame* frame, FunkString* name, bool asString) {
+	FunkFunction* result = NULL;
+
+	if (!find_variable(vm, frame, name, &result) && asString) {
+		result = (FunkFunction*) funk_create_basic_function(vm, name);
+	}
+
+	return result;
+}
+
+static inline FunkFunction* get_lexical_name(FunkVm* vm, FunkCallFrame* frame, FunkString* name, bool asString) {
+	FunkFunction* result = NULL;
+
+	if (!find_lexical_variable(vm, frame, name, &result) && asString) {
+		result = (FunkFunction*) funk_create_basic_function(vm, name);
+	}
+
+	return result;
+}
+
+static inline void define_global(FunkVm* vm, FunkCallFrame* frame, FunkBasicFunction* function) {
+	// Top level functions of a lexically scoped file see the variables of the file
+	if (function->lexical) {
+		function = create_closure(vm, function, frame);
+	}
+
+	funk_table_set(vm, &vm->globals, function->parent.name, (FunkObject*) function);
+
+	#ifdef FUNK_TRACE_STACK
+		printf(" %s", funk_to_string((FunkFunction*) function));
+	#endif
+}
+
+static inline void define_local(FunkVm* vm, FunkCallFrame* frame, uint8_t slot, FunkBasicFunction* prototype) {
+	FunkBasicFunction* closure = create_closure(vm, prototype, frame);
+
+	frame->slots[slot] = (FunkFunction*) closure;
+	capture_upvalues(closure, frame);
+}
+
+static inline FunkFunction* make_closure(FunkVm* vm, FunkCallFrame* frame, FunkBasicFunction* prototype) {
+	FunkBasicFunction* closure = create_closure(vm, prototype, frame);
+	capture_upvalues(closure, frame);
+
+	return (FunkFunction*) closure;
+}
+
+// Tells, if the name still means the native, that the compiler lowered the calls of
+static inline bool is_intrinsic(FunkVm* vm, FunkCallFrame* frame, uint8_t intrinsic) {
+	FunkFunction* value = NULL;
+	FunkString* name = vm->intrinsicNames[intrinsic];
+
+	if (frame->function->lexical) {
+		find_lexical_variable(vm, frame, name, &value);
+	} else {
+		find_variable(vm, frame, name, &value);
+	}
+
+	return value != NULL && value->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) value)->fn == vm->intrinsicFns[intrinsic];
+}
+
+typedef struct FunkForState {
+	double i;
+	double to;
+	double step;
+} FunkForState;
+
+static FunkFunction* for_state_callback(FunkVm* vm, FunkNativeFunction* self, FunkFunction** args, uint8_t argCount) {
+	return NULL;
+}
+
+static void cleanup_for_state(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data != NULL) {
+		FUNK_FREE(vm, FunkForState, (FunkForState*) function->data);
+		function->data = NULL;
+	}
+}
+
+// A lowered for keeps [to, state] on the stack, so that the numbers aren't parsed again every round.
+// Like the native, it runs the end again every round, if it is a function with code
+static inline void prepare_for(FunkVm* vm) {
+	FunkFunction* from = vm->stackTop[-2];
+	FunkFunction* to = vm->stackTop[-1];
+
+	FunkForState* data = FUNK_ALLOCATE(vm, FunkForState, 1);
+
+	data->i = funk_to_number(vm, from);
+	data->to = funk_to_number(vm, to);
+	data->step = data->i < data->to ? 1 : -1;
+
+	FunkNativeFunction* state = funk_create_native_function(vm, funk_create_string(vm, "$forState", 9), (FunkNativeFn) for_state_callback);
+
+	state->cleanupFn = cleanup_for_state;
+	state->data = (void*) data;
+
+	vm->stackTop[-2] = to;
+	vm->stackTop[-1] = (FunkFunction*) state;
+}
+
+// Pushes the number for the body, or drops the loop from the stack, once it is done
+static inline bool next_for(FunkVm* vm) {
+	FunkFunction* to = vm->stackTop[-2];
+	FunkForState* data = (FunkForState*) ((FunkNativeFunction*) vm->stackTop[-1])->data;
+
+	if (to != NULL && funk_function_has_code(to)) {
+		data->to = funk_to_number(vm, to);
+	}
+
+	if (data->step > 0 ? data->i < data->to : data->i > data->to) {
+		push_value(vm, funk_number_to_string(vm, data->i));
+		return true;
+	}
+
+	vm->stackTop -= 2;
+	return false;
+}
+
+static inline void step_for(FunkVm* vm) {
+	FunkForState* data = (FunkForState*) ((FunkNativeFunction*) vm->stackTop[-1])->data;
+	data->i += data->step;
+}
+
+// Gives an inlined lambda a frame of its own, ip points to the operands of the instruction:
+// the number of arguments, that are on the stack already, and the offset of the code after the lambda
+static inline FunkCallFrame* push_scope(FunkVm* vm, FunkCallFrame* frame, FunkInlineFrame* inlineFrames, uint8_t* ip) {
+	FunkInlineFrame* inlineFrame = frame->enclosing == NULL ? inlineFrames : (FunkInlineFrame*) frame + 1;
+	FunkCallFrame* newFrame = &inlineFrame->frame;
+	uint16_t offset = (uint16_t) ((ip[1] << 8) | ip[2]);
+
+	inlineFrame->errorFrame = vm->errorFrame;
+	inlineFrame->stackTop = vm->stackTop - ip[0];
+	inlineFrame->exit = (uint32_t) (ip + 3 + offset - frame->function->code);
+
+	newFrame->function = frame->function;
+	newFrame->variables = &newFrame->ownVariables;
+	newFrame->scope = NULL;
+	newFrame->slots = frame->slots;
+	newFrame->previous = frame;
+	newFrame->enclosing = frame;
+
+	funk_init_table(&newFrame->ownVariables);
+
+	// An error unwinds only the frame of the lambda
+	vm->callFrame = newFrame;
+	vm->errorFrame = frame;
+
+	return newFrame;
+}
+
+// Leaves the frame with only the value of the lambda on top of the stack
+static inline FunkCallFrame* pop_scope(FunkVm* vm, FunkCallFrame* frame) {
+	FunkInlineFrame* inlineFrame = (FunkInlineFrame*) frame;
+	FunkFunction* value = vm->stackTop[-1];
+
+	vm->stackTop = inlineFrame->stackTop;
+	push_value(vm, value);
+
+	vm->callFrame = frame->previous;
+	vm->errorFrame = inlineFrame->errorFrame;
+
+	free_frame_variables(vm, frame);
+	return frame->previous;
+}
+
+// Returns false, if the callee was null, the error is already reported then
+static inline bool call_function(FunkVm* vm, uint8_t argumentCount) {
+	// Calls are the only safe point, everything alive is reachable from the stack, frames or globals
+	#ifdef FUNK_STRESS_GC
+		if (vm->gcPhase == FUNK_GC_IDLE && vm->collections % 8 != 0) {
+			funk_collect_nursery(vm);
+		} else {
+			funk_step_garbage(vm);
+		}
+	#else
+		if (vm->gcPhase != FUNK_GC_IDLE || vm->bytesAllocated > vm->nextCollection) {
+			funk_step_garbage(vm);
+		} else if (vm->nurseryBytes > vm->nurserySize) {
+			funk_collect_nursery(vm);
+		}
+	#endif
+
+	FunkFunction** stackTop = vm->stackTop - argumentCount - 1;
+	FunkFunction* callee = *stackTop;
+	FunkFunction* result;
+
+	#ifdef FUNK_TRACE_STACK
+		printf(" %s %i", funk_to_string(callee), argumentCount);
+	#endif
+
+	if (callee == NULL) {
+		// Only the inlined lambda ends, like its call would
+		if (vm->callFrame->enclosing != NULL) {
+			funk_error(vm, "Attempt to call a null value");
+		}
+
+		funk_flush_output(vm);
+		vm->errorFn(vm, "Attempt to call a null value");
+		return false;
+	}
+
+	if (callee->object.type == FUNK_OBJECT_NATIVE_FUNCTION) {
+		FunkNativeFunction* nativeFunction = (FunkNativeFunction*) callee;
+		result = nativeFunction->fn(vm, nativeFunction, (vm->stackTop - argumentCount), argumentCount);
+	} else {
+		FunkBasicFunction* basicFunction = (FunkBasicFunction*) callee;
+		vm->stackTop = stackTop;
+
+		for (uint8_t i = argumentCount; i < basicFunction->argumentCount; i++) {
+			vm->stackTop[i + 1] = NULL;
+		}
+
+		result = funk_run_function(vm, callee, argumentCount);
+	}
+
+	#ifdef FUNK_TRACE_STACK
+		printf("\n== %s ==\n", vm->callFrame->function->parent.name->chars);
+	#endif
+
+	vm->stackTop = stackTop;
+	push_value(vm, result);
+
+	return true;
+}
+
+#define FUNK_JIT_HELPER(name) static bool name(FunkJitFrame* frame, FunkObject* constant, uint32_t operand)
+
+FUNK_JIT_HELPER(jit_return) {
+	frame->result = *(--frame->vm->stackTop);
+	return false;
+}
+
+FUNK_JIT_HELPER(jit_call) {
+	return call_function(frame->vm, (uint8_t) operand);
+}
+
+FUNK_JIT_HELPER(jit_get) {
+	push_value(frame->vm, get_name(frame->vm, frame->callFrame, (FunkString*) constant, false));
+	return true;
+}
+
+FUNK_JIT_HELPER(jit_get_string) {
+	push_value(frame->vm, get_name(frame->vm, frame->callFrame, (FunkString*) constant, true));
+	return true;
+}
+
+FUNK_JIT_HELPER(jit_define) {
+	set_frame_variable(frame->vm, frame->callFrame, ((FunkFunction*) constant)->name, (FunkFunction*) constant);
+	return true;
+}
+
+FUNK_JIT_HELPER(jit_define_global) {
+	define_global(frame->vm, frame->callFrame, (FunkBasicFunction*) constant);
+	return true;
+}
+
+FUNK_JIT_HELPER(jit_get_lexical) {
+	push_value(frame->vm, get_lexical_name(frame->vm, frame->callFrame, (FunkString*) constant, false));
+	return true;
+}
+
+FUNK_JIT_HELPER(jit_get_lexical_string) {
+	push_value(frame->vm, get_lexical_name(frame->vm, frame->callFrame, (FunkString*) constant, true));
+	return true;
+}
+
+FUNK_JIT_HELPER(jit_define_local) {
+	define_local(frame->vm, frame->callFrame, (uint8_t) operand, (FunkBasicFunction*) constant);
+	return true;
+}
+
+FUNK_JIT_HELPER(jit_closure) {
+	push_value(frame->vm, make_closure(frame->vm, frame->callFrame, (FunkBasicFunction*) constant));
+	return true;
+}
+
+// The helpers of the branches return false to take the jump, the jit jumps to the target of the instruction then
+
+FUNK_JIT_HELPER(jit_jump_if_false) {
+	return funk_is_true(frame->vm, *(--frame->vm->stackTop));
+}
+
+FUNK_JIT_HELPER(jit_jump_if_redefined) {
+	return is_intrinsic(frame->vm, frame->callFrame, (uint8_t) operand);
+}
+
+FUNK_JIT_HELPER(jit_set) {
+	set_frame_variable(frame->vm, frame->callFrame, (FunkString*) constant, *(--frame->vm->stackTop));
+	return true;
+}
+
+FUNK_JIT_HELPER(jit_set_local) {
+	frame->slots[operand] = *(--frame->vm->stackTop);
+	return true;
+}
+
+FUNK_JIT_HELPER(jit_for_prepare) {
+	prepare_for(frame->vm);
+	return true;
+}
+
+FUNK_JIT_HELPER(jit_for_next) {
+	return next_for(frame->vm);
+}
+
+FUNK_JIT_HELPER(jit_for_step) {
+	step_for(frame->vm);
+	return true;
+}
+
+// The operand is the offset of the instruction, its operands are read from the bytecode
+FUNK_JIT_HELPER(jit_push_scope) {
+	frame->callFrame = push_scope(frame->vm, frame->callFrame, frame->inlineFrames, frame->callFrame->function->code + operand + 1);
+	return true;
+}
+
+FUNK_JIT_HELPER(jit_pop_scope) {
+	frame->callFrame = pop_scope(frame->vm, frame->callFrame);
+	return true;
+}
+
+#undef FUNK_JIT_HELPER
+
+// The small instructions are inlined by the jit and have no helper
+static const FunkJitHelper jitHelpers[FUNK_INSTRUCTION_COUNT] = {
+	[FUNK_INSTRUCTION_RETURN] = jit_return,
+	[FUNK_INSTRUCTION_CALL] = jit_call,
+	[FUNK_INSTRUCTION_GET] = jit_get,
+	[FUNK_INSTRUCTION_GET_STRING] = jit_get_string,
+	[FUNK_INSTRUCTION_DEFINE] = jit_define,
+	[FUNK_INSTRUCTION_DEFINE_GLOBAL] = jit_define_global,
+	[FUNK_INSTRUCTION_GET_LEXICAL] = jit_get_lexical,
+	[FUNK_INSTRUCTION_GET_LEXICAL_STRING] = jit_get_lexical_string,
+	[FUNK_INSTRUCTION_DEFINE_LOCAL] = jit_define_local,
+	[FUNK_INSTRUCTION_CLOSURE] = jit_closure,
+	[FUNK_INSTRUCTION_JUMP_IF_FALSE] = jit_jump_if_false,
+	[FUNK_INSTRUCTION_JUMP_IF_REDEFINED] = jit_jump_if_redefined,
+	[FUNK_INSTRUCTION_SET] = jit_set,
+	[FUNK_INSTRUCTION_SET_LOCAL] = jit_set_local,
+	[FUNK_INSTRUCTION_FOR_PREPARE] = jit_for_prepare,
+	[FUNK_INSTRUCTION_FOR_NEXT] = jit_for_next,
+	[FUNK_INSTRUCTION_FOR_STEP] = jit_for_step,
+	[FUNK_INSTRUCTION_PUSH_SCOPE] = jit_push_scope,
+	[FUNK_INSTRUCTION_POP_SCOPE] = jit_pop_scope
+};
+
+const FunkJitHelper* funk_get_jit_helpers() {
+	return jitHelpers;
+}
+
+// Returns the machine code of the function, once it was called often enough
+static void* get_jit_code(FunkVm* vm, FunkBasicFunction* function) {
+	#ifdef FUNK_TRACE_STACK
+		// The machine code can't trace the stack
+		return NULL;
+	#endif
+
+	FunkBasicFunction* source = function->prototype != NULL ? function->prototype : function;
+
+	if (source->jitCode != NULL || vm->jitThreshold == 0 || source->calls >= vm->jitThreshold) {
+		return source->jitCode;
+	}
+
+	// Functions, that can't be compiled, stay at the threshold and aren't tried again
+	if (++source->calls == vm->jitThreshold) {
+		source->jitCode = funk_jit_compile(vm, source, jitHelpers, &source->jitSize);
+	}
+
+	return source->jitCode;
+}
+
+// Runs the bytecode of the call from ip on, frame is the one of the innermost inlined lambda, that runs there
+static FunkFunction* interpret(FunkVm* vm, FunkCallFrame* frame, FunkInlineFrame* inlineFrames, uint8_t* ip) {
+	FunkBasicFunction* fn = frame->function;
+	FunkObject** constants = fn->constants;
+	// The inlined lambdas share the slots of the call
+	FunkFunction** slots = frame->slots;
+
+	#ifdef FUNK_TRACE_STACK
+		printf("\n=+ %s +=\n", fn->parent.name->chars);
+
+		for (uint16_t i = 0; i < fn->constantsLength; i++) {
+			FunkObject* object = fn->constants[i];
+			printf("%i: %s\n", i, object->type == FUNK_OBJECT_STRING ? ((FunkString*) object)->chars : funk_to_string(object));
+		}
+	#endif
+
+	#define READ_UINT8() (*ip++)
+	#define READ_UINT16() (ip += 2, (uint16_t) ((ip[-2] << 8) | ip[-1]))
+	#define READ_CONSTANT() (constants[READ_UINT16()])
+	#define PUSH(value) (*vm->stackTop = value, vm->stackTop++)
+	#define POP() (*(--vm->stackTop))
+
+	while (true) {
+		#ifdef FUNK_TRACE_STACK
+			printf("%s ", funkInstructionNames[*ip]);
+
+			for (FunkFunction** slot = vm->stackBase; slot < vm->stackTop; slot++) {
+				if (*slot == NULL) {
+					printf("[ null ]");
+					continue;
+				}
+
+				printf("[ %s ]", (*slot)->name->chars);
+			}
+		#endif
+
+		switch (*ip++) {
+			case FUNK_INSTRUCTION_RETURN: {
+				return POP();
+			}
+
+			case FUNK_INSTRUCTION_CALL: {
+				if (!call_function(vm, READ_UINT8())) {
+					return NULL;
+				}
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_GET: {
+				FunkString* name = (FunkString*) READ_CONSTANT();
+				FunkFunction* result = get_name(vm, frame, name, false);
+
+				PUSH(result);
+
+				#ifdef FUNK_TRACE_STACK
+					printf(" %s => %s", name->chars, funk_to_string(result));
+				#endif
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_GET_STRING: {
+				FunkString* name = (FunkString*) READ_CONSTANT();
+				FunkFunction* result = get_name(vm, frame, name, true);
+
+				#ifdef FUNK_TRACE_STACK
+					printf(" %s => %s", name->chars, funk_to_string(result));
+				#endif
+
+				PUSH(result);
+				break;
+			}
+
+			case FUNK_INSTRUCTION_POP: {
+				POP();
+				break;
+			}
+
+			case FUNK_INSTRUCTION_DEFINE: {
+				FunkBasicFunction* basicFunction = (FunkBasicFunction*) READ_CONSTANT();
+				set_frame_variable(vm, frame, basicFunction->parent.name, (FunkFunction*) basicFunction);
+
+				#ifdef FUNK_TRACE_STACK
+					printf(" %s", funk_to_string((FunkFunction*) basicFunction));
+				#endif
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_DEFINE_GLOBAL: {
+				define_global(vm, frame, (FunkBasicFunction*) READ_CONSTANT());
+				break;
+			}
+
+			case FUNK_INSTRUCTION_PUSH_NULL: {
+				PUSH(NULL);
+				break;
+			}
+
+			case FUNK_INSTRUCTION_PUSH_CONSTANT: {
+				PUSH((FunkFunction*) READ_CONSTANT());
+				break;
+			}
+
+			case FUNK_INSTRUCTION_GET_LOCAL: {
+				PUSH(slots[READ_UINT8()]);
+				break;
+			}
+
+			case FUNK_INSTRUCTION_GET_UPVALUE: {
+				PUSH(fn->upvalues[READ_UINT8()]);
+				break;
+			}
+
+			case FUNK_INSTRUCTION_GET_LEXICAL: {
+				FunkString* name = (FunkString*) READ_CONSTANT();
+				FunkFunction* result = get_lexical_name(vm, frame, name, false);
+
+				PUSH(result);
+
+				#ifdef FUNK_TRACE_STACK
+					printf(" %s => %s", name->chars, funk_to_string(result));
+				#endif
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_GET_LEXICAL_STRING: {
+				PUSH(get_lexical_name(vm, frame, (FunkString*) READ_CONSTANT(), true));
+				break;
+			}
+
+			case FUNK_INSTRUCTION_DEFINE_LOCAL: {
+				uint8_t slot = READ_UINT8();
+				define_local(vm, frame, slot, (FunkBasicFunction*) READ_CONSTANT());
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_CLOSURE: {
+				PUSH(make_closure(vm, frame, (FunkBasicFunction*) READ_CONSTANT()));
+				break;
+			}
+
+			case FUNK_INSTRUCTION_JUMP: {
+				uint16_t offset = READ_UINT16();
+				ip += offset;
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_LOOP: {
+				uint16_t offset = READ_UINT16();
+				ip -= offset;
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_JUMP_IF_FALSE: {
+				uint16_t offset = READ_UINT16();
+
+				if (!funk_is_true(vm, POP())) {
+					ip += offset;
+				}
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_JUMP_IF_REDEFINED: {
+				uint8_t intrinsic = READ_UINT8();
+				uint16_t offset = READ_UINT16();
+
+				if (!is_intrinsic(vm, frame, intrinsic)) {
+					ip += offset;
+				}
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_SET: {
+				FunkString* name = (FunkString*) READ_CONSTANT();
+				set_frame_variable(vm, frame, name, POP());
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_SET_LOCAL: {
+				uint8_t slot = READ_UINT8();
+				slots[slot] = POP();
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_FOR_PREPARE: {
+				prepare_for(vm);
+				break;
+			}
+
+			case FUNK_INSTRUCTION_FOR_NEXT: {
+				uint16_t offset = READ_UINT16();
+
+				if (!next_for(vm)) {
+					ip += offset;
+				}
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_FOR_STEP: {
+				step_for(vm);
+				break;
+			}
+
+			case FUNK_INSTRUCTION_PUSH_SCOPE: {
+				frame = push_scope(vm, frame, inlineFrames, ip);
+				ip += 3;
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_POP_SCOPE: {
+				frame = pop_scope(vm, frame);
+				break;
+			}
+
+			default: {
+				funk_flush_output(vm);
+				vm->errorFn(vm, "Unknown instruction");
+
+				return NULL;
+			}
+		}
+
+		#ifdef FUNK_TRACE_STACK
+				printf("\n");
+		#endif
+	}
+
+	#undef READ_UINT8
+	#undef READ_UINT16
+	#undef PUSH
+	#undef POP
+}
+
+// Drops the frame of the call, once it returned
+static inline FunkFunction* finish_call(FunkVm* vm, FunkCallFrame* frame, FunkFunction** stackTop, FunkFunction* result) {
+	vm->callFrame = frame->previous;
+	vm->stackTop = stackTop;
+
+	free_frame_variables(vm, frame);
+	return result;
+}
+
+static FunkFunction* execute_function(FunkVm* vm, FunkFunction* function, uint8_t argCount) {
+	if (function->object.type == FUNK_OBJECT_NATIVE_FUNCTION) {
+		FunkNativeFunction* nativeFunction = (FunkNativeFunction*) function;
+		FunkFunction** args = vm->stackTop + 1;
+
+		// The arguments are kept below the stack top, so that a collection can see them
+		vm->stackTop = args + argCount;
+		FunkFunction* result = nativeFunction->fn(vm, nativeFunction, args, argCount);
+		vm->stackTop = args - 1;
+
+		return result;
+	}
+
+	FunkBasicFunction* fn = (FunkBasicFunction*) function;
+
+	if (fn->codeLength == 0) {
+		return function;
+	}
+
+	FunkCallFrame callFrame;
+
+	// Deep recursion fails here, before it runs out of either stack
+	bool stackFull = vm->stackTop + fn->localCount + FUNK_STACK_RESERVE > vm->stackBase + FUNK_STACK_SIZE;
+
+	if (stackFull || (vm->cStackLimit != NULL && __builtin_frame_address(0) < vm->cStackLimit)) {
+		funk_error(vm, "Stack overflow");
+		return NULL;
+	}
+
+	FunkFunction** initialStackTop = vm->stackTop;
+
+	callFrame.function = fn;
+	callFrame.previous = vm->callFrame;
+	callFrame.variables = &callFrame.ownVariables;
+	callFrame.scope = NULL;
+	callFrame.slots = NULL;
+	callFrame.enclosing = NULL;
+
+	funk_init_table(&callFrame.ownVariables);
+
+	if (fn->lexical) {
+		// The arguments stay where the caller put them, the slots of the inner functions follow.
+		// The stack is marked up to the top, so the slot of the callee can't be left unset
+		*vm->stackTop = function;
+		callFrame.slots = vm->stackTop + 1;
+
+		for (uint8_t i = argCount < fn->argumentCount ? argCount : fn->argumentCount; i < fn->localCount; i++) {
+			callFrame.slots[i] = NULL;
+		}
+
+		vm->stackTop = callFrame.slots + fn->localCount;
+	} else {
+		for (uint8_t i = 0; i < fn->argumentCount; i++) {
+			funk_table_set(vm, &callFrame.ownVariables, fn->argumentNames[i], (FunkObject*) *(vm->stackTop + 1 + i));
+		}
+	}
+
+	vm->callFrame = &callFrame;
+
+	// The frames of the inlined lambdas follow each other, like the lambdas are nested
+	FunkInlineFrame inlineFrames[fn->inlineDepth > 0 ? fn->inlineDepth : 1];
+
+	if (fn->inlineDepth > 0) {
+		// An error in an inlined lambda only ends the lambda, like it would end its call. The rest of the call is interpreted,
+		// the code of the jit can't be entered in the middle
+		if (setjmp(vm->errorJumpBuffer) != 0) {
+			if (vm->callFrame == &callFrame) {
+				vm->callFrame = callFrame.previous;
+				vm->stackTop = initialStackTop;
+
+				return NULL;
+			}
+
+			FunkInlineFrame* inlineFrame = (FunkInlineFrame*) vm->callFrame;
+
+			vm->stackTop = inlineFrame->stackTop;
+			push_value(vm, NULL);
+
+			vm->callFrame = inlineFrame->frame.previous;
+			vm->errorFrame = inlineFrame->errorFrame;
+
+			return finish_call(vm, &callFrame, initialStackTop, interpret(vm, vm->callFrame, inlineFrames, fn->code + inlineFrame->exit));
+		}
+	}
+
+	FunkJitCode jitCode = (FunkJitCode) get_jit_code(vm, fn);
+
+	if (jitCode != NULL) {
+		FunkJitFrame jitFrame;
+
+		jitFrame.vm = vm;
+		jitFrame.callFrame = &callFrame;
+		jitFrame.slots = callFrame.slots;
+		jitFrame.upvalues = fn->upvalues;
+		jitFrame.inlineFrames = inlineFrames;
+		jitFrame.result = NULL;
+
+		jitCode(&jitFrame);
+		return finish_call(vm, &callFrame, initialStackTop, jitFrame.result);
+	}
+
+	return finish_call(vm, &callFrame, initialStackTop, interpret(vm, &callFrame, inlineFrames, fn->code));
+}
+
+
+FunkFunction* funk_run_function(FunkVm* vm, FunkFunction* function, uint8_t argCount) {
+	if (function == NULL) {
+		return function;
+	}
+
+	// Errors unwind only to here, the jump buffer of the caller is restored, so that it stays valid
+	jmp_buf previousJumpBuffer;
+	memcpy((void*) previousJumpBuffer, (void*) vm->errorJumpBuffer, sizeof(jmp_buf));
+
+	FunkFunction** stackTop = vm->stackTop;
+	FunkCallFrame* callFrame = vm->callFrame;
+	FunkCallFrame* previousErrorFrame = vm->errorFrame;
+	FunkFunction* result = NULL;
+
+	vm->errorFrame = callFrame;
+
+	if (setjmp(vm->errorJumpBuffer) == 0) {
+		result = execute_function(vm, function, argCount);
+	} else {
+		vm->stackTop = stackTop;
+		vm->callFrame = callFrame;
+	}
+
+	memcpy((void*) vm->errorJumpBuffer, (void*) previousJumpBuffer, sizeof(jmp_buf));
+	vm->errorFrame = previousErrorFrame;
+
+	return result;
+}
+
+FunkFunction* funk_run_string(FunkVm* vm, const char* name, const char* string) {
+	FunkFunction* function = funk_compile_string(vm, name, string);
+	return funk_run_function(vm, function, 0);
+}
+
+FunkFunction* funk_run_function_arged(FunkVm* vm, FunkFunction* function, FunkFunction** args, uint8_t argCount) {
+	for (uint8_t i = 0; i < argCount; i++) {
+		vm->stackTop[i + 1] = args[i];
+	}
+
+	return funk_run_function(vm, function, argCount);
+}
+
+FunkFunction* funk_run_string_arged(FunkVm* vm, const char* name, const char* string, FunkFunction** args, uint8_t argCount) {
+	FunkFunction* function = funk_compile_string(vm, name, string);
+	return funk_run_function_arged(vm, function, args, argCount);
+}
+
+const char* funk_read_file(const char* path) {
+	FILE* file = fopen(path, "rb");
+
+	if (file == NULL) {
+		return NULL;
+	}
+
+	fseek(file, 0L, SEEK_END);
+	size_t fileSize = ftell(file);
+	rewind(file);
+
+	char* buffer = (char*) malloc(fileSize + 1);
+	size_t bytes_read = fread(buffer, sizeof(char), fileSize, file);
+	buffer[bytes_read] = '\0';
+
+	fclose(file);
+	return (const char*) buffer;
+}
+
+FunkFunction* funk_run_file(FunkVm* vm, const char* file) {
+	const char* source = funk_read_file(file);
+
+	if (source == NULL) {
+		funk_error(vm, "Failed to open '%s'", file);
+		return NULL;
+	}
+
+	FunkFunction* result = funk_run_string(vm, file, source);
+	free((void*) source);
+
+	return result;
+}
+
+static void compile_program_function(FunkVm* vm, FunkBasicFunction* function) {
+	// Marks the function as tried, like get_jit_code() does, so that shared prototypes are only compiled once
+	if (function->calls >= vm->jitThreshold) {
+		return;
+	}
+
+	function->calls = vm->jitThreshold;
+	function->jitCode = funk_jit_compile(vm, function, jitHelpers, &function->jitSize);
+
+	for (uint16_t i = 0; i < function->constantsLength; i++) {
+		FunkObject* constant = function->constants[i];
+
+		if (constant != NULL && constant->type == FUNK_OBJECT_BASIC_FUNCTION && ((FunkBasicFunction*) constant)->codeLength > 0) {
+			compile_program_function(vm, (FunkBasicFunction*) constant);
+		}
+	}
+}
+
+FunkProgram* funk_create_program(FunkVm* vm, const char* name, const char* source) {
+	jmp_buf previousJumpBuffer;
+	memcpy((void*) previousJumpBuffer, (void*) vm->errorJumpBuffer, sizeof(jmp_buf));
+
+	FunkFunction* main = funk_compile_string(vm, name, source);
+	memcpy((void*) vm->errorJumpBuffer, (void*) previousJumpBuffer, sizeof(jmp_buf));
+
+	if (main == NULL) {
+		return NULL;
+	}
+
+	// The script stays on the stack of the program for good, nothing else runs there
+	funk_push_root(vm, main);
+
+	#ifndef FUNK_TRACE_STACK
+		if (vm->jitThreshold > 0) {
+			compile_program_function(vm, (FunkBasicFunction*) main);
+		}
+	#endif
+
+	// Finishes a collection, that the compiler might have started, the heap of the program is frozen from now on
+	if (vm->gcPhase != FUNK_GC_IDLE) {
+		funk_collect_garbage(vm);
+	}
+
+	funk_set_gc_trigger(vm, 0, 0);
+	funk_set_nursery_size(vm, 0);
+
+	FunkProgram* program = FUNK_ALLOCATE(vm, FunkProgram, 1);
+
+	program->vm = vm;
+	program->main = main;
+
+	return program;
+}
+
+void funk_free_program(FunkProgram* program) {
+	FunkVm* vm = program->vm;
+
+	FUNK_FREE(vm, FunkProgram, program);
+	funk_free_vm(vm);
+}
+
+FunkVm* funk_create_instance(FunkProgram* program, FunkErrorFn errorFn) {
+	return funk_create_child_vm(program->vm, errorFn);
+}
+
+FunkFunction* funk_run_program(FunkVm* instance, FunkProgram* program) {
+	return funk_run_function(instance, program->main, 0);
+}
+
+void funk_set_global(FunkVm* vm, const char* name, FunkFunction* function) {
+	funk_table_set(vm, &vm->globals, funk_create_string(vm, name, strlen(name)), (FunkObject*) function);
+}
+
+FunkFunction* funk_get_global(FunkVm* vm, const char* name) {
+	FunkFunction* result = NULL;
+	find_variable(vm, NULL, funk_create_string(vm, name, strlen(name)), &result);
+
+	return result;
+}
+
+void funk_define_native(FunkVm* vm, const char* name, FunkNativeFn fn) {
+	FunkString* nameString = funk_create_string(vm, name, strlen(name));
+	funk_table_set(vm, &vm->globals, nameString, (FunkObject*) funk_create_native_function(vm, nameString, fn));
+}
+
+void funk_define_intrinsic(FunkVm* vm, FunkIntrinsic intrinsic, const char* name, FunkNativeFn fn) {
+	funk_define_native(vm, name, fn);
+
+	vm->intrinsicFns[intrinsic] = fn;
+	vm->intrinsicNames[intrinsic] = funk_create_string(vm, name, strlen(name));
+}
+
+void funk_set_variable(FunkVm* vm, const char* name, FunkFunction* function) {
+	if (vm->callFrame == NULL) {
+		funk_set_global(vm, name, function);
+		return;
+	}
+
+	FunkCallFrame* currentFrame = vm->callFrame;
+	FunkString* nameString = funk_create_string(vm, name, strlen(name));
+	FunkObject* result = NULL;
+
+	if (currentFrame->function->lexical) {
+		set_lexical_variable(vm, currentFrame, nameString, function);
+		return;
+	}
+
+	do {
+		if (currentFrame == NULL) {
+			if (funk_table_get(&vm->globals, nameString, &result)) {
+				funk_table_set(vm, &vm->globals, nameString, (FunkObject*) function);
+			} else {
+				set_frame_variable(vm, vm->callFrame, nameString, function);
+			}
+
+			break;
+		}
+
+		if (funk_table_get(currentFrame->variables, nameString, &result)) {
+			set_frame_variable(vm, currentFrame, nameString, function);
+			return;
+		}
+
+		currentFrame = currentFrame->previous;
+	} while (true);
+}
+
+FunkFunction* funk_get_variable(FunkVm* vm, const char* name) {
+	if (vm->callFrame == NULL) {
+		return funk_get_global(vm, name);
+	}
+
+	FunkFunction* result = NULL;
+	FunkString* nameString = funk_create_string(vm, name, strlen(name));
+
+	if (vm->callFrame->function->lexical) {
+		get_lexical_variable(vm, vm->callFrame, nameString, &result);
+	} else {
+		find_variable(vm, vm->callFrame, nameString, &result);
+	}
+
+	return result;
+}
+
+void funk_set_lexical_scoping(FunkVm* vm, bool enabled) {
+	vm->lexicalScoping = enabled;
+}
+
+void funk_set_jit_threshold(FunkVm* vm, uint32_t calls) {
+	vm->jitThreshold = funk_jit_is_supported() ? calls : 0;
+}
+
+void funk_set_output(FunkVm* vm, FunkOutputFn outputFn, void* userData) {
+	funk_flush_output(vm);
+
+	vm->outputFn = outputFn == NULL ? write_to_stdout : outputFn;
+	vm->outputUserData = userData;
+}
+
+void funk_set_flush_mode(FunkVm* vm, FunkFlushMode mode) {
+	vm->flushMode = mode;
+}
+
+void funk_write_output(FunkVm* vm, const char* data, size_t length) {
+	bool newLine = vm->flushMode == FUNK_FLUSH_LINES && memchr((const void*) data, '\n', length) != NULL;
+
+	// Usually it fits and there is nothing else to do
+	if (!newLine && length < FUNK_OUTPUT_BUFFER_SIZE - vm->outputLength) {
+		memcpy((void*) (vm->output + vm->outputLength), (const void*) data, length);
+		vm->outputLength += length;
+
+		return;
+	}
+
+	while (length > 0) {
+		size_t available = FUNK_OUTPUT_BUFFER_SIZE - vm->outputLength;
+
+		// Big writes skip the buffer
+		if (vm->outputLength == 0 && length >= FUNK_OUTPUT_BUFFER_SIZE) {
+			vm->outputFn(vm->outputUserData, data, length);
+			return;
+		}
+
+		size_t copied = length < available ? length : available;
+
+		memcpy((void*) (vm->output + vm->outputLength), (const void*) data, copied);
+		vm->outputLength += copied;
+		data += copied;
+		length -= copied;
+
+		if (vm->outputLength == FUNK_OUTPUT_BUFFER_SIZE) {
+			funk_flush_output(vm);
+		}
+	}
+
+	if (newLine) {
+		funk_flush_output(vm);
+	}
+}
+
+void funk_flush_output(FunkVm* vm) {
+	if (vm->outputLength > 0) {
+		// Emptied first, an output function, that raises an error, would flush again
+		uint32_t length = vm->outputLength;
+		vm->outputLength = 0;
+
+		vm->outputFn(vm->outputUserData, vm->output, length);
+	}
+}
+
+void funk_error(FunkVm* vm, const char* message, ...) {
+	va_list args;
+	va_start(args, message);
+	va_list args_copy;
+	va_copy(args_copy, args);
+	size_t buffer_size = vsnprintf(NULL, 0, message, args_copy) + 1;
+	va_end(args_copy);
+
+	char buffer[buffer_size];
+	vsnprintf(buffer, buffer_size, message, args);
+	va_end(args);
+
+	funk_flush_output(vm);
+	vm->errorFn(vm, buffer);
+
+	// The unwound frames never return, a running generator catches its errors before its resumer
+	FunkCallFrame* resumerFrame = funk_get_resumer_frame(vm);
+
+	for (FunkCallFrame* frame = vm->callFrame; frame != NULL && frame != vm->errorFrame && frame != resumerFrame; frame = frame->previous) {
+		free_frame_variables(vm, frame);
+	}
+
+	longjmp(vm->errorJumpBuffer, 1);
+}
+
+void funk_print_stack_trace(FunkVm* vm) {
+	FunkCallFrame* frame = vm->callFrame;
+
+	while (frame != NULL) {
+		// The inlined lambdas are part of the function around them
+		if (frame->enclosing == NULL) {
+			fprintf(stderr, "%s():\n", frame->function->parent.name->chars);
+		}
+
+		frame = frame->previous;
+	}
+}
+
+bool funk_function_has_code(FunkFunction* function) {
+	return function != NULL && (function->object.type == FUNK_OBJECT_NATIVE_FUNCTION || ((FunkBasicFunction*) function)->codeLength > 0);
+}
+
+bool funk_is_true(FunkVm* vm, FunkFunction* function) {
+	if (funk_function_has_code(function)) {
+		function = funk_run_function(vm, function, 0);
+	}
+
+	return function != NULL && function->name->length == 4 && memcmp(function->name->chars, "true", 4) == 0;
+}
+
+static uint32_t parse_roman_numeral(const char* string, uint16_t length) {
+	if (length == 5 && memcmp(string, "NULLA", 5) == 0) {
+		return 0;
+	}
+
+	uint32_t value = 0;
+
+	for (uint16_t i = 0; i < length; i++) {
+		if (string[i] == 'I' && string[i + 1] == 'V') {
+			value += 4;
+		} else if (string[i] == 'I' && string[i + 1] == 'X') {
+			value += 9;
+		} else if (string[i] == 'X' && string[i + 1] == 'L') {
+			value += 40;
+		} else if (string[i] == 'X' && string[i + 1] == 'C') {
+			value += 90;
+		} else if (string[i] == 'C' && string[i + 1] == 'D') {
+			value += 400;
+		} else if (string[i] == 'C' && string[i + 1] == 'M') {
+			value += 900;
+		} else {
+			switch (string[i]) {
+				case 'I': value += 1; break;
+				case 'V': value += 5; break;
+				case 'X': value += 10; break;
+				case 'L': value += 50; break;
+				case 'C': value += 100; break;
+				case 'D': value += 500; break;
+				case 'M': value += 1000; break;
+
+				default: break;
+			}
+
+			continue;
+		}
+
+		i++;
+	}
+
+	return value;
+}
+
+static uint16_t calculate_number_of_places(uint32_t n) {
+	uint16_t r = 1;
+
+	while (n > 9) {
+		n /= 10;
+		r++;
+	}
+
+	return r;
+}
+
+static uint16_t calculate_number_of_places_after_dot(double n) {
+	uint16_t places = 0;
+
+	while (true) {
+		n *= 10;
+
+		if ((int) fmod(n, 10) == 0 && (int) fmod(n * 10, 10) == 0) {
+			return places;
+		}
+
+		places++;
+
+		if (places >= 5) {
+			return places;
+		}
+	}
+}
+
+double funk_to_number(FunkVm* vm, FunkFunction* function) {
+	if (function == NULL) {
+		return 0;
+	}
+
+	if (funk_function_has_code(function)) {
+		function = funk_run_function(vm, function, 0);
+	}
+
+	const char* string = function->name->chars;
+	uint16_t length = function->name->length;
+	bool negative = false;
+
+	if (string[0] == '-') {
+		negative = true;
+		string++;
+		length--;
+	}
+
+	const char* dot = strchr(string, '.');
+	double value = 0;
+
+	if (dot != NULL) {
+		length = dot - string;
+		uint32_t afterDot = parse_roman_numeral(dot + 1, function->name->length - length - 1);
+
+		value += (double) afterDot / (pow(10, calculate_number_of_places(afterDot)));
+	}
+
+	return (value + parse_roman_numeral(string, length)) * (negative ? -1 : 1);
+}
+
+static FunkString* roman_to_string(FunkVm* vm, uint32_t value) {
+	uint32_t number = value;
+	uint16_t index = 0;
+
+	char buffer[255];
+
+	// Every thousand is another M, the largest remainder (888) takes 12 more characters
+	if (value / 1000 + 12 > sizeof(buffer)) {
+		funk_error(vm, "%u is too big for a roman numeral", value);
+		return NULL;
+	}
+
+	while (number != 0) {
+		if (number >= 1000) {
+			buffer[index++] = 'M';
+			number -= 1000;
+		} else if (number >= 900) {
+			memcpy((void*) (buffer + index), "CM", 2);
+
+			index += 2;
+			number -= 900;
+		} else if (number >= 500) {
+			buffer[index++] = 'D';
+			number -= 500;
+		} else if (number >= 400) {
+			memcpy((void*) (buffer + index), "CD", 2);
+
+			index += 2;
+			number -= 400;
+		} else if (number >= 100) {
+			buffer[index++] = 'C';
+			number -= 100;
+		} else if (number >= 90) {memcpy((void*) (buffer + index), "XC", 2);
+
+			index += 2;
+			number -= 90;
+		} else if (number >= 50) {
+			buffer[index++] = 'L';
+			number -= 50;
+		} else if (number >= 40) {memcpy((void*) (buffer + index), "XL", 2);
+
+			index += 2;
+			number -= 40;
+		} else if (number >= 10) {
+			buffer[index++] = 'X';
+			number -= 10;
+		} else if (number >= 9) {memcpy((void*) (buffer + index), "IX", 2);
+
+			index += 2;
+			number -= 9;
+		} else if (number >= 5) {
+			buffer[index++] = 'V';
+			number -= 5;
+		} else if (number >= 4) {memcpy((void*) (buffer + index), "IV", 2);
+
+			index += 2;
+			number -= 4;
+		} else {
+			buffer[index++] = 'I';
+			number -= 1;
+		}
+	}
+
+	return funk_create_string(vm, buffer, index);
+}
+
+FunkFunction* funk_number_to_string(FunkVm* vm, double number) {
+	bool negative = number < 0;
+	number = fabs(number);
+
+	uint32_t whole = floor(number);
+	double fraction = number - whole;
+	FunkString* fractionString = fraction > 0 ? roman_to_string(vm, (uint32_t) (fraction * pow(10, calculate_number_of_places_after_dot(fraction)))) : NULL;
+
+	FunkString* digitsString = roman_to_string(vm, whole);
+	uint16_t length = digitsString->length + (uint16_t) negative;
+
+	if (fractionString != NULL) {
+		length += fractionString->length + 1;
+	}
+
+	char buffer[length + 1];
+	uint16_t index = 0;
+
+	if (negative) {
+		buffer[0] = '-';
+		index++;
+	}
+
+	memcpy((void*) (buffer + index), digitsString->chars, digitsString->length);
+	index += digitsString->length;
+
+	if (fractionString != NULL) {
+		buffer[index++] = '.';
+		memcpy((void*) (buffer + index), fractionString->chars, fractionString->length);
+	}
+
+	buffer[length] = '\0';
+	return (FunkFunction*) funk_create_empty_function(vm, buffer);
+}
+
+static void trace_references(FunkVm* vm, FunkObject* object) {
+	switch (object->type) {
+		case FUNK_OBJECT_BASIC_FUNCTION: {
+			FunkBasicFunction* function = (FunkBasicFunction*) object;
+			funk_mark_object(vm, (FunkObject *) function->parent.name);
+
+			// The code, constants and names belong to the prototype
+			if (function->prototype != NULL) {
+				funk_mark_object(vm, (FunkObject *) function->prototype);
+				funk_mark_object(vm, (FunkObject *) function->scope);
+
+				for (uint8_t i = 0; i < function->upvalueCount; i++) {
+					funk_mark_object(vm, (FunkObject *) function->upvalues[i]);
+				}
+
+				break;
+			}
+
+			for (uint8_t i = 0; i < function->localCount; i++) {
+				funk_mark_object(vm, (FunkObject *) function->localNames[i]);
+			}
+
+			for (uint16_t i = 0; i < function->constantsLength; i++) {
+				funk_mark_object(vm, (FunkObject *) function->constants[i]);
+			}
+
+			for (uint16_t i = 0; i < function->argumentCount; i++) {
+				funk_mark_object(vm, (FunkObject *) function->argumentNames[i]);
 			}
-		#endif
 
-		switch (*ip++) {
-			case FUNK_INSTRUCTION_RETURN: {
-				FunkFunction* value = POP();
+			break;
+		}
 
-				vm->callFrame = callFrame.previous;
-				vm->stackTop = initialStackTop;
+		case FUNK_OBJECT_NATIVE_FUNCTION: {
+			FunkNativeFunction* function = (FunkNativeFunction*) object;
+			funk_mark_object(vm, (FunkObject *) function->parent.name);
 
-				funk_free_table(vm, &callFrame.variables);
-				return value;
+			if (function->traceFn != NULL && function->data != NULL) {
+				function->traceFn(vm, function);
 			}
 
-			case FUNK_INSTRUCTION_CALL: {
-				uint8_t argumentCount = READ_UINT8();
+			break;
+		}
 
-				FunkFunction** stackTop = vm->stackTop - argumentCount - 1;
-				FunkFunction* callee = *stackTop;
-				FunkFunction* result;
+		case FUNK_OBJECT_STRING: {
+			break;
+		}
 
-				#ifdef FUNK_TRACE_STACK
-					printf(" %s %i", funk_to_string(callee), argumentCount);
-				#endif
+		default: UNREACHABLE;
+	}
+}
 
-				if (callee == NULL) {
-					vm->errorFn(vm, "Attempt to call a null value");
-					vm->stackTop = initialStackTop;
+// Every marker traces from its own stack and hands half of it over to the shared one from time to time,
+// the markers, that run out of work, steal from the shared stacks, until nothing is left to trace anywhere
+#define FUNK_MARKER_SHARE_INTERVAL 64
 
-					return NULL;
-				}
+typedef struct FunkMarkStack {
+	FunkObject** objects;
+	uint32_t count;
+	uint32_t allocated;
+} FunkMarkStack;
 
-				if (callee->object.type == FUNK_OBJECT_NATIVE_FUNCTION) {
-					FunkNativeFunction* nativeFunction = (FunkNativeFunction*) callee;
-					result = nativeFunction->fn(vm, nativeFunction, (vm->stackTop - argumentCount), argumentCount);
-				} else {
-					FunkBasicFunction* basicFunction = (FunkBasicFunction*) callee;
-					vm->stackTop = stackTop;
+typedef struct FunkMarker {
+	struct FunkParallelMark* mark;
 
-					for (uint8_t i = argumentCount; i < basicFunction->argumentCount; i++) {
-						vm->stackTop[i + 1] = NULL;
-					}
+	FunkMarkStack local;
+	FunkMarkStack shared;
+	pthread_mutex_t lock;
 
-					result = funk_run_function(vm, callee, argumentCount);
-				}
+	uint32_t traced;
+} FunkMarker;
 
-				#ifdef FUNK_TRACE_STACK
-					printf("\n== %s ==\n", function->name->chars);
-				#endif
+typedef struct FunkParallelMark {
+	FunkVm* vm;
+	FunkMarker* markers;
+	uint16_t markerCount;
 
-				vm->stackTop = stackTop;
-				PUSH(result);
+	// Objects, that were marked, but not traced yet, the marking is done, once it drops to zero
+	uint64_t pending;
+} FunkParallelMark;
 
-				break;
-			}
+static __thread FunkMarker* activeMarker = NULL;
 
-			case FUNK_INSTRUCTION_GET: {
-				FunkString* name = (FunkString*) READ_CONSTANT();
-				FunkFunction* result = NULL;
-				FunkCallFrame* currentFrame = &callFrame;
+static void push_mark_stack(FunkMarkStack* stack, FunkObject* object) {
+	if (stack->count + 1 > stack->allocated) {
+		uint32_t allocated = FUNK_GROW_CAPACITY(stack->allocated);
+		FunkObject** objects = (FunkObject**) realloc((void*) stack->objects, sizeof(FunkObject*) * allocated);
 
-				bool hadResult = false;
+		// The heap is half marked, there is no consistent state to unwind to
+		if (objects == NULL) {
+			fprintf(stderr, "Out of memory while marking\n");
+			abort();
+		}
 
-				do {
-					hadResult = funk_table_get(currentFrame == NULL ? &vm->globals : &currentFrame->variables, name, (FunkObject**) &result);
+		stack->objects = objects;
+		stack->allocated = allocated;
+	}
 
-					if (currentFrame == NULL) {
-						break;
-					}
+	stack->objects[stack->count++] = object;
+}
 
-					currentFrame = currentFrame->previous;
-				} while (!hadResult);
+static void mark_in_parallel(FunkMarker* marker, FunkObject* object) {
+	if (__atomic_exchange_n(&object->marked, true, __ATOMIC_RELAXED) || object->type == FUNK_OBJECT_STRING) {
+		return;
+	}
 
-				PUSH(result);
+	__atomic_fetch_add(&marker->mark->pending, 1, __ATOMIC_RELAXED);
+	push_mark_stack(&marker->local, object);
+}
 
-				#ifdef FUNK_TRACE_STACK
-					printf(" %s => %s", name->chars, funk_to_string(result));
-				#endif
+static FunkObject* take_grey_object(FunkMarker* marker) {
+	if (marker->local.count > 0) {
+		return marker->local.objects[--marker->local.count];
+	}
 
-				break;
-			}
+	FunkParallelMark* mark = marker->mark;
+	uint16_t index = (uint16_t) (marker - mark->markers);
 
-			case FUNK_INSTRUCTION_GET_STRING: {
-				FunkString* name = (FunkString*) READ_CONSTANT();
-				FunkFunction* result = NULL;
-				FunkCallFrame* currentFrame = &callFrame;
+	// Starts with its own shared stack, then steals from the next markers
+	for (uint16_t i = 0; i < mark->markerCount; i++) {
+		FunkMarker* victim = &mark->markers[(index + i) % mark->markerCount];
 
-				bool hadResult = false;
+		pthread_mutex_lock(&victim->lock);
 
-				do {
-					hadResult = funk_table_get(currentFrame == NULL ? &vm->globals : &currentFrame->variables, name, (FunkObject**) &result);
+		uint32_t taken = (victim->shared.count + 1) / 2;
 
-					if (currentFrame == NULL) {
-						break;
-					}
+		for (uint32_t j = 0; j < taken; j++) {
+			push_mark_stack(&marker->local, victim->shared.objects[--victim->shared.count]);
+		}
 
-					currentFrame = currentFrame->previous;
-				} while (!hadResult);
+		pthread_mutex_unlock(&victim->lock);
 
-				if (!hadResult) {
-					result = (FunkFunction*) funk_create_basic_function(vm, name);
-				}
+		if (taken > 0) {
+			return marker->local.objects[--marker->local.count];
+		}
+	}
 
-				#ifdef FUNK_TRACE_STACK
-					printf(" %s => %s", name->chars, funk_to_string(result));
-				#endif
+	return NULL;
+}
 
-				PUSH(result);
-				break;
-			}
+static void share_grey_objects(FunkMarker* marker) {
+	if (++marker->traced % FUNK_MARKER_SHARE_INTERVAL != 0 || marker->local.count < 2) {
+		return;
+	}
 
-			case FUNK_INSTRUCTION_POP: {
-				POP();
-				break;
-			}
+	pthread_mutex_lock(&marker->lock);
 
-			case FUNK_INSTRUCTION_DEFINE: {
-				FunkBasicFunction* basicFunction = (FunkBasicFunction*) READ_CONSTANT();
-				funk_table_set(vm, &callFrame.variables, basicFunction->parent.name, (FunkObject*) basicFunction);
+	if (marker->shared.count == 0) {
+		uint32_t given = marker->local.count / 2;
 
-				#ifdef FUNK_TRACE_STACK
-					printf(" %s", funk_to_string((FunkFunction*) basicFunction));
-				#endif
+		for (uint32_t i = 0; i < given; i++) {
+			push_mark_stack(&marker->shared, marker->local.objects[--marker->local.count]);
+		}
+	}
 
-				break;
-			}
+	pthread_mutex_unlock(&marker->lock);
+}
 
-			case FUNK_INSTRUCTION_DEFINE_GLOBAL: {
-				FunkBasicFunction* basicFunction = (FunkBasicFunction*) READ_CONSTANT();
-				funk_table_set(vm, &vm->globals, basicFunction->parent.name, (FunkObject*) basicFunction);
+static void trace_references(FunkVm* vm, FunkObject* object);
 
-				#ifdef FUNK_TRACE_STACK
-					printf(" %s", funk_to_string((FunkFunction*) basicFunction));
-				#endif
+static void run_marker(FunkVm* worker, uint32_t chunk, void* userData) {
+	FunkParallelMark* mark = (FunkParallelMark*) userData;
+	FunkMarker* marker = &mark->markers[chunk];
 
-				break;
-			}
+	activeMarker = marker;
 
-			case FUNK_INSTRUCTION_PUSH_NULL: {
-				PUSH(NULL);
-				break;
-			}
+	while (true) {
+		FunkObject* object = take_grey_object(marker);
 
-			case FUNK_INSTRUCTION_PUSH_CONSTANT: {
-				PUSH((FunkFunction*) READ_CONSTANT());
+		if (object == NULL) {
+			// Others might still be tracing objects, that lead to more work
+			if (__atomic_load_n(&mark->pending, __ATOMIC_ACQUIRE) == 0) {
 				break;
 			}
 
-			default: {
-				vm->errorFn(vm, "Unknown instruction");
-				vm->stackTop = initialStackTop;
-
-				return NULL;
-			}
+			sched_yield();
+			continue;
 		}
 
-		#ifdef FUNK_TRACE_STACK
-				printf("\n");
-		#endif
-	}
+		trace_references(mark->vm, object);
+		__atomic_fetch_sub(&mark->pending, 1, __ATOMIC_RELEASE);
 
-	#undef READ_UINT8
-	#undef READ_UINT16
-	#undef PUSH
-	#undef POP
-}
+		share_grey_objects(marker);
+	}
 
-FunkFunction* funk_run_string(FunkVm* vm, const char* name, const char* string) {
-	FunkFunction* function = funk_compile_string(vm, name, string);
-	return funk_run_function(vm, function, 0);
+	activeMarker = NULL;
 }
 
-FunkFunction* funk_run_function_arged(FunkVm* vm, FunkFunction* function, FunkFunction** args, uint8_t argCount) {
-	for (uint8_t i = 0; i < argCount; i++) {
-		vm->stackTop[i + 1] = args[i];
+static FunkWorkerPool* get_gc_pool(FunkVm* vm) {
+	if (vm->gcPool == NULL) {
+		vm->gcPool = funk_create_worker_pool(vm, vm->gcThreads);
 	}
 
-	return funk_run_function(vm, function, argCount);
+	return vm->gcPool;
 }
 
-FunkFunction* funk_run_string_arged(FunkVm* vm, const char* name, const char* string, FunkFunction** args, uint8_t argCount) {
-	FunkFunction* function = funk_compile_string(vm, name, string);
-	return funk_run_function_arged(vm, function, args, argCount);
-}
+static void trace_grey_in_parallel(FunkVm* vm) {
+	FunkWorkerPool* pool = get_gc_pool(vm);
+	uint16_t markerCount = funk_get_worker_count(pool);
 
-const char* funk_read_file(const char* path) {
-	FILE* file = fopen(path, "rb");
+	FunkParallelMark mark;
+	mark.vm = vm;
+	mark.markers = FUNK_ALLOCATE(vm, FunkMarker, markerCount);
+	mark.markerCount = markerCount;
+	mark.pending = vm->greyCount;
 
-	if (file == NULL) {
-		return NULL;
-	}
+	for (uint16_t i = 0; i < markerCount; i++) {
+		FunkMarker* marker = &mark.markers[i];
 
-	fseek(file, 0L, SEEK_END);
-	size_t fileSize = ftell(file);
-	rewind(file);
+		marker->mark = &mark;
+		marker->local = (FunkMarkStack) { NULL, 0, 0 };
+		marker->shared = (FunkMarkStack) { NULL, 0, 0 };
+		marker->traced = 0;
 
-	char* buffer = (char*) malloc(fileSize + 1);
-	size_t bytes_read = fread(buffer, sizeof(char), fileSize, file);
-	buffer[bytes_read] = '\0';
+		pthread_mutex_init(&marker->lock, NULL);
+	}
 
-	fclose(file);
-	return (const char*) buffer;
-}
+	for (uint32_t i = 0; i < vm->greyCount; i++) {
+		push_mark_stack(&mark.markers[i % markerCount].shared, vm->grey[i]);
+	}
 
-FunkFunction* funk_run_file(FunkVm* vm, const char* file) {
-	const char* source = funk_read_file(file);
+	vm->greyCount = 0;
+	funk_run_on_workers(pool, run_marker, (void*) &mark, markerCount);
 
-	if (source == NULL) {
-		funk_error(vm, "Failed to open '%s'", file);
-		return NULL;
-	}
+	for (uint16_t i = 0; i < markerCount; i++) {
+		FunkMarker* marker = &mark.markers[i];
 
-	FunkFunction* result = funk_run_string(vm, file, source);
-	free((void*) source);
+		free((void*) marker->local.objects);
+		free((void*) marker->shared.objects);
+		pthread_mutex_destroy(&marker->lock);
+	}
 
-	return result;
+	FUNK_FREE_ARRAY(vm, FunkMarker, mark.markers, markerCount);
 }
 
-void funk_set_global(FunkVm* vm, const char* name, FunkFunction* function) {
-	funk_table_set(vm, &vm->globals, funk_create_string(vm, name, strlen(name)), (FunkObject*) function);
-}
+typedef struct FunkParallelSweep {
+	FunkVm* vm;
+	FunkObject* unreached[FUNK_HEAP_SEGMENTS];
+} FunkParallelSweep;
 
-FunkFunction* funk_get_global(FunkVm* vm, const char* name) {
-	FunkFunction* result = NULL;
-	funk_table_get(&vm->globals, funk_create_string(vm, name, strlen(name)), (FunkObject**) &result);
+// Only unlinks the unreached objects, freeing them touches the allocator and the string table, which are not thread safe
+static void run_sweeper(FunkVm* worker, uint32_t segment, void* userData) {
+	FunkParallelSweep* sweep = (FunkParallelSweep*) userData;
+	FunkObject** cursor = &sweep->vm->objects[segment];
 
-	return result;
+	while (*cursor != NULL) {
+		FunkObject* object = *cursor;
+
+		if (object->marked) {
+			object->marked = false;
+			cursor = &object->next;
+		} else {
+			*cursor = object->next;
+
+			object->next = sweep->unreached[segment];
+			sweep->unreached[segment] = object;
+		}
+	}
 }
 
-void funk_define_native(FunkVm* vm, const char* name, FunkNativeFn fn) {
-	FunkString* nameString = funk_create_string(vm, name, strlen(name));
-	funk_table_set(vm, &vm->globals, nameString, (FunkObject*) funk_create_native_function(vm, nameString, fn));
+typedef struct FunkHeapDump {
+	FILE* file;
+	// NULL while the roots are written
+	FunkObject* source;
+} FunkHeapDump;
+
+static void dump_reference(FunkHeapDump* dump, FunkObject* object) {
+	if (dump->source == NULL) {
+		fprintf(dump->file, "\troots -> \"%p\";\n", (void*) object);
+	} else {
+		fprintf(dump->file, "\t\"%p\" -> \"%p\";\n", (void*) dump->source, (void*) object);
+	}
 }
 
-void funk_set_variable(FunkVm* vm, const char* name, FunkFunction* function) {
-	if (vm->callFrame == NULL) {
-		funk_set_global(vm, name, function);
+void funk_mark_object(FunkVm* vm, FunkObject* object) {
+	if (object != NULL && vm->heapDump != NULL) {
+		dump_reference(vm->heapDump, object);
 		return;
 	}
 
-	FunkCallFrame* currentFrame = vm->callFrame;
-	FunkString* nameString = funk_create_string(vm, name, strlen(name));
-	FunkFunction* result = NULL;
+	if (object != NULL && activeMarker != NULL) {
+		mark_in_parallel(activeMarker, object);
+		return;
+	}
 
-	do {
-		FunkTable* table = currentFrame == NULL ? &vm->globals : &currentFrame->variables;
+	// Nursery collections stop at old objects, the remembered set covers their references to young ones
+	if (object == NULL || object->marked || object->level != vm->level || (vm->collectingNursery && !object->young)) {
+		return;
+	}
 
-		if (funk_table_get(table, nameString, (FunkObject**) &result)) {
-			funk_table_set(vm, table, nameString, (FunkObject*) function);
-			return;
-		}
+	object->marked = true;
 
-		if (currentFrame == NULL) {
-			funk_table_set(vm, &vm->callFrame->variables, nameString, (FunkObject*) function);
-			break;
-		}
+	// Strings have no references, so they never need to be traced
+	if (object->type == FUNK_OBJECT_STRING) {
+		return;
+	}
 
-		currentFrame = currentFrame->previous;
-	} while (true);
-}
+	if (vm->greyCount + 1 > vm->greyAllocated) {
+		uint32_t allocated = FUNK_GROW_CAPACITY(vm->greyAllocated);
 
-FunkFunction* funk_get_variable(FunkVm* vm, const char* name) {
-	if (vm->callFrame == NULL) {
-		return funk_get_global(vm, name);
+		vm->grey = FUNK_GROW_ARRAY(vm, FunkObject*, vm->grey, vm->greyAllocated, allocated);
+		vm->greyAllocated = allocated;
 	}
 
-	FunkCallFrame* currentFrame = vm->callFrame;
-	FunkString* nameString = funk_create_string(vm, name, strlen(name));
-	FunkFunction* result = NULL;
-
-	bool hadResult = false;
+	vm->grey[vm->greyCount++] = object;
+}
 
-	do {
-		hadResult = funk_table_get(currentFrame == NULL ? &vm->globals : &currentFrame->variables, nameString, (FunkObject**) &result);
+void funk_mark_table(FunkVm* vm, FunkTable* table) {
+	for (int i = 0; i <= table->capacity; i++) {
+		FunkTableEntry* entry = &table->entries[i];
 
-		if (currentFrame == NULL) {
-			break;
+		if (entry->key != NULL) {
+			funk_mark_object(vm, (FunkObject *) entry->key);
+			funk_mark_object(vm, entry->value);
 		}
-
-		currentFrame = currentFrame->previous;
-	} while (!hadResult);
-
-	return result;
+	}
 }
 
-void funk_error(FunkVm* vm, const char* message, ...) {
-	va_list args;
-	va_start(args, message);
-	va_list args_copy;
-	va_copy(args_copy, args);
-	size_t buffer_size = vsnprintf(NULL, 0, message, args_copy) + 1;
-	va_end(args_copy);
+static void mark_roots(FunkVm* vm) {
+	funk_mark_table(vm, &vm->globals);
+	funk_mark_table(vm, &vm->modules);
 
-	char buffer[buffer_size];
-	vsnprintf(buffer, buffer_size, message, args);
-	va_end(args);
+	for (uint8_t i = 0; i < FUNK_INTRINSIC_COUNT; i++) {
+		funk_mark_object(vm, (FunkObject*) vm->intrinsicNames[i]);
+	}
 
-	vm->errorFn(vm, buffer);
-	longjmp(vm->errorJumpBuffer, 1);
-}
+	funk_mark_object(vm, (FunkObject*) vm->loop);
 
-void funk_print_stack_trace(FunkVm* vm) {
 	FunkCallFrame* frame = vm->callFrame;
 
 	while (frame != NULL) {
-		fprintf(stderr, "%s():\n", frame->function->parent.name->chars);
+		funk_mark_table(vm, frame->variables);
+		funk_mark_object(vm, (FunkObject *) frame->function);
+		funk_mark_object(vm, (FunkObject *) frame->scope);
+
 		frame = frame->previous;
 	}
-}
-
-bool funk_function_has_code(FunkFunction* function) {
-	return function != NULL && function->object.type == FUNK_OBJECT_NATIVE_FUNCTION ? true : ((FunkBasicFunction*) function)->codeLength > 0;
-}
 
-bool funk_is_true(FunkVm* vm, FunkFunction* function) {
-	if (funk_function_has_code(function)) {
-		function = funk_run_function(vm, function, 0);
+	for (FunkFunction** object = vm->stackBase; object < vm->stackTop; object++) {
+		funk_mark_object(vm, (FunkObject *) *object);
 	}
 
-	return function == NULL ? false : strcmp(function->name->chars, "true") == 0;
-}
-
-static uint32_t parse_roman_numeral(const char* string, uint16_t length) {
-	if (memcmp(string, "NULLA", length) == 0) {
-		return 0;
+	for (FunkStackSegment* segment = vm->resumerStacks; segment != NULL; segment = segment->previous) {
+		for (FunkFunction** object = segment->base; object < segment->top; object++) {
+			funk_mark_object(vm, (FunkObject *) *object);
+		}
 	}
+}
 
-	uint32_t value = 0;
+static void mark_remembered(FunkVm* vm) {
+	for (uint32_t i = 0; i < vm->rememberedCount; i++) {
+		FunkObject* object = vm->remembered[i];
+		object->remembered = false;
 
-	for (uint16_t i = 0; i < length; i++) {
-		if (string[i] == 'I' && string[i + 1] == 'V') {
-			value += 4;
-		} else if (string[i] == 'I' && string[i + 1] == 'X') {
-			value += 9;
-		} else if (string[i] == 'X' && string[i + 1] == 'L') {
-			value += 40;
-		} else if (string[i] == 'X' && string[i + 1] == 'C') {
-			value += 90;
-		} else if (string[i] == 'C' && string[i + 1] == 'D') {
-			value += 400;
-		} else if (string[i] == 'C' && string[i + 1] == 'M') {
-			value += 900;
-		} else {
-			switch (string[i]) {
-				case 'I': value += 1; break;
-				case 'V': value += 5; break;
-				case 'X': value += 10; break;
-				case 'L': value += 50; break;
-				case 'C': value += 100; break;
-				case 'D': value += 500; break;
-				case 'M': value += 1000; break;
+		if (vm->collectingNursery) {
+			trace_references(vm, object);
+		}
+	}
 
-				default: break;
-			}
+	vm->rememberedCount = 0;
+}
 
-			continue;
+// Traces up to budget grey objects, returns true once none are left
+static bool trace_grey(FunkVm* vm, uint32_t budget) {
+	// Only tracing everything at once is worth waking the threads for
+	if (budget == UINT32_MAX && vm->gcThreads != 1 && !vm->collectingNursery && vm->greyCount > 0) {
+		trace_grey_in_parallel(vm);
+		return true;
+	}
+
+	while (vm->greyCount > 0) {
+		if (budget-- == 0) {
+			return false;
 		}
 
-		i++;
+		trace_references(vm, vm->grey[--vm->greyCount]);
 	}
 
-	return value;
+	return true;
 }
 
-static uint16_t calculate_number_of_places(uint32_t n) {
-	uint16_t r = 1;
-
-	while (n > 9) {
-		n /= 10;
-		r++;
+static void free_unreached(FunkVm* vm, FunkObject* object) {
+	// The string table is weak, so the strings have to be dropped from it before they are freed
+	if (object->type == FUNK_OBJECT_STRING) {
+		funk_table_delete(&vm->strings, (FunkString*) object);
 	}
 
-	return r;
+	size_t bytesAllocated = vm->bytesAllocated;
+	funk_free_object(vm, object);
+
+	vm->bytesFreed += bytesAllocated - vm->bytesAllocated;
 }
 
-static uint16_t calculate_number_of_places_after_dot(double n) {
-	uint16_t places = 0;
+static void sweep_in_parallel(FunkVm* vm) {
+	FunkParallelSweep sweep;
+	sweep.vm = vm;
 
-	while (true) {
-		n *= 10;
+	for (uint8_t i = 0; i < FUNK_HEAP_SEGMENTS; i++) {
+		sweep.unreached[i] = NULL;
+	}
 
-		if ((int) fmod(n, 10) == 0 && (int) fmod(n * 10, 10) == 0) {
-			return places;
-		}
+	funk_run_on_workers(get_gc_pool(vm), run_sweeper, (void*) &sweep, FUNK_HEAP_SEGMENTS);
 
-		places++;
+	for (uint8_t i = 0; i < FUNK_HEAP_SEGMENTS; i++) {
+		FunkObject* object = sweep.unreached[i];
 
-		if (places >= 5) {
-			return places;
+		while (object != NULL) {
+			FunkObject* next = object->next;
+			free_unreached(vm, object);
+			object = next;
 		}
 	}
 }
 
-double funk_to_number(FunkVm* vm, FunkFunction* function) {
-	if (function == NULL) {
-		return 0;
+// Sweeps up to budget old objects, returns true once every segment was swept
+static bool sweep(FunkVm* vm, uint32_t budget) {
+	if (budget == UINT32_MAX && vm->gcThreads != 1 && vm->sweepSegment == 0 && vm->sweepCursor == &vm->objects[0]) {
+		sweep_in_parallel(vm);
+		return true;
 	}
 
-	if (funk_function_has_code(function)) {
-		function = funk_run_function(vm, function, 0);
+	while (vm->sweepSegment < FUNK_HEAP_SEGMENTS) {
+		while (*vm->sweepCursor != NULL) {
+			if (budget-- == 0) {
+				return false;
+			}
+
+			FunkObject* object = *vm->sweepCursor;
+
+			if (object->marked) {
+				object->marked = false;
+				vm->sweepCursor = &object->next;
+			} else {
+				*vm->sweepCursor = object->next;
+				free_unreached(vm, object);
+			}
+		}
+
+		if (++vm->sweepSegment < FUNK_HEAP_SEGMENTS) {
+			vm->sweepCursor = &vm->objects[vm->sweepSegment];
+		}
 	}
 
-	const char* string = function->name->chars;
-	uint16_t length = function->name->length;
-	bool negative = false;
+	return true;
+}
 
-	if (string[0] == '-') {
-		negative = true;
-		string++;
-		length--;
+// Frees the young objects, that were not reached, and moves the rest to the old list.
+// A major collection keeps the marks, so that its sweep of the old list does not free them
+static void sweep_nursery(FunkVm* vm, bool keepMarks) {
+	FunkObject* object = vm->youngObjects;
+
+	while (object != NULL) {
+		FunkObject* next = object->next;
+
+		if (object->marked) {
+			object->marked = keepMarks;
+			object->young = false;
+
+			// Spread evenly, so that the segments take about the same time to sweep
+			object->next = vm->objects[vm->promotionSegment];
+			vm->objects[vm->promotionSegment] = object;
+			vm->promotionSegment = (uint8_t) ((vm->promotionSegment + 1) % FUNK_HEAP_SEGMENTS);
+		} else {
+			free_unreached(vm, object);
+		}
+
+		object = next;
 	}
 
-	const char* dot = strchr(string, '.');
-	double value = 0;
+	vm->youngObjects = NULL;
+	vm->nurseryBytes = 0;
+}
 
-	if (dot != NULL) {
-		length = dot - string;
-		uint32_t afterDot = parse_roman_numeral(dot + 1, function->name->length - length - 1);
+static uint64_t get_nanoseconds() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
 
-		value += (double) afterDot / (pow(10, calculate_number_of_places(afterDot)));
+	return (uint64_t) time.tv_sec * 1000000000u + (uint64_t) time.tv_nsec;
+}
+
+static void record_pause(FunkVm* vm, uint64_t start) {
+	uint64_t pause = get_nanoseconds() - start;
+	uint64_t microseconds = pause / 1000;
+	uint8_t bucket = 0;
+
+	while (bucket < FUNK_PAUSE_BUCKETS - 1 && microseconds >= ((uint64_t) 1 << bucket)) {
+		bucket++;
 	}
 
-	return (value + parse_roman_numeral(string, length)) * (negative ? -1 : 1);
+	vm->pauses.counts[bucket]++;
+	vm->pauses.totalNanoseconds += pause;
+	vm->pauses.lastNanoseconds = pause;
+
+	if (pause > vm->pauses.maxNanoseconds) {
+		vm->pauses.maxNanoseconds = pause;
+	}
 }
 
-static FunkString* roman_to_string(FunkVm* vm, uint32_t value) {
-	uint32_t number = value;
-	uint16_t index = 0;
+static void start_collection(FunkVm* vm) {
+	vm->collections++;
+	vm->markEpoch++;
+	vm->gcPhase = FUNK_GC_MARKING;
 
-	char buffer[255];
+	mark_roots(vm);
+}
 
-	while (number != 0) {
-		if (number >= 1000) {
-			buffer[index++] = 'M';
-			number -= 1000;
-		} else if (number >= 900) {
-			memcpy((void*) (buffer + index), "CM", 2);
+// The roots are not behind write barriers, so they are marked once more, before the sweep starts
+static void finish_marking(FunkVm* vm) {
+	mark_roots(vm);
+	trace_grey(vm, UINT32_MAX);
 
-			index += 2;
-			number -= 900;
-		} else if (number >= 500) {
-			buffer[index++] = 'D';
-			number -= 500;
-		} else if (number >= 400) {
-			memcpy((void*) (buffer + index), "CD", 2);
+	mark_remembered(vm);
+	sweep_nursery(vm, true);
 
-			index += 2;
-			number -= 400;
-		} else if (number >= 100) {
-			buffer[index++] = 'C';
-			number -= 100;
-		} else if (number >= 90) {memcpy((void*) (buffer + index), "XC", 2);
+	vm->gcPhase = FUNK_GC_SWEEPING;
+	vm->sweepSegment = 0;
+	vm->sweepCursor = &vm->objects[0];
+}
 
-			index += 2;
-			number -= 90;
-		} else if (number >= 50) {
-			buffer[index++] = 'L';
-			number -= 50;
-		} else if (number >= 40) {memcpy((void*) (buffer + index), "XL", 2);
+static void finish_sweeping(FunkVm* vm) {
+	vm->gcPhase = FUNK_GC_IDLE;
+	vm->sweepCursor = NULL;
 
-			index += 2;
-			number -= 40;
-		} else if (number >= 10) {
-			buffer[index++] = 'X';
-			number -= 10;
-		} else if (number >= 9) {memcpy((void*) (buffer + index), "IX", 2);
+	if (vm->heapGrowth > 0) {
+		size_t next = (size_t) ((double) vm->bytesAllocated * vm->heapGrowth);
+		vm->nextCollection = next < vm->minHeap ? vm->minHeap : next;
+	}
+}
 
-			index += 2;
-			number -= 9;
-		} else if (number >= 5) {
-			buffer[index++] = 'V';
-			number -= 5;
-		} else if (number >= 4) {memcpy((void*) (buffer + index), "IV", 2);
+static void run_collection_step(FunkVm* vm, uint32_t budget) {
+	if (vm->gcPhase == FUNK_GC_IDLE) {
+		start_collection(vm);
+	}
 
-			index += 2;
-			number -= 4;
-		} else {
-			buffer[index++] = 'I';
-			number -= 1;
+	if (vm->gcPhase == FUNK_GC_MARKING) {
+		if (!trace_grey(vm, budget)) {
+			return;
 		}
+
+		finish_marking(vm);
 	}
 
-	return funk_create_string(vm, buffer, index);
+	if (sweep(vm, budget)) {
+		finish_sweeping(vm);
+	}
 }
 
-FunkFunction* funk_number_to_string(FunkVm* vm, double number) {
-	bool negative = number < 0;
-	number = fabs(number);
-
-	uint32_t whole = floor(number);
-	double fraction = number - whole;
-	FunkString* fractionString = fraction > 0 ? roman_to_string(vm, (uint32_t) (fraction * pow(10, calculate_number_of_places_after_dot(fraction)))) : NULL;
+void funk_step_garbage(FunkVm* vm) {
+	uint64_t start = get_nanoseconds();
+	run_collection_step(vm, vm->gcStep > 0 ? vm->gcStep : UINT32_MAX);
+	record_pause(vm, start);
+}
 
-	FunkString* digitsString = roman_to_string(vm, whole);
-	uint16_t length = digitsString->length + (uint16_t) negative;
+void funk_collect_garbage(FunkVm* vm) {
+	uint64_t start = get_nanoseconds();
 
-	if (fractionString != NULL) {
-		length += fractionString->length + 1;
+	// A collection in progress has marked only the objects, that were alive, when it started
+	if (vm->gcPhase != FUNK_GC_IDLE) {
+		run_collection_step(vm, UINT32_MAX);
 	}
 
-	char buffer[length + 1];
-	uint16_t index = 0;
+	run_collection_step(vm, UINT32_MAX);
+	record_pause(vm, start);
+}
 
-	if (negative) {
-		buffer[0] = '-';
-		index++;
+void funk_collect_nursery(FunkVm* vm) {
+	// Children have no remembered set, so they always collect the whole heap
+	if (vm->parent != NULL) {
+		funk_collect_garbage(vm);
+		return;
 	}
 
-	memcpy((void*) (buffer + index), digitsString->chars, digitsString->length);
-	index += digitsString->length;
-
-	if (fractionString != NULL) {
-		buffer[index++] = '.';
-		memcpy((void*) (buffer + index), fractionString->chars, fractionString->length);
+	if (vm->gcPhase != FUNK_GC_IDLE) {
+		return;
 	}
 
-	buffer[length] = '\0';
-	return (FunkFunction*) funk_create_empty_function(vm, buffer);
+	uint64_t start = get_nanoseconds();
+
+	vm->collections++;
+	vm->nurseryCollections++;
+	vm->markEpoch++;
+	vm->collectingNursery = true;
+
+	mark_roots(vm);
+	mark_remembered(vm);
+	trace_grey(vm, UINT32_MAX);
+
+	vm->collectingNursery = false;
+	sweep_nursery(vm, false);
+
+	record_pause(vm, start);
 }
 
-static void mark(FunkObject* object) {
-	if (object == NULL || object->marked) {
-		return;
+void funk_set_nursery_size(FunkVm* vm, size_t size) {
+	vm->nurserySize = size > 0 ? size : SIZE_MAX;
+}
+
+void funk_set_gc_step(FunkVm* vm, uint32_t step) {
+	vm->gcStep = step;
+}
+
+void funk_set_gc_threads(FunkVm* vm, uint16_t threadCount) {
+	if (vm->gcPool != NULL && threadCount != vm->gcThreads) {
+		funk_free_worker_pool(vm->gcPool);
+		vm->gcPool = NULL;
 	}
 
-	object->marked = true;
+	vm->gcThreads = threadCount;
+}
 
+static size_t get_object_size(FunkObject* object) {
 	switch (object->type) {
 		case FUNK_OBJECT_BASIC_FUNCTION: {
 			FunkBasicFunction* function = (FunkBasicFunction*) object;
-			mark((FunkObject *) function->parent.name);
 
-			for (uint16_t i = 0; i < function->constantsLength; i++) {
-				mark((FunkObject *) function->constants[i]);
+			if (function->prototype != NULL) {
+				return sizeof(FunkBasicFunction) + sizeof(FunkFunction*) * function->upvalueCount;
 			}
 
-			for (uint16_t i = 0; i < function->argumentCount; i++) {
-				mark((FunkObject *) function->argumentNames[i]);
-			}
+			return sizeof(FunkBasicFunction) + function->codeAllocated + sizeof(FunkObject*) * function->constantsAllocated
+				+ sizeof(FunkString*) * (function->argumentCount + function->localCount) + sizeof(uint16_t) * function->upvalueCount;
+		}
 
-			break;
+		case FUNK_OBJECT_NATIVE_FUNCTION: return sizeof(FunkNativeFunction);
+		case FUNK_OBJECT_STRING: return sizeof(FunkString) + ((FunkString*) object)->length + 1;
+		default: UNREACHABLE;
+	}
+
+	return 0;
+}
+
+static void count_native_kind(FunkHeapStats* stats, FunkNativeFunction* function) {
+	// Names are interned, so the same kind always has the same characters
+	const char* name = function->parent.name->chars;
+
+	for (uint16_t i = 0; i < stats->nativeKindCount; i++) {
+		if (stats->nativeKinds[i].name == name) {
+			stats->nativeKinds[i].count++;
+			return;
 		}
+	}
 
-		case FUNK_OBJECT_NATIVE_FUNCTION: {
-			FunkNativeFunction* function = (FunkNativeFunction*) object;
-			mark((FunkObject *) function->parent.name);
+	if (stats->nativeKindCount < FUNK_HEAP_STATS_KINDS) {
+		stats->nativeKinds[stats->nativeKindCount++] = (FunkNativeKindStats) { name, 1 };
+	}
+}
 
-			break;
+static void count_objects(FunkHeapStats* stats, FunkObject* object) {
+	for (; object != NULL; object = object->next) {
+		size_t size = get_object_size(object);
+
+		stats->objects[object->type]++;
+		stats->objectBytes[object->type] += size;
+
+		if (object->young) {
+			stats->youngObjects++;
 		}
 
-		case FUNK_OBJECT_STRING: {
-			break;
+		if (object->type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) object)->data != NULL) {
+			count_native_kind(stats, (FunkNativeFunction*) object);
 		}
+	}
+}
 
-		default: UNREACHABLE;
+void funk_get_heap_stats(FunkVm* vm, FunkHeapStats* stats) {
+	memset((void*) stats, 0, sizeof(FunkHeapStats));
+
+	stats->liveBytes = vm->bytesAllocated;
+	stats->allocatedBytes = vm->bytesAllocated - vm->slabUsed + vm->slabBytes;
+	stats->freedBytes = vm->bytesFreed;
+
+	for (uint8_t i = 0; i < FUNK_HEAP_SEGMENTS; i++) {
+		count_objects(stats, vm->objects[i]);
 	}
+
+	count_objects(stats, vm->youngObjects);
+
+	stats->internedStrings = (uint32_t) vm->strings.count;
+	stats->internTableCapacity = (uint32_t) (vm->strings.capacity + 1);
+
+	stats->collections = vm->collections;
+	stats->nurseryCollections = vm->nurseryCollections;
+	stats->lastPauseNanoseconds = vm->pauses.lastNanoseconds;
+	stats->totalPauseNanoseconds = vm->pauses.totalNanoseconds;
 }
 
-static void mark_table(FunkTable* table) {
-	for (int i = 0; i <= table->capacity; i++) {
-		FunkTableEntry* entry = &table->entries[i];
+static void dump_object(FunkVm* vm, FunkHeapDump* dump, FunkObject* object) {
+	static const char* typeNames[] = { "function", "native", "string" };
+	const char* name = object->type == FUNK_OBJECT_STRING ? ((FunkString*) object)->chars : ((FunkFunction*) object)->name->chars;
 
-		if (entry->key != NULL) {
-			mark((FunkObject *) entry->key);
-			mark(entry->value);
+	fprintf(dump->file, "\t\"%p\" [label=\"%s ", (void*) object, typeNames[object->type]);
+
+	// Long strings are cut, they would only make the graph unreadable
+	for (uint16_t i = 0; name[i] != '\0' && i < 32; i++) {
+		if (name[i] == '"' || name[i] == '\\') {
+			fputc('\\', dump->file);
 		}
+
+		fputc(name[i] == '\n' ? ' ' : name[i], dump->file);
 	}
+
+	fprintf(dump->file, "\"%s];\n", object->young ? ", style=dashed" : "");
+
+	// Every object gets its own epoch, so that shared nodes are listed under each of their owners
+	dump->source = object;
+	vm->markEpoch++;
+
+	trace_references(vm, object);
 }
 
-static void mark_roots(FunkVm* vm) {
-	mark_table(&vm->globals);
-	mark_table(&vm->modules);
-	mark_table(&vm->strings);
+void funk_dump_heap(FunkVm* vm, FILE* file) {
+	FunkHeapDump dump = { file, NULL };
+	vm->heapDump = &dump;
 
-	FunkCallFrame* frame = vm->callFrame;
+	fprintf(file, "digraph heap {\n\troots [shape=box];\n");
+	mark_roots(vm);
 
-	while (frame != NULL) {
-		mark_table(&frame->variables);
-		mark((FunkObject *) frame->function);
+	for (uint8_t i = 0; i < FUNK_HEAP_SEGMENTS; i++) {
+		for (FunkObject* object = vm->objects[i]; object != NULL; object = object->next) {
+			dump_object(vm, &dump, object);
+		}
+	}
 
-		frame = frame->previous;
+	for (FunkObject* object = vm->youngObjects; object != NULL; object = object->next) {
+		dump_object(vm, &dump, object);
+	}
+
+	fprintf(file, "}\n");
+	vm->heapDump = NULL;
+}
+
+bool funk_claim_node(FunkVm* vm, uint32_t* markedIn) {
+	// Parallel markers can reach the same node at once
+	return __atomic_exchange_n(markedIn, vm->markEpoch, __ATOMIC_RELAXED) != vm->markEpoch;
+}
+
+void funk_get_pause_histogram(FunkVm* vm, FunkPauseHistogram* histogram) {
+	*histogram = vm->pauses;
+}
+
+void funk_reset_pause_histogram(FunkVm* vm) {
+	memset((void*) &vm->pauses, 0, sizeof(FunkPauseHistogram));
+}
+
+static void remember_object(FunkVm* vm, FunkObject* object) {
+	if (vm->rememberedCount + 1 > vm->rememberedAllocated) {
+		uint32_t allocated = FUNK_GROW_CAPACITY(vm->rememberedAllocated);
+
+		vm->remembered = FUNK_GROW_ARRAY(vm, FunkObject*, vm->remembered, vm->rememberedAllocated, allocated);
+		vm->rememberedAllocated = allocated;
+	}
+
+	object->remembered = true;
+	vm->remembered[vm->rememberedCount++] = object;
+}
+
+void funk_write_barrier(FunkVm* vm, FunkFunction* container, FunkObject* value) {
+	FunkObject* object = &container->object;
+
+	if (value == NULL || vm->parent != NULL) {
+		return;
+	}
+
+	// The container might be traced already, so the value is shaded, to keep a traced object from pointing to an unmarked one
+	if (vm->gcPhase == FUNK_GC_MARKING) {
+		funk_mark_object(vm, value);
 	}
 
-	for (FunkFunction** object = vm->stack; object < vm->stackTop; object++) {
-		mark((FunkObject *) *object);
+	if (!value->young || object->young || object->remembered) {
+		return;
 	}
+
+	remember_object(vm, object);
 }
 
-static void sweep(FunkVm* vm) {
-	FunkObject* previous = NULL;
-	FunkObject* object = vm->objects;
+void funk_write_barrier_all(FunkVm* vm, FunkFunction* container) {
+	FunkObject* object = &container->object;
 
-	while (object != NULL) {
-		if (object->marked) {
-			previous = object;
-			object = object->next;
-		} else {
-			FunkObject *unreached = object;
-			object = object->next;
+	if (vm->parent != NULL) {
+		return;
+	}
 
-			if (previous != NULL) {
-				previous->next = object;
-			} else {
-				vm->objects = object;
-			}
+	// Tracing it again shades everything, that it holds now
+	if (vm->gcPhase == FUNK_GC_MARKING && object->marked) {
+		trace_references(vm, object);
+	}
 
-			funk_free_object(vm, unreached);
-		}
+	if (object->young || object->remembered) {
+		return;
 	}
+
+	remember_object(vm, object);
 }
 
-void funk_collect_garbage(FunkVm* vm) {
-	mark_roots(vm);
-	sweep(vm);
+void funk_set_gc_trigger(FunkVm* vm, size_t minHeap, double heapGrowth) {
+	vm->minHeap = minHeap;
+	vm->heapGrowth = heapGrowth;
+	vm->nextCollection = heapGrowth > 0 ? minHeap : SIZE_MAX;
+}
+
+void funk_push_root(FunkVm* vm, FunkFunction* value) {
+	*vm->stackTop++ = value;
+}
+
+void funk_pop_roots(FunkVm* vm, uint8_t count) {
+	vm->stackTop -= count;
 }
\ No newline at end of file
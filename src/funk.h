@@ -7,6 +7,7 @@
 #include <assert.h>
 #include <string.h>
 #include <setjmp.h>
+#include <stdio.h>
 
 #define UNREACHABLE assert(false);
 #define FUNK_GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity) * 2)
@@ -48,7 +49,8 @@ FunkToken funk_scan_token(FunkScanner* scanner);
 typedef enum {
 	FUNK_OBJECT_BASIC_FUNCTION,
 	FUNK_OBJECT_NATIVE_FUNCTION,
-	FUNK_OBJECT_STRING
+	FUNK_OBJECT_STRING,
+	FUNK_OBJECT_TYPE_COUNT
 } FunkObjectType;
 
 typedef struct FunkObject {
@@ -56,6 +58,12 @@ typedef struct FunkObject {
 	struct FunkObject* next;
 
 	bool marked;
+	// Young objects live in the nursery until they survive a collection
+	bool young;
+	// Set for old objects, that are in the remembered set of the vm
+	bool remembered;
+	// The level of the vm, that allocated it, a collection never marks the objects of the parents
+	uint8_t level;
 } FunkObject;
 
 void funk_free_object(sFunkVm* vm, FunkObject* object);
@@ -86,7 +94,25 @@ typedef enum {
 	FUNK_INSTRUCTION_DEFINE,
 	FUNK_INSTRUCTION_DEFINE_GLOBAL,
 	FUNK_INSTRUCTION_PUSH_NULL,
-	FUNK_INSTRUCTION_PUSH_CONSTANT
+	FUNK_INSTRUCTION_PUSH_CONSTANT,
+	FUNK_INSTRUCTION_GET_LOCAL,
+	FUNK_INSTRUCTION_GET_UPVALUE,
+	FUNK_INSTRUCTION_GET_LEXICAL,
+	FUNK_INSTRUCTION_GET_LEXICAL_STRING,
+	FUNK_INSTRUCTION_DEFINE_LOCAL,
+	FUNK_INSTRUCTION_CLOSURE,
+	FUNK_INSTRUCTION_JUMP,
+	FUNK_INSTRUCTION_LOOP,
+	FUNK_INSTRUCTION_JUMP_IF_FALSE,
+	FUNK_INSTRUCTION_JUMP_IF_REDEFINED,
+	FUNK_INSTRUCTION_SET,
+	FUNK_INSTRUCTION_SET_LOCAL,
+	FUNK_INSTRUCTION_FOR_PREPARE,
+	FUNK_INSTRUCTION_FOR_NEXT,
+	FUNK_INSTRUCTION_FOR_STEP,
+	FUNK_INSTRUCTION_PUSH_SCOPE,
+	FUNK_INSTRUCTION_POP_SCOPE,
+	FUNK_INSTRUCTION_COUNT
 } FunkInstruction;
 
 // Uncomment for execution debug
@@ -102,7 +128,24 @@ static const char* funkInstructionNames[] = {
 	"FUNK_INSTRUCTION_DEFINE",
 	"FUNK_INSTRUCTION_DEFINE_GLOBAL",
 	"FUNK_INSTRUCTION_PUSH_NULL",
-	"FUNK_INSTRUCTION_PUSH_CONSTANT"
+	"FUNK_INSTRUCTION_PUSH_CONSTANT",
+	"FUNK_INSTRUCTION_GET_LOCAL",
+	"FUNK_INSTRUCTION_GET_UPVALUE",
+	"FUNK_INSTRUCTION_GET_LEXICAL",
+	"FUNK_INSTRUCTION_GET_LEXICAL_STRING",
+	"FUNK_INSTRUCTION_DEFINE_LOCAL",
+	"FUNK_INSTRUCTION_CLOSURE",
+	"FUNK_INSTRUCTION_JUMP",
+	"FUNK_INSTRUCTION_LOOP",
+	"FUNK_INSTRUCTION_JUMP_IF_FALSE",
+	"FUNK_INSTRUCTION_JUMP_IF_REDEFINED",
+	"FUNK_INSTRUCTION_SET",
+	"FUNK_INSTRUCTION_SET_LOCAL",
+	"FUNK_INSTRUCTION_FOR_PREPARE",
+	"FUNK_INSTRUCTION_FOR_NEXT",
+	"FUNK_INSTRUCTION_FOR_STEP",
+	"FUNK_INSTRUCTION_PUSH_SCOPE",
+	"FUNK_INSTRUCTION_POP_SCOPE"
 };
 #endif
 
@@ -113,12 +156,33 @@ typedef struct FunkBasicFunction {
 	uint8_t argumentCount;
 
 	uint8_t* code;
-	uint16_t codeAllocated;
-	uint16_t codeLength;
+	uint32_t codeAllocated;
+	uint32_t codeLength;
 
 	FunkObject** constants;
 	uint16_t constantsAllocated;
 	uint16_t constantsLength;
+
+	// Lexically scoped functions keep their arguments and inner functions in stack slots, the arguments come first
+	bool lexical;
+	FunkString** localNames;
+	uint8_t localCount;
+	// The high byte is set, if the upvalue is a slot of the enclosing function, otherwise it is one of its upvalues
+	uint16_t* upvalueSources;
+	uint8_t upvalueCount;
+	// How deep the lambdas, that the compiler inlined, are nested, every one of them runs in a frame of its own
+	uint8_t inlineDepth;
+
+	// Closures share everything but the captured values with their prototype
+	struct FunkBasicFunction* prototype;
+	FunkFunction** upvalues;
+	// The variables of the function, that created the closure
+	FunkFunction* scope;
+
+	// Functions are compiled to machine code, once they were called jitThreshold times, closures count on their prototype
+	uint32_t calls;
+	void* jitCode;
+	uint32_t jitSize;
 } FunkBasicFunction;
 
 FunkBasicFunction* funk_create_basic_function(sFunkVm* vm, FunkString* name);
@@ -129,16 +193,29 @@ uint16_t funk_add_constant(sFunkVm* vm, FunkBasicFunction* function, FunkObject*
 typedef struct sFunkNativeFunction sFunkNativeFunction;
 typedef FunkFunction* (*FunkNativeFn)(sFunkVm*, void*, FunkFunction**, uint8_t);
 typedef void (*FunkDataCleanupFn)(sFunkVm*, sFunkNativeFunction* function);
+// Marks every object, that the native data holds, with funk_mark_object()
+typedef void (*FunkDataTraceFn)(sFunkVm*, sFunkNativeFunction* function);
 
 typedef struct sFunkNativeFunction {
 	FunkFunction parent;
 	FunkNativeFn fn;
 	FunkDataCleanupFn cleanupFn;
+	FunkDataTraceFn traceFn;
 	void* data;
 } FunkNativeFunction;
 
 FunkNativeFunction* funk_create_native_function(sFunkVm* vm, FunkString* name, FunkNativeFn fn);
 
+typedef struct FunkLexicalScope {
+	FunkBasicFunction* function;
+	FunkString* locals[UINT8_MAX];
+	// The names of inlined bodies keep their slots, but they are out of scope after the body
+	bool hidden[UINT8_MAX];
+	uint16_t upvalues[UINT8_MAX];
+
+	struct FunkLexicalScope* enclosing;
+} FunkLexicalScope;
+
 typedef struct FunkCompiler {
 	FunkScanner* scanner;
 	sFunkVm* vm;
@@ -146,8 +223,18 @@ typedef struct FunkCompiler {
 	FunkToken previous;
 	FunkToken current;
 	FunkBasicFunction* function;
+
+	// Set for the files, that start with FUNK_LEXICAL_PRAGMA, or when the vm asks for it
+	bool lexical;
+	FunkLexicalScope* scope;
+
+	// Calls to the intrinsics are compiled to jumps, with the bodies of their lambdas inlined
+	bool lowerIntrinsics;
+	struct FunkInlineBody* inlineBody;
 } FunkCompiler;
 
+#define FUNK_LEXICAL_PRAGMA "// lexical"
+
 FunkFunction* funk_compile_string(sFunkVm* vm, const char* name, const char* string);
 
 #define TABLE_MAX_LOAD 0.75
@@ -159,6 +246,7 @@ typedef struct {
 
 typedef struct FunkTable {
 	int count;
+	int tombstones;
 	int capacity;
 
 	FunkTableEntry* entries;
@@ -175,35 +263,265 @@ typedef void* (*FunkAllocFn)(size_t);
 typedef void (*FunkFreeFn)(void*);
 typedef void (*FunkErrorFn)(sFunkVm*, const char*);
 
+// Pointer is NULL for new allocations, so that an allocator can grow buffers in place
+typedef void* (*FunkReallocateFn)(void* userData, void* pointer, size_t oldSize, size_t newSize);
+typedef void (*FunkSizedFreeFn)(void* userData, void* pointer, size_t size);
+
+typedef struct FunkAllocator {
+	FunkReallocateFn reallocateFn;
+	FunkSizedFreeFn freeFn;
+	void* userData;
+} FunkAllocator;
+
+// Gets the output of the print functions a buffer at a time, the workers of a vm call it from their own threads
+typedef void (*FunkOutputFn)(void* userData, const char* data, size_t length);
+
+typedef enum {
+	// Every line goes out at once, the default, when stdout is a terminal
+	FUNK_FLUSH_LINES,
+	// Only a full buffer goes out, the default otherwise
+	FUNK_FLUSH_FULL
+} FunkFlushMode;
+
+#define FUNK_OUTPUT_BUFFER_SIZE 8192
+
+// The natives, that the compiler turns into jumps, as long as their names aren't given to anything else
+typedef enum {
+	FUNK_INTRINSIC_IF,
+	FUNK_INTRINSIC_WHILE,
+	FUNK_INTRINSIC_FOR,
+	FUNK_INTRINSIC_COUNT
+} FunkIntrinsic;
+
+typedef struct FunkSnapshotWriter FunkSnapshotWriter;
+typedef struct FunkSnapshotReader FunkSnapshotReader;
+// Save and restore the data of a native in a snapshot, see funk_snapshot.h
+typedef void (*FunkSnapshotSaveFn)(sFunkVm*, sFunkNativeFunction* function, FunkSnapshotWriter* writer);
+typedef void (*FunkSnapshotLoadFn)(sFunkVm*, sFunkNativeFunction* function, FunkSnapshotReader* reader);
+
+typedef struct FunkSnapshotType {
+	const char* name;
+	FunkDataCleanupFn cleanupFn;
+	FunkSnapshotSaveFn saveFn;
+	FunkSnapshotLoadFn loadFn;
+} FunkSnapshotType;
+
+#define FUNK_SNAPSHOT_TYPES 16
+
+typedef struct FunkStackSegment {
+	FunkFunction** base;
+	FunkFunction** top;
+	struct FunkStackSegment* previous;
+} FunkStackSegment;
+
 typedef struct FunkCallFrame {
 	FunkBasicFunction* function;
-	FunkTable variables;
+	// Points to ownVariables, until a closure captures them into the scope
+	FunkTable* variables;
+	FunkTable ownVariables;
+	FunkFunction* scope;
+	FunkFunction** slots;
 
 	struct FunkCallFrame* previous;
+	// The frame of the function, that an inlined lambda runs in, NULL for the frames of calls
+	struct FunkCallFrame* enclosing;
 } FunkCallFrame;
 
-#define FUNK_STACK_SIZE 256
+// The frame of an inlined lambda, an error in it only ends the lambda, like it would end its call
+typedef struct FunkInlineFrame {
+	FunkCallFrame frame;
+	FunkCallFrame* errorFrame;
+	// Where the stack is reset to, once the lambda is done, its arguments are already below
+	FunkFunction** stackTop;
+	// The offset of the code after the lambda
+	uint32_t exit;
+} FunkInlineFrame;
+
+// A call fails, once it would leave less than FUNK_STACK_RESERVE slots, enough for the arguments of one more call
+#define FUNK_STACK_SIZE 8192
+#define FUNK_STACK_RESERVE 256
+
+// Objects up to FUNK_SLAB_MAX_SIZE bytes are carved from pages, one free list per size class of FUNK_SLAB_CLASS_SIZE bytes
+#define FUNK_SLAB_CLASS_SIZE 16
+#define FUNK_SLAB_CLASSES 16
+#define FUNK_SLAB_MAX_SIZE (FUNK_SLAB_CLASS_SIZE * FUNK_SLAB_CLASSES)
+#define FUNK_SLAB_PAGE_SIZE (16 * 1024)
+
+typedef struct FunkSlabPage {
+	struct FunkSlabPage* next;
+} FunkSlabPage;
+
+#define FUNK_HEAP_SEGMENTS 16
+
+typedef struct FunkSlabSlot {
+	struct FunkSlabSlot* next;
+} FunkSlabSlot;
+
+typedef enum {
+	FUNK_GC_IDLE,
+	FUNK_GC_MARKING,
+	FUNK_GC_SWEEPING
+} FunkGcPhase;
+
+// Bucket i counts the pauses shorter than 2^i microseconds, the last one counts the rest
+#define FUNK_PAUSE_BUCKETS 16
+
+typedef struct FunkPauseHistogram {
+	uint64_t counts[FUNK_PAUSE_BUCKETS];
+	uint64_t totalNanoseconds;
+	uint64_t maxNanoseconds;
+	uint64_t lastNanoseconds;
+} FunkPauseHistogram;
 
 typedef struct sFunkVm {
+	// Only set for the vms, created with funk_create_vm()
 	FunkAllocFn allocFn;
 	FunkFreeFn freeFn;
+
+	FunkAllocator allocator;
 	FunkErrorFn errorFn;
 
 	FunkTable strings;
 	FunkTable globals;
 	FunkTable modules;
 
-	FunkObject* objects;
+	// Objects, that survived a collection, are spread over the segments, so that they can be swept in parallel.
+	// The nursery only holds the objects, allocated since the last collection
+	FunkObject* objects[FUNK_HEAP_SEGMENTS];
+	FunkObject* youngObjects;
+	uint8_t promotionSegment;
+
+	// The pages are only given back to the allocator, once the vm is freed, clearing it keeps them for reuse
+	FunkSlabPage* slabPages;
+	FunkSlabPage* spareSlabPages;
+	FunkSlabSlot* slabFree[FUNK_SLAB_CLASSES];
+	char* slabNext[FUNK_SLAB_CLASSES];
+	char* slabEnd[FUNK_SLAB_CLASSES];
+	size_t slabBytes;
+	size_t slabUsed;
+
+	// The collection runs at the next call, once the allocated bytes pass nextCollection
+	size_t bytesAllocated;
+	size_t nextCollection;
+	size_t minHeap;
+	double heapGrowth;
+	uint32_t collections;
+	uint32_t nurseryCollections;
+	size_t bytesFreed;
+
+	// Changes with every marking, so that funk_claim_node() can tell, which nodes were visited already
+	uint32_t markEpoch;
+
+	// The nursery is collected, once nurseryBytes have been allocated since the last collection
+	size_t nurseryBytes;
+	size_t nurserySize;
+	bool collectingNursery;
+
+	// Old objects, that were given references to young ones, these are roots for the nursery collections
+	FunkObject** remembered;
+	uint32_t rememberedCount;
+	uint32_t rememberedAllocated;
+
+	// Marked objects, whose references were not traced yet
+	FunkObject** grey;
+	uint32_t greyCount;
+	uint32_t greyAllocated;
+
+	// A major collection runs in steps of gcStep objects, spread over the next calls
+	FunkGcPhase gcPhase;
+	uint32_t gcStep;
+	uint8_t sweepSegment;
+	FunkObject** sweepCursor;
+	FunkPauseHistogram pauses;
+
+	// Collections, that run at once, mark and sweep on gcThreads threads of the gcPool
+	uint16_t gcThreads;
+	struct FunkWorkerPool* gcPool;
+
+	// While the heap is dumped, marking an object writes a reference instead
+	struct FunkHeapDump* heapDump;
+
+	// Compiles every file in the lexical scoping mode, not only the ones with the pragma
+	bool lexicalScoping;
+
+	// Zero turns the jit off
+	uint32_t jitThreshold;
+
+	// The print functions copy into the buffer, the output function only gets it, once it's flushed
+	FunkOutputFn outputFn;
+	void* outputUserData;
+	FunkFlushMode flushMode;
+	uint32_t outputLength;
+	char output[FUNK_OUTPUT_BUFFER_SIZE];
+
+	FunkNativeFn intrinsicFns[FUNK_INTRINSIC_COUNT];
+	FunkString* intrinsicNames[FUNK_INTRINSIC_COUNT];
+
+	// The natives with data, that snapshots can hold, told apart by their cleanup function
+	FunkSnapshotType snapshotTypes[FUNK_SNAPSHOT_TYPES];
+	uint8_t snapshotTypeCount;
 
 	FunkFunction* stack[FUNK_STACK_SIZE];
 	FunkFunction** stackTop;
 	FunkCallFrame* callFrame;
 
+	// A running generator has a stack of its own, the stacks of the code, that resumed it, are kept below
+	FunkFunction** stackBase;
+	FunkStackSegment* resumerStacks;
+	struct FunkGenerator* generator;
+	// Calls, that would go below it on the C stack of the running generator, fail, NULL elsewhere
+	void* cStackLimit;
+	// The open handles of the event loop, NULL until the first one is created
+	FunkFunction* loop;
+
 	jmp_buf errorJumpBuffer;
+	// The frame at the setjmp() of the jump buffer, an error frees the variables of the frames above it
+	FunkCallFrame* errorFrame;
+
+	// Worker vms look up strings and globals in their parent, but never write to it
+	struct sFunkVm* parent;
+	// The number of parents
+	uint8_t level;
+	struct FunkWorkerPool* workerPool;
+
+	void* userData;
 } FunkVm;
 
 FunkVm* funk_create_vm(FunkAllocFn allocFn, FunkFreeFn freeFn, FunkErrorFn errorFn);
+// Allocator can be NULL, then the realloc() and free() from the C library are used
+FunkVm* funk_create_vm_ex(const FunkAllocator* allocator, FunkErrorFn errorFn);
 void funk_free_vm(FunkVm* vm);
+// Frees every object, string and global of the vm, leaving it empty
+void funk_clear_vm(FunkVm* vm);
+// Looks up strings and globals in the parent and runs its machine code, but never writes to it, so many of them
+// can run on other threads at once, while the parent doesn't. They collect only the garbage, that they allocated, all at once
+FunkVm* funk_create_child_vm(FunkVm* parent, FunkErrorFn errorFn);
+
+// A script, that is compiled once and then run by many vms at the same time, without copying its code
+typedef struct FunkProgram {
+	FunkVm* vm;
+	FunkFunction* main;
+} FunkProgram;
+
+// The program owns the vm from now on, its natives have to be defined already, and it must not run anything itself anymore.
+// Every function of the script is compiled to machine code right away, the instances can't do it. Returns NULL, if the script has errors
+FunkProgram* funk_create_program(FunkVm* vm, const char* name, const char* source);
+// Frees the vm of the program as well, none of its instances may be left
+void funk_free_program(FunkProgram* program);
+// A child vm of the program, the script runs in it with funk_run_program()
+FunkVm* funk_create_instance(FunkProgram* program, FunkErrorFn errorFn);
+FunkFunction* funk_run_program(FunkVm* instance, FunkProgram* program);
+
+void* funk_reallocate(FunkVm* vm, void* pointer, size_t oldSize, size_t newSize);
+void funk_deallocate(FunkVm* vm, void* pointer, size_t size);
+// Blocks larger, than FUNK_SLAB_MAX_SIZE, go straight to the allocator
+void* funk_allocate_slab(FunkVm* vm, size_t size);
+void funk_free_slab(FunkVm* vm, void* pointer, size_t size);
+
+#define FUNK_ALLOCATE(vm, type, count) ((type*) funk_reallocate(vm, NULL, 0, sizeof(type) * (count)))
+#define FUNK_FREE(vm, type, pointer) funk_deallocate(vm, (void*) (pointer), sizeof(type))
+#define FUNK_GROW_ARRAY(vm, type, pointer, oldCount, newCount) ((type*) funk_reallocate(vm, (void*) (pointer), sizeof(type) * (oldCount), sizeof(type) * (newCount)))
+#define FUNK_FREE_ARRAY(vm, type, pointer, count) funk_deallocate(vm, (void*) (pointer), sizeof(type) * (count))
 
 FunkFunction* funk_run_function(FunkVm* vm, FunkFunction* function, uint8_t argCount);
 FunkFunction* funk_run_string(FunkVm* vm, const char* name, const char* string);
@@ -221,19 +539,102 @@ FunkFunction* funk_run_file(FunkVm* vm, const char* file);
 #define FUNK_ENSURE_MIN_ARG_COUNT(count) if (argCount < (count)) { funk_error(vm, "Expected at least %i arguments", (count)); return NULL; }
 
 void funk_define_native(FunkVm* vm, const char* name, FunkNativeFn fn);
+// Defines the native, calls to it are compiled to jumps afterwards
+void funk_define_intrinsic(FunkVm* vm, FunkIntrinsic intrinsic, const char* name, FunkNativeFn fn);
 
 void funk_set_global(FunkVm* vm, const char* name, FunkFunction* function);
 FunkFunction* funk_get_global(FunkVm* vm, const char* name);
 void funk_set_variable(FunkVm* vm, const char* name, FunkFunction* function);
 FunkFunction* funk_get_variable(FunkVm* vm, const char* name);
+void funk_set_lexical_scoping(FunkVm* vm, bool enabled);
+// Functions are compiled to machine code after the given number of calls, zero keeps everything in the interpreter
+void funk_set_jit_threshold(FunkVm* vm, uint32_t calls);
+// NULL writes to stdout again. The output, that is still buffered, goes to the old function first
+void funk_set_output(FunkVm* vm, FunkOutputFn outputFn, void* userData);
+void funk_set_flush_mode(FunkVm* vm, FunkFlushMode mode);
+// Errors, clearing the vm and reading from stdin flush as well, so the output never lags behind them
+void funk_write_output(FunkVm* vm, const char* data, size_t length);
+void funk_flush_output(FunkVm* vm);
 
 void funk_error(FunkVm* vm, const char* message, ...);
 void funk_print_stack_trace(FunkVm* vm);
 bool funk_function_has_code(FunkFunction* function);
+// Closures of a worker are copied into its parent with the same captured values, that are still the worker's to replace
+bool funk_can_copy_closure(FunkVm* vm, FunkBasicFunction* closure);
+FunkBasicFunction* funk_copy_closure(FunkVm* vm, FunkBasicFunction* closure);
 bool funk_is_true(FunkVm* vm, FunkFunction* function);
 double funk_to_number(FunkVm* vm, FunkFunction* function);
 FunkFunction* funk_number_to_string(FunkVm* vm, double value);
 
+#define FUNK_DEFAULT_MIN_HEAP (1024 * 1024)
+#define FUNK_DEFAULT_HEAP_GROWTH 2.0
+#define FUNK_DEFAULT_NURSERY_SIZE (256 * 1024)
+#define FUNK_DEFAULT_GC_STEP 1024
+#define FUNK_DEFAULT_JIT_THRESHOLD 100
+
+// Finishes the collection in progress, if there is one, and then collects the whole heap at once
 void funk_collect_garbage(FunkVm* vm);
+// Only collects the objects, allocated since the last collection, and promotes the survivors. Waits while a major collection is in progress
+void funk_collect_nursery(FunkVm* vm);
+// Does the next step of the major collection, starting one, if none is in progress
+void funk_step_garbage(FunkVm* vm);
+// Objects, that are marked or swept in one step, 0 makes every major collection run at once
+void funk_set_gc_step(FunkVm* vm, uint32_t step);
+// Threads, that mark and sweep, when the whole heap is collected at once. 1 does it on the calling thread, 0 uses every cpu
+void funk_set_gc_threads(FunkVm* vm, uint16_t threadCount);
+// Every step and nursery collection is a pause
+void funk_get_pause_histogram(FunkVm* vm, FunkPauseHistogram* histogram);
+void funk_reset_pause_histogram(FunkVm* vm);
+
+// Natives with data are told apart by their name, like $arrayData or $mapData
+#define FUNK_HEAP_STATS_KINDS 32
+
+typedef struct FunkNativeKindStats {
+	const char* name;
+	uint32_t count;
+} FunkNativeKindStats;
+
+typedef struct FunkHeapStats {
+	// Bytes, that the vm uses, and bytes, that it holds from the allocator, including the unused parts of the slab pages
+	size_t liveBytes;
+	size_t allocatedBytes;
+	size_t freedBytes;
+
+	uint32_t objects[FUNK_OBJECT_TYPE_COUNT];
+	size_t objectBytes[FUNK_OBJECT_TYPE_COUNT];
+	uint32_t youngObjects;
+
+	FunkNativeKindStats nativeKinds[FUNK_HEAP_STATS_KINDS];
+	uint16_t nativeKindCount;
+
+	uint32_t internedStrings;
+	uint32_t internTableCapacity;
+
+	uint32_t collections;
+	uint32_t nurseryCollections;
+	uint64_t lastPauseNanoseconds;
+	uint64_t totalPauseNanoseconds;
+} FunkHeapStats;
+
+// Walks the whole heap, so it takes about as long, as a collection
+void funk_get_heap_stats(FunkVm* vm, FunkHeapStats* stats);
+// Writes every object and its references as a Graphviz digraph, the roots are references of the node "roots"
+void funk_dump_heap(FunkVm* vm, FILE* file);
+// Collects, once the heap reaches minHeap, and then every time it grows heapGrowth times. Growth of 0 disables automatic collection
+void funk_set_gc_trigger(FunkVm* vm, size_t minHeap, double heapGrowth);
+// Size of 0 disables the automatic nursery collections
+void funk_set_nursery_size(FunkVm* vm, size_t size);
+// Has to be called, when a reference to value is stored in the data of container
+void funk_write_barrier(FunkVm* vm, FunkFunction* container, FunkObject* value);
+// For containers, that changed in ways, the barrier didn't see, like a generator, that ran. They are traced again
+void funk_write_barrier_all(FunkVm* vm, FunkFunction* container);
+void funk_mark_object(FunkVm* vm, FunkObject* object);
+void funk_mark_table(FunkVm* vm, FunkTable* table);
+// For structures, that are shared between objects, returns true only for the first claim of the node in a collection
+bool funk_claim_node(FunkVm* vm, uint32_t* markedIn);
+
+// Keeps values, that natives only hold in C variables, alive while they run callbacks
+void funk_push_root(FunkVm* vm, FunkFunction* value);
+void funk_pop_roots(FunkVm* vm, uint8_t count);
 
 #endif
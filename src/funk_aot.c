@@ -0,0 +1,137 @@
+#include "funk_aot.h"
+
+#include <string.h>
+
+typedef struct FunkAotRequire {
+	const FunkAotProgram* program;
+	// The require() of the standard library, for the modules, that are not in the program
+	FunkNativeFunction* fallback;
+} FunkAotRequire;
+
+static FunkString* load_string(FunkVm* vm, const FunkAotProgram* program, uint32_t index) {
+	const char* chars = program->strings[index];
+	return funk_create_string(vm, chars, strlen(chars));
+}
+
+static FunkString** load_strings(FunkVm* vm, const FunkAotProgram* program, const uint32_t* indices, uint8_t count) {
+	if (count == 0) {
+		return NULL;
+	}
+
+	FunkString** strings = FUNK_ALLOCATE(vm, FunkString*, count);
+
+	for (uint8_t i = 0; i < count; i++) {
+		strings[i] = load_string(vm, program, indices[i]);
+	}
+
+	return strings;
+}
+
+// Collections only start at a call, so the new functions don't have to be kept anywhere, until they run
+static FunkBasicFunction* load_function(FunkVm* vm, const FunkAotProgram* program, uint32_t index) {
+	const FunkAotFunction* source = &program->functions[index];
+	FunkBasicFunction* function = funk_create_basic_function(vm, load_string(vm, program, source->name));
+
+	function->argumentNames = load_strings(vm, program, source->argumentNames, source->argumentCount);
+	function->argumentCount = source->argumentCount;
+
+	if (source->codeLength > 0) {
+		function->code = FUNK_ALLOCATE(vm, uint8_t, source->codeLength);
+		function->codeAllocated = source->codeLength;
+		function->codeLength = source->codeLength;
+
+		memcpy((void*) function->code, (const void*) source->code, source->codeLength);
+	}
+
+	if (source->constantsLength > 0) {
+		function->constants = FUNK_ALLOCATE(vm, FunkObject*, source->constantsLength);
+		function->constantsAllocated = source->constantsLength;
+		function->constantsLength = source->constantsLength;
+
+		for (uint16_t i = 0; i < source->constantsLength; i++) {
+			uint32_t constant = source->constants[i];
+
+			function->constants[i] = (constant & 1) == 1
+				? (FunkObject*) load_function(vm, program, constant >> 1)
+				: (FunkObject*) load_string(vm, program, constant >> 1);
+		}
+	}
+
+	function->lexical = source->lexical;
+	function->localNames = load_strings(vm, program, source->localNames, source->localCount);
+	function->localCount = source->localCount;
+
+	if (source->upvalueCount > 0) {
+		function->upvalueSources = FUNK_ALLOCATE(vm, uint16_t, source->upvalueCount);
+		memcpy((void*) function->upvalueSources, (const void*) source->upvalueSources, sizeof(uint16_t) * source->upvalueCount);
+	}
+
+	function->upvalueCount = source->upvalueCount;
+	function->inlineDepth = source->inlineDepth;
+
+	// The code isn't owned by the jit, so it's never freed
+	function->jitCode = (void*) source->run;
+	function->jitSize = 0;
+
+	return function;
+}
+
+static void cleanup_require_data(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data != NULL) {
+		FUNK_FREE(vm, FunkAotRequire, function->data);
+		function->data = NULL;
+	}
+}
+
+static void trace_require_data(FunkVm* vm, FunkNativeFunction* function) {
+	funk_mark_object(vm, (FunkObject*) ((FunkAotRequire*) function->data)->fallback);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(aotRequire) {
+	FunkAotRequire* data = (FunkAotRequire*) self->data;
+
+	if (argCount == 1 && args[0] != NULL) {
+		FunkString* path = args[0]->name;
+
+		for (uint16_t i = 0; i < data->program->moduleCount; i++) {
+			const FunkAotModule* module = &data->program->modules[i];
+
+			if (strlen(module->path) != path->length || memcmp(module->path, path->chars, path->length) != 0) {
+				continue;
+			}
+
+			FunkFunction* result;
+
+			if (funk_table_get(&vm->modules, path, (FunkObject**) &result)) {
+				return result;
+			}
+
+			result = funk_run_function(vm, (FunkFunction*) load_function(vm, data->program, module->function), 0);
+			funk_table_set(vm, &vm->modules, path, (FunkObject*) result);
+
+			return result;
+		}
+	}
+
+	return data->fallback->fn(vm, data->fallback, args, argCount);
+}
+
+FunkFunction* funk_run_aot_program(FunkVm* vm, const FunkAotProgram* program) {
+	FunkFunction* fallback = funk_get_global(vm, "require");
+
+	if (program->moduleCount > 0 && fallback != NULL && fallback->object.type == FUNK_OBJECT_NATIVE_FUNCTION) {
+		FunkNativeFunction* require = funk_create_native_function(vm, fallback->name, (FunkNativeFn) aotRequire);
+		FunkAotRequire* data = FUNK_ALLOCATE(vm, FunkAotRequire, 1);
+
+		data->program = program;
+		data->fallback = (FunkNativeFunction*) fallback;
+
+		require->cleanupFn = cleanup_require_data;
+		require->traceFn = trace_require_data;
+		require->data = (void*) data;
+
+		funk_set_global(vm, "require", (FunkFunction*) require);
+	}
+
+	return funk_run_function(vm, (FunkFunction*) load_function(vm, program, program->main), 0);
+}
@@ -0,0 +1,59 @@
+#ifndef FUNK_AOT_H
+#define FUNK_AOT_H
+
+#include "funk.h"
+#include "funk_jit.h"
+
+// The tables, that funkc writes for a script and the modules it requires
+
+// Constants are indices, strings are even and functions odd
+#define FUNK_AOT_STRING(index) ((uint32_t) (index) << 1)
+#define FUNK_AOT_FUNCTION(index) (((uint32_t) (index) << 1) | 1)
+
+typedef struct FunkAotFunction {
+	uint32_t name;
+
+	const uint32_t* argumentNames;
+	uint8_t argumentCount;
+
+	const uint8_t* code;
+	uint32_t codeLength;
+
+	const uint32_t* constants;
+	uint16_t constantsLength;
+
+	bool lexical;
+	const uint32_t* localNames;
+	uint8_t localCount;
+	const uint16_t* upvalueSources;
+	uint8_t upvalueCount;
+	uint8_t inlineDepth;
+
+	// The bytecode translated to C, it is run instead of the interpreter, just like the code of the jit
+	FunkJitCode run;
+} FunkAotFunction;
+
+typedef struct FunkAotModule {
+	// The argument of require(), that loads the module
+	const char* path;
+	uint32_t function;
+} FunkAotModule;
+
+typedef struct FunkAotProgram {
+	const char* const* strings;
+	uint32_t stringCount;
+
+	const FunkAotFunction* functions;
+	uint32_t functionCount;
+
+	const FunkAotModule* modules;
+	uint16_t moduleCount;
+
+	uint32_t main;
+} FunkAotProgram;
+
+// Runs the main script of the program, require() finds its modules without reading them.
+// The standard library has to be opened before
+FunkFunction* funk_run_aot_program(FunkVm* vm, const FunkAotProgram* program);
+
+#endif
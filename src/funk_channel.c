@@ -0,0 +1,398 @@
+#include "funk_channel.h"
+#include "funk_snapshot.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__linux__)
+	#define FUNK_CHANNEL_EVENTFD
+	#include <sys/eventfd.h>
+	#include <unistd.h>
+#endif
+
+#define FUNK_CHANNEL_MIN_CAPACITY 2
+#define FUNK_CHANNEL_MAX_CAPACITY (1u << 24)
+// Tries, before a side gives its thread up and sleeps, the other side is usually only a few messages away
+#define FUNK_CHANNEL_SPINS 16
+#define FUNK_CACHE_LINE 64
+
+// The sequence of a cell tells, whose turn it is: it equals the position, once the cell is free for the sender with that position,
+// and the position plus one, once the message in it can be taken out by the receiver with that position
+typedef struct FunkChannelCell {
+	size_t sequence;
+	void* message;
+	uint32_t size;
+} FunkChannelCell;
+
+struct FunkChannel {
+	// The senders and the receivers each get their own cache line
+	size_t sendPosition;
+	char sendPadding[FUNK_CACHE_LINE - sizeof(size_t)];
+	size_t receivePosition;
+	char receivePadding[FUNK_CACHE_LINE - sizeof(size_t)];
+
+	FunkChannelCell* cells;
+	size_t mask;
+
+	uint32_t references;
+	bool closed;
+
+	// Only the sides, that have to wait, take the lock
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+	uint32_t waitingReceivers;
+	uint32_t waitingSenders;
+
+	uint32_t watchers;
+	int eventFd;
+};
+
+FunkChannel* funk_create_channel(uint32_t capacity) {
+	size_t size = FUNK_CHANNEL_MIN_CAPACITY;
+
+	while (size < capacity && size < FUNK_CHANNEL_MAX_CAPACITY) {
+		size *= 2;
+	}
+
+	FunkChannel* channel = (FunkChannel*) calloc(1, sizeof(FunkChannel));
+
+	channel->cells = (FunkChannelCell*) malloc(sizeof(FunkChannelCell) * size);
+	channel->mask = size - 1;
+	channel->references = 1;
+	channel->eventFd = -1;
+
+	for (size_t i = 0; i < size; i++) {
+		channel->cells[i].sequence = i;
+	}
+
+	pthread_mutex_init(&channel->lock, NULL);
+	pthread_cond_init(&channel->notEmpty, NULL);
+	pthread_cond_init(&channel->notFull, NULL);
+
+	return channel;
+}
+
+void funk_retain_channel(FunkChannel* channel) {
+	__atomic_fetch_add(&channel->references, 1, __ATOMIC_RELAXED);
+}
+
+void funk_release_channel(FunkChannel* channel) {
+	if (__atomic_sub_fetch(&channel->references, 1, __ATOMIC_ACQ_REL) != 0) {
+		return;
+	}
+
+	void* message;
+	uint32_t size;
+
+	while (funk_channel_pop(channel, &message, &size, false)) {
+		funk_free_message(message);
+	}
+
+	#ifdef FUNK_CHANNEL_EVENTFD
+		if (channel->eventFd >= 0) {
+			close(channel->eventFd);
+		}
+	#endif
+
+	pthread_mutex_destroy(&channel->lock);
+	pthread_cond_destroy(&channel->notEmpty);
+	pthread_cond_destroy(&channel->notFull);
+
+	free((void*) channel->cells);
+	free((void*) channel);
+}
+
+static bool try_push(FunkChannel* channel, void* message, uint32_t size) {
+	size_t position = __atomic_load_n(&channel->sendPosition, __ATOMIC_RELAXED);
+	FunkChannelCell* cell;
+
+	while (true) {
+		cell = &channel->cells[position & channel->mask];
+		intptr_t difference = (intptr_t) __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (intptr_t) position;
+
+		if (difference == 0) {
+			if (__atomic_compare_exchange_n(&channel->sendPosition, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (difference < 0) {
+			// The receivers haven't taken the message out of this cell yet, a whole round ago
+			return false;
+		} else {
+			position = __atomic_load_n(&channel->sendPosition, __ATOMIC_RELAXED);
+		}
+	}
+
+	cell->message = message;
+	cell->size = size;
+	__atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static bool try_pop(FunkChannel* channel, void** message, uint32_t* size) {
+	size_t position = __atomic_load_n(&channel->receivePosition, __ATOMIC_RELAXED);
+	FunkChannelCell* cell;
+
+	while (true) {
+		cell = &channel->cells[position & channel->mask];
+		intptr_t difference = (intptr_t) __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (intptr_t) (position + 1);
+
+		if (difference == 0) {
+			if (__atomic_compare_exchange_n(&channel->receivePosition, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (difference < 0) {
+			return false;
+		} else {
+			position = __atomic_load_n(&channel->receivePosition, __ATOMIC_RELAXED);
+		}
+	}
+
+	*message = cell->message;
+	*size = cell->size;
+	__atomic_store_n(&cell->sequence, position + channel->mask + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static void signal_watchers(FunkChannel* channel) {
+	#ifdef FUNK_CHANNEL_EVENTFD
+		if (__atomic_load_n(&channel->watchers, __ATOMIC_SEQ_CST) > 0) {
+			uint64_t value = 1;
+
+			if (write(__atomic_load_n(&channel->eventFd, __ATOMIC_ACQUIRE), (const void*) &value, sizeof(uint64_t)) < 0) {
+				// The counter is full, so the descriptor is readable anyway
+			}
+		}
+	#endif
+}
+
+// The full fence orders the push or pop before the check, the waiting side counts itself before it looks at the queue again,
+// so one of them always sees the other
+static void wake(FunkChannel* channel, uint32_t* waiting, pthread_cond_t* condition) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&channel->lock);
+		pthread_cond_signal(condition);
+		pthread_mutex_unlock(&channel->lock);
+	}
+}
+
+bool funk_channel_push(FunkChannel* channel, void* message, uint32_t size, bool wait) {
+	bool pushed = false;
+
+	for (uint32_t i = 0; i < FUNK_CHANNEL_SPINS && !pushed; i++) {
+		if (__atomic_load_n(&channel->closed, __ATOMIC_ACQUIRE)) {
+			return false;
+		}
+
+		pushed = try_push(channel, message, size);
+
+		if (!pushed && !wait) {
+			return false;
+		}
+
+		if (!pushed) {
+			sched_yield();
+		}
+	}
+
+	if (!pushed) {
+		pthread_mutex_lock(&channel->lock);
+		__atomic_fetch_add(&channel->waitingSenders, 1, __ATOMIC_SEQ_CST);
+
+		while (!__atomic_load_n(&channel->closed, __ATOMIC_ACQUIRE) && !(pushed = try_push(channel, message, size))) {
+			pthread_cond_wait(&channel->notFull, &channel->lock);
+		}
+
+		__atomic_fetch_sub(&channel->waitingSenders, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&channel->lock);
+
+		if (!pushed) {
+			return false;
+		}
+	}
+
+	wake(channel, &channel->waitingReceivers, &channel->notEmpty);
+	signal_watchers(channel);
+
+	return true;
+}
+
+bool funk_channel_pop(FunkChannel* channel, void** message, uint32_t* size, bool wait) {
+	bool popped = false;
+
+	for (uint32_t i = 0; i < FUNK_CHANNEL_SPINS && !popped; i++) {
+		popped = try_pop(channel, message, size);
+
+		if (!popped && (!wait || __atomic_load_n(&channel->closed, __ATOMIC_ACQUIRE))) {
+			// The messages, that were sent right before the channel was closed, are still taken out
+			return wait && try_pop(channel, message, size);
+		}
+
+		if (!popped) {
+			sched_yield();
+		}
+	}
+
+	if (!popped) {
+		pthread_mutex_lock(&channel->lock);
+		__atomic_fetch_add(&channel->waitingReceivers, 1, __ATOMIC_SEQ_CST);
+
+		while (!(popped = try_pop(channel, message, size)) && !__atomic_load_n(&channel->closed, __ATOMIC_ACQUIRE)) {
+			pthread_cond_wait(&channel->notEmpty, &channel->lock);
+		}
+
+		__atomic_fetch_sub(&channel->waitingReceivers, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&channel->lock);
+
+		if (!popped) {
+			return try_pop(channel, message, size);
+		}
+	}
+
+	wake(channel, &channel->waitingSenders, &channel->notFull);
+	return true;
+}
+
+void funk_close_channel(FunkChannel* channel) {
+	pthread_mutex_lock(&channel->lock);
+	__atomic_store_n(&channel->closed, true, __ATOMIC_RELEASE);
+
+	pthread_cond_broadcast(&channel->notEmpty);
+	pthread_cond_broadcast(&channel->notFull);
+	pthread_mutex_unlock(&channel->lock);
+
+	signal_watchers(channel);
+}
+
+bool funk_is_channel_closed(FunkChannel* channel) {
+	return __atomic_load_n(&channel->closed, __ATOMIC_ACQUIRE);
+}
+
+int funk_watch_channel(FunkChannel* channel) {
+	#ifdef FUNK_CHANNEL_EVENTFD
+		pthread_mutex_lock(&channel->lock);
+
+		if (channel->eventFd < 0) {
+			__atomic_store_n(&channel->eventFd, eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), __ATOMIC_RELEASE);
+		}
+
+		int fd = channel->eventFd;
+
+		if (fd >= 0) {
+			__atomic_fetch_add(&channel->watchers, 1, __ATOMIC_SEQ_CST);
+		}
+
+		pthread_mutex_unlock(&channel->lock);
+
+		// The messages, that were sent before the watch, would never signal it
+		funk_set_channel_signal(channel, true);
+		return fd;
+	#else
+		return -1;
+	#endif
+}
+
+void funk_unwatch_channel(FunkChannel* channel) {
+	__atomic_fetch_sub(&channel->watchers, 1, __ATOMIC_SEQ_CST);
+}
+
+void funk_set_channel_signal(FunkChannel* channel, bool signaled) {
+	#ifdef FUNK_CHANNEL_EVENTFD
+		if (channel->eventFd < 0) {
+			return;
+		}
+
+		uint64_t value = 1;
+
+		if (signaled) {
+			if (write(channel->eventFd, (const void*) &value, sizeof(uint64_t)) < 0) {
+				// Readable already
+			}
+		} else if (read(channel->eventFd, (void*) &value, sizeof(uint64_t)) < 0) {
+			// Wasn't signaled
+		}
+	#endif
+}
+
+// Calling a channel does nothing, it's only passed around
+static FunkFunction* channel_callback(FunkVm* vm, FunkNativeFunction* self, FunkFunction** args, uint8_t argCount) {
+	return NULL;
+}
+
+static void cleanup_channel(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data != NULL) {
+		funk_release_channel((FunkChannel*) function->data);
+		function->data = NULL;
+	}
+}
+
+FunkFunction* funk_wrap_channel(FunkVm* vm, FunkChannel* channel) {
+	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, "$channelData", 12), (FunkNativeFn) channel_callback);
+
+	funk_retain_channel(channel);
+
+	function->cleanupFn = cleanup_channel;
+	function->data = (void*) channel;
+
+	return (FunkFunction *) function;
+}
+
+bool funk_is_channel(FunkFunction* function) {
+	return function != NULL && function->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) function)->cleanupFn == cleanup_channel;
+}
+
+FunkChannel* funk_extract_channel(FunkVm* vm, FunkFunction* function) {
+	if (!funk_is_channel(function)) {
+		funk_error(vm, "Expected a channel as argument");
+		return NULL;
+	}
+
+	return (FunkChannel*) ((FunkNativeFunction*) function)->data;
+}
+
+void funk_channel_send(FunkVm* vm, FunkFunction* function, FunkFunction* value) {
+	FunkChannel* channel = funk_extract_channel(vm, function);
+	uint32_t size;
+	void* message = funk_encode_message(vm, value, &size);
+
+	if (!funk_channel_push(channel, message, size, true)) {
+		funk_free_message(message);
+		funk_error(vm, "The channel is closed");
+	}
+}
+
+FunkFunction* funk_channel_receive(FunkVm* vm, FunkFunction* function) {
+	FunkChannel* channel = funk_extract_channel(vm, function);
+	void* message;
+	uint32_t size;
+
+	// The output shouldn't lag behind, while the vm sleeps
+	if (!funk_channel_pop(channel, &message, &size, false)) {
+		funk_flush_output(vm);
+
+		if (!funk_channel_pop(channel, &message, &size, true)) {
+			return NULL;
+		}
+	}
+
+	return funk_decode_message(vm, message, size);
+}
+
+bool funk_channel_try_receive(FunkVm* vm, FunkFunction* function, FunkFunction** value) {
+	FunkChannel* channel = funk_extract_channel(vm, function);
+	void* message;
+	uint32_t size;
+
+	if (!funk_channel_pop(channel, &message, &size, false)) {
+		return false;
+	}
+
+	*value = funk_decode_message(vm, message, size);
+	return true;
+}
@@ -0,0 +1,44 @@
+#ifndef FUNK_CHANNEL_H
+#define FUNK_CHANNEL_H
+
+#include "funk.h"
+
+// A bounded queue of messages, that any number of vms on any threads send to and receive from.
+// The values are copied into a message by the sender (see funk_encode_message()), the queue itself only moves pointers
+// and takes no lock, unless a side has to wait. Channels are counted references, every vm, that holds one, keeps it alive
+typedef struct FunkChannel FunkChannel;
+
+// The capacity is rounded up to a power of two
+FunkChannel* funk_create_channel(uint32_t capacity);
+void funk_retain_channel(FunkChannel* channel);
+// Frees the channel and the messages, that are left, once the last reference is gone
+void funk_release_channel(FunkChannel* channel);
+
+// Returns false, if the channel is closed, or, without waiting, full. The channel owns the message after a push
+bool funk_channel_push(FunkChannel* channel, void* message, uint32_t size, bool wait);
+// Returns false, if the channel is empty and, with waiting, closed as well
+bool funk_channel_pop(FunkChannel* channel, void** message, uint32_t* size, bool wait);
+// Wakes up everything, that waits. The messages, that were sent before, can still be received
+void funk_close_channel(FunkChannel* channel);
+bool funk_is_channel_closed(FunkChannel* channel);
+
+// A descriptor for event loops, that is readable, once a message was sent or the channel was closed, -1 without eventfd.
+// Every watch has to be undone with funk_unwatch_channel()
+int funk_watch_channel(FunkChannel* channel);
+void funk_unwatch_channel(FunkChannel* channel);
+// Makes the descriptor readable again, or not, before the messages are taken out
+void funk_set_channel_signal(FunkChannel* channel, bool signaled);
+
+// A native, that holds a reference to the channel, so that the vm can pass it around
+FunkFunction* funk_wrap_channel(FunkVm* vm, FunkChannel* channel);
+bool funk_is_channel(FunkFunction* function);
+FunkChannel* funk_extract_channel(FunkVm* vm, FunkFunction* function);
+
+// Waits, while the channel is full, sending to a closed channel is an error
+void funk_channel_send(FunkVm* vm, FunkFunction* channel, FunkFunction* value);
+// Waits for a message, returns null, once the channel is closed and empty
+FunkFunction* funk_channel_receive(FunkVm* vm, FunkFunction* channel);
+// Returns false right away, if there is no message
+bool funk_channel_try_receive(FunkVm* vm, FunkFunction* channel, FunkFunction** value);
+
+#endif
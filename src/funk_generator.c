@@ -0,0 +1,394 @@
+#if defined(__APPLE__)
+	// ucontext is only declared for the XSI extensions there
+	#define _XOPEN_SOURCE 600
+#endif
+
+#include "funk_generator.h"
+
+#include <string.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+	#define FUNK_GENERATORS
+	#include <sys/mman.h>
+	#include <ucontext.h>
+	#include <unistd.h>
+#endif
+
+// AddressSanitizer has to be told about every switch of the C stack, or it misreads the errors, that unwind on it
+#if defined(__SANITIZE_ADDRESS__)
+	#define FUNK_GENERATOR_FIBERS
+#elif defined(__has_feature)
+	#if __has_feature(address_sanitizer)
+		#define FUNK_GENERATOR_FIBERS
+	#endif
+#endif
+
+#ifdef FUNK_GENERATOR_FIBERS
+	#include <sanitizer/common_interface_defs.h>
+
+	#define START_SWITCH(fakeStack, bottom, size) __sanitizer_start_switch_fiber(fakeStack, bottom, size)
+	#define FINISH_SWITCH(fakeStack, bottom, size) __sanitizer_finish_switch_fiber(fakeStack, bottom, size)
+#else
+	#define START_SWITCH(fakeStack, bottom, size) ((void) (fakeStack))
+	#define FINISH_SWITCH(fakeStack, bottom, size) ((void) (fakeStack))
+#endif
+
+#ifdef FUNK_GENERATORS
+
+// Only the pages, that the generator touches, are ever backed by memory. The C stack grows down to a guard page,
+// calls stop FUNK_GENERATOR_C_STACK_RESERVE bytes above it, so that the natives and the error have room to run
+#define FUNK_GENERATOR_C_STACK_SIZE (4 * 1024 * 1024)
+#define FUNK_GENERATOR_C_STACK_RESERVE (64 * 1024)
+#define FUNK_GENERATOR_STACK_BYTES (FUNK_STACK_SIZE * sizeof(FunkFunction*))
+
+typedef enum {
+	FUNK_GENERATOR_READY,
+	FUNK_GENERATOR_SUSPENDED,
+	FUNK_GENERATOR_RUNNING,
+	FUNK_GENERATOR_DONE
+} FunkGeneratorState;
+
+typedef struct FunkGenerator {
+	FunkVm* vm;
+	FunkFunction* self;
+	FunkGeneratorState state;
+
+	FunkFunction* function;
+	FunkFunction** args;
+	uint8_t argCount;
+
+	// Passed by yield() to the resume and back
+	FunkFunction* value;
+
+	// The guard page, the C stack and the stack of values in one mapping, from the first resume until it's done
+	void* mapping;
+	size_t mappingSize;
+	FunkFunction** stack;
+	void* cStack;
+	ucontext_t context;
+
+	// Saved, while the generator is suspended. The frames live on its C stack, from the innermost one
+	// to the one of its function, that is linked to the frame of whoever resumes it next
+	FunkFunction** stackTop;
+	FunkCallFrame* topFrame;
+	FunkCallFrame* bottomFrame;
+	jmp_buf errorJumpBuffer;
+	FunkCallFrame* errorFrame;
+
+	// Saved, while the generator runs
+	ucontext_t resumer;
+	FunkStackSegment resumerStack;
+	FunkCallFrame* resumerFrame;
+	jmp_buf resumerJumpBuffer;
+	FunkCallFrame* resumerErrorFrame;
+	void* resumerCStackLimit;
+	const void* resumerCStack;
+	size_t resumerCStackSize;
+	struct FunkGenerator* enclosing;
+} FunkGenerator;
+
+static FunkFunction* generator_callback(FunkVm* vm, FunkNativeFunction* self, FunkFunction** args, uint8_t argCount);
+
+static FunkGenerator* get_generator(FunkFunction* function) {
+	return (FunkGenerator*) ((FunkNativeFunction*) function)->data;
+}
+
+static void free_generator_stacks(FunkGenerator* generator) {
+	if (generator->mapping != NULL) {
+		munmap(generator->mapping, generator->mappingSize);
+
+		generator->mapping = NULL;
+		generator->stack = NULL;
+		generator->cStack = NULL;
+	}
+}
+
+// The frames of a generator, that never finished, still own their variables
+static void cleanup_generator(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data == NULL) {
+		return;
+	}
+
+	FunkGenerator* generator = (FunkGenerator*) function->data;
+
+	if (generator->state == FUNK_GENERATOR_SUSPENDED && generator->bottomFrame != NULL) {
+		for (FunkCallFrame* frame = generator->topFrame; ; frame = frame->previous) {
+			if (frame->scope == NULL) {
+				funk_free_table(vm, &frame->ownVariables);
+			}
+
+			if (frame == generator->bottomFrame) {
+				break;
+			}
+		}
+	}
+
+	free_generator_stacks(generator);
+
+	FUNK_FREE_ARRAY(vm, FunkFunction*, generator->args, generator->argCount);
+	FUNK_FREE(vm, FunkGenerator, generator);
+
+	function->data = NULL;
+}
+
+static void trace_generator(FunkVm* vm, FunkNativeFunction* function) {
+	FunkGenerator* generator = (FunkGenerator*) function->data;
+
+	funk_mark_object(vm, (FunkObject *) generator->function);
+	funk_mark_object(vm, (FunkObject *) generator->value);
+
+	for (uint8_t i = 0; i < generator->argCount; i++) {
+		funk_mark_object(vm, (FunkObject *) generator->args[i]);
+	}
+
+	// A running generator is marked with the roots
+	if (generator->state != FUNK_GENERATOR_SUSPENDED) {
+		return;
+	}
+
+	for (FunkFunction** object = generator->stack; object < generator->stackTop; object++) {
+		funk_mark_object(vm, (FunkObject *) *object);
+	}
+
+	if (generator->bottomFrame != NULL) {
+		for (FunkCallFrame* frame = generator->topFrame; ; frame = frame->previous) {
+			funk_mark_table(vm, frame->variables);
+			funk_mark_object(vm, (FunkObject *) frame->function);
+			funk_mark_object(vm, (FunkObject *) frame->scope);
+
+			if (frame == generator->bottomFrame) {
+				break;
+			}
+		}
+	}
+}
+
+// makecontext() only passes ints, so the pointer is split in two
+static void run_generator(unsigned int high, unsigned int low) {
+	FunkGenerator* generator = (FunkGenerator*) (((uintptr_t) high << 32) | (uintptr_t) low);
+	FINISH_SWITCH(NULL, &generator->resumerCStack, &generator->resumerCStackSize);
+
+	// Errors stop the generator here, the resume sees it as done
+	funk_run_function_arged(generator->vm, generator->function, generator->args, generator->argCount);
+
+	generator->state = FUNK_GENERATOR_DONE;
+	generator->value = NULL;
+
+	START_SWITCH(NULL, generator->resumerCStack, generator->resumerCStackSize);
+	setcontext(&generator->resumer);
+}
+
+bool funk_generators_are_supported() {
+	return true;
+}
+
+FunkFunction* funk_create_generator(FunkVm* vm, FunkFunction* function, FunkFunction** args, uint8_t argCount) {
+	FunkNativeFunction* native = funk_create_native_function(vm, funk_create_string(vm, "$generatorData", 14), (FunkNativeFn) generator_callback);
+	FunkGenerator* generator = FUNK_ALLOCATE(vm, FunkGenerator, 1);
+
+	generator->vm = vm;
+	generator->self = (FunkFunction*) native;
+	generator->state = FUNK_GENERATOR_READY;
+	generator->function = function;
+	generator->args = argCount > 0 ? FUNK_ALLOCATE(vm, FunkFunction*, argCount) : NULL;
+	generator->argCount = argCount;
+	generator->value = NULL;
+	generator->mapping = NULL;
+	generator->stack = NULL;
+	generator->cStack = NULL;
+	generator->stackTop = NULL;
+	generator->topFrame = NULL;
+	generator->bottomFrame = NULL;
+	generator->enclosing = NULL;
+
+	if (argCount > 0) {
+		memcpy((void*) generator->args, (void*) args, sizeof(FunkFunction*) * argCount);
+	}
+
+	native->cleanupFn = cleanup_generator;
+	native->traceFn = trace_generator;
+	native->data = (void*) generator;
+
+	return (FunkFunction*) native;
+}
+
+bool funk_is_generator(FunkFunction* function) {
+	return function != NULL && function->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) function)->cleanupFn == cleanup_generator;
+}
+
+bool funk_resume_generator(FunkVm* vm, FunkFunction* function, FunkFunction* value, FunkFunction** result) {
+	FunkGenerator* generator = get_generator(function);
+
+	if (generator->state == FUNK_GENERATOR_DONE) {
+		return false;
+	}
+
+	if (generator->state == FUNK_GENERATOR_RUNNING) {
+		funk_error(vm, "The generator is already running");
+		return false;
+	}
+
+	if (generator->state == FUNK_GENERATOR_READY) {
+		size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+		size_t mappingSize = pageSize + FUNK_GENERATOR_C_STACK_SIZE + FUNK_GENERATOR_STACK_BYTES;
+		char* mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (mapping == MAP_FAILED || mprotect(mapping, pageSize, PROT_NONE) != 0) {
+			if (mapping != MAP_FAILED) {
+				munmap(mapping, mappingSize);
+			}
+
+			funk_error(vm, "Failed to allocate the stack of a generator");
+			return false;
+		}
+
+		generator->mapping = (void*) mapping;
+		generator->mappingSize = mappingSize;
+		generator->cStack = (void*) (mapping + pageSize);
+		generator->stack = (FunkFunction**) (mapping + pageSize + FUNK_GENERATOR_C_STACK_SIZE);
+		generator->stackTop = generator->stack;
+
+		uintptr_t pointer = (uintptr_t) generator;
+
+		getcontext(&generator->context);
+		generator->context.uc_stack.ss_sp = generator->cStack;
+		generator->context.uc_stack.ss_size = FUNK_GENERATOR_C_STACK_SIZE;
+		generator->context.uc_link = NULL;
+
+		makecontext(&generator->context, (void (*)()) run_generator, 2, (unsigned int) (pointer >> 32), (unsigned int) (pointer & 0xffffffff));
+	}
+
+	generator->value = value;
+
+	generator->resumerStack.base = vm->stackBase;
+	generator->resumerStack.top = vm->stackTop;
+	generator->resumerStack.previous = vm->resumerStacks;
+	generator->resumerFrame = vm->callFrame;
+	generator->enclosing = vm->generator;
+	memcpy((void*) generator->resumerJumpBuffer, (void*) vm->errorJumpBuffer, sizeof(jmp_buf));
+	generator->resumerErrorFrame = vm->errorFrame;
+	generator->resumerCStackLimit = vm->cStackLimit;
+
+	vm->resumerStacks = &generator->resumerStack;
+	vm->generator = generator;
+	vm->cStackLimit = (char*) generator->cStack + FUNK_GENERATOR_C_STACK_RESERVE;
+	vm->stackBase = generator->stack;
+	vm->stackTop = generator->stackTop;
+
+	if (generator->state == FUNK_GENERATOR_SUSPENDED) {
+		// The variables of the resumer are visible to the generator, like to any other function, that it calls
+		if (generator->bottomFrame != NULL) {
+			generator->bottomFrame->previous = vm->callFrame;
+			vm->callFrame = generator->topFrame;
+		}
+
+		memcpy((void*) vm->errorJumpBuffer, (void*) generator->errorJumpBuffer, sizeof(jmp_buf));
+		vm->errorFrame = generator->errorFrame;
+	}
+
+	generator->state = FUNK_GENERATOR_RUNNING;
+	void* fakeStack = NULL;
+
+	START_SWITCH(&fakeStack, generator->cStack, FUNK_GENERATOR_C_STACK_SIZE);
+	swapcontext(&generator->resumer, &generator->context);
+	FINISH_SWITCH(fakeStack, NULL, NULL);
+
+	vm->stackBase = generator->resumerStack.base;
+	vm->stackTop = generator->resumerStack.top;
+	vm->resumerStacks = generator->resumerStack.previous;
+	vm->callFrame = generator->resumerFrame;
+	vm->generator = generator->enclosing;
+	vm->cStackLimit = generator->resumerCStackLimit;
+	memcpy((void*) vm->errorJumpBuffer, (void*) generator->resumerJumpBuffer, sizeof(jmp_buf));
+	vm->errorFrame = generator->resumerErrorFrame;
+
+	if (generator->state == FUNK_GENERATOR_DONE) {
+		free_generator_stacks(generator);
+		return false;
+	}
+
+	// The stack and frames, that the generator left behind, weren't behind any barrier
+	funk_write_barrier_all(vm, generator->self);
+
+	*result = generator->value;
+	return true;
+}
+
+FunkFunction* funk_yield(FunkVm* vm, FunkFunction* value) {
+	FunkGenerator* generator = vm->generator;
+
+	if (generator == NULL) {
+		funk_error(vm, "yield() can only be called in a generator");
+		return NULL;
+	}
+
+	generator->value = value;
+	generator->stackTop = vm->stackTop;
+	generator->topFrame = NULL;
+	generator->bottomFrame = NULL;
+
+	for (FunkCallFrame* frame = vm->callFrame; frame != generator->resumerFrame; frame = frame->previous) {
+		if (generator->topFrame == NULL) {
+			generator->topFrame = frame;
+		}
+
+		generator->bottomFrame = frame;
+	}
+
+	memcpy((void*) generator->errorJumpBuffer, (void*) vm->errorJumpBuffer, sizeof(jmp_buf));
+	generator->errorFrame = vm->errorFrame;
+
+	generator->state = FUNK_GENERATOR_SUSPENDED;
+	void* fakeStack = NULL;
+
+	START_SWITCH(&fakeStack, generator->resumerCStack, generator->resumerCStackSize);
+	swapcontext(&generator->context, &generator->resumer);
+	FINISH_SWITCH(fakeStack, &generator->resumerCStack, &generator->resumerCStackSize);
+
+	return generator->value;
+}
+
+FunkCallFrame* funk_get_resumer_frame(FunkVm* vm) {
+	return vm->generator != NULL ? vm->generator->resumerFrame : NULL;
+}
+
+// Called with an argument, the generator gets it from yield(), returns null, once it is done
+static FunkFunction* generator_callback(FunkVm* vm, FunkNativeFunction* self, FunkFunction** args, uint8_t argCount) {
+	FunkFunction* result = NULL;
+
+	if (!funk_resume_generator(vm, (FunkFunction*) self, argCount > 0 ? args[0] : NULL, &result)) {
+		return NULL;
+	}
+
+	return result;
+}
+
+#else
+
+bool funk_generators_are_supported() {
+	return false;
+}
+
+FunkFunction* funk_create_generator(FunkVm* vm, FunkFunction* function, FunkFunction** args, uint8_t argCount) {
+	funk_error(vm, "Generators aren't supported on this platform");
+	return NULL;
+}
+
+bool funk_is_generator(FunkFunction* function) {
+	return false;
+}
+
+bool funk_resume_generator(FunkVm* vm, FunkFunction* generator, FunkFunction* value, FunkFunction** result) {
+	return false;
+}
+
+FunkFunction* funk_yield(FunkVm* vm, FunkFunction* value) {
+	funk_error(vm, "yield() can only be called in a generator");
+	return NULL;
+}
+
+FunkCallFrame* funk_get_resumer_frame(FunkVm* vm) {
+	return NULL;
+}
+
+#endif
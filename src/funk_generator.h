@@ -0,0 +1,25 @@
+#ifndef FUNK_GENERATOR_H
+#define FUNK_GENERATOR_H
+
+#include "funk.h"
+
+// A generator runs its function on a C stack and a funk stack of its own, so that yield() can suspend it anywhere,
+// even deep in the natives, that it called, and it continues at the same place, once it is resumed.
+// The frames of a suspended generator stay on its C stack, the object keeps them alive for the collector
+
+// False on the hosts without ucontext, creating a generator is an error there
+bool funk_generators_are_supported();
+
+// The function gets the arguments, once the generator is resumed for the first time
+FunkFunction* funk_create_generator(FunkVm* vm, FunkFunction* function, FunkFunction** args, uint8_t argCount);
+bool funk_is_generator(FunkFunction* function);
+
+// Runs the generator, until it yields or returns. The value is returned from the yield(), that it was suspended in.
+// Returns false, once the generator is done, otherwise the result is the yielded value
+bool funk_resume_generator(FunkVm* vm, FunkFunction* generator, FunkFunction* value, FunkFunction** result);
+// Suspends the running generator, returns the value, that it is resumed with
+FunkFunction* funk_yield(FunkVm* vm, FunkFunction* value);
+// The frame, that resumed the running generator, NULL, if none runs
+FunkCallFrame* funk_get_resumer_frame(FunkVm* vm);
+
+#endif
@@ -0,0 +1,336 @@
+#include "funk_jit.h"
+
+#include <stddef.h>
+#include <string.h>
+
+// Every instruction becomes a piece of machine code in the same order, so the jumps of the bytecode become jumps between them:
+// the small instructions are inlined, the rest are calls to the helpers of the interpreter
+
+#if defined(__GNUC__) && defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+	#define FUNK_JIT_X86_64
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+#ifdef FUNK_JIT_X86_64
+
+// The longest instruction, a helper call, takes 38 bytes of machine code, and every instruction is at least a byte long
+#define FUNK_JIT_BYTES_PER_INSTRUCTION 40
+#define FUNK_JIT_PROLOGUE_SIZE 64
+
+// The target is an offset in the bytecode, or FUNK_JIT_EPILOGUE
+typedef struct FunkJitJump {
+	uint32_t position;
+	uint32_t target;
+} FunkJitJump;
+
+#define FUNK_JIT_EPILOGUE UINT32_MAX
+
+typedef struct FunkJitBuffer {
+	uint8_t* code;
+	uint32_t length;
+
+	// Where the machine code of every instruction starts, indexed by its offset in the bytecode
+	uint32_t* offsets;
+
+	// The jumps, that are patched, once all the code is written
+	FunkJitJump* jumps;
+	uint32_t jumpCount;
+} FunkJitBuffer;
+
+#define EMIT(buffer, ...) emit_bytes((buffer), (const uint8_t[]) { __VA_ARGS__ }, sizeof((const uint8_t[]) { __VA_ARGS__ }))
+
+static void emit_bytes(FunkJitBuffer* buffer, const uint8_t* bytes, uint32_t count) {
+	memcpy((void*) (buffer->code + buffer->length), bytes, count);
+	buffer->length += count;
+}
+
+static void emit_uint32_t(FunkJitBuffer* buffer, uint32_t value) {
+	memcpy((void*) (buffer->code + buffer->length), &value, sizeof(uint32_t));
+	buffer->length += sizeof(uint32_t);
+}
+
+static void emit_uint64_t(FunkJitBuffer* buffer, uint64_t value) {
+	memcpy((void*) (buffer->code + buffer->length), &value, sizeof(uint64_t));
+	buffer->length += sizeof(uint64_t);
+}
+
+// rbx holds the frame and r12 the vm for the whole function, both are kept by the helpers
+static void emit_prologue(FunkJitBuffer* buffer) {
+	EMIT(buffer, 0x53); // push rbx
+	EMIT(buffer, 0x41, 0x54); // push r12
+	EMIT(buffer, 0x48, 0x83, 0xec, 0x08); // sub rsp, 8, the calls need a 16 byte aligned stack
+	EMIT(buffer, 0x48, 0x89, 0xfb); // mov rbx, rdi
+	EMIT(buffer, 0x4c, 0x8b, 0x27); // mov r12, [rdi], the vm is the first field of the frame
+}
+
+static void emit_epilogue(FunkJitBuffer* buffer) {
+	EMIT(buffer, 0x48, 0x83, 0xc4, 0x08); // add rsp, 8
+	EMIT(buffer, 0x41, 0x5c); // pop r12
+	EMIT(buffer, 0x5b); // pop rbx
+	EMIT(buffer, 0xc3); // ret
+}
+
+// Pushes rcx to the stack of the vm
+static void emit_push(FunkJitBuffer* buffer) {
+	EMIT(buffer, 0x49, 0x8b, 0x84, 0x24); // mov rax, [r12 + stackTop]
+	emit_uint32_t(buffer, offsetof(FunkVm, stackTop));
+	EMIT(buffer, 0x48, 0x89, 0x08); // mov [rax], rcx
+	EMIT(buffer, 0x48, 0x83, 0xc0, 0x08); // add rax, 8
+	EMIT(buffer, 0x49, 0x89, 0x84, 0x24); // mov [r12 + stackTop], rax
+	emit_uint32_t(buffer, offsetof(FunkVm, stackTop));
+}
+
+static void emit_pop(FunkJitBuffer* buffer) {
+	EMIT(buffer, 0x49, 0x83, 0xac, 0x24); // sub qword [r12 + stackTop], 8
+	emit_uint32_t(buffer, offsetof(FunkVm, stackTop));
+	EMIT(buffer, 0x08);
+}
+
+// Loads the pointer at the given index of the array in the frame to rcx
+static void emit_load_from_frame(FunkJitBuffer* buffer, uint32_t arrayOffset, uint8_t index) {
+	EMIT(buffer, 0x48, 0x8b, 0x93); // mov rdx, [rbx + arrayOffset]
+	emit_uint32_t(buffer, arrayOffset);
+	EMIT(buffer, 0x48, 0x8b, 0x8a); // mov rcx, [rdx + index * 8]
+	emit_uint32_t(buffer, (uint32_t) index * sizeof(FunkFunction*));
+}
+
+// Leaves a rel32 operand, that is pointed at the target later
+static void emit_jump_target(FunkJitBuffer* buffer, uint32_t target) {
+	buffer->jumps[buffer->jumpCount].position = buffer->length;
+	buffer->jumps[buffer->jumpCount].target = target;
+	buffer->jumpCount++;
+
+	emit_uint32_t(buffer, 0);
+}
+
+// Jumps to the target, once the helper returns false
+static void emit_helper_call(FunkJitBuffer* buffer, FunkJitHelper helper, FunkObject* constant, uint32_t operand, uint32_t target) {
+	EMIT(buffer, 0x48, 0x89, 0xdf); // mov rdi, rbx
+	EMIT(buffer, 0x48, 0xbe); // mov rsi, constant
+	emit_uint64_t(buffer, (uint64_t) (uintptr_t) constant);
+	EMIT(buffer, 0xba); // mov edx, operand
+	emit_uint32_t(buffer, operand);
+	EMIT(buffer, 0x48, 0xb8); // mov rax, helper
+	emit_uint64_t(buffer, (uint64_t) (uintptr_t) helper);
+	EMIT(buffer, 0xff, 0xd0); // call rax
+	EMIT(buffer, 0x84, 0xc0); // test al, al
+	EMIT(buffer, 0x0f, 0x84); // jz target
+	emit_jump_target(buffer, target);
+}
+
+static bool emit_instructions(FunkJitBuffer* buffer, FunkBasicFunction* function, const FunkJitHelper* helpers) {
+	uint8_t* ip = function->code;
+	uint8_t* end = function->code + function->codeLength;
+
+	#define READ_UINT8() (*ip++)
+	#define READ_UINT16() (ip += 2, (uint16_t) ((ip[-2] << 8) | ip[-1]))
+	#define READ_CONSTANT() (function->constants[READ_UINT16()])
+
+	while (ip < end) {
+		buffer->offsets[ip - function->code] = buffer->length;
+		uint8_t instruction = READ_UINT8();
+
+		switch (instruction) {
+			case FUNK_INSTRUCTION_PUSH_NULL: {
+				EMIT(buffer, 0x31, 0xc9); // xor ecx, ecx
+				emit_push(buffer);
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_PUSH_CONSTANT: {
+				EMIT(buffer, 0x48, 0xb9); // mov rcx, constant
+				emit_uint64_t(buffer, (uint64_t) (uintptr_t) READ_CONSTANT());
+				emit_push(buffer);
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_POP: {
+				emit_pop(buffer);
+				break;
+			}
+
+			case FUNK_INSTRUCTION_GET_LOCAL: {
+				emit_load_from_frame(buffer, offsetof(FunkJitFrame, slots), READ_UINT8());
+				emit_push(buffer);
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_GET_UPVALUE: {
+				emit_load_from_frame(buffer, offsetof(FunkJitFrame, upvalues), READ_UINT8());
+				emit_push(buffer);
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_JUMP: {
+				uint16_t offset = READ_UINT16();
+
+				EMIT(buffer, 0xe9); // jmp target
+				emit_jump_target(buffer, (uint32_t) (ip - function->code) + offset);
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_LOOP: {
+				uint16_t offset = READ_UINT16();
+
+				EMIT(buffer, 0xe9); // jmp target
+				emit_jump_target(buffer, (uint32_t) (ip - function->code) - offset);
+
+				break;
+			}
+
+			default: {
+				if (helpers[instruction] == NULL) {
+					return false;
+				}
+
+				FunkObject* constant = NULL;
+				uint32_t operand = 0;
+				uint32_t target = FUNK_JIT_EPILOGUE;
+
+				switch (instruction) {
+					case FUNK_INSTRUCTION_RETURN:
+					case FUNK_INSTRUCTION_FOR_PREPARE:
+					case FUNK_INSTRUCTION_FOR_STEP:
+					case FUNK_INSTRUCTION_POP_SCOPE: break;
+					case FUNK_INSTRUCTION_CALL:
+					case FUNK_INSTRUCTION_SET_LOCAL: operand = READ_UINT8(); break;
+
+					case FUNK_INSTRUCTION_JUMP_IF_FALSE:
+					case FUNK_INSTRUCTION_FOR_NEXT: {
+						uint16_t offset = READ_UINT16();
+						target = (uint32_t) (ip - function->code) + offset;
+
+						break;
+					}
+
+					case FUNK_INSTRUCTION_JUMP_IF_REDEFINED: {
+						operand = READ_UINT8();
+						uint16_t offset = READ_UINT16();
+						target = (uint32_t) (ip - function->code) + offset;
+
+						break;
+					}
+
+					case FUNK_INSTRUCTION_PUSH_SCOPE: {
+						operand = (uint32_t) (ip - function->code - 1);
+						ip += 3;
+
+						break;
+					}
+
+					case FUNK_INSTRUCTION_DEFINE_LOCAL: {
+						operand = READ_UINT8();
+						constant = READ_CONSTANT();
+
+						break;
+					}
+
+					case FUNK_INSTRUCTION_GET:
+					case FUNK_INSTRUCTION_GET_STRING:
+					case FUNK_INSTRUCTION_GET_LEXICAL:
+					case FUNK_INSTRUCTION_GET_LEXICAL_STRING:
+					case FUNK_INSTRUCTION_DEFINE:
+					case FUNK_INSTRUCTION_DEFINE_GLOBAL:
+					case FUNK_INSTRUCTION_CLOSURE:
+					case FUNK_INSTRUCTION_SET: constant = READ_CONSTANT(); break;
+
+					default: return false;
+				}
+
+				emit_helper_call(buffer, helpers[instruction], constant, operand, target);
+				break;
+			}
+		}
+	}
+
+	#undef READ_UINT8
+	#undef READ_UINT16
+	#undef READ_CONSTANT
+
+	return true;
+}
+
+bool funk_jit_is_supported() {
+	return true;
+}
+
+void* funk_jit_compile(FunkVm* vm, FunkBasicFunction* function, const FunkJitHelper* helpers, uint32_t* size) {
+	uint32_t capacity = function->codeLength * FUNK_JIT_BYTES_PER_INSTRUCTION + FUNK_JIT_PROLOGUE_SIZE;
+
+	FunkJitBuffer buffer;
+
+	buffer.code = FUNK_ALLOCATE(vm, uint8_t, capacity);
+	buffer.length = 0;
+	// A jump can land right after the last instruction
+	buffer.offsets = FUNK_ALLOCATE(vm, uint32_t, function->codeLength + 1);
+	buffer.jumps = FUNK_ALLOCATE(vm, FunkJitJump, function->codeLength);
+	buffer.jumpCount = 0;
+
+	emit_prologue(&buffer);
+
+	bool compiled = emit_instructions(&buffer, function, helpers);
+	void* code = NULL;
+
+	if (compiled) {
+		buffer.offsets[function->codeLength] = buffer.length;
+
+		for (uint32_t i = 0; i < buffer.jumpCount; i++) {
+			FunkJitJump* jump = &buffer.jumps[i];
+			uint32_t target = jump->target == FUNK_JIT_EPILOGUE ? buffer.length : buffer.offsets[jump->target];
+			int32_t offset = (int32_t) target - (int32_t) (jump->position + sizeof(uint32_t));
+
+			memcpy((void*) (buffer.code + jump->position), &offset, sizeof(int32_t));
+		}
+
+		emit_epilogue(&buffer);
+
+		// The pages are never writable and executable at the same time
+		long pageSize = sysconf(_SC_PAGESIZE);
+		*size = (uint32_t) ((buffer.length + pageSize - 1) / pageSize * pageSize);
+
+		code = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (code == MAP_FAILED) {
+			code = NULL;
+		} else {
+			memcpy(code, (void*) buffer.code, buffer.length);
+
+			if (mprotect(code, *size, PROT_READ | PROT_EXEC) != 0) {
+				munmap(code, *size);
+				code = NULL;
+			}
+		}
+	}
+
+	FUNK_FREE_ARRAY(vm, uint8_t, buffer.code, capacity);
+	FUNK_FREE_ARRAY(vm, uint32_t, buffer.offsets, function->codeLength + 1);
+	FUNK_FREE_ARRAY(vm, FunkJitJump, buffer.jumps, function->codeLength);
+
+	return code;
+}
+
+void funk_jit_free(void* code, uint32_t size) {
+	munmap(code, size);
+}
+
+#else
+
+bool funk_jit_is_supported() {
+	return false;
+}
+
+void* funk_jit_compile(FunkVm* vm, FunkBasicFunction* function, const FunkJitHelper* helpers, uint32_t* size) {
+	return NULL;
+}
+
+void funk_jit_free(void* code, uint32_t size) {
+
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef FUNK_JIT_H
+#define FUNK_JIT_H
+
+#include "funk.h"
+
+// The generated code keeps a pointer to the frame in a callee-saved register, helpers get it as the first argument
+typedef struct FunkJitFrame {
+	FunkVm* vm;
+	FunkCallFrame* callFrame;
+	FunkFunction** slots;
+	FunkFunction** upvalues;
+	// The frames of the inlined lambdas, callFrame is the innermost one, that runs
+	FunkInlineFrame* inlineFrames;
+	FunkFunction* result;
+} FunkJitFrame;
+
+// Runs one instruction, that is too big to be inlined, the constant is already read from the function.
+// Returns false, once the function has to stop: it returned, or the call failed
+typedef bool (*FunkJitHelper)(FunkJitFrame* frame, FunkObject* constant, uint32_t operand);
+typedef void (*FunkJitCode)(FunkJitFrame* frame);
+
+// False on the hosts, that the jit can't generate code for, the interpreter is used there
+bool funk_jit_is_supported();
+// Returns NULL, if the function can't be compiled. Helpers are indexed by the instruction
+void* funk_jit_compile(FunkVm* vm, FunkBasicFunction* function, const FunkJitHelper* helpers, uint32_t* size);
+void funk_jit_free(void* code, uint32_t size);
+
+// The helpers of the interpreter, indexed by the instruction, funkc calls them from the C code it writes
+const FunkJitHelper* funk_get_jit_helpers();
+
+#endif
@@ -0,0 +1,1033 @@
+#if defined(__linux__)
+	// accept4() is an extension
+	#define _GNU_SOURCE
+#endif
+
+#include "funk_loop.h"
+#include "funk_channel.h"
+#include "funk_snapshot.h"
+
+#include <string.h>
+
+#if defined(__linux__)
+	#define FUNK_LOOP
+	#include <errno.h>
+	#include <math.h>
+	#include <stdio.h>
+	#include <stdlib.h>
+	#include <time.h>
+	#include <unistd.h>
+	#include <arpa/inet.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <sys/epoll.h>
+	#include <sys/socket.h>
+	#include <sys/un.h>
+#endif
+
+#ifdef FUNK_LOOP
+
+// Strings are at most 65535 bytes long, chunks stay well below
+#define FUNK_LOOP_CHUNK_SIZE 16384
+#define FUNK_LOOP_EVENT_COUNT 64
+// Handed out in one go, before the other handles get their turn
+#define FUNK_LOOP_ACCEPT_BATCH 64
+#define FUNK_LOOP_LINE_BATCH 64
+#define FUNK_LOOP_MESSAGE_BATCH 64
+
+typedef enum {
+	FUNK_HANDLE_SERVER,
+	FUNK_HANDLE_CONNECTING,
+	FUNK_HANDLE_SOCKET,
+	FUNK_HANDLE_TIMER,
+	FUNK_HANDLE_READER,
+	FUNK_HANDLE_RECEIVER
+} FunkHandleType;
+
+typedef struct FunkHandle {
+	FunkHandleType type;
+	FunkFunction* self;
+	bool closed;
+
+	int fd;
+	uint32_t events;
+	// Of a connection, that failed right away
+	int error;
+
+	// Gets the accepted sockets, the connected socket, the lines, the messages or nothing for the timers
+	FunkFunction* callback;
+	FunkFunction* dataCallback;
+	FunkFunction* closeCallback;
+
+	char* output;
+	uint32_t outputStart;
+	uint32_t outputLength;
+	uint32_t outputAllocated;
+	bool closeWhenSent;
+
+	double deadline;
+	double interval;
+	uint32_t heapIndex;
+
+	FILE* file;
+	// Unix socket servers remove their file, once they are closed
+	char* path;
+
+	// Receivers watch the descriptor of their channel, but don't own it
+	FunkChannel* channel;
+} FunkHandle;
+
+typedef struct FunkLoop {
+	int epollFd;
+	bool running;
+
+	// Closed handles stay here until the end of the loop round, so that the events of the round can still see them
+	FunkFunction** handles;
+	uint32_t handleCount;
+	uint32_t handlesAllocated;
+	uint32_t openCount;
+	// Handles, that have something to do without waiting for an event
+	uint32_t readerCount;
+	uint32_t failedCount;
+
+	// A min-heap by the deadline
+	FunkHandle** timers;
+	uint32_t timerCount;
+	uint32_t timersAllocated;
+} FunkLoop;
+
+// Calling a handle does nothing, it's only passed around
+static FunkFunction* handle_callback(FunkVm* vm, FunkNativeFunction* self, FunkFunction** args, uint8_t argCount) {
+	return NULL;
+}
+
+static void cleanup_loop(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data == NULL) {
+		return;
+	}
+
+	FunkLoop* loop = (FunkLoop*) function->data;
+
+	close(loop->epollFd);
+
+	FUNK_FREE_ARRAY(vm, FunkFunction*, loop->handles, loop->handlesAllocated);
+	FUNK_FREE_ARRAY(vm, FunkHandle*, loop->timers, loop->timersAllocated);
+	FUNK_FREE(vm, FunkLoop, loop);
+
+	function->data = NULL;
+}
+
+static void trace_loop(FunkVm* vm, FunkNativeFunction* function) {
+	FunkLoop* loop = (FunkLoop*) function->data;
+
+	for (uint32_t i = 0; i < loop->handleCount; i++) {
+		funk_mark_object(vm, (FunkObject *) loop->handles[i]);
+	}
+}
+
+static FunkLoop* get_loop(FunkVm* vm) {
+	if (vm->loop != NULL) {
+		return (FunkLoop*) ((FunkNativeFunction*) vm->loop)->data;
+	}
+
+	if (vm->parent != NULL) {
+		funk_error(vm, "The event loop can't be used in parallel functions");
+		return NULL;
+	}
+
+	int epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (epollFd < 0) {
+		funk_error(vm, "Failed to create the event loop");
+		return NULL;
+	}
+
+	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, "$loopData", 9), (FunkNativeFn) handle_callback);
+	FunkLoop* loop = FUNK_ALLOCATE(vm, FunkLoop, 1);
+
+	memset((void*) loop, 0, sizeof(FunkLoop));
+	loop->epollFd = epollFd;
+
+	function->cleanupFn = cleanup_loop;
+	function->traceFn = trace_loop;
+	function->data = (void*) loop;
+
+	vm->loop = (FunkFunction *) function;
+	return loop;
+}
+
+// Only called for handles, that are unreachable, so they never touch the loop
+static void cleanup_handle(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data == NULL) {
+		return;
+	}
+
+	FunkHandle* handle = (FunkHandle*) function->data;
+
+	if (handle->channel != NULL) {
+		if (handle->fd >= 0) {
+			funk_unwatch_channel(handle->channel);
+		}
+
+		funk_release_channel(handle->channel);
+	} else if (handle->fd >= 0) {
+		close(handle->fd);
+	}
+
+	if (handle->file != NULL) {
+		fclose(handle->file);
+	}
+
+	if (handle->path != NULL) {
+		FUNK_FREE_ARRAY(vm, char, handle->path, strlen(handle->path) + 1);
+	}
+
+	FUNK_FREE_ARRAY(vm, char, handle->output, handle->outputAllocated);
+	FUNK_FREE(vm, FunkHandle, handle);
+
+	function->data = NULL;
+}
+
+static void trace_handle(FunkVm* vm, FunkNativeFunction* function) {
+	FunkHandle* handle = (FunkHandle*) function->data;
+
+	funk_mark_object(vm, (FunkObject *) handle->callback);
+	funk_mark_object(vm, (FunkObject *) handle->dataCallback);
+	funk_mark_object(vm, (FunkObject *) handle->closeCallback);
+}
+
+bool funk_is_loop_handle(FunkFunction* function) {
+	return function != NULL && function->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) function)->cleanupFn == cleanup_handle;
+}
+
+static FunkHandle* extract_handle(FunkVm* vm, FunkFunction* function) {
+	if (!funk_is_loop_handle(function)) {
+		funk_error(vm, "Expected a socket, timer or file reader as argument");
+		return NULL;
+	}
+
+	return (FunkHandle*) ((FunkNativeFunction*) function)->data;
+}
+
+static FunkHandle* create_handle(FunkVm* vm, FunkLoop* loop, FunkHandleType type, const char* name, int fd) {
+	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, name, strlen(name)), (FunkNativeFn) handle_callback);
+	FunkHandle* handle = FUNK_ALLOCATE(vm, FunkHandle, 1);
+
+	memset((void*) handle, 0, sizeof(FunkHandle));
+	handle->type = type;
+	handle->self = (FunkFunction *) function;
+	handle->fd = fd;
+
+	function->cleanupFn = cleanup_handle;
+	function->traceFn = trace_handle;
+	function->data = (void*) handle;
+
+	if (loop->handleCount + 1 > loop->handlesAllocated) {
+		uint32_t allocated = FUNK_GROW_CAPACITY(loop->handlesAllocated);
+
+		loop->handles = FUNK_GROW_ARRAY(vm, FunkFunction*, loop->handles, loop->handlesAllocated, allocated);
+		loop->handlesAllocated = allocated;
+	}
+
+	loop->handles[loop->handleCount++] = (FunkFunction *) function;
+	loop->openCount++;
+	funk_write_barrier(vm, vm->loop, (FunkObject *) function);
+
+	return handle;
+}
+
+static void set_callback(FunkVm* vm, FunkHandle* handle, FunkFunction** slot, FunkFunction* callback) {
+	*slot = callback;
+	funk_write_barrier(vm, handle->self, (FunkObject *) callback);
+}
+
+static bool watch(FunkLoop* loop, FunkHandle* handle, uint32_t events) {
+	if (handle->closed || handle->fd < 0 || handle->events == events) {
+		return true;
+	}
+
+	struct epoll_event event;
+	event.events = events;
+	event.data.ptr = (void*) handle;
+
+	handle->events = events;
+	return epoll_ctl(loop->epollFd, EPOLL_CTL_MOD, handle->fd, &event) == 0;
+}
+
+static bool add_to_epoll(FunkLoop* loop, FunkHandle* handle, uint32_t events) {
+	struct epoll_event event;
+	event.events = events;
+	event.data.ptr = (void*) handle;
+
+	handle->events = events;
+	return epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, handle->fd, &event) == 0;
+}
+
+static uint32_t socket_events(FunkHandle* handle) {
+	uint32_t events = EPOLLRDHUP;
+
+	if (handle->dataCallback != NULL) {
+		events |= EPOLLIN;
+	}
+
+	if (handle->outputLength > 0) {
+		events |= EPOLLOUT;
+	}
+
+	return events;
+}
+
+static double current_milliseconds() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (double) time.tv_sec * 1e3 + (double) time.tv_nsec / 1e6;
+}
+
+static void swap_timers(FunkLoop* loop, uint32_t a, uint32_t b) {
+	FunkHandle* timer = loop->timers[a];
+
+	loop->timers[a] = loop->timers[b];
+	loop->timers[b] = timer;
+	loop->timers[a]->heapIndex = a;
+	loop->timers[b]->heapIndex = b;
+}
+
+static void sift_timer_up(FunkLoop* loop, uint32_t index) {
+	while (index > 0) {
+		uint32_t parent = (index - 1) / 2;
+
+		if (loop->timers[parent]->deadline <= loop->timers[index]->deadline) {
+			break;
+		}
+
+		swap_timers(loop, parent, index);
+		index = parent;
+	}
+}
+
+static void sift_timer_down(FunkLoop* loop, uint32_t index) {
+	while (true) {
+		uint32_t smallest = index;
+		uint32_t left = index * 2 + 1;
+		uint32_t right = left + 1;
+
+		if (left < loop->timerCount && loop->timers[left]->deadline < loop->timers[smallest]->deadline) {
+			smallest = left;
+		}
+
+		if (right < loop->timerCount && loop->timers[right]->deadline < loop->timers[smallest]->deadline) {
+			smallest = right;
+		}
+
+		if (smallest == index) {
+			return;
+		}
+
+		swap_timers(loop, smallest, index);
+		index = smallest;
+	}
+}
+
+static void push_timer(FunkVm* vm, FunkLoop* loop, FunkHandle* timer) {
+	if (loop->timerCount + 1 > loop->timersAllocated) {
+		uint32_t allocated = FUNK_GROW_CAPACITY(loop->timersAllocated);
+
+		loop->timers = FUNK_GROW_ARRAY(vm, FunkHandle*, loop->timers, loop->timersAllocated, allocated);
+		loop->timersAllocated = allocated;
+	}
+
+	timer->heapIndex = loop->timerCount;
+	loop->timers[loop->timerCount++] = timer;
+	sift_timer_up(loop, timer->heapIndex);
+}
+
+static void remove_timer(FunkLoop* loop, FunkHandle* timer) {
+	uint32_t index = timer->heapIndex;
+	loop->timerCount--;
+
+	if (index == loop->timerCount) {
+		return;
+	}
+
+	swap_timers(loop, index, loop->timerCount);
+	sift_timer_down(loop, index);
+	sift_timer_up(loop, index);
+}
+
+static void run_callback(FunkVm* vm, FunkFunction* callback, FunkFunction* argument) {
+	if (callback != NULL) {
+		funk_run_function_arged(vm, callback, &argument, argument == NULL ? 0 : 1);
+	}
+}
+
+static void close_handle(FunkVm* vm, FunkLoop* loop, FunkHandle* handle) {
+	if (handle->closed) {
+		return;
+	}
+
+	handle->closed = true;
+	loop->openCount--;
+
+	if (handle->channel != NULL && handle->fd >= 0) {
+		// Other handles can watch the same channel, so its descriptor stays open
+		epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, handle->fd, NULL);
+		funk_unwatch_channel(handle->channel);
+		handle->fd = -1;
+	} else if (handle->fd >= 0) {
+		// Closing the descriptor takes it out of the epoll set as well
+		close(handle->fd);
+		handle->fd = -1;
+	}
+
+	if (handle->file != NULL) {
+		fclose(handle->file);
+		handle->file = NULL;
+		loop->readerCount--;
+	}
+
+	if (handle->path != NULL) {
+		unlink(handle->path);
+	}
+
+	if (handle->type == FUNK_HANDLE_TIMER) {
+		remove_timer(loop, handle);
+	} else if (handle->type == FUNK_HANDLE_CONNECTING && handle->error != 0) {
+		loop->failedCount--;
+	}
+
+	run_callback(vm, handle->closeCallback, handle->type == FUNK_HANDLE_READER ? NULL : handle->self);
+}
+
+// Returns false, if the socket failed and was closed
+static bool flush_output(FunkVm* vm, FunkLoop* loop, FunkHandle* handle) {
+	while (handle->outputLength > 0) {
+		ssize_t sent = send(handle->fd, handle->output + handle->outputStart, handle->outputLength, MSG_NOSIGNAL);
+
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+
+			close_handle(vm, loop, handle);
+			return false;
+		}
+
+		handle->outputStart += (uint32_t) sent;
+		handle->outputLength -= (uint32_t) sent;
+	}
+
+	if (handle->outputLength == 0) {
+		handle->outputStart = 0;
+
+		if (handle->closeWhenSent) {
+			close_handle(vm, loop, handle);
+			return false;
+		}
+	}
+
+	watch(loop, handle, socket_events(handle));
+	return true;
+}
+
+static int create_socket(FunkVm* vm, const char* address, struct sockaddr_storage* storage, socklen_t* length) {
+	memset((void*) storage, 0, sizeof(struct sockaddr_storage));
+
+	if (strchr(address, '/') != NULL) {
+		struct sockaddr_un* unixAddress = (struct sockaddr_un*) storage;
+
+		if (strlen(address) >= sizeof(unixAddress->sun_path)) {
+			funk_error(vm, "The socket path '%s' is too long", address);
+			return -1;
+		}
+
+		unixAddress->sun_family = AF_UNIX;
+		strcpy(unixAddress->sun_path, address);
+		*length = sizeof(struct sockaddr_un);
+
+		return socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	}
+
+	struct sockaddr_in* inetAddress = (struct sockaddr_in*) storage;
+	inetAddress->sin_family = AF_INET;
+	inetAddress->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	*length = sizeof(struct sockaddr_in);
+
+	return socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+}
+
+static void set_port(FunkVm* vm, const char* address, struct sockaddr_storage* storage) {
+	if (storage->ss_family == AF_INET) {
+		FunkFunction* port = (FunkFunction *) funk_create_basic_function(vm, funk_create_string(vm, address, strlen(address)));
+		((struct sockaddr_in*) storage)->sin_port = htons((uint16_t) funk_to_number(vm, port));
+	}
+}
+
+bool funk_loop_is_supported() {
+	return true;
+}
+
+FunkFunction* funk_loop_listen(FunkVm* vm, const char* address, FunkFunction* callback) {
+	FunkLoop* loop = get_loop(vm);
+	struct sockaddr_storage storage;
+	socklen_t length;
+
+	int fd = create_socket(vm, address, &storage, &length);
+
+	if (fd < 0) {
+		funk_error(vm, "Failed to listen on '%s'", address);
+		return NULL;
+	}
+
+	int enabled = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enabled, sizeof(enabled));
+	set_port(vm, address, &storage);
+
+	if (bind(fd, (struct sockaddr*) &storage, length) != 0 || listen(fd, SOMAXCONN) != 0) {
+		close(fd);
+		funk_error(vm, "Failed to listen on '%s'", address);
+
+		return NULL;
+	}
+
+	FunkHandle* handle = create_handle(vm, loop, FUNK_HANDLE_SERVER, "$serverData", fd);
+	handle->callback = callback;
+
+	if (storage.ss_family == AF_UNIX) {
+		size_t pathLength = strlen(address);
+
+		handle->path = FUNK_ALLOCATE(vm, char, pathLength + 1);
+		memcpy((void*) handle->path, (void*) address, pathLength + 1);
+	}
+
+	add_to_epoll(loop, handle, EPOLLIN);
+	return handle->self;
+}
+
+FunkFunction* funk_loop_connect(FunkVm* vm, const char* address, FunkFunction* callback) {
+	FunkLoop* loop = get_loop(vm);
+	struct sockaddr_storage storage;
+	socklen_t length;
+
+	int fd = create_socket(vm, address, &storage, &length);
+
+	if (fd < 0) {
+		funk_error(vm, "Failed to connect to '%s'", address);
+		return NULL;
+	}
+
+	set_port(vm, address, &storage);
+
+	FunkHandle* handle = create_handle(vm, loop, FUNK_HANDLE_CONNECTING, "$socketData", fd);
+	handle->callback = callback;
+
+	// Whether it connects right away or not, the callback is called from the loop, once the socket is writable.
+	// Connections, that fail later, are seen there too, as an error on the socket
+	if (connect(fd, (struct sockaddr*) &storage, length) != 0 && errno != EINPROGRESS) {
+		handle->error = errno;
+		loop->failedCount++;
+
+		return handle->self;
+	}
+
+	add_to_epoll(loop, handle, EPOLLOUT);
+	return handle->self;
+}
+
+void funk_loop_pipe(FunkVm* vm, FunkFunction** ends) {
+	FunkLoop* loop = get_loop(vm);
+	int fds[2];
+
+	// A socket pair instead of a pipe, so that writes to a closed end fail with an error instead of SIGPIPE
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) != 0) {
+		funk_error(vm, "Failed to create a pipe");
+		return;
+	}
+
+	for (uint8_t i = 0; i < 2; i++) {
+		FunkHandle* handle = create_handle(vm, loop, FUNK_HANDLE_SOCKET, "$socketData", fds[i]);
+
+		add_to_epoll(loop, handle, socket_events(handle));
+		ends[i] = handle->self;
+	}
+}
+
+FunkFunction* funk_loop_timer(FunkVm* vm, double milliseconds, bool repeat, FunkFunction* callback) {
+	FunkLoop* loop = get_loop(vm);
+	FunkHandle* handle = create_handle(vm, loop, FUNK_HANDLE_TIMER, "$timerData", -1);
+
+	handle->callback = callback;
+	handle->interval = repeat ? fmax(milliseconds, 1) : 0;
+	handle->deadline = current_milliseconds() + milliseconds;
+
+	push_timer(vm, loop, handle);
+	return handle->self;
+}
+
+FunkFunction* funk_loop_read_lines(FunkVm* vm, const char* path, FunkFunction* callback) {
+	FunkLoop* loop = get_loop(vm);
+	FILE* file = fopen(path, "r");
+
+	if (file == NULL) {
+		funk_error(vm, "Failed to open '%s'", path);
+		return NULL;
+	}
+
+	FunkHandle* handle = create_handle(vm, loop, FUNK_HANDLE_READER, "$readerData", -1);
+
+	handle->callback = callback;
+	handle->file = file;
+	loop->readerCount++;
+
+	return handle->self;
+}
+
+FunkFunction* funk_loop_on_message(FunkVm* vm, FunkFunction* channel, FunkFunction* callback) {
+	FunkChannel* source = funk_extract_channel(vm, channel);
+	FunkLoop* loop = get_loop(vm);
+	int fd = funk_watch_channel(source);
+
+	if (fd < 0) {
+		funk_error(vm, "Failed to watch the channel");
+		return NULL;
+	}
+
+	FunkHandle* handle = create_handle(vm, loop, FUNK_HANDLE_RECEIVER, "$receiverData", fd);
+
+	funk_retain_channel(source);
+	handle->channel = source;
+	handle->callback = callback;
+
+	if (!add_to_epoll(loop, handle, EPOLLIN)) {
+		close_handle(vm, loop, handle);
+		funk_error(vm, "Failed to watch the channel");
+
+		return NULL;
+	}
+
+	return handle->self;
+}
+
+void funk_loop_on_data(FunkVm* vm, FunkFunction* socket, FunkFunction* callback) {
+	FunkHandle* handle = extract_handle(vm, socket);
+
+	if (handle->type != FUNK_HANDLE_SOCKET && handle->type != FUNK_HANDLE_CONNECTING) {
+		funk_error(vm, "Expected a socket as argument");
+		return;
+	}
+
+	set_callback(vm, handle, &handle->dataCallback, callback);
+
+	if (handle->type == FUNK_HANDLE_SOCKET && !watch(get_loop(vm), handle, socket_events(handle))) {
+		funk_error(vm, "Failed to watch the socket");
+	}
+}
+
+void funk_loop_on_close(FunkVm* vm, FunkFunction* function, FunkFunction* callback) {
+	FunkHandle* handle = extract_handle(vm, function);
+	set_callback(vm, handle, &handle->closeCallback, callback);
+}
+
+void funk_loop_send(FunkVm* vm, FunkFunction* socket, const char* data, uint32_t length) {
+	FunkHandle* handle = extract_handle(vm, socket);
+
+	if (handle->type != FUNK_HANDLE_SOCKET && handle->type != FUNK_HANDLE_CONNECTING) {
+		funk_error(vm, "Expected a socket as argument");
+		return;
+	}
+
+	if (handle->closed || handle->closeWhenSent) {
+		funk_error(vm, "The socket is closed");
+		return;
+	}
+
+	if (length == 0) {
+		return;
+	}
+
+	uint32_t end = handle->outputStart + handle->outputLength;
+
+	if (end + length > handle->outputAllocated) {
+		// Moves the unsent rest to the front, before growing
+		if (handle->outputStart > 0) {
+			memmove((void*) handle->output, (void*) (handle->output + handle->outputStart), handle->outputLength);
+			handle->outputStart = 0;
+			end = handle->outputLength;
+		}
+
+		uint32_t allocated = handle->outputAllocated;
+
+		while (end + length > allocated) {
+			allocated = FUNK_GROW_CAPACITY(allocated);
+		}
+
+		if (allocated != handle->outputAllocated) {
+			handle->output = FUNK_GROW_ARRAY(vm, char, handle->output, handle->outputAllocated, allocated);
+			handle->outputAllocated = allocated;
+		}
+	}
+
+	memcpy((void*) (handle->output + end), (void*) data, length);
+	handle->outputLength += length;
+
+	// Sockets, that are still connecting, send everything, once they are connected
+	if (handle->type == FUNK_HANDLE_SOCKET) {
+		flush_output(vm, get_loop(vm), handle);
+	}
+}
+
+uint16_t funk_loop_port(FunkVm* vm, FunkFunction* server) {
+	FunkHandle* handle = extract_handle(vm, server);
+
+	if (handle->type != FUNK_HANDLE_SERVER || handle->closed) {
+		funk_error(vm, "Expected an open server as argument");
+		return 0;
+	}
+
+	struct sockaddr_storage storage;
+	socklen_t length = sizeof(storage);
+
+	if (getsockname(handle->fd, (struct sockaddr*) &storage, &length) != 0 || storage.ss_family != AF_INET) {
+		return 0;
+	}
+
+	return ntohs(((struct sockaddr_in*) &storage)->sin_port);
+}
+
+void funk_loop_close(FunkVm* vm, FunkFunction* function) {
+	FunkHandle* handle = extract_handle(vm, function);
+
+	if (handle->type == FUNK_HANDLE_SOCKET && handle->outputLength > 0 && !handle->closed) {
+		handle->closeWhenSent = true;
+		return;
+	}
+
+	close_handle(vm, get_loop(vm), handle);
+}
+
+static void accept_sockets(FunkVm* vm, FunkLoop* loop, FunkHandle* server) {
+	for (uint32_t i = 0; i < FUNK_LOOP_ACCEPT_BATCH && !server->closed; i++) {
+		int fd = accept4(server->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (fd < 0) {
+			// Out of descriptors or an aborted connection, the rest waits for the next round
+			return;
+		}
+
+		FunkHandle* handle = create_handle(vm, loop, FUNK_HANDLE_SOCKET, "$socketData", fd);
+		add_to_epoll(loop, handle, socket_events(handle));
+
+		run_callback(vm, server->callback, handle->self);
+	}
+}
+
+static void finish_connecting(FunkVm* vm, FunkLoop* loop, FunkHandle* handle) {
+	int error = 0;
+	socklen_t length = sizeof(error);
+
+	if (handle->error != 0 || getsockopt(handle->fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+		close_handle(vm, loop, handle);
+		run_callback(vm, handle->callback, NULL);
+
+		return;
+	}
+
+	handle->type = FUNK_HANDLE_SOCKET;
+
+	if (handle->outputLength > 0 && !flush_output(vm, loop, handle)) {
+		return;
+	}
+
+	watch(loop, handle, socket_events(handle));
+
+	if (handle->callback != NULL) {
+		FunkFunction* argument = handle->self;
+		funk_run_function_arged(vm, handle->callback, &argument, 1);
+	}
+}
+
+static void receive(FunkVm* vm, FunkLoop* loop, FunkHandle* handle) {
+	char buffer[FUNK_LOOP_CHUNK_SIZE];
+	ssize_t received = recv(handle->fd, buffer, FUNK_LOOP_CHUNK_SIZE, 0);
+
+	if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return;
+	}
+
+	if (received <= 0) {
+		close_handle(vm, loop, handle);
+		return;
+	}
+
+	FunkFunction* chunk = (FunkFunction *) funk_create_basic_function(vm, funk_create_string(vm, buffer, (uint16_t) received));
+	run_callback(vm, handle->dataCallback, chunk);
+}
+
+static void receive_messages(FunkVm* vm, FunkLoop* loop, FunkHandle* handle) {
+	// Cleared first, so that the messages, that are sent in between, signal it again
+	funk_set_channel_signal(handle->channel, false);
+
+	for (uint32_t i = 0; i < FUNK_LOOP_MESSAGE_BATCH && !handle->closed; i++) {
+		void* message;
+		uint32_t size;
+
+		bool popped = funk_channel_pop(handle->channel, &message, &size, false);
+
+		if (!popped && funk_is_channel_closed(handle->channel)) {
+			// The messages, that were sent right before the channel was closed, still come first
+			popped = funk_channel_pop(handle->channel, &message, &size, false);
+
+			if (!popped) {
+				close_handle(vm, loop, handle);
+			}
+		}
+
+		if (!popped) {
+			return;
+		}
+
+		run_callback(vm, handle->callback, funk_decode_message(vm, message, size));
+	}
+
+	// The rest waits for the next round, so that the other handles get their turn
+	if (!handle->closed) {
+		funk_set_channel_signal(handle->channel, true);
+	}
+}
+
+static void dispatch(FunkVm* vm, FunkLoop* loop, FunkHandle* handle, uint32_t events) {
+	switch (handle->type) {
+		case FUNK_HANDLE_SERVER: {
+			accept_sockets(vm, loop, handle);
+			break;
+		}
+
+		case FUNK_HANDLE_CONNECTING: {
+			finish_connecting(vm, loop, handle);
+			break;
+		}
+
+		case FUNK_HANDLE_SOCKET: {
+			if ((events & EPOLLOUT) && !flush_output(vm, loop, handle)) {
+				return;
+			}
+
+			if ((events & EPOLLIN) && handle->dataCallback != NULL) {
+				receive(vm, loop, handle);
+			} else if (events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
+				// Without a data callback the rest of the data is dropped
+				close_handle(vm, loop, handle);
+			}
+
+			break;
+		}
+
+		case FUNK_HANDLE_RECEIVER: {
+			receive_messages(vm, loop, handle);
+			break;
+		}
+
+		default: break;
+	}
+}
+
+static void run_timers(FunkVm* vm, FunkLoop* loop) {
+	double now = current_milliseconds();
+
+	while (loop->timerCount > 0 && loop->timers[0]->deadline <= now) {
+		FunkHandle* timer = loop->timers[0];
+
+		if (timer->interval > 0) {
+			timer->deadline = fmax(timer->deadline + timer->interval, now);
+			sift_timer_down(loop, 0);
+
+			run_callback(vm, timer->callback, NULL);
+		} else {
+			close_handle(vm, loop, timer);
+			run_callback(vm, timer->callback, NULL);
+		}
+	}
+}
+
+static void fail_connections(FunkVm* vm, FunkLoop* loop) {
+	for (uint32_t i = 0; i < loop->handleCount; i++) {
+		FunkHandle* handle = (FunkHandle*) ((FunkNativeFunction*) loop->handles[i])->data;
+
+		if (handle->type == FUNK_HANDLE_CONNECTING && handle->error != 0 && !handle->closed) {
+			finish_connecting(vm, loop, handle);
+		}
+	}
+}
+
+static void read_lines(FunkVm* vm, FunkLoop* loop) {
+	char* line = NULL;
+	size_t allocated = 0;
+
+	for (uint32_t i = 0; i < loop->handleCount; i++) {
+		FunkHandle* handle = (FunkHandle*) ((FunkNativeFunction*) loop->handles[i])->data;
+
+		for (uint32_t j = 0; j < FUNK_LOOP_LINE_BATCH && handle->file != NULL; j++) {
+			ssize_t length = getline(&line, &allocated, handle->file);
+
+			if (length < 0) {
+				close_handle(vm, loop, handle);
+				break;
+			}
+
+			if (length > 0 && line[length - 1] == '\n') {
+				length--;
+			}
+
+			if (length > UINT16_MAX) {
+				free(line);
+				close_handle(vm, loop, handle);
+				funk_error(vm, "A line of %zd bytes doesn't fit into a string, read the file in parts with readAt()", length);
+
+				return;
+			}
+
+			FunkFunction* string = (FunkFunction *) funk_create_basic_function(vm, funk_create_string(vm, line, (uint16_t) length));
+			run_callback(vm, handle->callback, string);
+		}
+	}
+
+	free(line);
+}
+
+static void remove_closed_handles(FunkLoop* loop) {
+	uint32_t count = 0;
+
+	for (uint32_t i = 0; i < loop->handleCount; i++) {
+		FunkHandle* handle = (FunkHandle*) ((FunkNativeFunction*) loop->handles[i])->data;
+
+		if (!handle->closed) {
+			loop->handles[count++] = loop->handles[i];
+		}
+	}
+
+	loop->handleCount = count;
+}
+
+void funk_run_loop(FunkVm* vm) {
+	if (vm->loop == NULL) {
+		return;
+	}
+
+	FunkLoop* loop = get_loop(vm);
+
+	if (loop->running) {
+		funk_error(vm, "The event loop is already running");
+		return;
+	}
+
+	struct epoll_event events[FUNK_LOOP_EVENT_COUNT];
+	loop->running = true;
+
+	while (loop->openCount > 0) {
+		run_timers(vm, loop);
+		remove_closed_handles(loop);
+
+		if (loop->openCount == 0) {
+			break;
+		}
+
+		int timeout = -1;
+
+		if (loop->readerCount > 0 || loop->failedCount > 0) {
+			timeout = 0;
+		} else if (loop->timerCount > 0) {
+			timeout = (int) ceil(fmax(loop->timers[0]->deadline - current_milliseconds(), 0));
+		}
+
+		// What the callbacks printed shouldn't wait for the next event
+		if (timeout != 0) {
+			funk_flush_output(vm);
+		}
+
+		int count = epoll_wait(loop->epollFd, events, FUNK_LOOP_EVENT_COUNT, timeout);
+
+		for (int i = 0; i < count; i++) {
+			FunkHandle* handle = (FunkHandle*) events[i].data.ptr;
+
+			if (!handle->closed) {
+				dispatch(vm, loop, handle, events[i].events);
+			}
+		}
+
+		if (loop->failedCount > 0) {
+			fail_connections(vm, loop);
+		}
+
+		if (loop->readerCount > 0) {
+			read_lines(vm, loop);
+		}
+
+		remove_closed_handles(loop);
+	}
+
+	loop->running = false;
+}
+
+#else
+
+bool funk_loop_is_supported() {
+	return false;
+}
+
+FunkFunction* funk_loop_listen(FunkVm* vm, const char* address, FunkFunction* callback) {
+	funk_error(vm, "The event loop isn't supported on this platform");
+	return NULL;
+}
+
+FunkFunction* funk_loop_connect(FunkVm* vm, const char* address, FunkFunction* callback) {
+	funk_error(vm, "The event loop isn't supported on this platform");
+	return NULL;
+}
+
+void funk_loop_pipe(FunkVm* vm, FunkFunction** ends) {
+	funk_error(vm, "The event loop isn't supported on this platform");
+}
+
+FunkFunction* funk_loop_timer(FunkVm* vm, double milliseconds, bool repeat, FunkFunction* callback) {
+	funk_error(vm, "The event loop isn't supported on this platform");
+	return NULL;
+}
+
+FunkFunction* funk_loop_read_lines(FunkVm* vm, const char* path, FunkFunction* callback) {
+	funk_error(vm, "The event loop isn't supported on this platform");
+	return NULL;
+}
+
+FunkFunction* funk_loop_on_message(FunkVm* vm, FunkFunction* channel, FunkFunction* callback) {
+	funk_error(vm, "The event loop isn't supported on this platform");
+	return NULL;
+}
+
+void funk_loop_on_data(FunkVm* vm, FunkFunction* socket, FunkFunction* callback) {
+}
+
+void funk_loop_on_close(FunkVm* vm, FunkFunction* handle, FunkFunction* callback) {
+}
+
+void funk_loop_send(FunkVm* vm, FunkFunction* socket, const char* data, uint32_t length) {
+}
+
+uint16_t funk_loop_port(FunkVm* vm, FunkFunction* server) {
+	return 0;
+}
+
+bool funk_is_loop_handle(FunkFunction* function) {
+	return false;
+}
+
+void funk_loop_close(FunkVm* vm, FunkFunction* handle) {
+}
+
+void funk_run_loop(FunkVm* vm) {
+}
+
+#endif
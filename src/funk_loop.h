@@ -0,0 +1,44 @@
+#ifndef FUNK_LOOP_H
+#define FUNK_LOOP_H
+
+#include "funk.h"
+
+// Sockets, pipes, timers, file readers and channel receivers are handles of the event loop. Every open handle keeps funk_run_loop() running,
+// their callbacks are only ever called from there, one at a time, on the vm, that created them.
+// Sockets are non-blocking, so a script serves as many connections, as it has, instead of one at a time
+
+// False on the hosts without epoll, creating a handle is an error there
+bool funk_loop_is_supported();
+
+// Addresses with a '/' are paths of Unix sockets, anything else is a port on the loopback.
+// The callback gets every accepted socket
+FunkFunction* funk_loop_listen(FunkVm* vm, const char* address, FunkFunction* callback);
+// The callback gets the socket, once it is connected, or null, if connecting failed
+FunkFunction* funk_loop_connect(FunkVm* vm, const char* address, FunkFunction* callback);
+// Two connected sockets, what is sent to one of them, is received by the other
+void funk_loop_pipe(FunkVm* vm, FunkFunction** ends);
+// A timer, that isn't repeated, closes itself, once it has called the callback
+FunkFunction* funk_loop_timer(FunkVm* vm, double milliseconds, bool repeat, FunkFunction* callback);
+// Reads a few lines at a time, in between the other handles, the lines don't have the new line
+FunkFunction* funk_loop_read_lines(FunkVm* vm, const char* path, FunkFunction* callback);
+
+// A receiver handle, the callback gets every message, that the channel receives, the handle is closed with the channel,
+// once the messages, that were sent before, are handled
+FunkFunction* funk_loop_on_message(FunkVm* vm, FunkFunction* channel, FunkFunction* callback);
+// The callback gets every chunk of data, that the socket receives
+void funk_loop_on_data(FunkVm* vm, FunkFunction* socket, FunkFunction* callback);
+// Called once the handle is closed, by either side. The file readers are closed after the last line
+void funk_loop_on_close(FunkVm* vm, FunkFunction* handle, FunkFunction* callback);
+// What doesn't fit into the socket right away is buffered and sent, once it's writable
+void funk_loop_send(FunkVm* vm, FunkFunction* socket, const char* data, uint32_t length);
+// The port, that a server listens on, useful, when it was started on port 0
+uint16_t funk_loop_port(FunkVm* vm, FunkFunction* server);
+
+bool funk_is_loop_handle(FunkFunction* function);
+// Sockets with data, that isn't sent yet, are closed, once it is sent
+void funk_loop_close(FunkVm* vm, FunkFunction* handle);
+
+// Returns, once every handle is closed
+void funk_run_loop(FunkVm* vm);
+
+#endif
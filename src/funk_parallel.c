@@ -0,0 +1,236 @@
+#include "funk_parallel.h"
+#include "funk_simd.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define FUNK_ERROR_LENGTH 256
+
+typedef struct FunkWorker {
+	FunkWorkerPool* pool;
+	FunkVm* vm;
+	pthread_t thread;
+
+	bool failed;
+	char error[FUNK_ERROR_LENGTH];
+} FunkWorker;
+
+struct FunkWorkerPool {
+	FunkVm* parent;
+	FunkWorker* workers;
+	uint16_t workerCount;
+	uint16_t workersAllocated;
+
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+
+	FunkWorkerJobFn job;
+	void* userData;
+
+	uint32_t generation;
+	uint32_t chunkCount;
+	uint32_t nextChunk;
+	uint32_t finishedChunks;
+
+	bool stopping;
+	bool failed;
+	char error[FUNK_ERROR_LENGTH];
+};
+
+static void record_worker_error(FunkVm* vm, const char* error) {
+	if (vm == NULL) {
+		fprintf(stderr, "%s\n", error);
+		return;
+	}
+
+	FunkWorker* worker = (FunkWorker*) vm->userData;
+
+	if (!worker->failed) {
+		worker->failed = true;
+		snprintf(worker->error, FUNK_ERROR_LENGTH, "%s", error);
+	}
+}
+
+static void* run_worker(void* argument) {
+	FunkWorker* worker = (FunkWorker*) argument;
+	FunkWorkerPool* pool = worker->pool;
+	uint32_t generation = 0;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (true) {
+		while (!pool->stopping && pool->generation == generation) {
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		}
+
+		if (pool->stopping) {
+			break;
+		}
+
+		generation = pool->generation;
+
+		while (pool->nextChunk < pool->chunkCount) {
+			uint32_t chunk = pool->nextChunk++;
+
+			// Once a chunk has failed, the rest of the job is only counted off
+			if (!pool->failed) {
+				pthread_mutex_unlock(&pool->lock);
+
+				worker->vm->stackTop = worker->vm->stack;
+				worker->vm->callFrame = NULL;
+
+				pool->job(worker->vm, chunk, pool->userData);
+				pthread_mutex_lock(&pool->lock);
+
+				if (worker->failed) {
+					if (!pool->failed) {
+						pool->failed = true;
+						snprintf(pool->error, FUNK_ERROR_LENGTH, "%s", worker->error);
+					}
+
+					worker->failed = false;
+				}
+			}
+
+			if (++pool->finishedChunks == pool->chunkCount) {
+				pthread_cond_signal(&pool->done);
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+static uint16_t count_cpus() {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (count < 1) {
+		return 1;
+	}
+
+	return count > UINT16_MAX ? UINT16_MAX : (uint16_t) count;
+}
+
+FunkWorkerPool* funk_create_worker_pool(FunkVm* parent, uint16_t threadCount) {
+	if (threadCount == 0) {
+		threadCount = count_cpus();
+	}
+
+	// Detected once, before any of the workers can race for it
+	funk_detect_simd_level();
+
+	FunkWorkerPool* pool = FUNK_ALLOCATE(parent, FunkWorkerPool, 1);
+
+	pool->parent = parent;
+	pool->workers = FUNK_ALLOCATE(parent, FunkWorker, threadCount);
+	pool->workerCount = 0;
+	pool->workersAllocated = threadCount;
+
+	pool->job = NULL;
+	pool->userData = NULL;
+	pool->generation = 0;
+	pool->chunkCount = 0;
+	pool->nextChunk = 0;
+	pool->finishedChunks = 0;
+	pool->stopping = false;
+	pool->failed = false;
+	pool->error[0] = '\0';
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (uint16_t i = 0; i < threadCount; i++) {
+		FunkWorker* worker = &pool->workers[i];
+
+		worker->vm = funk_create_child_vm(parent, record_worker_error);
+
+		if (worker->vm == NULL) {
+			break;
+		}
+
+		worker->pool = pool;
+		worker->failed = false;
+		worker->vm->userData = (void*) worker;
+
+		if (pthread_create(&worker->thread, NULL, run_worker, (void*) worker) != 0) {
+			funk_free_vm(worker->vm);
+			break;
+		}
+
+		pool->workerCount++;
+	}
+
+	if (pool->workerCount == 0) {
+		funk_free_worker_pool(pool);
+		funk_error(parent, "Failed to start any worker threads");
+		return NULL;
+	}
+
+	return pool;
+}
+
+void funk_free_worker_pool(FunkWorkerPool* pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (uint16_t i = 0; i < pool->workerCount; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+		funk_free_vm(pool->workers[i].vm);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->wake);
+	pthread_cond_destroy(&pool->done);
+
+	FunkVm* parent = pool->parent;
+
+	FUNK_FREE_ARRAY(parent, FunkWorker, pool->workers, pool->workersAllocated);
+	FUNK_FREE(parent, FunkWorkerPool, pool);
+}
+
+uint16_t funk_get_worker_count(FunkWorkerPool* pool) {
+	return pool->workerCount;
+}
+
+bool funk_run_on_workers(FunkWorkerPool* pool, FunkWorkerJobFn job, void* userData, uint32_t chunkCount) {
+	pthread_mutex_lock(&pool->lock);
+
+	pool->job = job;
+	pool->userData = userData;
+	pool->chunkCount = chunkCount;
+	pool->nextChunk = 0;
+	pool->finishedChunks = 0;
+	pool->failed = false;
+	pool->error[0] = '\0';
+
+	if (chunkCount > 0) {
+		pool->generation++;
+		pthread_cond_broadcast(&pool->wake);
+
+		while (pool->finishedChunks < chunkCount) {
+			pthread_cond_wait(&pool->done, &pool->lock);
+		}
+	}
+
+	bool failed = pool->failed;
+	pthread_mutex_unlock(&pool->lock);
+
+	return !failed;
+}
+
+const char* funk_get_worker_error(FunkWorkerPool* pool) {
+	return pool->error;
+}
+
+void funk_reset_workers(FunkWorkerPool* pool) {
+	for (uint16_t i = 0; i < pool->workerCount; i++) {
+		funk_clear_vm(pool->workers[i].vm);
+	}
+}
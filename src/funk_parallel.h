@@ -0,0 +1,25 @@
+#ifndef FUNK_PARALLEL_H
+#define FUNK_PARALLEL_H
+
+#include "funk.h"
+
+// A set of threads, each owning a worker vm. Workers share the compiled code, strings and globals
+// of the parent vm read-only, so the parent must not run, while a job is in progress.
+typedef struct FunkWorkerPool FunkWorkerPool;
+
+// Runs one chunk of a job on the given worker vm
+typedef void (*FunkWorkerJobFn)(FunkVm* worker, uint32_t chunk, void* userData);
+
+// Thread count of 0 uses the number of online cpus
+FunkWorkerPool* funk_create_worker_pool(FunkVm* parent, uint16_t threadCount);
+void funk_free_worker_pool(FunkWorkerPool* pool);
+uint16_t funk_get_worker_count(FunkWorkerPool* pool);
+
+// Blocks, until every chunk is done. Returns false, if any of them has failed
+bool funk_run_on_workers(FunkWorkerPool* pool, FunkWorkerJobFn job, void* userData, uint32_t chunkCount);
+// The error of the first failed chunk in the last job
+const char* funk_get_worker_error(FunkWorkerPool* pool);
+// Frees everything, that the workers have allocated. Results must be copied into the parent before
+void funk_reset_workers(FunkWorkerPool* pool);
+
+#endif
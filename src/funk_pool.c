@@ -0,0 +1,298 @@
+#include "funk_pool.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FUNK_ERROR_LENGTH 256
+
+struct FunkJob {
+	FunkProgram* program;
+	char* function;
+	char** args;
+	uint8_t argCount;
+
+	char* result;
+	bool failed;
+	char error[FUNK_ERROR_LENGTH];
+
+	// Every job has its own, so that it can be waited for, even after the pool is gone
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	bool finished;
+
+	struct FunkJob* next;
+};
+
+typedef struct FunkJobThread {
+	FunkJobPool* pool;
+	pthread_t thread;
+
+	// The instance is kept for the next job of the same program
+	FunkProgram* program;
+	FunkVm* vm;
+	FunkJob* job;
+} FunkJobThread;
+
+struct FunkJobPool {
+	FunkJobThread* threads;
+	uint16_t threadCount;
+
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+
+	FunkJob* first;
+	FunkJob* last;
+	bool stopping;
+};
+
+static char* copy_string(const char* string) {
+	size_t length = strlen(string);
+	char* copy = (char*) malloc(length + 1);
+
+	memcpy((void*) copy, (void*) string, length + 1);
+	return copy;
+}
+
+static void record_job_error(FunkVm* vm, const char* error) {
+	if (vm == NULL) {
+		fprintf(stderr, "%s\n", error);
+		return;
+	}
+
+	FunkJob* job = ((FunkJobThread*) vm->userData)->job;
+
+	if (!job->failed) {
+		job->failed = true;
+		snprintf(job->error, FUNK_ERROR_LENGTH, "%s", error);
+	}
+}
+
+static bool prepare_instance(FunkJobThread* thread, FunkProgram* program) {
+	if (thread->program == program && thread->vm != NULL) {
+		return true;
+	}
+
+	funk_free_vm(thread->vm);
+
+	thread->program = program;
+	thread->vm = funk_create_instance(program, record_job_error);
+
+	if (thread->vm == NULL) {
+		return false;
+	}
+
+	thread->vm->userData = (void*) thread;
+	return true;
+}
+
+static void run_job(FunkJobThread* thread, FunkJob* job) {
+	thread->job = job;
+
+	if (!prepare_instance(thread, job->program)) {
+		job->failed = true;
+		snprintf(job->error, FUNK_ERROR_LENGTH, "Failed to create the vm of the job");
+
+		return;
+	}
+
+	FunkVm* vm = thread->vm;
+	FunkFunction* result = funk_run_program(vm, job->program);
+
+	if (!job->failed && job->function != NULL) {
+		FunkFunction* function = funk_get_global(vm, job->function);
+		FunkFunction* args[UINT8_MAX];
+
+		for (uint8_t i = 0; i < job->argCount; i++) {
+			args[i] = (FunkFunction *) funk_create_basic_function(vm, funk_create_string(vm, job->args[i], strlen(job->args[i])));
+		}
+
+		if (function == NULL) {
+			job->failed = true;
+			snprintf(job->error, FUNK_ERROR_LENGTH, "Function '%s' is not defined", job->function);
+		} else {
+			result = funk_run_function_arged(vm, function, args, job->argCount);
+		}
+	}
+
+	if (!job->failed && result != NULL) {
+		job->result = copy_string(result->name->chars);
+	}
+
+	// Everything of the job goes at once, so that the next one starts with an empty heap
+	funk_clear_vm(vm);
+	thread->job = NULL;
+}
+
+static void* run_job_thread(void* argument) {
+	FunkJobThread* thread = (FunkJobThread*) argument;
+	FunkJobPool* pool = thread->pool;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (true) {
+		while (!pool->stopping && pool->first == NULL) {
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		}
+
+		// The jobs, that are left, are still run, before the pool stops
+		if (pool->first == NULL) {
+			break;
+		}
+
+		FunkJob* job = pool->first;
+		pool->first = job->next;
+
+		if (pool->first == NULL) {
+			pool->last = NULL;
+		}
+
+		pthread_mutex_unlock(&pool->lock);
+		run_job(thread, job);
+
+		pthread_mutex_lock(&job->lock);
+		job->finished = true;
+		pthread_cond_broadcast(&job->done);
+		pthread_mutex_unlock(&job->lock);
+
+		pthread_mutex_lock(&pool->lock);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+FunkJobPool* funk_create_job_pool(uint16_t threadCount) {
+	if (threadCount == 0) {
+		long count = sysconf(_SC_NPROCESSORS_ONLN);
+		threadCount = count < 1 ? 1 : count > UINT16_MAX ? UINT16_MAX : (uint16_t) count;
+	}
+
+	FunkJobPool* pool = (FunkJobPool*) malloc(sizeof(FunkJobPool));
+
+	pool->threads = (FunkJobThread*) calloc(threadCount, sizeof(FunkJobThread));
+	pool->threadCount = 0;
+	pool->first = NULL;
+	pool->last = NULL;
+	pool->stopping = false;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+
+	for (uint16_t i = 0; i < threadCount; i++) {
+		FunkJobThread* thread = &pool->threads[pool->threadCount];
+		thread->pool = pool;
+
+		if (pthread_create(&thread->thread, NULL, run_job_thread, (void*) thread) != 0) {
+			break;
+		}
+
+		pool->threadCount++;
+	}
+
+	if (pool->threadCount == 0) {
+		funk_free_job_pool(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+void funk_free_job_pool(FunkJobPool* pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = true;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (uint16_t i = 0; i < pool->threadCount; i++) {
+		pthread_join(pool->threads[i].thread, NULL);
+		funk_free_vm(pool->threads[i].vm);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->wake);
+
+	free((void*) pool->threads);
+	free((void*) pool);
+}
+
+uint16_t funk_get_job_thread_count(FunkJobPool* pool) {
+	return pool->threadCount;
+}
+
+FunkJob* funk_submit_job(FunkJobPool* pool, FunkProgram* program, const char* function, const char** args, uint8_t argCount) {
+	FunkJob* job = (FunkJob*) malloc(sizeof(FunkJob));
+
+	job->program = program;
+	job->function = function != NULL ? copy_string(function) : NULL;
+	job->args = argCount > 0 ? (char**) malloc(sizeof(char*) * argCount) : NULL;
+	job->argCount = argCount;
+	job->result = NULL;
+	job->failed = false;
+	job->error[0] = '\0';
+	job->finished = false;
+	job->next = NULL;
+
+	for (uint8_t i = 0; i < argCount; i++) {
+		job->args[i] = copy_string(args[i]);
+	}
+
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->done, NULL);
+
+	pthread_mutex_lock(&pool->lock);
+
+	if (pool->last == NULL) {
+		pool->first = job;
+	} else {
+		pool->last->next = job;
+	}
+
+	pool->last = job;
+	pthread_cond_signal(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	return job;
+}
+
+bool funk_is_job_done(FunkJob* job) {
+	pthread_mutex_lock(&job->lock);
+	bool finished = job->finished;
+	pthread_mutex_unlock(&job->lock);
+
+	return finished;
+}
+
+const char* funk_wait_for_job(FunkJob* job) {
+	pthread_mutex_lock(&job->lock);
+
+	while (!job->finished) {
+		pthread_cond_wait(&job->done, &job->lock);
+	}
+
+	pthread_mutex_unlock(&job->lock);
+	return job->result;
+}
+
+const char* funk_get_job_error(FunkJob* job) {
+	funk_wait_for_job(job);
+	return job->failed ? job->error : NULL;
+}
+
+void funk_free_job(FunkJob* job) {
+	funk_wait_for_job(job);
+
+	for (uint8_t i = 0; i < job->argCount; i++) {
+		free((void*) job->args[i]);
+	}
+
+	free((void*) job->args);
+	free((void*) job->function);
+	free((void*) job->result);
+
+	pthread_mutex_destroy(&job->lock);
+	pthread_cond_destroy(&job->done);
+	free((void*) job);
+}
@@ -0,0 +1,28 @@
+#ifndef FUNK_POOL_H
+#define FUNK_POOL_H
+
+#include "funk.h"
+
+// Threads, that run jobs of programs, for embedding funk in servers. Every thread keeps an instance of the last program,
+// that it ran, and clears its heap after each job, so jobs never see each other
+typedef struct FunkJobPool FunkJobPool;
+// The future of a submitted job
+typedef struct FunkJob FunkJob;
+
+// Thread count of 0 uses the number of online cpus
+FunkJobPool* funk_create_job_pool(uint16_t threadCount);
+// Waits for the submitted jobs, the jobs themselves still have to be freed
+void funk_free_job_pool(FunkJobPool* pool);
+uint16_t funk_get_job_thread_count(FunkJobPool* pool);
+
+// Runs the script, then calls its global function with the given name, if there is one, with the arguments as strings.
+// The arguments are copied, the program has to live, until the job is done
+FunkJob* funk_submit_job(FunkJobPool* pool, FunkProgram* program, const char* function, const char** args, uint8_t argCount);
+bool funk_is_job_done(FunkJob* job);
+// Blocks, until the job is done. Returns the name of the result, NULL, if it is null or the job failed
+const char* funk_wait_for_job(FunkJob* job);
+// The error of a failed job, NULL, if it didn't fail
+const char* funk_get_job_error(FunkJob* job);
+void funk_free_job(FunkJob* job);
+
+#endif
@@ -0,0 +1,314 @@
+#include "funk_simd.h"
+
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define FUNK_SIMD_X86
+	#include <immintrin.h>
+#endif
+
+// min/max kernels are never called with an empty array
+
+static double scalar_sum(const double* values, uint32_t length) {
+	double sum = 0;
+
+	for (uint32_t i = 0; i < length; i++) {
+		sum += values[i];
+	}
+
+	return sum;
+}
+
+static double scalar_min(const double* values, uint32_t length) {
+	double result = values[0];
+
+	for (uint32_t i = 1; i < length; i++) {
+		result = values[i] < result ? values[i] : result;
+	}
+
+	return result;
+}
+
+static double scalar_max(const double* values, uint32_t length) {
+	double result = values[0];
+
+	for (uint32_t i = 1; i < length; i++) {
+		result = values[i] > result ? values[i] : result;
+	}
+
+	return result;
+}
+
+static double scalar_dot(const double* a, const double* b, uint32_t length) {
+	double sum = 0;
+
+	for (uint32_t i = 0; i < length; i++) {
+		sum += a[i] * b[i];
+	}
+
+	return sum;
+}
+
+static void scalar_scale(double* values, uint32_t length, double factor) {
+	for (uint32_t i = 0; i < length; i++) {
+		values[i] *= factor;
+	}
+}
+
+static void scalar_add(double* destination, const double* source, uint32_t length) {
+	for (uint32_t i = 0; i < length; i++) {
+		destination[i] += source[i];
+	}
+}
+
+static const FunkNumberKernels scalarKernels = {
+	FUNK_SIMD_SCALAR, "scalar",
+	scalar_sum, scalar_min, scalar_max, scalar_dot, scalar_scale, scalar_add
+};
+
+#ifdef FUNK_SIMD_X86
+
+// The tails, that do not fill a whole register, are handled by the scalar kernels
+
+__attribute__((target("sse2"))) static double sse2_sum(const double* values, uint32_t length) {
+	__m128d sum = _mm_setzero_pd();
+	uint32_t i = 0;
+
+	for (; i + 2 <= length; i += 2) {
+		sum = _mm_add_pd(sum, _mm_loadu_pd(values + i));
+	}
+
+	double lanes[2];
+	_mm_storeu_pd(lanes, sum);
+
+	return lanes[0] + lanes[1] + scalar_sum(values + i, length - i);
+}
+
+__attribute__((target("sse2"))) static double sse2_min(const double* values, uint32_t length) {
+	if (length < 2) {
+		return scalar_min(values, length);
+	}
+
+	__m128d result = _mm_loadu_pd(values);
+	uint32_t i = 2;
+
+	for (; i + 2 <= length; i += 2) {
+		result = _mm_min_pd(result, _mm_loadu_pd(values + i));
+	}
+
+	double lanes[2];
+	_mm_storeu_pd(lanes, result);
+
+	double value = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+	return i < length ? (values[i] < value ? values[i] : value) : value;
+}
+
+__attribute__((target("sse2"))) static double sse2_max(const double* values, uint32_t length) {
+	if (length < 2) {
+		return scalar_max(values, length);
+	}
+
+	__m128d result = _mm_loadu_pd(values);
+	uint32_t i = 2;
+
+	for (; i + 2 <= length; i += 2) {
+		result = _mm_max_pd(result, _mm_loadu_pd(values + i));
+	}
+
+	double lanes[2];
+	_mm_storeu_pd(lanes, result);
+
+	double value = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+	return i < length ? (values[i] > value ? values[i] : value) : value;
+}
+
+__attribute__((target("sse2"))) static double sse2_dot(const double* a, const double* b, uint32_t length) {
+	__m128d sum = _mm_setzero_pd();
+	uint32_t i = 0;
+
+	for (; i + 2 <= length; i += 2) {
+		sum = _mm_add_pd(sum, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+	}
+
+	double lanes[2];
+	_mm_storeu_pd(lanes, sum);
+
+	return lanes[0] + lanes[1] + scalar_dot(a + i, b + i, length - i);
+}
+
+__attribute__((target("sse2"))) static void sse2_scale(double* values, uint32_t length, double factor) {
+	__m128d multiplier = _mm_set1_pd(factor);
+	uint32_t i = 0;
+
+	for (; i + 2 <= length; i += 2) {
+		_mm_storeu_pd(values + i, _mm_mul_pd(_mm_loadu_pd(values + i), multiplier));
+	}
+
+	scalar_scale(values + i, length - i, factor);
+}
+
+__attribute__((target("sse2"))) static void sse2_add(double* destination, const double* source, uint32_t length) {
+	uint32_t i = 0;
+
+	for (; i + 2 <= length; i += 2) {
+		_mm_storeu_pd(destination + i, _mm_add_pd(_mm_loadu_pd(destination + i), _mm_loadu_pd(source + i)));
+	}
+
+	scalar_add(destination + i, source + i, length - i);
+}
+
+static const FunkNumberKernels sse2Kernels = {
+	FUNK_SIMD_SSE2, "sse2",
+	sse2_sum, sse2_min, sse2_max, sse2_dot, sse2_scale, sse2_add
+};
+
+__attribute__((target("avx2"))) static double avx2_reduce_add(__m256d value) {
+	__m128d sum = _mm_add_pd(_mm256_castpd256_pd128(value), _mm256_extractf128_pd(value, 1));
+	double lanes[2];
+
+	_mm_storeu_pd(lanes, sum);
+	return lanes[0] + lanes[1];
+}
+
+__attribute__((target("avx2"))) static double avx2_sum(const double* values, uint32_t length) {
+	__m256d first = _mm256_setzero_pd();
+	__m256d second = _mm256_setzero_pd();
+	uint32_t i = 0;
+
+	// Two accumulators hide the latency of the additions
+	for (; i + 8 <= length; i += 8) {
+		first = _mm256_add_pd(first, _mm256_loadu_pd(values + i));
+		second = _mm256_add_pd(second, _mm256_loadu_pd(values + i + 4));
+	}
+
+	return avx2_reduce_add(_mm256_add_pd(first, second)) + sse2_sum(values + i, length - i);
+}
+
+__attribute__((target("avx2"))) static double avx2_min(const double* values, uint32_t length) {
+	if (length < 4) {
+		return sse2_min(values, length);
+	}
+
+	__m256d result = _mm256_loadu_pd(values);
+	uint32_t i = 4;
+
+	for (; i + 4 <= length; i += 4) {
+		result = _mm256_min_pd(result, _mm256_loadu_pd(values + i));
+	}
+
+	double lanes[4];
+	_mm256_storeu_pd(lanes, result);
+
+	double value = scalar_min(lanes, 4);
+
+	if (i < length) {
+		double tail = scalar_min(values + i, length - i);
+		value = tail < value ? tail : value;
+	}
+
+	return value;
+}
+
+__attribute__((target("avx2"))) static double avx2_max(const double* values, uint32_t length) {
+	if (length < 4) {
+		return sse2_max(values, length);
+	}
+
+	__m256d result = _mm256_loadu_pd(values);
+	uint32_t i = 4;
+
+	for (; i + 4 <= length; i += 4) {
+		result = _mm256_max_pd(result, _mm256_loadu_pd(values + i));
+	}
+
+	double lanes[4];
+	_mm256_storeu_pd(lanes, result);
+
+	double value = scalar_max(lanes, 4);
+
+	if (i < length) {
+		double tail = scalar_max(values + i, length - i);
+		value = tail > value ? tail : value;
+	}
+
+	return value;
+}
+
+__attribute__((target("avx2,fma"))) static double avx2_dot(const double* a, const double* b, uint32_t length) {
+	__m256d first = _mm256_setzero_pd();
+	__m256d second = _mm256_setzero_pd();
+	uint32_t i = 0;
+
+	for (; i + 8 <= length; i += 8) {
+		first = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), first);
+		second = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), second);
+	}
+
+	return avx2_reduce_add(_mm256_add_pd(first, second)) + sse2_dot(a + i, b + i, length - i);
+}
+
+__attribute__((target("avx2"))) static void avx2_scale(double* values, uint32_t length, double factor) {
+	__m256d multiplier = _mm256_set1_pd(factor);
+	uint32_t i = 0;
+
+	for (; i + 4 <= length; i += 4) {
+		_mm256_storeu_pd(values + i, _mm256_mul_pd(_mm256_loadu_pd(values + i), multiplier));
+	}
+
+	scalar_scale(values + i, length - i, factor);
+}
+
+__attribute__((target("avx2"))) static void avx2_add(double* destination, const double* source, uint32_t length) {
+	uint32_t i = 0;
+
+	for (; i + 4 <= length; i += 4) {
+		_mm256_storeu_pd(destination + i, _mm256_add_pd(_mm256_loadu_pd(destination + i), _mm256_loadu_pd(source + i)));
+	}
+
+	scalar_add(destination + i, source + i, length - i);
+}
+
+static const FunkNumberKernels avx2Kernels = {
+	FUNK_SIMD_AVX2, "avx2",
+	avx2_sum, avx2_min, avx2_max, avx2_dot, avx2_scale, avx2_add
+};
+
+#endif
+
+FunkSimdLevel funk_detect_simd_level() {
+	static int detected = -1;
+
+	if (detected < 0) {
+		detected = FUNK_SIMD_SCALAR;
+
+		#ifdef FUNK_SIMD_X86
+			__builtin_cpu_init();
+
+			if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+				detected = FUNK_SIMD_AVX2;
+			} else if (__builtin_cpu_supports("sse2")) {
+				detected = FUNK_SIMD_SSE2;
+			}
+		#endif
+	}
+
+	return (FunkSimdLevel) detected;
+}
+
+const FunkNumberKernels* funk_get_number_kernels(FunkSimdLevel level) {
+	FunkSimdLevel supported = funk_detect_simd_level();
+
+	if (level > supported) {
+		level = supported;
+	}
+
+	#ifdef FUNK_SIMD_X86
+		switch (level) {
+			case FUNK_SIMD_AVX2: return &avx2Kernels;
+			case FUNK_SIMD_SSE2: return &sse2Kernels;
+			default: break;
+		}
+	#endif
+
+	return &scalarKernels;
+}
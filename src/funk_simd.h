@@ -0,0 +1,29 @@
+#ifndef FUNK_SIMD_H
+#define FUNK_SIMD_H
+
+#include <stdint.h>
+
+typedef enum {
+	FUNK_SIMD_SCALAR,
+	FUNK_SIMD_SSE2,
+	FUNK_SIMD_AVX2
+} FunkSimdLevel;
+
+typedef struct FunkNumberKernels {
+	FunkSimdLevel level;
+	const char* name;
+
+	double (*sum)(const double* values, uint32_t length);
+	double (*min)(const double* values, uint32_t length);
+	double (*max)(const double* values, uint32_t length);
+	double (*dot)(const double* a, const double* b, uint32_t length);
+	void (*scale)(double* values, uint32_t length, double factor);
+	void (*add)(double* destination, const double* source, uint32_t length);
+} FunkNumberKernels;
+
+// The best level, supported by the cpu, that the program is running on. Detected once.
+FunkSimdLevel funk_detect_simd_level();
+// Returns the kernels for the given level, or for the best supported one below it
+const FunkNumberKernels* funk_get_number_kernels(FunkSimdLevel level);
+
+#endif
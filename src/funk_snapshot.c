@@ -0,0 +1,1045 @@
+#include "funk_snapshot.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) || defined(__APPLE__)
+	#define FUNK_SNAPSHOT_MMAP
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+// The image starts with the magic, the version, the instruction count of the build and the number of objects.
+// Every object is a record of its type, the size of its data and the data, the references are indices into the records,
+// plus one, so that 0 stays NULL. The globals and the modules follow the last record as pairs of references
+#define FUNK_SNAPSHOT_MAGIC "FUNKSNAP"
+#define FUNK_SNAPSHOT_MAGIC_LENGTH 8
+#define FUNK_SNAPSHOT_VERSION 2
+#define FUNK_SNAPSHOT_HEADER_SIZE (FUNK_SNAPSHOT_MAGIC_LENGTH + 3 * sizeof(uint32_t))
+#define FUNK_SNAPSHOT_RECORD_HEADER_SIZE (1 + sizeof(uint32_t))
+#define FUNK_SNAPSHOT_ERROR_LENGTH 128
+
+// Messages start with their kind. Names are only their characters, everything else is the object count,
+// the records, like in a snapshot, and the reference to the value
+typedef enum {
+	FUNK_MESSAGE_NULL,
+	FUNK_MESSAGE_NAME,
+	FUNK_MESSAGE_OBJECTS
+} FunkMessageKind;
+
+typedef enum {
+	FUNK_RECORD_STRING,
+	FUNK_RECORD_FUNCTION,
+	FUNK_RECORD_CLOSURE,
+	// Natives without data, the loading vm has to define a global native with the same name
+	FUNK_RECORD_NATIVE,
+	FUNK_RECORD_NATIVE_DATA
+} FunkRecordType;
+
+struct FunkSnapshotWriter {
+	FunkVm* vm;
+	bool message;
+
+	// Allocated with malloc(), so that a message can be freed by any vm
+	uint8_t* buffer;
+	size_t length;
+	size_t allocated;
+
+	// Objects get their index, once they are first written, and their records are saved in that order
+	FunkObject** objects;
+	uint32_t objectCount;
+	uint32_t objectsAllocated;
+
+	// Open addressing from an object to its index plus one
+	FunkObject** keys;
+	uint32_t* indices;
+	uint32_t capacity;
+
+	bool failed;
+	char error[FUNK_SNAPSHOT_ERROR_LENGTH];
+};
+
+typedef struct FunkSnapshotRecord {
+	FunkRecordType type;
+	const uint8_t* data;
+	uint32_t size;
+} FunkSnapshotRecord;
+
+struct FunkSnapshotReader {
+	FunkVm* vm;
+
+	// The data of the record, that is loaded
+	const uint8_t* data;
+	const uint8_t* end;
+
+	FunkSnapshotRecord* records;
+	FunkObject** objects;
+	uint32_t objectCount;
+
+	bool failed;
+	char error[FUNK_SNAPSHOT_ERROR_LENGTH];
+};
+
+static void report_error(FunkVm* vm, const char* message, ...) {
+	char buffer[256];
+	va_list args;
+
+	va_start(args, message);
+	vsnprintf(buffer, sizeof(buffer), message, args);
+	va_end(args);
+
+	funk_flush_output(vm);
+	vm->errorFn(vm, buffer);
+}
+
+// Only the first error is kept, the ones after it are mostly caused by it
+static void set_error(bool* failed, char* error, const char* message, ...) {
+	if (*failed) {
+		return;
+	}
+
+	va_list args;
+
+	va_start(args, message);
+	vsnprintf(error, FUNK_SNAPSHOT_ERROR_LENGTH, message, args);
+	va_end(args);
+
+	*failed = true;
+}
+
+void funk_register_snapshot_type(FunkVm* vm, const char* name, FunkDataCleanupFn cleanupFn, FunkSnapshotSaveFn saveFn, FunkSnapshotLoadFn loadFn) {
+	uint8_t index = 0;
+
+	// Opening the standard library again only replaces its types
+	while (index < vm->snapshotTypeCount && vm->snapshotTypes[index].cleanupFn != cleanupFn && strcmp(vm->snapshotTypes[index].name, name) != 0) {
+		index++;
+	}
+
+	if (index == FUNK_SNAPSHOT_TYPES) {
+		return;
+	}
+
+	if (index == vm->snapshotTypeCount) {
+		vm->snapshotTypeCount++;
+	}
+
+	FunkSnapshotType* type = &vm->snapshotTypes[index];
+
+	type->name = name;
+	type->cleanupFn = cleanupFn;
+	type->saveFn = saveFn;
+	type->loadFn = loadFn;
+}
+
+// Child vms only register the types of the core, the ones of the standard library are on their parent
+static FunkSnapshotType* find_type_by_cleanup(FunkVm* vm, FunkDataCleanupFn cleanupFn) {
+	for (; vm != NULL; vm = vm->parent) {
+		for (uint8_t i = 0; i < vm->snapshotTypeCount; i++) {
+			if (vm->snapshotTypes[i].cleanupFn == cleanupFn) {
+				return &vm->snapshotTypes[i];
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static FunkSnapshotType* find_type_by_name(FunkVm* vm, const char* name, uint32_t length) {
+	for (; vm != NULL; vm = vm->parent) {
+		for (uint8_t i = 0; i < vm->snapshotTypeCount; i++) {
+			const char* typeName = vm->snapshotTypes[i].name;
+
+			if (strlen(typeName) == length && memcmp(typeName, name, length) == 0) {
+				return &vm->snapshotTypes[i];
+			}
+		}
+	}
+
+	return NULL;
+}
+
+// Saving
+
+void funk_snapshot_write_bytes(FunkSnapshotWriter* writer, const void* bytes, uint32_t size) {
+	if (writer->length + size > writer->allocated) {
+		size_t allocated = writer->allocated < 64 ? 64 : writer->allocated;
+
+		while (allocated < writer->length + size) {
+			allocated *= 2;
+		}
+
+		writer->buffer = (uint8_t*) realloc((void*) writer->buffer, allocated);
+		writer->allocated = allocated;
+	}
+
+	if (size > 0) {
+		memcpy((void*) (writer->buffer + writer->length), bytes, size);
+		writer->length += size;
+	}
+}
+
+void funk_snapshot_write_uint32(FunkSnapshotWriter* writer, uint32_t value) {
+	funk_snapshot_write_bytes(writer, (const void*) &value, sizeof(uint32_t));
+}
+
+static uint32_t hash_pointer(FunkObject* object) {
+	uint64_t value = (uint64_t) (uintptr_t) object;
+	return (uint32_t) ((value >> 4) * 2654435761u);
+}
+
+static void grow_object_indices(FunkSnapshotWriter* writer) {
+	uint32_t capacity = writer->capacity < 256 ? 256 : writer->capacity * 2;
+	FunkObject** keys = FUNK_ALLOCATE(writer->vm, FunkObject*, capacity);
+	uint32_t* indices = FUNK_ALLOCATE(writer->vm, uint32_t, capacity);
+
+	memset((void*) keys, 0, sizeof(FunkObject*) * capacity);
+
+	for (uint32_t i = 0; i < writer->capacity; i++) {
+		if (writer->keys[i] == NULL) {
+			continue;
+		}
+
+		uint32_t slot = hash_pointer(writer->keys[i]) & (capacity - 1);
+
+		while (keys[slot] != NULL) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+
+		keys[slot] = writer->keys[i];
+		indices[slot] = writer->indices[i];
+	}
+
+	FUNK_FREE_ARRAY(writer->vm, FunkObject*, writer->keys, writer->capacity);
+	FUNK_FREE_ARRAY(writer->vm, uint32_t, writer->indices, writer->capacity);
+
+	writer->keys = keys;
+	writer->indices = indices;
+	writer->capacity = capacity;
+}
+
+// Returns the reference to the object, the first one adds it to the objects, that are saved
+static uint32_t get_reference(FunkSnapshotWriter* writer, FunkObject* object) {
+	if (object == NULL) {
+		return 0;
+	}
+
+	if ((writer->objectCount + 1) * 2 > writer->capacity) {
+		grow_object_indices(writer);
+	}
+
+	uint32_t slot = hash_pointer(object) & (writer->capacity - 1);
+
+	while (writer->keys[slot] != NULL) {
+		if (writer->keys[slot] == object) {
+			return writer->indices[slot];
+		}
+
+		slot = (slot + 1) & (writer->capacity - 1);
+	}
+
+	if (writer->objectCount == writer->objectsAllocated) {
+		uint32_t allocated = FUNK_GROW_CAPACITY(writer->objectsAllocated);
+
+		writer->objects = FUNK_GROW_ARRAY(writer->vm, FunkObject*, writer->objects, writer->objectsAllocated, allocated);
+		writer->objectsAllocated = allocated;
+	}
+
+	writer->objects[writer->objectCount++] = object;
+	writer->keys[slot] = object;
+	writer->indices[slot] = writer->objectCount;
+
+	return writer->objectCount;
+}
+
+void funk_snapshot_write_object(FunkSnapshotWriter* writer, FunkObject* object) {
+	funk_snapshot_write_uint32(writer, get_reference(writer, object));
+}
+
+static void write_string_bytes(FunkSnapshotWriter* writer, FunkString* string) {
+	funk_snapshot_write_uint32(writer, string->length);
+	funk_snapshot_write_bytes(writer, (const void*) string->chars, string->length);
+}
+
+static void write_strings(FunkSnapshotWriter* writer, FunkString** strings, uint8_t count) {
+	funk_snapshot_write_uint32(writer, count);
+
+	for (uint8_t i = 0; i < count; i++) {
+		funk_snapshot_write_object(writer, (FunkObject*) strings[i]);
+	}
+}
+
+static FunkRecordType write_function(FunkSnapshotWriter* writer, FunkBasicFunction* function) {
+	// The closures share everything, but their name, scope and captured values, with the prototype
+	if (function->prototype != NULL) {
+		funk_snapshot_write_object(writer, (FunkObject*) function->prototype);
+		funk_snapshot_write_object(writer, (FunkObject*) function->parent.name);
+		funk_snapshot_write_object(writer, (FunkObject*) function->scope);
+		funk_snapshot_write_uint32(writer, function->upvalueCount);
+
+		for (uint8_t i = 0; i < function->upvalueCount; i++) {
+			funk_snapshot_write_object(writer, (FunkObject*) function->upvalues[i]);
+		}
+
+		return FUNK_RECORD_CLOSURE;
+	}
+
+	funk_snapshot_write_object(writer, (FunkObject*) function->parent.name);
+	write_strings(writer, function->argumentNames, function->argumentCount);
+
+	funk_snapshot_write_uint32(writer, function->codeLength);
+	funk_snapshot_write_bytes(writer, (const void*) function->code, function->codeLength);
+
+	funk_snapshot_write_uint32(writer, function->constantsLength);
+
+	for (uint16_t i = 0; i < function->constantsLength; i++) {
+		funk_snapshot_write_object(writer, function->constants[i]);
+	}
+
+	funk_snapshot_write_uint32(writer, function->lexical ? 1 : 0);
+	write_strings(writer, function->localNames, function->localCount);
+
+	funk_snapshot_write_uint32(writer, function->upvalueCount);
+	funk_snapshot_write_bytes(writer, (const void*) function->upvalueSources, sizeof(uint16_t) * function->upvalueCount);
+	funk_snapshot_write_uint32(writer, function->inlineDepth);
+
+	return FUNK_RECORD_FUNCTION;
+}
+
+// Only the natives, that are globals under their own name, can be found again by it
+static bool is_global_native(FunkVm* vm, FunkNativeFunction* function) {
+	FunkString* name = function->parent.name;
+
+	if (function->cleanupFn != NULL || function->data != NULL || name == NULL) {
+		return false;
+	}
+
+	for (; vm != NULL; vm = vm->parent) {
+		FunkObject* value;
+
+		if (funk_table_get(&vm->globals, name, &value)) {
+			return value == (FunkObject*) function;
+		}
+	}
+
+	return false;
+}
+
+static FunkRecordType write_native(FunkSnapshotWriter* writer, FunkNativeFunction* function) {
+	FunkString* name = function->parent.name;
+
+	if (is_global_native(writer->vm, function)) {
+		write_string_bytes(writer, name);
+		return FUNK_RECORD_NATIVE;
+	}
+
+	FunkSnapshotType* type = function->cleanupFn != NULL ? find_type_by_cleanup(writer->vm, function->cleanupFn) : NULL;
+
+	if (type == NULL) {
+		set_error(&writer->failed, writer->error, writer->message ? "Can't send '%s' to another vm" : "Can't save '%s' into a snapshot", name != NULL ? name->chars : "");
+		return FUNK_RECORD_NATIVE;
+	}
+
+	funk_snapshot_write_object(writer, (FunkObject*) name);
+	funk_snapshot_write_uint32(writer, (uint32_t) strlen(type->name));
+	funk_snapshot_write_bytes(writer, (const void*) type->name, (uint32_t) strlen(type->name));
+
+	type->saveFn(writer->vm, function, writer);
+	return FUNK_RECORD_NATIVE_DATA;
+}
+
+static void write_record(FunkSnapshotWriter* writer, FunkObject* object) {
+	uint8_t type = 0;
+	funk_snapshot_write_bytes(writer, (const void*) &type, 1);
+
+	// The type and the size are filled in, once the data is written
+	size_t start = writer->length;
+	funk_snapshot_write_uint32(writer, 0);
+
+	switch (object->type) {
+		case FUNK_OBJECT_STRING: {
+			type = FUNK_RECORD_STRING;
+			write_string_bytes(writer, (FunkString*) object);
+
+			break;
+		}
+
+		case FUNK_OBJECT_BASIC_FUNCTION: {
+			type = write_function(writer, (FunkBasicFunction*) object);
+			break;
+		}
+
+		case FUNK_OBJECT_NATIVE_FUNCTION: {
+			type = write_native(writer, (FunkNativeFunction*) object);
+			break;
+		}
+
+		default: {
+			UNREACHABLE
+		}
+	}
+
+	uint32_t size = (uint32_t) (writer->length - start - sizeof(uint32_t));
+
+	writer->buffer[start - 1] = type;
+	memcpy((void*) (writer->buffer + start), (const void*) &size, sizeof(uint32_t));
+}
+
+static void add_table(FunkSnapshotWriter* writer, FunkTable* table) {
+	for (int i = 0; i <= table->capacity; i++) {
+		FunkTableEntry* entry = &table->entries[i];
+
+		if (entry->key != NULL) {
+			get_reference(writer, (FunkObject*) entry->key);
+			get_reference(writer, entry->value);
+		}
+	}
+}
+
+static void write_table(FunkSnapshotWriter* writer, FunkTable* table) {
+	funk_snapshot_write_uint32(writer, (uint32_t) table->count);
+
+	for (int i = 0; i <= table->capacity; i++) {
+		FunkTableEntry* entry = &table->entries[i];
+
+		if (entry->key != NULL) {
+			funk_snapshot_write_object(writer, (FunkObject*) entry->key);
+			funk_snapshot_write_object(writer, entry->value);
+		}
+	}
+}
+
+static void init_writer(FunkSnapshotWriter* writer, FunkVm* vm, bool message) {
+	writer->vm = vm;
+	writer->message = message;
+	writer->buffer = NULL;
+	writer->length = 0;
+	writer->allocated = 0;
+	writer->objects = NULL;
+	writer->objectCount = 0;
+	writer->objectsAllocated = 0;
+	writer->keys = NULL;
+	writer->indices = NULL;
+	writer->capacity = 0;
+	writer->failed = false;
+}
+
+// Leaves the buffer alone
+static void free_writer_objects(FunkSnapshotWriter* writer) {
+	FUNK_FREE_ARRAY(writer->vm, FunkObject*, writer->objects, writer->objectsAllocated);
+	FUNK_FREE_ARRAY(writer->vm, FunkObject*, writer->keys, writer->capacity);
+	FUNK_FREE_ARRAY(writer->vm, uint32_t, writer->indices, writer->capacity);
+}
+
+// Records add the objects, that they reference, to the end, until every reachable one is written
+static void write_records(FunkSnapshotWriter* writer) {
+	for (uint32_t i = 0; i < writer->objectCount && !writer->failed; i++) {
+		write_record(writer, writer->objects[i]);
+	}
+}
+
+bool funk_save_snapshot(FunkVm* vm, const char* path) {
+	// The interned strings of a sweep in progress can still hold the ones, that are about to be freed
+	if (vm->gcPhase != FUNK_GC_IDLE) {
+		funk_collect_garbage(vm);
+	}
+
+	FunkSnapshotWriter writer;
+	init_writer(&writer, vm, false);
+
+	uint32_t header[3] = { FUNK_SNAPSHOT_VERSION, FUNK_INSTRUCTION_COUNT, 0 };
+
+	funk_snapshot_write_bytes(&writer, (const void*) FUNK_SNAPSHOT_MAGIC, FUNK_SNAPSHOT_MAGIC_LENGTH);
+	funk_snapshot_write_bytes(&writer, (const void*) header, sizeof(header));
+
+	// The roots get the first indices, so that they are all known, before their references are written at the end
+	add_table(&writer, &vm->strings);
+	add_table(&writer, &vm->globals);
+	add_table(&writer, &vm->modules);
+
+	write_records(&writer);
+
+	write_table(&writer, &vm->globals);
+	write_table(&writer, &vm->modules);
+
+	memcpy((void*) (writer.buffer + FUNK_SNAPSHOT_MAGIC_LENGTH + 2 * sizeof(uint32_t)), (const void*) &writer.objectCount, sizeof(uint32_t));
+
+	bool saved = false;
+
+	if (writer.failed) {
+		report_error(vm, "%s", writer.error);
+	} else {
+		FILE* file = fopen(path, "wb");
+
+		if (file == NULL) {
+			report_error(vm, "Failed to open '%s'", path);
+		} else {
+			saved = fwrite((const void*) writer.buffer, 1, writer.length, file) == writer.length;
+			saved = fclose(file) == 0 && saved;
+
+			if (!saved) {
+				report_error(vm, "Failed to write '%s'", path);
+			}
+		}
+	}
+
+	free((void*) writer.buffer);
+	free_writer_objects(&writer);
+
+	return saved;
+}
+
+// Loading
+
+const void* funk_snapshot_read_bytes(FunkSnapshotReader* reader, uint32_t size) {
+	if (reader->failed || (size_t) (reader->end - reader->data) < size) {
+		reader->failed = true;
+		return NULL;
+	}
+
+	const void* bytes = (const void*) reader->data;
+	reader->data += size;
+
+	return bytes;
+}
+
+uint32_t funk_snapshot_read_uint32(FunkSnapshotReader* reader) {
+	const void* bytes = funk_snapshot_read_bytes(reader, sizeof(uint32_t));
+	uint32_t value = 0;
+
+	if (bytes != NULL) {
+		memcpy((void*) &value, bytes, sizeof(uint32_t));
+	}
+
+	return value;
+}
+
+uint32_t funk_snapshot_read_count(FunkSnapshotReader* reader, uint32_t elementSize) {
+	uint32_t count = funk_snapshot_read_uint32(reader);
+
+	if ((uint64_t) count * elementSize > (uint64_t) (reader->end - reader->data)) {
+		reader->failed = true;
+		return 0;
+	}
+
+	return count;
+}
+
+static uint32_t read_reference(FunkSnapshotReader* reader) {
+	uint32_t reference = funk_snapshot_read_uint32(reader);
+
+	if (reference > reader->objectCount) {
+		reader->failed = true;
+		return 0;
+	}
+
+	return reference;
+}
+
+FunkObject* funk_snapshot_read_object(FunkSnapshotReader* reader) {
+	uint32_t reference = read_reference(reader);
+	return reference > 0 ? reader->objects[reference - 1] : NULL;
+}
+
+FunkString* funk_snapshot_read_string(FunkSnapshotReader* reader) {
+	FunkObject* object = funk_snapshot_read_object(reader);
+
+	if (object != NULL && object->type != FUNK_OBJECT_STRING) {
+		reader->failed = true;
+		return NULL;
+	}
+
+	return (FunkString*) object;
+}
+
+static FunkString** read_strings(FunkSnapshotReader* reader, uint8_t* count) {
+	uint32_t length = funk_snapshot_read_count(reader, sizeof(uint32_t));
+
+	if (length > UINT8_MAX) {
+		reader->failed = true;
+		length = 0;
+	}
+
+	*count = (uint8_t) length;
+
+	if (length == 0) {
+		return NULL;
+	}
+
+	FunkString** strings = FUNK_ALLOCATE(reader->vm, FunkString*, length);
+
+	for (uint32_t i = 0; i < length; i++) {
+		strings[i] = funk_snapshot_read_string(reader);
+	}
+
+	return strings;
+}
+
+static void start_record(FunkSnapshotReader* reader, uint32_t index) {
+	reader->data = reader->records[index].data;
+	reader->end = reader->records[index].data + reader->records[index].size;
+}
+
+// Every count is set together with its array, so that a broken image still leaves objects, that can be freed
+static void read_function(FunkSnapshotReader* reader, FunkBasicFunction* function) {
+	FunkVm* vm = reader->vm;
+
+	function->parent.name = funk_snapshot_read_string(reader);
+	function->argumentNames = read_strings(reader, &function->argumentCount);
+
+	uint32_t codeLength = funk_snapshot_read_count(reader, 1);
+
+	if (codeLength > 0) {
+		function->code = FUNK_ALLOCATE(vm, uint8_t, codeLength);
+		function->codeAllocated = codeLength;
+		function->codeLength = codeLength;
+
+		memcpy((void*) function->code, funk_snapshot_read_bytes(reader, codeLength), codeLength);
+	}
+
+	uint32_t constantsLength = funk_snapshot_read_count(reader, sizeof(uint32_t));
+
+	if (constantsLength > UINT16_MAX) {
+		reader->failed = true;
+		return;
+	}
+
+	if (constantsLength > 0) {
+		function->constants = FUNK_ALLOCATE(vm, FunkObject*, constantsLength);
+		function->constantsAllocated = (uint16_t) constantsLength;
+		function->constantsLength = (uint16_t) constantsLength;
+
+		for (uint32_t i = 0; i < constantsLength; i++) {
+			function->constants[i] = funk_snapshot_read_object(reader);
+		}
+	}
+
+	function->lexical = funk_snapshot_read_uint32(reader) != 0;
+	function->localNames = read_strings(reader, &function->localCount);
+
+	uint32_t upvalueCount = funk_snapshot_read_count(reader, sizeof(uint16_t));
+
+	if (upvalueCount > UINT8_MAX) {
+		reader->failed = true;
+		return;
+	}
+
+	if (upvalueCount > 0) {
+		function->upvalueSources = FUNK_ALLOCATE(vm, uint16_t, upvalueCount);
+		function->upvalueCount = (uint8_t) upvalueCount;
+
+		memcpy((void*) function->upvalueSources, funk_snapshot_read_bytes(reader, sizeof(uint16_t) * upvalueCount), sizeof(uint16_t) * upvalueCount);
+	}
+
+	uint32_t inlineDepth = funk_snapshot_read_uint32(reader);
+
+	if (inlineDepth > UINT8_MAX) {
+		reader->failed = true;
+		return;
+	}
+
+	function->inlineDepth = (uint8_t) inlineDepth;
+}
+
+// Runs after every prototype is read
+static void read_closure(FunkSnapshotReader* reader, FunkBasicFunction* closure) {
+	uint32_t reference = read_reference(reader);
+
+	if (reference == 0 || reader->records[reference - 1].type != FUNK_RECORD_FUNCTION) {
+		reader->failed = true;
+		return;
+	}
+
+	FunkBasicFunction* prototype = (FunkBasicFunction*) reader->objects[reference - 1];
+
+	closure->argumentNames = prototype->argumentNames;
+	closure->argumentCount = prototype->argumentCount;
+	closure->code = prototype->code;
+	closure->codeLength = prototype->codeLength;
+	closure->constants = prototype->constants;
+	closure->constantsLength = prototype->constantsLength;
+
+	closure->lexical = true;
+	closure->localNames = prototype->localNames;
+	closure->localCount = prototype->localCount;
+	closure->upvalueSources = prototype->upvalueSources;
+	closure->upvalueCount = prototype->upvalueCount;
+	closure->inlineDepth = prototype->inlineDepth;
+	closure->prototype = prototype;
+
+	closure->parent.name = funk_snapshot_read_string(reader);
+
+	FunkObject* scope = funk_snapshot_read_object(reader);
+
+	if (scope != NULL && scope->type != FUNK_OBJECT_NATIVE_FUNCTION) {
+		reader->failed = true;
+		return;
+	}
+
+	closure->scope = (FunkFunction*) scope;
+
+	if (funk_snapshot_read_count(reader, sizeof(uint32_t)) != prototype->upvalueCount) {
+		reader->failed = true;
+		return;
+	}
+
+	if (prototype->upvalueCount > 0) {
+		closure->upvalues = FUNK_ALLOCATE(reader->vm, FunkFunction*, prototype->upvalueCount);
+
+		for (uint8_t i = 0; i < prototype->upvalueCount; i++) {
+			closure->upvalues[i] = (FunkFunction*) funk_snapshot_read_object(reader);
+		}
+	}
+}
+
+static void read_native_data(FunkSnapshotReader* reader, FunkNativeFunction* function) {
+	function->parent.name = funk_snapshot_read_string(reader);
+
+	uint32_t length = funk_snapshot_read_count(reader, 1);
+	const char* name = (const char*) funk_snapshot_read_bytes(reader, length);
+
+	if (reader->failed) {
+		return;
+	}
+
+	FunkSnapshotType* type = find_type_by_name(reader->vm, name, length);
+
+	if (type == NULL) {
+		set_error(&reader->failed, reader->error, "The snapshot type '%.*s' isn't registered", (int) length, name);
+		return;
+	}
+
+	type->loadFn(reader->vm, function, reader);
+}
+
+// Natives without data are the ones, that the loading vm defined itself
+static FunkObject* find_native(FunkSnapshotReader* reader) {
+	uint32_t length = funk_snapshot_read_count(reader, 1);
+	const char* chars = (const char*) funk_snapshot_read_bytes(reader, length);
+
+	if (reader->failed || length > UINT16_MAX) {
+		reader->failed = true;
+		return NULL;
+	}
+
+	FunkString* name = funk_create_string(reader->vm, chars, (uint16_t) length);
+
+	for (FunkVm* vm = reader->vm; vm != NULL; vm = vm->parent) {
+		FunkObject* value;
+
+		if (funk_table_get(&vm->globals, name, &value) && value != NULL && value->type == FUNK_OBJECT_NATIVE_FUNCTION
+			&& ((FunkNativeFunction*) value)->cleanupFn == NULL) {
+
+			return value;
+		}
+	}
+
+	set_error(&reader->failed, reader->error, "The native function '%s' isn't defined", name->chars);
+	return NULL;
+}
+
+static FunkObject* create_object(FunkSnapshotReader* reader, FunkRecordType type) {
+	FunkVm* vm = reader->vm;
+
+	switch (type) {
+		case FUNK_RECORD_STRING: {
+			uint32_t length = funk_snapshot_read_count(reader, 1);
+			const char* chars = (const char*) funk_snapshot_read_bytes(reader, length);
+
+			if (reader->failed || length > UINT16_MAX) {
+				reader->failed = true;
+				return NULL;
+			}
+
+			return (FunkObject*) funk_create_string(vm, chars, (uint16_t) length);
+		}
+
+		case FUNK_RECORD_FUNCTION:
+		case FUNK_RECORD_CLOSURE: return (FunkObject*) funk_create_basic_function(vm, NULL);
+		case FUNK_RECORD_NATIVE: return find_native(reader);
+		case FUNK_RECORD_NATIVE_DATA: return (FunkObject*) funk_create_native_function(vm, NULL, NULL);
+
+		default: {
+			reader->failed = true;
+			return NULL;
+		}
+	}
+}
+
+static void read_table(FunkSnapshotReader* reader, FunkTable* table) {
+	uint32_t count = funk_snapshot_read_count(reader, 2 * sizeof(uint32_t));
+
+	for (uint32_t i = 0; i < count; i++) {
+		FunkString* key = funk_snapshot_read_string(reader);
+		FunkObject* value = funk_snapshot_read_object(reader);
+
+		if (table != NULL && key != NULL) {
+			funk_table_set(reader->vm, table, key, value);
+		}
+	}
+}
+
+static void init_reader(FunkSnapshotReader* reader, FunkVm* vm, uint32_t objectCount) {
+	reader->vm = vm;
+	reader->objectCount = objectCount;
+	reader->records = objectCount > 0 ? FUNK_ALLOCATE(vm, FunkSnapshotRecord, objectCount) : NULL;
+	reader->objects = objectCount > 0 ? FUNK_ALLOCATE(vm, FunkObject*, objectCount) : NULL;
+	reader->failed = false;
+	reader->error[0] = '\0';
+
+	for (uint32_t i = 0; i < objectCount; i++) {
+		reader->objects[i] = NULL;
+	}
+}
+
+static void free_reader(FunkSnapshotReader* reader) {
+	FUNK_FREE_ARRAY(reader->vm, FunkSnapshotRecord, reader->records, reader->objectCount);
+	FUNK_FREE_ARRAY(reader->vm, FunkObject*, reader->objects, reader->objectCount);
+}
+
+// Returns the data after the last record
+static const uint8_t* read_records(FunkSnapshotReader* reader, const uint8_t* start, const uint8_t* end) {
+	reader->data = start;
+	reader->end = end;
+
+	// Collections only start at a call, so the objects don't have to be kept anywhere, until the globals hold them.
+	// Every object is created first, so that the references can point anywhere
+	for (uint32_t i = 0; i < reader->objectCount && !reader->failed; i++) {
+		const uint8_t* type = (const uint8_t*) funk_snapshot_read_bytes(reader, 1);
+		uint32_t recordSize = funk_snapshot_read_count(reader, 1);
+
+		if (reader->failed) {
+			break;
+		}
+
+		const uint8_t* next = reader->data + recordSize;
+
+		reader->records[i].type = (FunkRecordType) *type;
+		reader->records[i].data = reader->data;
+		reader->records[i].size = recordSize;
+
+		reader->end = next;
+		reader->objects[i] = create_object(reader, reader->records[i].type);
+
+		reader->data = next;
+		reader->end = end;
+	}
+
+	const uint8_t* rest = reader->data;
+
+	for (uint32_t i = 0; i < reader->objectCount && !reader->failed; i++) {
+		start_record(reader, i);
+
+		if (reader->records[i].type == FUNK_RECORD_FUNCTION) {
+			read_function(reader, (FunkBasicFunction*) reader->objects[i]);
+		} else if (reader->records[i].type == FUNK_RECORD_NATIVE_DATA) {
+			read_native_data(reader, (FunkNativeFunction*) reader->objects[i]);
+		}
+	}
+
+	for (uint32_t i = 0; i < reader->objectCount && !reader->failed; i++) {
+		if (reader->records[i].type == FUNK_RECORD_CLOSURE) {
+			start_record(reader, i);
+			read_closure(reader, (FunkBasicFunction*) reader->objects[i]);
+		}
+	}
+
+	reader->data = rest;
+	reader->end = end;
+
+	return rest;
+}
+
+static bool load_image(FunkVm* vm, const uint8_t* image, size_t size, char* error) {
+	uint32_t header[3];
+
+	if (size < FUNK_SNAPSHOT_HEADER_SIZE || memcmp((const void*) image, FUNK_SNAPSHOT_MAGIC, FUNK_SNAPSHOT_MAGIC_LENGTH) != 0) {
+		return false;
+	}
+
+	memcpy((void*) header, (const void*) (image + FUNK_SNAPSHOT_MAGIC_LENGTH), sizeof(header));
+
+	if (header[0] != FUNK_SNAPSHOT_VERSION || header[1] != FUNK_INSTRUCTION_COUNT || header[2] > size / FUNK_SNAPSHOT_RECORD_HEADER_SIZE) {
+		return false;
+	}
+
+	FunkSnapshotReader reader;
+	init_reader(&reader, vm, header[2]);
+
+	const uint8_t* roots = read_records(&reader, image + FUNK_SNAPSHOT_HEADER_SIZE, image + size);
+
+	// The roots are checked, before any of them replaces a global
+	for (uint8_t apply = 0; apply < 2 && !reader.failed; apply++) {
+		reader.data = roots;
+
+		read_table(&reader, apply ? &vm->globals : NULL);
+		read_table(&reader, apply ? &vm->modules : NULL);
+	}
+
+	memcpy((void*) error, (const void*) reader.error, FUNK_SNAPSHOT_ERROR_LENGTH);
+	free_reader(&reader);
+
+	return !reader.failed;
+}
+
+bool funk_load_snapshot(FunkVm* vm, const char* path) {
+	// New objects can't be told apart from the ones, that a sweep in progress has to free
+	if (vm->gcPhase != FUNK_GC_IDLE) {
+		funk_collect_garbage(vm);
+	}
+
+	bool loaded;
+	char error[FUNK_SNAPSHOT_ERROR_LENGTH] = "";
+
+	#ifdef FUNK_SNAPSHOT_MMAP
+		int file = open(path, O_RDONLY);
+		struct stat info;
+
+		if (file < 0 || fstat(file, &info) != 0) {
+			if (file >= 0) {
+				close(file);
+			}
+
+			report_error(vm, "Failed to open '%s'", path);
+			return false;
+		}
+
+		size_t size = (size_t) info.st_size;
+		void* image = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+		close(file);
+
+		if (image == MAP_FAILED) {
+			report_error(vm, "The snapshot '%s' is broken", path);
+			return false;
+		}
+
+		loaded = load_image(vm, (const uint8_t*) image, size, error);
+		munmap(image, size);
+	#else
+		FILE* file = fopen(path, "rb");
+
+		if (file == NULL) {
+			report_error(vm, "Failed to open '%s'", path);
+			return false;
+		}
+
+		fseek(file, 0L, SEEK_END);
+		size_t size = (size_t) ftell(file);
+		rewind(file);
+
+		uint8_t* image = FUNK_ALLOCATE(vm, uint8_t, size);
+		loaded = fread((void*) image, 1, size, file) == size && load_image(vm, image, size, error);
+
+		fclose(file);
+		FUNK_FREE_ARRAY(vm, uint8_t, image, size);
+	#endif
+
+	if (!loaded) {
+		if (error[0] != '\0') {
+			report_error(vm, "%s", error);
+		} else {
+			report_error(vm, "The snapshot '%s' is broken", path);
+		}
+	}
+
+	return loaded;
+}
+
+// Messages
+
+void* funk_encode_message(FunkVm* vm, FunkFunction* value, uint32_t* size) {
+	FunkSnapshotWriter writer;
+	init_writer(&writer, vm, true);
+
+	uint8_t kind = FUNK_MESSAGE_OBJECTS;
+
+	if (value == NULL) {
+		kind = FUNK_MESSAGE_NULL;
+	} else if (!funk_function_has_code(value) && ((FunkBasicFunction*) value)->prototype == NULL) {
+		kind = FUNK_MESSAGE_NAME;
+	}
+
+	funk_snapshot_write_bytes(&writer, (const void*) &kind, 1);
+
+	if (kind == FUNK_MESSAGE_NAME) {
+		funk_snapshot_write_bytes(&writer, (const void*) value->name->chars, value->name->length);
+	} else if (kind == FUNK_MESSAGE_OBJECTS) {
+		// The object count is filled in at the end
+		funk_snapshot_write_uint32(&writer, 0);
+		uint32_t root = get_reference(&writer, (FunkObject*) value);
+
+		write_records(&writer);
+		funk_snapshot_write_uint32(&writer, root);
+
+		memcpy((void*) (writer.buffer + 1), (const void*) &writer.objectCount, sizeof(uint32_t));
+	}
+
+	free_writer_objects(&writer);
+
+	if (writer.failed) {
+		free((void*) writer.buffer);
+		funk_error(vm, "%s", writer.error);
+
+		return NULL;
+	}
+
+	*size = (uint32_t) writer.length;
+	return (void*) writer.buffer;
+}
+
+FunkFunction* funk_decode_message(FunkVm* vm, void* message, uint32_t size) {
+	const uint8_t* data = (const uint8_t*) message;
+	FunkFunction* value = NULL;
+	char error[FUNK_SNAPSHOT_ERROR_LENGTH] = "The message is broken";
+	bool failed = size == 0;
+
+	if (failed) {
+		// The size is checked first
+	} else if (data[0] == FUNK_MESSAGE_NAME) {
+		failed = size - 1 > UINT16_MAX;
+
+		if (!failed) {
+			value = (FunkFunction*) funk_create_basic_function(vm, funk_create_string(vm, (const char*) data + 1, (uint16_t) (size - 1)));
+		}
+	} else if (data[0] == FUNK_MESSAGE_OBJECTS && size >= 1 + 2 * sizeof(uint32_t)) {
+		uint32_t objectCount;
+		memcpy((void*) &objectCount, (const void*) (data + 1), sizeof(uint32_t));
+
+		failed = objectCount > size / FUNK_SNAPSHOT_RECORD_HEADER_SIZE;
+
+		if (!failed) {
+			FunkSnapshotReader reader;
+			init_reader(&reader, vm, objectCount);
+
+			read_records(&reader, data + 1 + sizeof(uint32_t), data + size);
+			FunkObject* root = funk_snapshot_read_object(&reader);
+
+			failed = reader.failed || reader.data != data + size || (root != NULL && root->type == FUNK_OBJECT_STRING);
+			value = (FunkFunction*) root;
+
+			if (reader.error[0] != '\0') {
+				memcpy((void*) error, (const void*) reader.error, FUNK_SNAPSHOT_ERROR_LENGTH);
+			}
+
+			free_reader(&reader);
+		}
+	} else {
+		failed = data[0] != FUNK_MESSAGE_NULL;
+	}
+
+	free(message);
+
+	if (failed) {
+		funk_error(vm, "%s", error);
+		return NULL;
+	}
+
+	return value;
+}
+
+void funk_free_message(void* message) {
+	free(message);
+}
@@ -0,0 +1,42 @@
+#ifndef FUNK_SNAPSHOT_H
+#define FUNK_SNAPSHOT_H
+
+#include "funk.h"
+
+// A snapshot is an image of the globals and modules of a vm, with every object, that they reach.
+// Loading one skips compiling and running the scripts, that made them. The natives without data are saved by their name,
+// the loading vm has to define them first, the natives with data only by the types, that were registered for them.
+// The image is only meant for the same build of funk, it keeps the bytecode as it is
+
+// Returns false and reports the error, if the heap holds natives, that can't be saved, or the file can't be written
+bool funk_save_snapshot(FunkVm* vm, const char* path);
+// The globals and modules of the snapshot replace the ones with the same names. Returns false, if the image is broken
+bool funk_load_snapshot(FunkVm* vm, const char* path);
+
+// Values, that go to another vm, are copied the same way, into a buffer from malloc(), that any thread can free.
+// Strings only take their characters. Raises an error with funk_error(), if the value holds something, that can't be copied
+void* funk_encode_message(FunkVm* vm, FunkFunction* value, uint32_t* size);
+// Creates the value in the vm, that receives it, and frees the message, even if it raises an error
+FunkFunction* funk_decode_message(FunkVm* vm, void* message, uint32_t size);
+// For the messages, that were never received
+void funk_free_message(void* message);
+
+// Natives, whose cleanup function is the one of the type, are saved with saveFn and restored with loadFn into a native,
+// that only has a name yet, loadFn has to set its functions and data
+void funk_register_snapshot_type(FunkVm* vm, const char* name, FunkDataCleanupFn cleanupFn, FunkSnapshotSaveFn saveFn, FunkSnapshotLoadFn loadFn);
+
+void funk_snapshot_write_uint32(FunkSnapshotWriter* writer, uint32_t value);
+void funk_snapshot_write_bytes(FunkSnapshotWriter* writer, const void* bytes, uint32_t size);
+// The object is saved as well, if it isn't already
+void funk_snapshot_write_object(FunkSnapshotWriter* writer, FunkObject* object);
+
+// Reading past the end of the saved data returns zeros and fails the load
+uint32_t funk_snapshot_read_uint32(FunkSnapshotReader* reader);
+const void* funk_snapshot_read_bytes(FunkSnapshotReader* reader, uint32_t size);
+// A count of elements, that follow, fails the load, if they can't fit into the rest of the data
+uint32_t funk_snapshot_read_count(FunkSnapshotReader* reader, uint32_t elementSize);
+FunkObject* funk_snapshot_read_object(FunkSnapshotReader* reader);
+// Fails the load, unless the object is a string or NULL
+FunkString* funk_snapshot_read_string(FunkSnapshotReader* reader);
+
+#endif
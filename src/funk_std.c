@@ -1,17 +1,42 @@
 #include "funk_std.h"
+#include "funk_simd.h"
+#include "funk_parallel.h"
+#include "funk_generator.h"
+#include "funk_loop.h"
+#include "funk_snapshot.h"
+#include "funk_channel.h"
 
 #include <stdio.h>
 #include <math.h>
 #include <time.h>
 
+#if defined(__linux__) || defined(__APPLE__)
+	#define FUNK_STD_MMAP
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
 static inline bool is_array(FunkFunction* argument);
 static inline bool is_map(FunkFunction* argument);
 static inline bool is_file(FunkFunction* argument);
+static size_t get_file_size(FunkVm* vm, FunkFunction* file);
+static inline bool is_iterator(FunkFunction* argument);
+static inline bool is_persistent_array(FunkFunction* argument);
+static inline bool is_persistent_map(FunkFunction* argument);
+static inline bool is_array_view(FunkFunction* argument);
+static inline bool is_numbers(FunkFunction* argument);
+static inline bool is_deque(FunkFunction* argument);
+static inline bool is_memo(FunkFunction* argument);
+static FunkFunction* persistent_array_push(FunkVm* vm, FunkFunction* array, FunkFunction** values, uint32_t count);
+static void run_iterator(FunkVm* vm, FunkFunction* iterator, FunkFunction* callback);
+static FunkFunction* to_iterator(FunkVm* vm, FunkFunction* argument);
 
 typedef struct FunkArrayData {
 	FunkFunction** data;
-	uint16_t length;
-	uint16_t allocated;
+	uint32_t length;
+	uint32_t allocated;
 } FunkArrayData;
 
 static FunkArrayData* extract_array_data(FunkVm* vm, FunkFunction* function) {
@@ -25,24 +50,36 @@ static FunkArrayData* extract_array_data(FunkVm* vm, FunkFunction* function) {
 
 static void cleanup_array_data(FunkVm* vm, FunkNativeFunction* function) {
 	if (function->data != NULL) {
-		vm->freeFn(function->data);
+		FunkArrayData* data = (FunkArrayData*) function->data;
+
+		FUNK_FREE_ARRAY(vm, FunkFunction*, data->data, data->allocated);
+		FUNK_FREE(vm, FunkArrayData, data);
+
 		function->data = NULL;
 	}
 }
 
+static void trace_array_data(FunkVm* vm, FunkNativeFunction* function) {
+	FunkArrayData* data = (FunkArrayData*) function->data;
+
+	for (uint32_t i = 0; i < data->length; i++) {
+		funk_mark_object(vm, (FunkObject *) data->data[i]);
+	}
+}
+
 FUNK_NATIVE_FUNCTION_DEFINITION(arrayCallback) {
 	FunkArrayData* data = extract_array_data(vm, (FunkFunction *) self);
 
 	if (argCount == 1) {
 		if (funk_function_has_code(args[0])) {
-			for (uint16_t i = 0; i < data->length; i++) {
+			for (uint32_t i = 0; i < data->length; i++) {
 				funk_run_function_arged(vm, args[0], &data->data[i], 1);
 			}
 
 			return NULL;
 		}
 
-		int32_t index = (int32_t) funk_to_number(vm, args[0]);
+		int64_t index = (int64_t) funk_to_number(vm, args[0]);
 
 		if (index < 0 || index >= data->length) {
 			return NULL;
@@ -52,31 +89,33 @@ FUNK_NATIVE_FUNCTION_DEFINITION(arrayCallback) {
 	}
 
 	FUNK_ENSURE_ARG_COUNT(2);
-	int32_t index = (int32_t) funk_to_number(vm, args[0]);
+	int64_t index = (int64_t) funk_to_number(vm, args[0]);
 
 	if (index < 0 || index >= data->length) {
 		return NULL;
 	}
 
 	data->data[index] = args[1];
+	funk_write_barrier(vm, (FunkFunction *) self, (FunkObject *) args[1]);
+
 	return NULL;
 }
 
 FUNK_NATIVE_FUNCTION_DEFINITION(array) {
 	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, "$arrayData", 10),(FunkNativeFn) arrayCallback);
-	FunkArrayData* data = (FunkArrayData*) vm->allocFn(sizeof(FunkArrayData));
+	FunkArrayData* data = FUNK_ALLOCATE(vm, FunkArrayData, 1);
 
+	data->data = NULL;
 	data->length = argCount;
 	data->allocated = argCount;
 
 	if (argCount > 0) {
-		size_t size = sizeof(FunkFunction*) * argCount;
-		data->data = (FunkFunction**) vm->allocFn(size);
-
-		memcpy((void*) data->data, args, size);
+		data->data = FUNK_ALLOCATE(vm, FunkFunction*, argCount);
+		memcpy((void*) data->data, args, sizeof(FunkFunction*) * argCount);
 	}
 
 	function->cleanupFn = cleanup_array_data;
+	function->traceFn = trace_array_data;
 	function->data = (void*) data;
 
 	return (FunkFunction *) function;
@@ -86,32 +125,65 @@ static inline bool is_array(FunkFunction* argument) {
 	return argument != NULL && argument->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) argument)->cleanupFn == cleanup_array_data;
 }
 
+static void save_array_data(FunkVm* vm, FunkNativeFunction* function, FunkSnapshotWriter* writer) {
+	FunkArrayData* data = (FunkArrayData*) function->data;
+	funk_snapshot_write_uint32(writer, data->length);
+
+	for (uint32_t i = 0; i < data->length; i++) {
+		funk_snapshot_write_object(writer, (FunkObject *) data->data[i]);
+	}
+}
+
+static void load_array_data(FunkVm* vm, FunkNativeFunction* function, FunkSnapshotReader* reader) {
+	FunkArrayData* data = FUNK_ALLOCATE(vm, FunkArrayData, 1);
+	uint32_t length = funk_snapshot_read_count(reader, sizeof(uint32_t));
+
+	data->data = length > 0 ? FUNK_ALLOCATE(vm, FunkFunction*, length) : NULL;
+	data->length = length;
+	data->allocated = length;
+
+	for (uint32_t i = 0; i < length; i++) {
+		data->data[i] = (FunkFunction *) funk_snapshot_read_object(reader);
+	}
+
+	function->fn = (FunkNativeFn) arrayCallback;
+	function->cleanupFn = cleanup_array_data;
+	function->traceFn = trace_array_data;
+	function->data = (void*) data;
+}
+
 FUNK_NATIVE_FUNCTION_DEFINITION(push) {
 	FUNK_ENSURE_MIN_ARG_COUNT(2);
 
-	if (!is_array(args[0])) {
+	if (is_persistent_array(args[0])) {
+		return persistent_array_push(vm, args[0], args + 1, argCount - 1);
+	} else if (!is_array(args[0])) {
 		funk_error(vm, "Expected an array as the first argument");
 		return NULL;
 	}
 
 	FunkArrayData* data = extract_array_data(vm, args[0]);
-	uint16_t newLength = data->length + argCount - 1;
+	uint32_t newLength = data->length + argCount - 1;
 
 	if (newLength > data->allocated) {
-		uint16_t newSize = FUNK_GROW_CAPACITY(data->allocated);
-		size_t totalSize = sizeof(FunkFunction*) * newSize;
-		FunkFunction** newData = (FunkFunction**) vm->allocFn(totalSize);
+		uint32_t newSize = FUNK_GROW_CAPACITY(data->allocated);
 
-		memcpy((void*) newData, (void*) data->data, sizeof(FunkFunction*) * data->allocated);
-		vm->freeFn((void*) data->data);
+		// A push with many arguments can need more, than just doubling
+		if (newSize < newLength) {
+			newSize = newLength;
+		}
 
-		data->data = newData;
+		data->data = FUNK_GROW_ARRAY(vm, FunkFunction*, data->data, data->allocated, newSize);
 		data->allocated = newSize;
 	}
 
 	memcpy((void*) (data->data + data->length), args + 1, sizeof(FunkFunction*) * (argCount - 1));
 	data->length = newLength;
 
+	for (uint8_t i = 1; i < argCount; i++) {
+		funk_write_barrier(vm, args[0], (FunkObject *) args[i]);
+	}
+
 	return NULL;
 }
 
@@ -145,12 +217,16 @@ static void cleanup_map_data(FunkVm* vm, FunkNativeFunction* function) {
 		FunkMapData* data = extract_map_data(vm, (FunkFunction *) function);
 
 		funk_free_table(vm, &data->table);
-		vm->freeFn(function->data);
+		FUNK_FREE(vm, FunkMapData, data);
 
 		function->data = NULL;
 	}
 }
 
+static void trace_map_data(FunkVm* vm, FunkNativeFunction* function) {
+	funk_mark_table(vm, &((FunkMapData*) function->data)->table);
+}
+
 FUNK_NATIVE_FUNCTION_DEFINITION(mapCallback) {
 	FunkMapData* data = extract_map_data(vm, (FunkFunction *) self);
 
@@ -184,12 +260,16 @@ FUNK_NATIVE_FUNCTION_DEFINITION(mapCallback) {
 	FUNK_ENSURE_ARG_COUNT(2);
 
 	funk_table_set(vm, &data->table, args[0]->name, (FunkObject *) args[1]);
+
+	funk_write_barrier(vm, (FunkFunction *) self, (FunkObject *) args[0]->name);
+	funk_write_barrier(vm, (FunkFunction *) self, (FunkObject *) args[1]);
+
 	return NULL;
 }
 
 FUNK_NATIVE_FUNCTION_DEFINITION(map) {
 	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, "$mapData", 8),(FunkNativeFn) mapCallback);
-	FunkMapData* data = (FunkMapData*) vm->allocFn(sizeof(FunkMapData));
+	FunkMapData* data = FUNK_ALLOCATE(vm, FunkMapData, 1);
 
 	funk_init_table(&data->table);
 
@@ -208,6 +288,7 @@ FUNK_NATIVE_FUNCTION_DEFINITION(map) {
 	}
 
 	function->cleanupFn = cleanup_map_data;
+	function->traceFn = trace_map_data;
 	function->data = (void*) data;
 
 	return (FunkFunction *) function;
@@ -217,520 +298,3612 @@ static inline bool is_map(FunkFunction* argument) {
 	return argument != NULL && argument->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) argument)->cleanupFn == cleanup_map_data;
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(_remove) {
-	FUNK_ENSURE_ARG_COUNT(2);
+static void save_map_data(FunkVm* vm, FunkNativeFunction* function, FunkSnapshotWriter* writer) {
+	FunkTable* table = &((FunkMapData*) function->data)->table;
+	funk_snapshot_write_uint32(writer, (uint32_t) table->count);
 
-	if (args[1] == NULL) {
-		return NULL;
+	for (int32_t i = 0; i <= table->capacity; i++) {
+		FunkTableEntry* entry = &table->entries[i];
+
+		if (entry->key != NULL) {
+			funk_snapshot_write_object(writer, (FunkObject *) entry->key);
+			funk_snapshot_write_object(writer, entry->value);
+		}
 	}
+}
 
-	FunkFunction* argument = args[0];
+static void load_map_data(FunkVm* vm, FunkNativeFunction* function, FunkSnapshotReader* reader) {
+	FunkMapData* data = FUNK_ALLOCATE(vm, FunkMapData, 1);
+	funk_init_table(&data->table);
 
-	if (is_map(argument)) {
-		FunkMapData* data = extract_map_data(vm, argument);
-		funk_table_delete(&data->table, args[1]->name);
+	function->fn = (FunkNativeFn) mapCallback;
+	function->cleanupFn = cleanup_map_data;
+	function->traceFn = trace_map_data;
+	function->data = (void*) data;
 
-		return NULL;
-	} else if (!is_array(argument)) {
-		funk_error(vm, "Expected an array as the first argument");
-		return NULL;
-	}
+	uint32_t count = funk_snapshot_read_count(reader, 2 * sizeof(uint32_t));
 
-	FunkArrayData* data = extract_array_data(vm, argument);
-	int32_t index = (int32_t) funk_to_number(vm, args[1]);
+	for (uint32_t i = 0; i < count; i++) {
+		FunkString* key = funk_snapshot_read_string(reader);
+		FunkObject* value = funk_snapshot_read_object(reader);
 
-	if (index < 0 || index >= data->length) {
-		return NULL;
+		if (key != NULL) {
+			funk_table_set(vm, &data->table, key, value);
+		}
 	}
+}
 
-	if (index == data->length - 1) {
-		data->length--;
-		return NULL;
+// Persistent arrays and maps never change once created: every update returns a new version,
+// that shares all the untouched nodes with the previous one. Nodes are reference counted,
+// so that a version can be freed without knowing, which other versions still use its nodes.
+
+#define FUNK_TRIE_BITS 5
+#define FUNK_TRIE_WIDTH (1 << FUNK_TRIE_BITS)
+#define FUNK_TRIE_MASK (FUNK_TRIE_WIDTH - 1)
+#define FUNK_HAMT_MAX_SHIFT 35
+#define FUNK_HAMT_MAX_DEPTH (FUNK_HAMT_MAX_SHIFT / FUNK_TRIE_BITS + 1)
+
+typedef struct FunkVectorNode {
+	uint32_t refCount;
+	// Nodes are shared between versions, so each one is traced once per collection
+	uint32_t markedIn;
+	void* slots[FUNK_TRIE_WIDTH];
+} FunkVectorNode;
+
+typedef struct FunkPersistentArrayData {
+	FunkVectorNode* root;
+	uint32_t length;
+	uint8_t shift;
+} FunkPersistentArrayData;
+
+static FunkVectorNode* create_vector_node(FunkVm* vm) {
+	FunkVectorNode* node = FUNK_ALLOCATE(vm, FunkVectorNode, 1);
+
+	node->refCount = 1;
+	node->markedIn = 0;
+	memset((void*) node->slots, 0, sizeof(node->slots));
+
+	return node;
+}
+
+static void release_vector_node(FunkVm* vm, FunkVectorNode* node, uint8_t shift) {
+	if (node == NULL || --node->refCount > 0) {
+		return;
 	}
 
-	memcpy((void*) (data->data + index), data->data + index + 1, sizeof(FunkFunction*) * (data->length - index - 1));
-	data->length--;
+	if (shift > 0) {
+		for (uint8_t i = 0; i < FUNK_TRIE_WIDTH; i++) {
+			release_vector_node(vm, (FunkVectorNode*) node->slots[i], shift - FUNK_TRIE_BITS);
+		}
+	}
 
-	return NULL;
+	FUNK_FREE(vm, FunkVectorNode, node);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(variable) {
-	FUNK_ENSURE_ARG_COUNT(1);
+static FunkVectorNode* copy_vector_node(FunkVm* vm, FunkVectorNode* node, uint8_t shift) {
+	FunkVectorNode* copy = create_vector_node(vm);
 
-	if (args[0] == NULL) {
-		return NULL;
+	if (node == NULL) {
+		return copy;
 	}
 
-	uint16_t length = args[0]->name->length + 1;
-	char string[length + 1];
+	memcpy((void*) copy->slots, (void*) node->slots, sizeof(node->slots));
 
-	string[0] = '$';
-	memcpy((void*) (string + 1), args[0]->name->chars, args[0]->name->length);
-	string[length] = '\0';
+	if (shift > 0) {
+		for (uint8_t i = 0; i < FUNK_TRIE_WIDTH; i++) {
+			if (copy->slots[i] != NULL) {
+				((FunkVectorNode*) copy->slots[i])->refCount++;
+			}
+		}
+	}
 
-	FUNK_RETURN_STRING(string);
+	return copy;
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(print) {
-	for (uint8_t i = 0; i < argCount; i++) {
-		printf("%s\n", funk_to_string(args[i]));
+static FunkVectorNode* vector_assoc(FunkVm* vm, FunkVectorNode* node, uint8_t shift, uint32_t index, FunkFunction* value) {
+	FunkVectorNode* copy = copy_vector_node(vm, node, shift);
+	uint32_t slot = (index >> shift) & FUNK_TRIE_MASK;
+
+	if (shift == 0) {
+		copy->slots[slot] = (void*) value;
+	} else {
+		FunkVectorNode* child = (FunkVectorNode*) copy->slots[slot];
+
+		copy->slots[slot] = (void*) vector_assoc(vm, child, shift - FUNK_TRIE_BITS, index, value);
+		release_vector_node(vm, child, shift - FUNK_TRIE_BITS);
 	}
 
-	return NULL;
+	return copy;
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(printNumber) {
-	for (uint8_t i = 0; i < argCount; i++) {
-		printf("%.6g\n", funk_to_number(vm, args[i]));
+static FunkFunction* vector_get(FunkPersistentArrayData* data, uint32_t index) {
+	FunkVectorNode* node = data->root;
+
+	for (uint8_t shift = data->shift; shift > 0 && node != NULL; shift -= FUNK_TRIE_BITS) {
+		node = (FunkVectorNode*) node->slots[(index >> shift) & FUNK_TRIE_MASK];
 	}
 
-	return NULL;
+	return node == NULL ? NULL : (FunkFunction*) node->slots[index & FUNK_TRIE_MASK];
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(printChar) {
-	for (uint8_t i = 0; i < argCount; i++) {
-		printf("%c", (char) funk_to_number(vm, args[i]));
+static FunkPersistentArrayData* extract_persistent_array_data(FunkVm* vm, FunkFunction* function) {
+	if (!is_persistent_array(function)) {
+		funk_error(vm, "Expected a persistent array as argument");
+		return NULL;
 	}
 
-	return NULL;
+	return (FunkPersistentArrayData*) ((FunkNativeFunction*) function)->data;
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(_clock) {
-	clock_t time = clock();
-	double inSeconds = (double) time / (double) CLOCKS_PER_SEC;
+static void cleanup_persistent_array_data(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data != NULL) {
+		FunkPersistentArrayData* data = (FunkPersistentArrayData*) function->data;
 
-	FUNK_RETURN_NUMBER(inSeconds);
+		release_vector_node(vm, data->root, data->shift);
+		FUNK_FREE(vm, FunkPersistentArrayData, data);
+
+		function->data = NULL;
+	}
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(set) {
-	FUNK_ENSURE_ARG_COUNT(2);
+static void trace_vector_node(FunkVm* vm, FunkVectorNode* node, uint8_t shift) {
+	if (node == NULL || !funk_claim_node(vm, &node->markedIn)) {
+		return;
+	}
 
-	if (args[0] == NULL) {
-		return NULL;
+	for (uint8_t i = 0; i < FUNK_TRIE_WIDTH; i++) {
+		if (shift > 0) {
+			trace_vector_node(vm, (FunkVectorNode*) node->slots[i], shift - FUNK_TRIE_BITS);
+		} else {
+			funk_mark_object(vm, (FunkObject *) node->slots[i]);
+		}
 	}
+}
 
-	funk_set_variable(vm, args[0]->name->chars, args[1]);
-	return NULL;
+static void trace_persistent_array_data(FunkVm* vm, FunkNativeFunction* function) {
+	FunkPersistentArrayData* data = (FunkPersistentArrayData*) function->data;
+	trace_vector_node(vm, data->root, data->shift);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(get) {
-	FUNK_ENSURE_ARG_COUNT(1);
+FUNK_NATIVE_FUNCTION_DEFINITION(persistentArrayCallback);
 
-	if (args[0] == NULL) {
-		return NULL;
-	}
+// Takes over the reference to the root
+static FunkFunction* create_persistent_array(FunkVm* vm, FunkVectorNode* root, uint32_t length, uint8_t shift) {
+	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, "$persistentArrayData", 20), (FunkNativeFn) persistentArrayCallback);
+	FunkPersistentArrayData* data = FUNK_ALLOCATE(vm, FunkPersistentArrayData, 1);
 
-	return funk_get_variable(vm, args[0]->name->chars);
+	data->root = root;
+	data->length = length;
+	data->shift = shift;
+
+	function->cleanupFn = cleanup_persistent_array_data;
+	function->traceFn = trace_persistent_array_data;
+	function->data = (void*) data;
+
+	return (FunkFunction *) function;
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(equal) {
-	FUNK_ENSURE_ARG_COUNT(2);
+static FunkFunction* persistent_array_set(FunkVm* vm, FunkFunction* array, uint32_t index, FunkFunction* value) {
+	FunkPersistentArrayData* data = extract_persistent_array_data(vm, array);
 
-	if (args[0] == NULL || args[1] == NULL) {
-		FUNK_RETURN_BOOL(args[0] == args[1]);
+	if (index >= data->length) {
+		return array;
 	}
 
-	FUNK_RETURN_BOOL(args[0]->name == args[1]->name);
+	return create_persistent_array(vm, vector_assoc(vm, data->root, data->shift, index, value), data->length, data->shift);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(notEqual) {
-	FUNK_ENSURE_ARG_COUNT(2);
+static void vector_append(FunkVm* vm, FunkPersistentArrayData* data, FunkFunction* value) {
+	if (data->length == ((uint32_t) 1 << (data->shift + FUNK_TRIE_BITS))) {
+		FunkVectorNode* newRoot = create_vector_node(vm);
 
-	if (args[0] == NULL || args[1] == NULL) {
-		FUNK_RETURN_BOOL(args[0] != args[1]);
+		newRoot->slots[0] = (void*) data->root;
+		data->root = newRoot;
+		data->shift += FUNK_TRIE_BITS;
 	}
 
-	FUNK_RETURN_BOOL(args[0]->name != args[1]->name);
-}
+	FunkVectorNode* newRoot = vector_assoc(vm, data->root, data->shift, data->length++, value);
 
-FUNK_NATIVE_FUNCTION_DEFINITION(notNull) {
-	FUNK_ENSURE_ARG_COUNT(1);
-	FUNK_RETURN_BOOL(args[0] != NULL);
+	release_vector_node(vm, data->root, data->shift);
+	data->root = newRoot;
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(not) {
-	FUNK_ENSURE_ARG_COUNT(1);
-	FUNK_RETURN_BOOL(!funk_is_true(vm, args[0]));
-}
+static FunkFunction* persistent_array_push(FunkVm* vm, FunkFunction* array, FunkFunction** values, uint32_t count) {
+	FunkPersistentArrayData data = *extract_persistent_array_data(vm, array);
 
-FUNK_NATIVE_FUNCTION_DEFINITION(_if) {
-	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	if (data.root != NULL) {
+		data.root->refCount++;
+	}
 
-	if (funk_is_true(vm, args[0])) {
-		return funk_run_function(vm, args[1], 0);
-	} else if (argCount > 2) {
-		return funk_run_function(vm, args[2], 0);
+	for (uint32_t i = 0; i < count; i++) {
+		vector_append(vm, &data, values[i]);
 	}
 
-	return NULL;
+	return create_persistent_array(vm, data.root, data.length, data.shift);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(_while) {
-	FUNK_ENSURE_ARG_COUNT(2);
+static FunkFunction* persistent_array_remove(FunkVm* vm, FunkFunction* array, uint32_t index) {
+	FunkPersistentArrayData* data = extract_persistent_array_data(vm, array);
 
-	while (funk_is_true(vm, args[0])) {
-		funk_run_function(vm, args[1], 0);
+	if (index >= data->length) {
+		return array;
 	}
 
-	return NULL;
-}
-
-FUNK_NATIVE_FUNCTION_DEFINITION(_for) {
-	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	if (index == data->length - 1) {
+		return create_persistent_array(vm, vector_assoc(vm, data->root, data->shift, index, NULL), data->length - 1, data->shift);
+	}
 
-	if (argCount == 2) {
-		FunkFunction* argument = args[0];
+	// Removing from the middle moves all the following elements, so the trie has to be rebuilt
+	FunkPersistentArrayData result = { NULL, 0, 0 };
 
-		if (argument == NULL) {
-			return NULL;
+	for (uint32_t i = 0; i < data->length; i++) {
+		if (i != index) {
+			vector_append(vm, &result, vector_get(data, i));
 		}
+	}
 
-		if (is_array(argument)) {
-			FunkArrayData* data = extract_array_data(vm, argument);
+	return create_persistent_array(vm, result.root, result.length, result.shift);
+}
 
-			for (uint16_t i = 0; i < data->length; i++) {
-				funk_run_function_arged(vm, args[1], &data->data[i], 1);
+FUNK_NATIVE_FUNCTION_DEFINITION(persistentArrayCallback) {
+	FunkPersistentArrayData* data = extract_persistent_array_data(vm, (FunkFunction *) self);
+
+	if (argCount == 1) {
+		if (funk_function_has_code(args[0])) {
+			for (uint32_t i = 0; i < data->length; i++) {
+				FunkFunction* value = vector_get(data, i);
+				funk_run_function_arged(vm, args[0], &value, 1);
 			}
 
 			return NULL;
-		} else if (is_map(argument)) {
-			FunkMapData* data = extract_map_data(vm, argument);
-
-			for (int32_t i = 0; i <= data->table.capacity; i++) {
-				FunkTableEntry* entry = &data->table.entries[i];
-
-				if (entry->key != NULL) {
-					FunkFunction* buffer[2] = {
-						(FunkFunction*) funk_create_basic_function(vm, entry->key), // Bye-bye efficiency!
-						(FunkFunction *) entry->value
-					};
+		}
 
-					funk_run_function_arged(vm, args[1], (FunkFunction **) &buffer, 2);
-				}
-			}
+		int32_t index = (int32_t) funk_to_number(vm, args[0]);
 
+		if (index < 0 || (uint32_t) index >= data->length) {
 			return NULL;
 		}
 
-		FunkString* string = argument->name;
-		char buffer[2] = " \0";
-
-		for (uint16_t i = 0; i < string->length; i++) {
-			buffer[0] = string->chars[i];
+		return vector_get(data, (uint32_t) index);
+	}
 
-			FunkFunction* function = (FunkFunction*) funk_create_empty_function(vm, buffer);
-			funk_run_function_arged(vm, args[1], &function, 1);
-		}
+	FUNK_ENSURE_ARG_COUNT(2);
+	int32_t index = (int32_t) funk_to_number(vm, args[0]);
 
-		return NULL;
+	if (index < 0) {
+		return (FunkFunction *) self;
 	}
 
-	FunkFunction* to = args[1];
-	double from = funk_to_number(vm, args[0]);
-	bool increment = from < funk_to_number(vm, to);
+	return persistent_array_set(vm, (FunkFunction *) self, (uint32_t) index, args[1]);
+}
 
-	for (double i = funk_to_number(vm, args[0]);
-			increment ? (i < funk_to_number(vm, to)) : (i > funk_to_number(vm, to));
-			i += (increment ? 1 : -1)) {
+static FunkFunction* create_persistent_array_from(FunkVm* vm, FunkFunction** values, uint32_t count) {
+	FunkPersistentArrayData data = { NULL, 0, 0 };
 
-		FunkFunction* indexFunction = funk_number_to_string(vm, i);
-		funk_run_function_arged(vm, args[2], &indexFunction, 1);
+	for (uint32_t i = 0; i < count; i++) {
+		vector_append(vm, &data, values[i]);
 	}
 
-	return NULL;
+	return create_persistent_array(vm, data.root, data.length, data.shift);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(space) {
-	FUNK_RETURN_STRING(" ");
+FUNK_NATIVE_FUNCTION_DEFINITION(persistentArray) {
+	return create_persistent_array_from(vm, args, argCount);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(separator) {
-	FUNK_RETURN_STRING("/");
+static inline bool is_persistent_array(FunkFunction* argument) {
+	return argument != NULL && argument->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) argument)->cleanupFn == cleanup_persistent_array_data;
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(dot) {
-	FUNK_RETURN_STRING(".");
-}
+// Hash array mapped trie, keyed by the interned name, so keys are compared by pointer
+typedef struct FunkHamtEntry {
+	FunkString* key; // NULL, if the value is a child node
+	void* value;
+} FunkHamtEntry;
 
-FUNK_NATIVE_FUNCTION_DEFINITION(substring) {
-	FUNK_ENSURE_MIN_ARG_COUNT(2);
+typedef struct FunkHamtNode {
+	uint32_t refCount;
+	uint32_t markedIn;
+	uint32_t bitmap;
+	uint16_t length;
 
-	FunkFunction* client = args[0];
+	FunkHamtEntry entries[];
+} FunkHamtNode;
 
-	if (client == NULL) {
-		return NULL;
-	}
+typedef struct FunkPersistentMapData {
+	FunkHamtNode* root;
+	uint32_t count;
+} FunkPersistentMapData;
 
-	uint16_t from = (uint16_t) fmax(0, funk_to_number(vm, args[1]));
-	uint16_t length = argCount > 2 ? (uint16_t) fmin(client->name->length - 1 - from, funk_to_number(vm, args[2])) : 1;
+static inline uint8_t count_bits(uint32_t value) {
+	value = value - ((value >> 1) & 0x55555555);
+	value = (value & 0x33333333) + ((value >> 2) & 0x33333333);
 
-	if (length < 1) {
-		FUNK_RETURN_STRING("");
-	}
+	return (uint8_t) ((((value + (value >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+}
 
-	char string[length + 1];
+static FunkHamtNode* create_hamt_node(FunkVm* vm, uint16_t length) {
+	FunkHamtNode* node = (FunkHamtNode*) funk_reallocate(vm, NULL, 0, sizeof(FunkHamtNode) + sizeof(FunkHamtEntry) * length);
 
-	memcpy((void*) string, (void*) (client->name->chars + from), length);
-	string[length] = '\0';
+	node->refCount = 1;
+	node->markedIn = 0;
+	node->bitmap = 0;
+	node->length = length;
 
-	FUNK_RETURN_STRING(string);
+	return node;
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(length) {
-	FUNK_ENSURE_ARG_COUNT(1);
-	FunkFunction* argument = args[0];
-
-	if (argument == NULL) {
-		FUNK_RETURN_NUMBER(0);
+static void release_hamt_node(FunkVm* vm, FunkHamtNode* node) {
+	if (node == NULL || --node->refCount > 0) {
+		return;
 	}
 
-	if (is_array(argument)) {
-		FunkArrayData* data = extract_array_data(vm, argument);
-		FUNK_RETURN_NUMBER(data->length);
-	} else if (is_map(argument)) {
-		FunkMapData* data = extract_map_data(vm, argument);
-		FUNK_RETURN_NUMBER(data->table.count);
+	for (uint16_t i = 0; i < node->length; i++) {
+		if (node->entries[i].key == NULL) {
+			release_hamt_node(vm, (FunkHamtNode*) node->entries[i].value);
+		}
 	}
 
-	FUNK_RETURN_NUMBER(argument->name->length);
+	funk_deallocate(vm, (void*) node, sizeof(FunkHamtNode) + sizeof(FunkHamtEntry) * node->length);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(join) {
-	uint16_t length = 0;
+// Copies the node with room for the given entry count change at position, all the shared children get an extra reference
+static FunkHamtNode* copy_hamt_node(FunkVm* vm, FunkHamtNode* node, uint16_t position, int8_t change) {
+	FunkHamtNode* copy = create_hamt_node(vm, node->length + change);
+	uint16_t skipped = change < 0 ? position + 1 : position;
 
-	if (argCount == 1 && is_array(args[0])) {
-		FunkArrayData* data = extract_array_data(vm, args[0]);
-		args = data->data;
-		argCount = data->length;
-	}
+	copy->bitmap = node->bitmap;
 
-	for (uint8_t i = 0; i < argCount; i++) {
-		length += args[i] == NULL ? 4 : args[i]->name->length;
+	memcpy((void*) copy->entries, (void*) node->entries, sizeof(FunkHamtEntry) * position);
+	memcpy((void*) (copy->entries + position + (change > 0 ? 1 : 0)), (void*) (node->entries + skipped), sizeof(FunkHamtEntry) * (node->length - skipped));
+
+	for (uint16_t i = 0; i < copy->length; i++) {
+		if (!(change > 0 && i == position) && copy->entries[i].key == NULL) {
+			((FunkHamtNode*) copy->entries[i].value)->refCount++;
+		}
 	}
 
-	char string[length + 1];
-	uint16_t index = 0;
+	return copy;
+}
 
-	for (uint8_t i = 0; i < argCount; i++) {
+static FunkHamtNode* hamt_merge(FunkVm* vm, FunkString* keyA, void* valueA, FunkString* keyB, void* valueB, uint8_t shift) {
+	if (shift >= FUNK_HAMT_MAX_SHIFT) {
+		FunkHamtNode* node = create_hamt_node(vm, 2);
+
+		node->entries[0] = (FunkHamtEntry) { keyA, valueA };
+		node->entries[1] = (FunkHamtEntry) { keyB, valueB };
+
+		return node;
+	}
+
+	uint32_t slotA = (keyA->hash >> shift) & FUNK_TRIE_MASK;
+	uint32_t slotB = (keyB->hash >> shift) & FUNK_TRIE_MASK;
+
+	if (slotA == slotB) {
+		FunkHamtNode* node = create_hamt_node(vm, 1);
+
+		node->bitmap = (uint32_t) 1 << slotA;
+		node->entries[0] = (FunkHamtEntry) { NULL, (void*) hamt_merge(vm, keyA, valueA, keyB, valueB, shift + FUNK_TRIE_BITS) };
+
+		return node;
+	}
+
+	FunkHamtNode* node = create_hamt_node(vm, 2);
+
+	node->bitmap = ((uint32_t) 1 << slotA) | ((uint32_t) 1 << slotB);
+	node->entries[slotA < slotB ? 0 : 1] = (FunkHamtEntry) { keyA, valueA };
+	node->entries[slotA < slotB ? 1 : 0] = (FunkHamtEntry) { keyB, valueB };
+
+	return node;
+}
+
+static bool hamt_get(FunkHamtNode* node, FunkString* key, FunkFunction** value) {
+	uint8_t shift = 0;
+
+	while (node != NULL) {
+		if (shift >= FUNK_HAMT_MAX_SHIFT) {
+			for (uint16_t i = 0; i < node->length; i++) {
+				if (node->entries[i].key == key) {
+					*value = (FunkFunction*) node->entries[i].value;
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		uint32_t bit = (uint32_t) 1 << ((key->hash >> shift) & FUNK_TRIE_MASK);
+
+		if ((node->bitmap & bit) == 0) {
+			return false;
+		}
+
+		FunkHamtEntry* entry = &node->entries[count_bits(node->bitmap & (bit - 1))];
+
+		if (entry->key == NULL) {
+			node = (FunkHamtNode*) entry->value;
+			shift += FUNK_TRIE_BITS;
+
+			continue;
+		}
+
+		if (entry->key != key) {
+			return false;
+		}
+
+		*value = (FunkFunction*) entry->value;
+		return true;
+	}
+
+	return false;
+}
+
+static FunkHamtNode* hamt_set(FunkVm* vm, FunkHamtNode* node, FunkString* key, FunkFunction* value, uint8_t shift, bool* added) {
+	if (node == NULL) {
+		node = create_hamt_node(vm, 0);
+		FunkHamtNode* result = hamt_set(vm, node, key, value, shift, added);
+
+		release_hamt_node(vm, node);
+		return result;
+	}
+
+	if (shift >= FUNK_HAMT_MAX_SHIFT) {
+		for (uint16_t i = 0; i < node->length; i++) {
+			if (node->entries[i].key == key) {
+				FunkHamtNode* copy = copy_hamt_node(vm, node, 0, 0);
+				copy->entries[i].value = (void*) value;
+
+				return copy;
+			}
+		}
+
+		FunkHamtNode* copy = copy_hamt_node(vm, node, node->length, 1);
+		copy->entries[node->length] = (FunkHamtEntry) { key, (void*) value };
+
+		*added = true;
+		return copy;
+	}
+
+	uint32_t bit = (uint32_t) 1 << ((key->hash >> shift) & FUNK_TRIE_MASK);
+	uint16_t position = count_bits(node->bitmap & (bit - 1));
+
+	if ((node->bitmap & bit) == 0) {
+		FunkHamtNode* copy = copy_hamt_node(vm, node, position, 1);
+
+		copy->bitmap |= bit;
+		copy->entries[position] = (FunkHamtEntry) { key, (void*) value };
+
+		*added = true;
+		return copy;
+	}
+
+	FunkHamtEntry* entry = &node->entries[position];
+	FunkHamtNode* copy = copy_hamt_node(vm, node, 0, 0);
+
+	if (entry->key == NULL) {
+		FunkHamtNode* child = (FunkHamtNode*) entry->value;
+
+		copy->entries[position].value = (void*) hamt_set(vm, child, key, value, shift + FUNK_TRIE_BITS, added);
+		release_hamt_node(vm, child);
+	} else if (entry->key == key) {
+		copy->entries[position].value = (void*) value;
+	} else {
+		copy->entries[position] = (FunkHamtEntry) { NULL, (void*) hamt_merge(vm, entry->key, entry->value, key, (void*) value, shift + FUNK_TRIE_BITS) };
+		*added = true;
+	}
+
+	return copy;
+}
+
+// Returns NULL, if the node became empty
+static FunkHamtNode* hamt_remove(FunkVm* vm, FunkHamtNode* node, FunkString* key, uint8_t shift, bool* removed) {
+	uint16_t position = 0;
+
+	if (shift >= FUNK_HAMT_MAX_SHIFT) {
+		while (position < node->length && node->entries[position].key != key) {
+			position++;
+		}
+
+		if (position == node->length) {
+			node->refCount++;
+			return node;
+		}
+	} else {
+		uint32_t bit = (uint32_t) 1 << ((key->hash >> shift) & FUNK_TRIE_MASK);
+
+		if ((node->bitmap & bit) == 0) {
+			node->refCount++;
+			return node;
+		}
+
+		position = count_bits(node->bitmap & (bit - 1));
+		FunkHamtEntry* entry = &node->entries[position];
+
+		if (entry->key == NULL) {
+			FunkHamtNode* child = (FunkHamtNode*) entry->value;
+			FunkHamtNode* newChild = hamt_remove(vm, child, key, shift + FUNK_TRIE_BITS, removed);
+
+			if (newChild == child) {
+				release_hamt_node(vm, newChild);
+				node->refCount++;
+
+				return node;
+			}
+
+			if (newChild != NULL) {
+				FunkHamtNode* copy = copy_hamt_node(vm, node, 0, 0);
+
+				// Pull a lonely entry up, so that the trie stays as shallow as possible
+				if (newChild->length == 1 && newChild->entries[0].key != NULL) {
+					copy->entries[position] = newChild->entries[0];
+					release_hamt_node(vm, newChild);
+				} else {
+					copy->entries[position].value = (void*) newChild;
+				}
+
+				release_hamt_node(vm, child);
+				return copy;
+			}
+		} else if (entry->key != key) {
+			node->refCount++;
+			return node;
+		}
+
+		*removed = true;
+
+		if (node->length == 1) {
+			return NULL;
+		}
+
+		FunkHamtNode* copy = copy_hamt_node(vm, node, position, -1);
+		copy->bitmap &= ~bit;
+
+		return copy;
+	}
+
+	*removed = true;
+
+	if (node->length == 1) {
+		return NULL;
+	}
+
+	return copy_hamt_node(vm, node, position, -1);
+}
+
+typedef struct FunkHamtCursor {
+	FunkHamtNode* nodes[FUNK_HAMT_MAX_DEPTH];
+	uint16_t positions[FUNK_HAMT_MAX_DEPTH];
+	int8_t depth;
+} FunkHamtCursor;
+
+static void init_hamt_cursor(FunkHamtCursor* cursor, FunkHamtNode* root) {
+	cursor->nodes[0] = root;
+	cursor->positions[0] = 0;
+	cursor->depth = root == NULL ? -1 : 0;
+}
+
+static FunkHamtEntry* hamt_cursor_next(FunkHamtCursor* cursor) {
+	while (cursor->depth >= 0) {
+		FunkHamtNode* node = cursor->nodes[cursor->depth];
+		uint16_t position = cursor->positions[cursor->depth];
+
+		if (position >= node->length) {
+			cursor->depth--;
+			continue;
+		}
+
+		FunkHamtEntry* entry = &node->entries[position];
+		cursor->positions[cursor->depth]++;
+
+		if (entry->key != NULL) {
+			return entry;
+		}
+
+		cursor->depth++;
+		cursor->nodes[cursor->depth] = (FunkHamtNode*) entry->value;
+		cursor->positions[cursor->depth] = 0;
+	}
+
+	return NULL;
+}
+
+static FunkPersistentMapData* extract_persistent_map_data(FunkVm* vm, FunkFunction* function) {
+	if (!is_persistent_map(function)) {
+		funk_error(vm, "Expected a persistent map as argument");
+		return NULL;
+	}
+
+	return (FunkPersistentMapData*) ((FunkNativeFunction*) function)->data;
+}
+
+static void cleanup_persistent_map_data(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data != NULL) {
+		FunkPersistentMapData* data = (FunkPersistentMapData*) function->data;
+
+		release_hamt_node(vm, data->root);
+		FUNK_FREE(vm, FunkPersistentMapData, data);
+
+		function->data = NULL;
+	}
+}
+
+static void trace_hamt_node(FunkVm* vm, FunkHamtNode* node) {
+	if (node == NULL || !funk_claim_node(vm, &node->markedIn)) {
+		return;
+	}
+
+	for (uint16_t i = 0; i < node->length; i++) {
+		FunkHamtEntry* entry = &node->entries[i];
+
+		if (entry->key == NULL) {
+			trace_hamt_node(vm, (FunkHamtNode*) entry->value);
+		} else {
+			funk_mark_object(vm, (FunkObject *) entry->key);
+			funk_mark_object(vm, (FunkObject *) entry->value);
+		}
+	}
+}
+
+static void trace_persistent_map_data(FunkVm* vm, FunkNativeFunction* function) {
+	trace_hamt_node(vm, ((FunkPersistentMapData*) function->data)->root);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(persistentMapCallback);
+
+// Takes over the reference to the root
+static FunkFunction* create_persistent_map(FunkVm* vm, FunkHamtNode* root, uint32_t count) {
+	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, "$persistentMapData", 18), (FunkNativeFn) persistentMapCallback);
+	FunkPersistentMapData* data = FUNK_ALLOCATE(vm, FunkPersistentMapData, 1);
+
+	data->root = root;
+	data->count = count;
+
+	function->cleanupFn = cleanup_persistent_map_data;
+	function->traceFn = trace_persistent_map_data;
+	function->data = (void*) data;
+
+	return (FunkFunction *) function;
+}
+
+static FunkFunction* persistent_map_set(FunkVm* vm, FunkFunction* map, FunkString* key, FunkFunction* value) {
+	FunkPersistentMapData* data = extract_persistent_map_data(vm, map);
+	bool added = false;
+
+	FunkHamtNode* root = hamt_set(vm, data->root, key, value, 0, &added);
+	return create_persistent_map(vm, root, data->count + (added ? 1 : 0));
+}
+
+static FunkFunction* persistent_map_remove(FunkVm* vm, FunkFunction* map, FunkString* key) {
+	FunkPersistentMapData* data = extract_persistent_map_data(vm, map);
+
+	if (data->root == NULL) {
+		return map;
+	}
+
+	bool removed = false;
+	FunkHamtNode* root = hamt_remove(vm, data->root, key, 0, &removed);
+
+	if (!removed) {
+		release_hamt_node(vm, root);
+		return map;
+	}
+
+	return create_persistent_map(vm, root, data->count - 1);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(persistentMapCallback) {
+	FunkPersistentMapData* data = extract_persistent_map_data(vm, (FunkFunction *) self);
+
+	if (argCount > 0 && args[0] == NULL) {
+		return NULL;
+	}
+
+	if (argCount == 1) {
+		if (funk_function_has_code(args[0])) {
+			FunkHamtCursor cursor;
+			FunkHamtEntry* entry;
+
+			init_hamt_cursor(&cursor, data->root);
+
+			while ((entry = hamt_cursor_next(&cursor)) != NULL) {
+				FunkFunction* buffer[2] = {
+					(FunkFunction*) funk_create_basic_function(vm, entry->key),
+					(FunkFunction*) entry->value
+				};
+
+				funk_run_function_arged(vm, args[0], (FunkFunction **) &buffer, 2);
+			}
+
+			return NULL;
+		}
+
+		FunkFunction* result = NULL;
+		hamt_get(data->root, args[0]->name, &result);
+
+		return result;
+	}
+
+	FUNK_ENSURE_ARG_COUNT(2);
+	return persistent_map_set(vm, (FunkFunction *) self, args[0]->name, args[1]);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(persistentMap) {
+	FunkHamtNode* root = NULL;
+	uint32_t count = 0;
+
+	for (uint8_t i = 0; i + 1 < argCount; i += 2) {
+		if (args[i] == NULL) {
+			continue;
+		}
+
+		bool added = false;
+		FunkHamtNode* newRoot = hamt_set(vm, root, args[i]->name, args[i + 1], 0, &added);
+
+		release_hamt_node(vm, root);
+		root = newRoot;
+		count += added ? 1 : 0;
+	}
+
+	return create_persistent_map(vm, root, count);
+}
+
+static inline bool is_persistent_map(FunkFunction* argument) {
+	return argument != NULL && argument->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) argument)->cleanupFn == cleanup_persistent_map_data;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(persistent) {
+	FUNK_ENSURE_ARG_COUNT(1);
+	FunkFunction* argument = args[0];
+
+	if (is_array(argument)) {
+		FunkArrayData* data = extract_array_data(vm, argument);
+		return create_persistent_array_from(vm, data->data, data->length);
+	} else if (is_map(argument)) {
+		FunkMapData* data = extract_map_data(vm, argument);
+		FunkHamtNode* root = NULL;
+		uint32_t count = 0;
+
+		for (int32_t i = 0; i <= data->table.capacity; i++) {
+			FunkTableEntry* entry = &data->table.entries[i];
+
+			if (entry->key != NULL) {
+				bool added = false;
+				FunkHamtNode* newRoot = hamt_set(vm, root, entry->key, (FunkFunction*) entry->value, 0, &added);
+
+				release_hamt_node(vm, root);
+				root = newRoot;
+				count += added ? 1 : 0;
+			}
+		}
+
+		return create_persistent_map(vm, root, count);
+	}
+
+	return argument;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(_remove) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	if (args[1] == NULL) {
+		return NULL;
+	}
+
+	FunkFunction* argument = args[0];
+
+	if (is_map(argument)) {
+		FunkMapData* data = extract_map_data(vm, argument);
+		funk_table_delete(&data->table, args[1]->name);
+
+		return NULL;
+	} else if (is_persistent_map(argument)) {
+		return persistent_map_remove(vm, argument, args[1]->name);
+	} else if (is_persistent_array(argument)) {
+		int32_t index = (int32_t) funk_to_number(vm, args[1]);
+		return index < 0 ? argument : persistent_array_remove(vm, argument, (uint32_t) index);
+	} else if (!is_array(argument)) {
+		funk_error(vm, "Expected an array as the first argument");
+		return NULL;
+	}
+
+	FunkArrayData* data = extract_array_data(vm, argument);
+	int32_t index = (int32_t) funk_to_number(vm, args[1]);
+
+	if (index < 0 || index >= data->length) {
+		return NULL;
+	}
+
+	if (index == data->length - 1) {
+		data->length--;
+		return NULL;
+	}
+
+	memmove((void*) (data->data + index), data->data + index + 1, sizeof(FunkFunction*) * (data->length - index - 1));
+	data->length--;
+
+	return NULL;
+}
+
+static FunkFunction* create_array(FunkVm* vm, FunkFunction** values, uint32_t length) {
+	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, "$arrayData", 10), (FunkNativeFn) arrayCallback);
+	FunkArrayData* data = FUNK_ALLOCATE(vm, FunkArrayData, 1);
+
+	data->data = length > 0 ? FUNK_ALLOCATE(vm, FunkFunction*, length) : NULL;
+	data->length = length;
+	data->allocated = length;
+
+	if (values != NULL && length > 0) {
+		memcpy((void*) data->data, (void*) values, sizeof(FunkFunction*) * length);
+	}
+
+	function->cleanupFn = cleanup_array_data;
+	function->traceFn = trace_array_data;
+	function->data = (void*) data;
+
+	return (FunkFunction *) function;
+}
+
+// Clamps an optional index argument into [0, length], negative indexes count from the end
+static uint32_t to_array_index(FunkVm* vm, FunkFunction** args, uint8_t argCount, uint8_t argument, uint32_t length, uint32_t defaultValue) {
+	if (argument >= argCount) {
+		return defaultValue;
+	}
+
+	double index = funk_to_number(vm, args[argument]);
+
+	if (index < 0) {
+		index += length;
+	}
+
+	return index < 0 ? 0 : (index > length ? length : (uint32_t) index);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(slice) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	FunkArrayData* data = extract_array_data(vm, args[0]);
+
+	uint32_t from = to_array_index(vm, args, argCount, 1, data->length, 0);
+	uint32_t to = to_array_index(vm, args, argCount, 2, data->length, data->length);
+
+	return create_array(vm, data->data + from, to > from ? to - from : 0);
+}
+
+typedef struct FunkArrayViewData {
+	FunkFunction* array;
+	uint32_t from;
+	uint32_t length;
+} FunkArrayViewData;
+
+static FunkArrayViewData* extract_array_view_data(FunkVm* vm, FunkFunction* function) {
+	if (!is_array_view(function)) {
+		funk_error(vm, "Expected an array view as argument");
+		return NULL;
+	}
+
+	return (FunkArrayViewData*) ((FunkNativeFunction*) function)->data;
+}
+
+static void cleanup_array_view_data(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data != NULL) {
+		FUNK_FREE(vm, FunkArrayViewData, function->data);
+		function->data = NULL;
+	}
+}
+
+static void trace_array_view_data(FunkVm* vm, FunkNativeFunction* function) {
+	funk_mark_object(vm, (FunkObject *) ((FunkArrayViewData*) function->data)->array);
+}
+
+// The viewed array can shrink after the view was created
+static uint32_t get_array_view_length(FunkVm* vm, FunkArrayViewData* view) {
+	FunkArrayData* data = extract_array_data(vm, view->array);
+
+	if (view->from >= data->length) {
+		return 0;
+	}
+
+	return data->length - view->from < view->length ? data->length - view->from : view->length;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(arrayViewCallback) {
+	FunkArrayViewData* view = extract_array_view_data(vm, (FunkFunction *) self);
+	FunkArrayData* data = extract_array_data(vm, view->array);
+
+	if (argCount == 1 && funk_function_has_code(args[0])) {
+		for (uint32_t i = 0; i < get_array_view_length(vm, view); i++) {
+			funk_run_function_arged(vm, args[0], &data->data[view->from + i], 1);
+		}
+
+		return NULL;
+	}
+
+	FUNK_ENSURE_MIN_ARG_COUNT(1);
+	int64_t index = (int64_t) funk_to_number(vm, args[0]);
+
+	if (index < 0 || index >= get_array_view_length(vm, view)) {
+		return NULL;
+	}
+
+	if (argCount == 1) {
+		return data->data[view->from + index];
+	}
+
+	data->data[view->from + index] = args[1];
+	funk_write_barrier(vm, view->array, (FunkObject *) args[1]);
+
+	return NULL;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(view) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	FunkArrayData* data = extract_array_data(vm, args[0]);
+
+	uint32_t from = to_array_index(vm, args, argCount, 1, data->length, 0);
+	uint32_t to = to_array_index(vm, args, argCount, 2, data->length, data->length);
+
+	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, "$arrayViewData", 14), (FunkNativeFn) arrayViewCallback);
+	FunkArrayViewData* view = FUNK_ALLOCATE(vm, FunkArrayViewData, 1);
+
+	view->array = args[0];
+	view->from = from;
+	view->length = to > from ? to - from : 0;
+
+	function->cleanupFn = cleanup_array_view_data;
+	function->traceFn = trace_array_view_data;
+	function->data = (void*) view;
+
+	return (FunkFunction *) function;
+}
+
+static inline bool is_array_view(FunkFunction* argument) {
+	return argument != NULL && argument->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) argument)->cleanupFn == cleanup_array_view_data;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(concat) {
+	uint32_t length = 0;
+
+	for (uint8_t i = 0; i < argCount; i++) {
+		length += extract_array_data(vm, args[i])->length;
+	}
+
+	FunkFunction* result = create_array(vm, NULL, length);
+	FunkFunction** destination = extract_array_data(vm, result)->data;
+
+	for (uint8_t i = 0; i < argCount; i++) {
+		FunkArrayData* data = extract_array_data(vm, args[i]);
+
+		if (data->length > 0) {
+			memcpy((void*) destination, (void*) data->data, sizeof(FunkFunction*) * data->length);
+			destination += data->length;
+		}
+	}
+
+	return result;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(fill) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	FunkArrayData* data = extract_array_data(vm, args[0]);
+
+	uint32_t from = to_array_index(vm, args, argCount, 2, data->length, 0);
+	uint32_t to = to_array_index(vm, args, argCount, 3, data->length, data->length);
+
+	for (uint32_t i = from; i < to; i++) {
+		data->data[i] = args[1];
+	}
+
+	funk_write_barrier(vm, args[0], (FunkObject *) args[1]);
+
+	return args[0];
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(reverse) {
+	FUNK_ENSURE_ARG_COUNT(1);
+	FunkArrayData* data = extract_array_data(vm, args[0]);
+
+	if (data->length > 1) {
+		for (uint32_t i = 0, j = data->length - 1; i < j; i++, j--) {
+			FunkFunction* temp = data->data[i];
+
+			data->data[i] = data->data[j];
+			data->data[j] = temp;
+		}
+	}
+
+	return args[0];
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(indexOf) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+
+	FunkArrayData* data = extract_array_data(vm, args[0]);
+	FunkString* name = args[1] == NULL ? NULL : args[1]->name;
+
+	// All names are interned, so comparing the pointers is enough
+	for (uint32_t i = to_array_index(vm, args, argCount, 2, data->length, 0); i < data->length; i++) {
+		FunkFunction* element = data->data[i];
+
+		if (element == NULL ? name == NULL : element->name == name) {
+			FUNK_RETURN_NUMBER(i);
+		}
+	}
+
+	return NULL;
+}
+
+typedef struct FunkSortEntry {
+	FunkFunction* value;
+	double number;
+} FunkSortEntry;
+
+typedef enum {
+	FUNK_SORT_NUMBERS,
+	FUNK_SORT_NAMES,
+	FUNK_SORT_CALLBACK
+} FunkSortMode;
+
+static bool is_number_name(FunkString* name) {
+	const char* chars = name->chars;
+	uint16_t length = name->length;
+
+	if (length > 0 && chars[0] == '-') {
+		chars++;
+		length--;
+	}
+
+	if (length == 5 && memcmp(chars, "NULLA", 5) == 0) {
+		return true;
+	}
+
+	bool hadDot = false;
+
+	for (uint16_t i = 0; i < length; i++) {
+		if (chars[i] == '.' && !hadDot) {
+			hadDot = true;
+		} else if (strchr("IVXLCDM", chars[i]) == NULL || chars[i] == '\0') {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool sort_entry_before(FunkVm* vm, FunkSortMode mode, FunkFunction* callback, FunkSortEntry* a, FunkSortEntry* b) {
+	switch (mode) {
+		case FUNK_SORT_NUMBERS: return a->number < b->number;
+
+		case FUNK_SORT_NAMES: {
+			if (a->value == NULL || b->value == NULL) {
+				return a->value == NULL && b->value != NULL;
+			}
+
+			FunkString* nameA = a->value->name;
+			FunkString* nameB = b->value->name;
+			int result = memcmp(nameA->chars, nameB->chars, nameA->length < nameB->length ? nameA->length : nameB->length);
+
+			return result < 0 || (result == 0 && nameA->length < nameB->length);
+		}
+
+		case FUNK_SORT_CALLBACK: {
+			FunkFunction* buffer[2] = { a->value, b->value };
+			return funk_is_true(vm, funk_run_function_arged(vm, callback, buffer, 2));
+		}
+
+		default: UNREACHABLE;
+	}
+
+	return false;
+}
+
+// Bottom-up merge sort, it is stable and only calls the comparator O(n log n) times
+static void sort_entries(FunkVm* vm, FunkSortMode mode, FunkFunction* callback, FunkSortEntry* entries, FunkSortEntry* buffer, uint32_t length) {
+	FunkSortEntry* from = entries;
+	FunkSortEntry* to = buffer;
+
+	for (uint32_t width = 1; width < length; width *= 2) {
+		for (uint32_t start = 0; start < length; start += 2 * width) {
+			uint32_t middle = start + width < length ? start + width : length;
+			uint32_t end = start + 2 * width < length ? start + 2 * width : length;
+			uint32_t left = start;
+			uint32_t right = middle;
+
+			for (uint32_t i = start; i < end; i++) {
+				if (left < middle && (right >= end || !sort_entry_before(vm, mode, callback, &from[right], &from[left]))) {
+					to[i] = from[left++];
+				} else {
+					to[i] = from[right++];
+				}
+			}
+		}
+
+		FunkSortEntry* temp = from;
+
+		from = to;
+		to = temp;
+	}
+
+	if (from != entries) {
+		memcpy((void*) entries, (void*) from, sizeof(FunkSortEntry) * length);
+	}
+}
+
+// The entries are the only place, that holds the values, once a comparator takes them out of the array,
+// so they are traced, and freed by the collector, if a comparator fails
+typedef struct FunkSortData {
+	FunkSortEntry* entries;
+	uint32_t length;
+} FunkSortData;
+
+static void cleanup_sort_data(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data != NULL) {
+		FunkSortData* data = (FunkSortData*) function->data;
+
+		FUNK_FREE_ARRAY(vm, FunkSortEntry, data->entries, data->length * 2);
+		FUNK_FREE(vm, FunkSortData, data);
+
+		function->data = NULL;
+	}
+}
+
+static void trace_sort_data(FunkVm* vm, FunkNativeFunction* function) {
+	FunkSortData* data = (FunkSortData*) function->data;
+
+	// Both halves, the merge moves the values between them
+	for (uint32_t i = 0; i < data->length * 2; i++) {
+		funk_mark_object(vm, (FunkObject *) data->entries[i].value);
+	}
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(sort) {
+	FUNK_ENSURE_MIN_ARG_COUNT(1);
+
+	FunkArrayData* data = extract_array_data(vm, args[0]);
+	FunkFunction* callback = argCount > 1 ? args[1] : NULL;
+	uint32_t length = data->length;
+
+	if (length < 2) {
+		return args[0];
+	}
+
+	FunkSortMode mode = callback != NULL ? FUNK_SORT_CALLBACK : FUNK_SORT_NUMBERS;
+	FunkSortData* sortData = FUNK_ALLOCATE(vm, FunkSortData, 1);
+	FunkSortEntry* entries = FUNK_ALLOCATE(vm, FunkSortEntry, length * 2);
+
+	memset((void*) entries, 0, sizeof(FunkSortEntry) * length * 2);
+	sortData->entries = entries;
+	sortData->length = length;
+
+	FunkNativeFunction* holder = funk_create_native_function(vm, funk_create_string(vm, "$sortData", 9), NULL);
+
+	holder->data = sortData;
+	holder->cleanupFn = cleanup_sort_data;
+	holder->traceFn = trace_sort_data;
+
+	funk_push_root(vm, (FunkFunction *) holder);
+
+	for (uint32_t i = 0; i < length; i++) {
+		FunkFunction* value = data->data[i];
+
+		entries[i].value = value;
+		entries[i].number = 0;
+
+		if (mode == FUNK_SORT_NUMBERS) {
+			if (value == NULL || !is_number_name(value->name)) {
+				mode = FUNK_SORT_NAMES;
+			} else {
+				// Converting once up front, instead of on every comparison
+				entries[i].number = funk_to_number(vm, value);
+			}
+		}
+	}
+
+	// The holder might have been promoted by a collection, that the allocations started
+	funk_write_barrier_all(vm, (FunkFunction *) holder);
+	sort_entries(vm, mode, callback, entries, entries + length, length);
+
+	// The callback could have changed the array
+	for (uint32_t i = 0; i < length && i < data->length; i++) {
+		data->data[i] = entries[i].value;
+	}
+
+	cleanup_sort_data(vm, holder);
+	funk_pop_roots(vm, 1);
+
+	return args[0];
+}
+
+// Numbers are stored unboxed, so numeric code does not convert names to numbers and back for every element
+typedef struct FunkNumbersData {
+	double* data;
+	uint32_t length;
+} FunkNumbersData;
+
+static FunkNumbersData* extract_numbers_data(FunkVm* vm, FunkFunction* function) {
+	if (!is_numbers(function)) {
+		funk_error(vm, "Expected numbers as argument");
+		return NULL;
+	}
+
+	return (FunkNumbersData*) ((FunkNativeFunction*) function)->data;
+}
+
+static void cleanup_numbers_data(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data != NULL) {
+		FunkNumbersData* data = (FunkNumbersData*) function->data;
+
+		FUNK_FREE_ARRAY(vm, double, data->data, data->length);
+		FUNK_FREE(vm, FunkNumbersData, data);
+
+		function->data = NULL;
+	}
+}
+
+static const FunkNumberKernels* get_number_kernels() {
+	return funk_get_number_kernels(funk_detect_simd_level());
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(numbersCallback) {
+	FunkNumbersData* data = extract_numbers_data(vm, (FunkFunction *) self);
+
+	if (argCount == 1 && funk_function_has_code(args[0])) {
+		for (uint32_t i = 0; i < data->length; i++) {
+			FunkFunction* value = funk_number_to_string(vm, data->data[i]);
+			funk_run_function_arged(vm, args[0], &value, 1);
+		}
+
+		return NULL;
+	}
+
+	FUNK_ENSURE_MIN_ARG_COUNT(1);
+	int64_t index = (int64_t) funk_to_number(vm, args[0]);
+
+	if (index < 0 || index >= data->length) {
+		return NULL;
+	}
+
+	if (argCount == 1) {
+		FUNK_RETURN_NUMBER(data->data[index]);
+	}
+
+	data->data[index] = funk_to_number(vm, args[1]);
+	return NULL;
+}
+
+static FunkFunction* create_numbers(FunkVm* vm, uint32_t length) {
+	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, "$numbersData", 12), (FunkNativeFn) numbersCallback);
+	FunkNumbersData* data = FUNK_ALLOCATE(vm, FunkNumbersData, 1);
+
+	data->data = length > 0 ? FUNK_ALLOCATE(vm, double, length) : NULL;
+	data->length = length;
+
+	function->cleanupFn = cleanup_numbers_data;
+	function->data = (void*) data;
+
+	return (FunkFunction *) function;
+}
+
+static void save_numbers_data(FunkVm* vm, FunkNativeFunction* function, FunkSnapshotWriter* writer) {
+	FunkNumbersData* data = (FunkNumbersData*) function->data;
+
+	funk_snapshot_write_uint32(writer, data->length);
+	funk_snapshot_write_bytes(writer, (const void*) data->data, sizeof(double) * data->length);
+}
+
+static void load_numbers_data(FunkVm* vm, FunkNativeFunction* function, FunkSnapshotReader* reader) {
+	FunkNumbersData* data = FUNK_ALLOCATE(vm, FunkNumbersData, 1);
+	uint32_t length = funk_snapshot_read_count(reader, sizeof(double));
+
+	data->data = length > 0 ? FUNK_ALLOCATE(vm, double, length) : NULL;
+	data->length = length;
+
+	if (length > 0) {
+		memcpy((void*) data->data, funk_snapshot_read_bytes(reader, sizeof(double) * length), sizeof(double) * length);
+	}
+
+	function->fn = (FunkNativeFn) numbersCallback;
+	function->cleanupFn = cleanup_numbers_data;
+	function->data = (void*) data;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(numbers) {
+	FUNK_ENSURE_MIN_ARG_COUNT(1);
+
+	double length = funk_to_number(vm, args[0]);
+	double value = argCount > 1 ? funk_to_number(vm, args[1]) : 0;
+
+	FunkFunction* result = create_numbers(vm, length < 0 ? 0 : (uint32_t) length);
+	FunkNumbersData* data = extract_numbers_data(vm, result);
+
+	for (uint32_t i = 0; i < data->length; i++) {
+		data->data[i] = value;
+	}
+
+	return result;
+}
+
+static inline bool is_numbers(FunkFunction* argument) {
+	return argument != NULL && argument->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) argument)->cleanupFn == cleanup_numbers_data;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(sum) {
+	FUNK_ENSURE_ARG_COUNT(1);
+	FunkNumbersData* data = extract_numbers_data(vm, args[0]);
+
+	FUNK_RETURN_NUMBER(get_number_kernels()->sum(data->data, data->length));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(min) {
+	FUNK_ENSURE_ARG_COUNT(1);
+	FunkNumbersData* data = extract_numbers_data(vm, args[0]);
+
+	if (data->length == 0) {
+		return NULL;
+	}
+
+	FUNK_RETURN_NUMBER(get_number_kernels()->min(data->data, data->length));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(max) {
+	FUNK_ENSURE_ARG_COUNT(1);
+	FunkNumbersData* data = extract_numbers_data(vm, args[0]);
+
+	if (data->length == 0) {
+		return NULL;
+	}
+
+	FUNK_RETURN_NUMBER(get_number_kernels()->max(data->data, data->length));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(dotProduct) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	FunkNumbersData* a = extract_numbers_data(vm, args[0]);
+	FunkNumbersData* b = extract_numbers_data(vm, args[1]);
+
+	FUNK_RETURN_NUMBER(get_number_kernels()->dot(a->data, b->data, a->length < b->length ? a->length : b->length));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(scale) {
+	FUNK_ENSURE_ARG_COUNT(2);
+	FunkNumbersData* data = extract_numbers_data(vm, args[0]);
+
+	get_number_kernels()->scale(data->data, data->length, funk_to_number(vm, args[1]));
+	return args[0];
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(addNumbers) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	FunkNumbersData* destination = extract_numbers_data(vm, args[0]);
+	FunkNumbersData* source = extract_numbers_data(vm, args[1]);
+
+	get_number_kernels()->add(destination->data, source->data, destination->length < source->length ? destination->length : source->length);
+	return args[0];
+}
+
+// A growable ring buffer. The capacity is always a power of two, so that indexes wrap with a mask
+typedef struct FunkDequeData {
+	FunkFunction** data;
+	uint32_t head;
+	uint32_t length;
+	uint32_t allocated;
+} FunkDequeData;
+
+static FunkDequeData* extract_deque_data(FunkVm* vm, FunkFunction* function) {
+	if (!is_deque(function)) {
+		funk_error(vm, "Expected a deque as argument");
+		return NULL;
+	}
+
+	return (FunkDequeData*) ((FunkNativeFunction*) function)->data;
+}
+
+static void cleanup_deque_data(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data != NULL) {
+		FunkDequeData* data = (FunkDequeData*) function->data;
+
+		FUNK_FREE_ARRAY(vm, FunkFunction*, data->data, data->allocated);
+		FUNK_FREE(vm, FunkDequeData, data);
+
+		function->data = NULL;
+	}
+}
+
+static inline FunkFunction** deque_slot(FunkDequeData* data, uint32_t index) {
+	return &data->data[(data->head + index) & (data->allocated - 1)];
+}
+
+static void trace_deque_data(FunkVm* vm, FunkNativeFunction* function) {
+	FunkDequeData* data = (FunkDequeData*) function->data;
+
+	for (uint32_t i = 0; i < data->length; i++) {
+		funk_mark_object(vm, (FunkObject *) *deque_slot(data, i));
+	}
+}
+
+static void ensure_deque_capacity(FunkVm* vm, FunkDequeData* data, uint32_t length) {
+	if (length <= data->allocated) {
+		return;
+	}
+
+	uint32_t newSize = FUNK_GROW_CAPACITY(data->allocated);
+
+	while (newSize < length) {
+		newSize *= 2;
+	}
+
+	// Unwraps the elements, so that the head starts at 0 again
+	FunkFunction** buffer = FUNK_ALLOCATE(vm, FunkFunction*, newSize);
+
+	for (uint32_t i = 0; i < data->length; i++) {
+		buffer[i] = *deque_slot(data, i);
+	}
+
+	FUNK_FREE_ARRAY(vm, FunkFunction*, data->data, data->allocated);
+
+	data->data = buffer;
+	data->head = 0;
+	data->allocated = newSize;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(dequeCallback) {
+	FunkDequeData* data = extract_deque_data(vm, (FunkFunction *) self);
+
+	if (argCount == 1) {
+		if (funk_function_has_code(args[0])) {
+			FunkFunction* callback = args[0];
+
+			for (uint32_t i = 0; i < data->length; i++) {
+				funk_run_function_arged(vm, callback, deque_slot(data, i), 1);
+			}
+
+			return NULL;
+		}
+
+		int64_t index = (int64_t) funk_to_number(vm, args[0]);
+
+		if (index < 0 || index >= data->length) {
+			return NULL;
+		}
+
+		return *deque_slot(data, (uint32_t) index);
+	}
+
+	FUNK_ENSURE_ARG_COUNT(2);
+	int64_t index = (int64_t) funk_to_number(vm, args[0]);
+
+	if (index < 0 || index >= data->length) {
+		return NULL;
+	}
+
+	*deque_slot(data, (uint32_t) index) = args[1];
+	funk_write_barrier(vm, (FunkFunction *) self, (FunkObject *) args[1]);
+
+	return NULL;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(deque) {
+	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, "$dequeData", 10), (FunkNativeFn) dequeCallback);
+	FunkDequeData* data = FUNK_ALLOCATE(vm, FunkDequeData, 1);
+
+	data->data = NULL;
+	data->head = 0;
+	data->length = 0;
+	data->allocated = 0;
+
+	function->cleanupFn = cleanup_deque_data;
+	function->traceFn = trace_deque_data;
+	function->data = (void*) data;
+
+	if (argCount > 0) {
+		ensure_deque_capacity(vm, data, argCount);
+		memcpy((void*) data->data, args, sizeof(FunkFunction*) * argCount);
+		data->length = argCount;
+	}
+
+	return (FunkFunction *) function;
+}
+
+static inline bool is_deque(FunkFunction* argument) {
+	return argument != NULL && argument->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) argument)->cleanupFn == cleanup_deque_data;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(pushBack) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+
+	FunkDequeData* data = extract_deque_data(vm, args[0]);
+	ensure_deque_capacity(vm, data, data->length + argCount - 1);
+
+	for (uint8_t i = 1; i < argCount; i++) {
+		*deque_slot(data, data->length++) = args[i];
+		funk_write_barrier(vm, args[0], (FunkObject *) args[i]);
+	}
+
+	return NULL;
+}
+
+// Values are pushed one by one, so the last one ends up at the front
+FUNK_NATIVE_FUNCTION_DEFINITION(pushFront) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+
+	FunkDequeData* data = extract_deque_data(vm, args[0]);
+	ensure_deque_capacity(vm, data, data->length + argCount - 1);
+
+	for (uint8_t i = 1; i < argCount; i++) {
+		data->head = (data->head - 1) & (data->allocated - 1);
+		data->data[data->head] = args[i];
+		data->length++;
+
+		funk_write_barrier(vm, args[0], (FunkObject *) args[i]);
+	}
+
+	return NULL;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(popBack) {
+	FUNK_ENSURE_ARG_COUNT(1);
+	FunkDequeData* data = extract_deque_data(vm, args[0]);
+
+	if (data->length == 0) {
+		return NULL;
+	}
+
+	data->length--;
+	return *deque_slot(data, data->length);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(popFront) {
+	FUNK_ENSURE_ARG_COUNT(1);
+	FunkDequeData* data = extract_deque_data(vm, args[0]);
+
+	if (data->length == 0) {
+		return NULL;
+	}
+
+	FunkFunction* value = data->data[data->head];
+
+	data->head = (data->head + 1) & (data->allocated - 1);
+	data->length--;
+
+	return value;
+}
+
+typedef struct FunkParallelJob {
+	FunkFunction* callback;
+	// Holds the arguments, that are replaced with the results by the workers
+	FunkFunction** values;
+	uint32_t length;
+	uint32_t chunkSize;
+} FunkParallelJob;
+
+static FunkWorkerPool* get_worker_pool(FunkVm* vm) {
+	if (vm->parent != NULL) {
+		funk_error(vm, "Parallel functions can't be called from a worker");
+		return NULL;
+	}
+
+	if (vm->workerPool == NULL) {
+		vm->workerPool = funk_create_worker_pool(vm, 0);
+	}
+
+	return vm->workerPool;
+}
+
+// Only names, functions and arrays of them can leave a worker
+static bool is_transferable(FunkVm* vm, FunkFunction* value) {
+	if (value == NULL) {
+		return true;
+	}
+
+	if (value->object.type == FUNK_OBJECT_BASIC_FUNCTION) {
+		FunkBasicFunction* closure = (FunkBasicFunction*) value;
+
+		if (closure->prototype == NULL) {
+			return true;
+		}
+
+		if (!funk_can_copy_closure(vm, closure)) {
+			return false;
+		}
+
+		// A function, that calls itself, captured itself
+		for (uint8_t i = 0; i < closure->upvalueCount; i++) {
+			if (closure->upvalues[i] != value && !is_transferable(vm, closure->upvalues[i])) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	if (((FunkNativeFunction*) value)->cleanupFn == NULL) {
+		return true;
+	}
+
+	if (!is_array(value)) {
+		return false;
+	}
+
+	FunkArrayData* data = (FunkArrayData*) ((FunkNativeFunction*) value)->data;
+
+	for (uint32_t i = 0; i < data->length; i++) {
+		if (!is_transferable(vm, data->data[i])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Copies a value from a worker heap into the parent, names are interned again
+static FunkFunction* transfer_value(FunkVm* vm, FunkFunction* value) {
+	if (value == NULL) {
+		return NULL;
+	}
+
+	if (value->object.type == FUNK_OBJECT_BASIC_FUNCTION) {
+		FunkBasicFunction* closure = (FunkBasicFunction*) value;
+
+		// Closures of the worker live on its heap, but their prototype was compiled by the parent
+		if (closure->prototype != NULL) {
+			FunkBasicFunction* copy = funk_copy_closure(vm, closure);
+
+			for (uint8_t i = 0; i < copy->upvalueCount; i++) {
+				copy->upvalues[i] = copy->upvalues[i] == value ? (FunkFunction*) copy : transfer_value(vm, copy->upvalues[i]);
+			}
+
+			return (FunkFunction*) copy;
+		}
+
+		// Code is only ever compiled by the parent
+		if (funk_function_has_code(value)) {
+			return value;
+		}
+
+		return (FunkFunction *) funk_create_basic_function(vm, funk_create_string(vm, value->name->chars, value->name->length));
+	}
+
+	// Natives without data are shared with the parent
+	if (((FunkNativeFunction*) value)->cleanupFn == NULL) {
+		return value;
+	}
+
+	FunkArrayData* data = (FunkArrayData*) ((FunkNativeFunction*) value)->data;
+	FunkFunction* copy = create_array(vm, data->data, data->length);
+	FunkArrayData* copyData = (FunkArrayData*) ((FunkNativeFunction*) copy)->data;
+
+	for (uint32_t i = 0; i < copyData->length; i++) {
+		copyData->data[i] = transfer_value(vm, copyData->data[i]);
+	}
+
+	return copy;
+}
+
+// Workers collect their own garbage, so they hold on to their results in a global, until the parent copied them
+static void keep_result(FunkVm* worker, FunkFunction* result) {
+	FunkFunction* results = funk_get_global(worker, "$parallelResults");
+
+	if (results == NULL) {
+		results = create_array(worker, NULL, 0);
+		funk_set_global(worker, "$parallelResults", results);
+	}
+
+	FunkArrayData* data = extract_array_data(worker, results);
+
+	if (data->length == data->allocated) {
+		uint32_t allocated = FUNK_GROW_CAPACITY(data->allocated);
+
+		data->data = FUNK_GROW_ARRAY(worker, FunkFunction*, data->data, data->allocated, allocated);
+		data->allocated = allocated;
+	}
+
+	data->data[data->length++] = result;
+}
+
+static void map_chunk(FunkVm* worker, uint32_t chunk, void* userData) {
+	FunkParallelJob* job = (FunkParallelJob*) userData;
+	uint32_t from = chunk * job->chunkSize;
+	uint32_t to = from + job->chunkSize < job->length ? from + job->chunkSize : job->length;
+
+	for (uint32_t i = from; i < to; i++) {
+		job->values[i] = funk_run_function_arged(worker, job->callback, &job->values[i], 1);
+		keep_result(worker, job->values[i]);
+	}
+}
+
+// Leaves the result of the chunk in its first value
+static void reduce_chunk(FunkVm* worker, uint32_t chunk, void* userData) {
+	FunkParallelJob* job = (FunkParallelJob*) userData;
+	uint32_t from = chunk * job->chunkSize;
+	uint32_t to = from + job->chunkSize < job->length ? from + job->chunkSize : job->length;
+
+	FunkFunction* values[2] = { job->values[from], NULL };
+
+	for (uint32_t i = from + 1; i < to; i++) {
+		values[1] = job->values[i];
+		values[0] = funk_run_function_arged(worker, job->callback, values, 2);
+	}
+
+	job->values[from] = values[0];
+	keep_result(worker, values[0]);
+}
+
+// Runs the job over the array on the workers and copies the results back. Returns the chunk count
+static uint32_t run_parallel_job(FunkVm* vm, FunkParallelJob* job, FunkWorkerJobFn chunkFn) {
+	FunkWorkerPool* pool = get_worker_pool(vm);
+
+	uint32_t chunkCount = funk_get_worker_count(pool) * 4;
+
+	if (chunkCount > job->length) {
+		chunkCount = job->length;
+	}
+
+	job->chunkSize = (job->length + chunkCount - 1) / chunkCount;
+	chunkCount = (job->length + job->chunkSize - 1) / job->chunkSize;
+
+	// The workers flush their output, once they are reset, after what was printed before the job
+	funk_flush_output(vm);
+
+	bool succeeded = funk_run_on_workers(pool, chunkFn, (void*) job, chunkCount);
+	bool transferable = true;
+
+	// Reduced chunks leave a single result at their start
+	uint32_t stride = chunkFn == reduce_chunk ? job->chunkSize : 1;
+
+	for (uint32_t i = 0; succeeded && transferable && i < job->length; i += stride) {
+		transferable = is_transferable(vm, job->values[i]);
+	}
+
+	if (!succeeded || !transferable) {
+		funk_reset_workers(pool);
+		FUNK_FREE_ARRAY(vm, FunkFunction*, job->values, job->length);
+
+		if (!succeeded) {
+			funk_error(vm, "%s", funk_get_worker_error(pool));
+		} else {
+			funk_error(vm, "Only names, functions and arrays can be returned from a parallel callback");
+		}
+
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < job->length; i += stride) {
+		job->values[i] = transfer_value(vm, job->values[i]);
+	}
+
+	funk_reset_workers(pool);
+	return chunkCount;
+}
+
+static void start_parallel_job(FunkVm* vm, FunkParallelJob* job, FunkFunction** args) {
+	FunkArrayData* data = extract_array_data(vm, args[0]);
+
+	job->callback = args[1];
+	job->length = data->length;
+	job->values = NULL;
+
+	// The array is copied, so that the workers never see it change
+	if (job->length > 0) {
+		job->values = FUNK_ALLOCATE(vm, FunkFunction*, job->length);
+		memcpy((void*) job->values, (void*) data->data, sizeof(FunkFunction*) * job->length);
+	}
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(parallelMap) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	FunkParallelJob job;
+	start_parallel_job(vm, &job, args);
+
+	if (job.length == 0) {
+		return create_array(vm, NULL, 0);
+	}
+
+	run_parallel_job(vm, &job, map_chunk);
+
+	FunkFunction* result = create_array(vm, job.values, job.length);
+	FUNK_FREE_ARRAY(vm, FunkFunction*, job.values, job.length);
+
+	return result;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(parallelReduce) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+
+	bool hasInitial = argCount > 2;
+	FunkFunction* values[2] = { hasInitial ? args[2] : NULL, NULL };
+
+	FunkParallelJob job;
+	start_parallel_job(vm, &job, args);
+
+	if (job.length == 0) {
+		return values[0];
+	}
+
+	uint32_t chunkCount = run_parallel_job(vm, &job, reduce_chunk);
+	FunkFunction* partials = create_array(vm, NULL, chunkCount);
+	FunkArrayData* data = extract_array_data(vm, partials);
+
+	for (uint32_t chunk = 0; chunk < chunkCount; chunk++) {
+		data->data[chunk] = job.values[chunk * job.chunkSize];
+	}
+
+	FUNK_FREE_ARRAY(vm, FunkFunction*, job.values, job.length);
+
+	funk_push_root(vm, partials);
+	funk_push_root(vm, values[0]);
+
+	// The chunk results are combined in order on this vm, so the callback has to be associative
+	for (uint32_t chunk = 0; chunk < chunkCount; chunk++) {
+		if (chunk == 0 && !hasInitial) {
+			values[0] = data->data[chunk];
+		} else {
+			values[1] = data->data[chunk];
+			values[0] = funk_run_function_arged(vm, job.callback, values, 2);
+		}
+
+		funk_pop_roots(vm, 1);
+		funk_push_root(vm, values[0]);
+	}
+
+	funk_pop_roots(vm, 2);
+	return values[0];
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(parallelThreads) {
+	if (argCount > 0) {
+		uint16_t count = (uint16_t) funk_to_number(vm, args[0]);
+
+		if (vm->workerPool != NULL) {
+			funk_free_worker_pool(vm->workerPool);
+			vm->workerPool = NULL;
+		}
+
+		vm->workerPool = funk_create_worker_pool(vm, count);
+	}
+
+	FUNK_RETURN_NUMBER(funk_get_worker_count(get_worker_pool(vm)));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(variable) {
+	FUNK_ENSURE_ARG_COUNT(1);
+
+	if (args[0] == NULL) {
+		return NULL;
+	}
+
+	uint16_t length = args[0]->name->length + 1;
+	char string[length + 1];
+
+	string[0] = '$';
+	memcpy((void*) (string + 1), args[0]->name->chars, args[0]->name->length);
+	string[length] = '\0';
+
+	FUNK_RETURN_STRING(string);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(print) {
+	for (uint8_t i = 0; i < argCount; i++) {
+		if (args[i] == NULL) {
+			funk_write_output(vm, "null", 4);
+		} else {
+			funk_write_output(vm, args[i]->name->chars, args[i]->name->length);
+		}
+
+		funk_write_output(vm, "\n", 1);
+	}
+
+	return NULL;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(printNumber) {
+	char buffer[64];
+
+	for (uint8_t i = 0; i < argCount; i++) {
+		int length = snprintf(buffer, sizeof(buffer), "%.6g\n", funk_to_number(vm, args[i]));
+		funk_write_output(vm, buffer, (size_t) length);
+	}
+
+	return NULL;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(printChar) {
+	for (uint8_t i = 0; i < argCount; i++) {
+		char byte = (char) funk_to_number(vm, args[i]);
+		funk_write_output(vm, &byte, 1);
+	}
+
+	return NULL;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(flush) {
+	funk_flush_output(vm);
+	return NULL;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(_clock) {
+	clock_t time = clock();
+	double inSeconds = (double) time / (double) CLOCKS_PER_SEC;
+
+	FUNK_RETURN_NUMBER(inSeconds);
+}
+
+// Fractions lose their leading zeros as roman numerals (0.05 becomes .V), so the time is counted in whole milliseconds,
+// from the start of the program, to keep the numbers short
+static struct timespec programStart;
+
+// Wall clock time, unlike clock() it doesn't add up the cpu time of every thread
+FUNK_NATIVE_FUNCTION_DEFINITION(now) {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	FUNK_RETURN_NUMBER(floor((double) (time.tv_sec - programStart.tv_sec) * 1e3 + (double) (time.tv_nsec - programStart.tv_nsec) / 1e6));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(set) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	if (args[0] == NULL) {
+		return NULL;
+	}
+
+	funk_set_variable(vm, args[0]->name->chars, args[1]);
+	return NULL;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(get) {
+	FUNK_ENSURE_ARG_COUNT(1);
+
+	if (args[0] == NULL) {
+		return NULL;
+	}
+
+	return funk_get_variable(vm, args[0]->name->chars);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(equal) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	if (args[0] == NULL || args[1] == NULL) {
+		FUNK_RETURN_BOOL(args[0] == args[1]);
+	}
+
+	FUNK_RETURN_BOOL(args[0]->name == args[1]->name);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(notEqual) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	if (args[0] == NULL || args[1] == NULL) {
+		FUNK_RETURN_BOOL(args[0] != args[1]);
+	}
+
+	FUNK_RETURN_BOOL(args[0]->name != args[1]->name);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(notNull) {
+	FUNK_ENSURE_ARG_COUNT(1);
+	FUNK_RETURN_BOOL(args[0] != NULL);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(not) {
+	FUNK_ENSURE_ARG_COUNT(1);
+	FUNK_RETURN_BOOL(!funk_is_true(vm, args[0]));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(_if) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+
+	if (funk_is_true(vm, args[0])) {
+		return funk_run_function(vm, args[1], 0);
+	} else if (argCount > 2) {
+		return funk_run_function(vm, args[2], 0);
+	}
+
+	return NULL;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(_while) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	while (funk_is_true(vm, args[0])) {
+		funk_run_function(vm, args[1], 0);
+	}
+
+	return NULL;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(_for) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+
+	if (argCount == 2) {
+		FunkFunction* argument = args[0];
+
+		if (argument == NULL) {
+			return NULL;
+		}
+
+		if (is_iterator(argument) || is_persistent_array(argument) || is_persistent_map(argument) || is_array_view(argument) || is_numbers(argument) || is_deque(argument) || funk_is_generator(argument)) {
+			run_iterator(vm, to_iterator(vm, argument), args[1]);
+			return NULL;
+		} else if (is_array(argument)) {
+			FunkArrayData* data = extract_array_data(vm, argument);
+
+			for (uint32_t i = 0; i < data->length; i++) {
+				funk_run_function_arged(vm, args[1], &data->data[i], 1);
+			}
+
+			return NULL;
+		} else if (is_map(argument)) {
+			FunkMapData* data = extract_map_data(vm, argument);
+
+			for (int32_t i = 0; i <= data->table.capacity; i++) {
+				FunkTableEntry* entry = &data->table.entries[i];
+
+				if (entry->key != NULL) {
+					FunkFunction* buffer[2] = {
+						(FunkFunction*) funk_create_basic_function(vm, entry->key), // Bye-bye efficiency!
+						(FunkFunction *) entry->value
+					};
+
+					funk_run_function_arged(vm, args[1], (FunkFunction **) &buffer, 2);
+				}
+			}
+
+			return NULL;
+		}
+
+		FunkString* string = argument->name;
+		char buffer[2] = " \0";
+
+		for (uint16_t i = 0; i < string->length; i++) {
+			buffer[0] = string->chars[i];
+
+			FunkFunction* function = (FunkFunction*) funk_create_empty_function(vm, buffer);
+			funk_run_function_arged(vm, args[1], &function, 1);
+		}
+
+		return NULL;
+	}
+
+	FunkFunction* to = args[1];
+	double from = funk_to_number(vm, args[0]);
+	bool increment = from < funk_to_number(vm, to);
+
+	for (double i = funk_to_number(vm, args[0]);
+			increment ? (i < funk_to_number(vm, to)) : (i > funk_to_number(vm, to));
+			i += (increment ? 1 : -1)) {
+
+		FunkFunction* indexFunction = funk_number_to_string(vm, i);
+		funk_run_function_arged(vm, args[2], &indexFunction, 1);
+	}
+
+	return NULL;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(space) {
+	FUNK_RETURN_STRING(" ");
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(separator) {
+	FUNK_RETURN_STRING("/");
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(dot) {
+	FUNK_RETURN_STRING(".");
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(substring) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+
+	FunkFunction* client = args[0];
+
+	if (client == NULL) {
+		return NULL;
+	}
+
+	uint16_t from = (uint16_t) fmax(0, funk_to_number(vm, args[1]));
+	uint16_t length = argCount > 2 ? (uint16_t) fmin(client->name->length - 1 - from, funk_to_number(vm, args[2])) : 1;
+
+	if (length < 1) {
+		FUNK_RETURN_STRING("");
+	}
+
+	char string[length + 1];
+
+	memcpy((void*) string, (void*) (client->name->chars + from), length);
+	string[length] = '\0';
+
+	FUNK_RETURN_STRING(string);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(length) {
+	FUNK_ENSURE_ARG_COUNT(1);
+	FunkFunction* argument = args[0];
+
+	if (argument == NULL) {
+		FUNK_RETURN_NUMBER(0);
+	}
+
+	if (is_array(argument)) {
+		FunkArrayData* data = extract_array_data(vm, argument);
+		FUNK_RETURN_NUMBER(data->length);
+	} else if (is_map(argument)) {
+		FunkMapData* data = extract_map_data(vm, argument);
+		FUNK_RETURN_NUMBER(data->table.count);
+	} else if (is_persistent_array(argument)) {
+		FUNK_RETURN_NUMBER(extract_persistent_array_data(vm, argument)->length);
+	} else if (is_persistent_map(argument)) {
+		FUNK_RETURN_NUMBER(extract_persistent_map_data(vm, argument)->count);
+	} else if (is_array_view(argument)) {
+		FUNK_RETURN_NUMBER(get_array_view_length(vm, extract_array_view_data(vm, argument)));
+	} else if (is_numbers(argument)) {
+		FUNK_RETURN_NUMBER(extract_numbers_data(vm, argument)->length);
+	} else if (is_deque(argument)) {
+		FUNK_RETURN_NUMBER(extract_deque_data(vm, argument)->length);
+	} else if (is_file(argument)) {
+		FUNK_RETURN_NUMBER(get_file_size(vm, argument));
+	}
+
+	FUNK_RETURN_NUMBER(argument->name->length);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(join) {
+	uint16_t length = 0;
+	uint32_t count = argCount;
+
+	if (argCount == 1 && is_array(args[0])) {
+		FunkArrayData* data = extract_array_data(vm, args[0]);
+		args = data->data;
+		count = data->length;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		length += args[i] == NULL ? 4 : args[i]->name->length;
+	}
+
+	char string[length + 1];
+	uint16_t index = 0;
+
+	for (uint32_t i = 0; i < count; i++) {
 		FunkFunction* arg = args[i];
 		uint16_t nameLength = arg == NULL ? 4 : arg->name->length;
 
-		memcpy((void*) (string + index), arg == NULL ? "null" : arg->name->chars, nameLength);
-		index += nameLength;
+		memcpy((void*) (string + index), arg == NULL ? "null" : arg->name->chars, nameLength);
+		index += nameLength;
+	}
+
+	string[length] = '\0';
+	FUNK_RETURN_STRING(string);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(_char) {
+	FUNK_ENSURE_ARG_COUNT(1);
+
+	uint8_t byte = (uint8_t) funk_to_number(vm, args[0]);
+	char buffer[2] = { (char) byte, '\0'};
+
+	FUNK_RETURN_STRING(buffer);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(add) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	FUNK_RETURN_NUMBER(funk_to_number(vm, args[0]) + funk_to_number(vm, args[1]));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(subtract) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	FUNK_RETURN_NUMBER(funk_to_number(vm, args[0]) - funk_to_number(vm, args[1]));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(multiply) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	FUNK_RETURN_NUMBER(funk_to_number(vm, args[0]) * funk_to_number(vm, args[1]));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(divide) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	FUNK_RETURN_NUMBER(funk_to_number(vm, args[0]) / funk_to_number(vm, args[1]));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(greater) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	FUNK_RETURN_BOOL(funk_to_number(vm, args[0]) > funk_to_number(vm, args[1]));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(greaterEqual) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	FUNK_RETURN_BOOL(funk_to_number(vm, args[0]) >= funk_to_number(vm, args[1]));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(less) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	FUNK_RETURN_BOOL(funk_to_number(vm, args[0]) < funk_to_number(vm, args[1]));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(lessEqual) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	FUNK_RETURN_BOOL(funk_to_number(vm, args[0]) <= funk_to_number(vm, args[1]));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(and) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	FUNK_RETURN_BOOL(funk_is_true(vm, args[0]) && funk_is_true(vm, args[1]));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(or) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+	FUNK_RETURN_BOOL(funk_is_true(vm, args[0]) || funk_is_true(vm, args[1]));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(_cos) {
+	FUNK_ENSURE_MIN_ARG_COUNT(1);
+	FUNK_RETURN_NUMBER(cos(funk_to_number(vm, args[0])));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(_sin) {
+	FUNK_ENSURE_MIN_ARG_COUNT(1);
+	FUNK_RETURN_NUMBER(sin(funk_to_number(vm, args[0])));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(require) {
+	FUNK_ENSURE_ARG_COUNT(1);
+	FunkString* path = args[0]->name;
+
+	if (path == NULL) {
+		return NULL;
+	}
+
+	FunkFunction* existingResult;
+
+	if (funk_table_get(&vm->modules, path, (FunkObject **) &existingResult)) {
+		return existingResult;
+	}
+
+	uint16_t length = path->length + 6;
+	char buffer[length];
+
+	memcpy((void*) buffer, path->chars, path->length);
+
+	for (uint16_t i = 0; i < path->length; i++) {
+		if (buffer[i] == '.') {
+			buffer[i] = '/';
+		}
+	}
+
+	memcpy((void*) (buffer + path->length), ".funk\0", 6);
+	FunkFunction* result = funk_run_file(vm, buffer);
+
+	funk_table_set(vm, &vm->modules, path, (FunkObject *) result);
+	return result;
+}
+
+// The file is mapped once, when it's opened, everything reads straight from the mapping
+typedef struct FunkFileData {
+	const char* data;
+	size_t size;
+	// Pipes and the files, that can't be mapped, are read into memory from malloc() instead
+	bool mapped;
+	bool closed;
+	// Where readLine() and the iteration continue
+	size_t position;
+} FunkFileData;
+
+static FunkFileData* extract_file_data(FunkVm* vm, FunkFunction* function) {
+	if (!is_file(function)) {
+		funk_error(vm, "Expected a file as argument");
+		return NULL;
+	}
+
+	return (FunkFileData*) ((FunkNativeFunction*) function)->data;
+}
+
+static size_t get_file_size(FunkVm* vm, FunkFunction* file) {
+	return extract_file_data(vm, file)->size;
+}
+
+static void unmap_file(FunkFileData* data) {
+	if (data->data != NULL) {
+		#ifdef FUNK_STD_MMAP
+			if (data->mapped) {
+				munmap((void*) data->data, data->size);
+			} else {
+				free((void*) data->data);
+			}
+		#else
+			free((void*) data->data);
+		#endif
+	}
+
+	data->data = NULL;
+	data->size = 0;
+	data->position = 0;
+	data->closed = true;
+}
+
+static void cleanup_file_data(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data != NULL) {
+		unmap_file((FunkFileData*) function->data);
+
+		FUNK_FREE(vm, FunkFileData, function->data);
+		function->data = NULL;
+	}
+}
+
+static bool read_whole_file(FILE* file, FunkFileData* data) {
+	size_t allocated = 4096;
+	char* buffer = (char*) malloc(allocated);
+
+	while (buffer != NULL) {
+		data->size += fread(buffer + data->size, 1, allocated - data->size, file);
+
+		if (data->size < allocated) {
+			break;
+		}
+
+		allocated *= 2;
+		char* grown = (char*) realloc(buffer, allocated);
+
+		if (grown == NULL) {
+			free(buffer);
+		}
+
+		buffer = grown;
+	}
+
+	data->data = buffer;
+	return buffer != NULL && !ferror(file);
+}
+
+static bool open_file(const char* path, FunkFileData* data) {
+	memset((void*) data, 0, sizeof(FunkFileData));
+
+	#ifdef FUNK_STD_MMAP
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		struct stat info;
+
+		if (fd < 0) {
+			return false;
+		}
+
+		if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+			void* mapping = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+			if (mapping != MAP_FAILED) {
+				// Scripts mostly scan a file from the start to the end
+				posix_madvise(mapping, (size_t) info.st_size, POSIX_MADV_SEQUENTIAL);
+				close(fd);
+
+				data->data = (const char*) mapping;
+				data->size = (size_t) info.st_size;
+				data->mapped = true;
+
+				return true;
+			}
+		}
+
+		FILE* file = fdopen(fd, "rb");
+
+		if (file == NULL) {
+			close(fd);
+			return false;
+		}
+	#else
+		FILE* file = fopen(path, "rb");
+
+		if (file == NULL) {
+			return false;
+		}
+	#endif
+
+	bool succeeded = read_whole_file(file, data);
+	fclose(file);
+
+	if (!succeeded) {
+		unmap_file(data);
+	}
+
+	return succeeded;
+}
+
+// The new line stays with the line, the end of the file returns false
+static bool next_line(FunkFileData* data, const char** line, size_t* length) {
+	if (data->position >= data->size) {
+		return false;
+	}
+
+	const char* start = data->data + data->position;
+	size_t rest = data->size - data->position;
+	const char* newLine = (const char*) memchr((const void*) start, '\n', rest);
+
+	*line = start;
+	*length = newLine == NULL ? rest : (size_t) (newLine - start) + 1;
+	data->position += *length;
+
+	return true;
+}
+
+static FunkFunction* create_file_string(FunkVm* vm, const char* chars, size_t length) {
+	if (length > UINT16_MAX) {
+		funk_error(vm, "%zu bytes don't fit into a string, read the file in parts", length);
+		return NULL;
+	}
+
+	return (FunkFunction *) funk_create_basic_function(vm, funk_create_string(vm, chars, (uint16_t) length));
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(fileCallback) {
+	FunkFileData* data = extract_file_data(vm, (FunkFunction *) self);
+
+	if (data->closed) {
+		return NULL;
+	}
+
+	return create_file_string(vm, data->data, data->size);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(file) {
+	FUNK_ENSURE_ARG_COUNT(1);
+
+	if (args[0] == NULL) {
+		return NULL;
+	}
+
+	FunkFileData opened;
+
+	if (!open_file(args[0]->name->chars, &opened)) {
+		return NULL;
+	}
+
+	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, "$fileData", 9),(FunkNativeFn) fileCallback);
+	FunkFileData* data = FUNK_ALLOCATE(vm, FunkFileData, 1);
+
+	*data = opened;
+
+	function->data = data;
+	function->cleanupFn = cleanup_file_data;
+
+	return (FunkFunction *) function;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(readAt) {
+	FUNK_ENSURE_ARG_COUNT(3);
+
+	FunkFileData* data = extract_file_data(vm, args[0]);
+	double offset = funk_to_number(vm, args[1]);
+	double length = funk_to_number(vm, args[2]);
+
+	if (data->closed || offset < 0 || length < 0 || offset >= (double) data->size) {
+		return NULL;
+	}
+
+	size_t start = (size_t) offset;
+	size_t rest = data->size - start;
+
+	return create_file_string(vm, data->data + start, (size_t) length < rest ? (size_t) length : rest);
+}
+
+// Makes a new, empty file, that nobody else uses, in the directory for temporary files, and returns its path
+FUNK_NATIVE_FUNCTION_DEFINITION(temporaryFile) {
+	#ifdef FUNK_STD_MMAP
+		const char* directory = getenv("TMPDIR");
+		char path[256];
+
+		snprintf(path, sizeof(path), "%s/funkXXXXXX", directory != NULL && directory[0] != '\0' ? directory : "/tmp");
+		int fd = mkstemp(path);
+
+		if (fd == -1) {
+			return NULL;
+		}
+
+		close(fd);
+	#else
+		char path[L_tmpnam];
+
+		if (tmpnam(path) == NULL) {
+			return NULL;
+		}
+	#endif
+
+	FUNK_RETURN_STRING(path);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(deleteFile) {
+	FUNK_ENSURE_ARG_COUNT(1);
+
+	if (args[0] == NULL) {
+		return NULL;
+	}
+
+	// The macro evaluates its argument twice
+	bool deleted = remove(args[0]->name->chars) == 0;
+	FUNK_RETURN_BOOL(deleted);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(_close) {
+	FUNK_ENSURE_ARG_COUNT(1);
+
+	if (funk_is_loop_handle(args[0])) {
+		funk_loop_close(vm, args[0]);
+		return NULL;
+	}
+
+	if (funk_is_channel(args[0])) {
+		funk_close_channel(funk_extract_channel(vm, args[0]));
+		return NULL;
+	}
+
+	unmap_file(extract_file_data(vm, args[0]));
+	return NULL;
+}
+
+static inline bool is_file(FunkFunction* argument) {
+	return argument != NULL && argument->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) argument)->cleanupFn == cleanup_file_data;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(readLine) {
+	if (argCount > 0 && is_file(args[0])) {
+		const char* chars;
+		size_t length;
+
+		if (!next_line(extract_file_data(vm, args[0]), &chars, &length)) {
+			return NULL;
+		}
+
+		return create_file_string(vm, chars, length);
+	}
+
+	char* line = NULL;
+	size_t capacity = 0;
+
+	// A prompt, that was printed before, has to be seen first
+	funk_flush_output(vm);
+	ssize_t length = getline(&line, &capacity, stdin);
+
+	// The end of the input
+	if (length < 0) {
+		free(line);
+		return NULL;
+	}
+
+	if (length > UINT16_MAX) {
+		free(line);
+		funk_error(vm, "%zd bytes don't fit into a string", length);
+
+		return NULL;
+	}
+
+	FunkString* string = funk_create_string(vm, line, (uint16_t) length);
+
+	free(line);
+	return (FunkFunction *) funk_create_basic_function(vm, string);
+}
+
+typedef enum {
+	FUNK_ITERATOR_RANGE,
+	FUNK_ITERATOR_ARRAY,
+	FUNK_ITERATOR_MAP,
+	FUNK_ITERATOR_STRING,
+	FUNK_ITERATOR_FILE,
+	FUNK_ITERATOR_PERSISTENT_ARRAY,
+	FUNK_ITERATOR_PERSISTENT_MAP,
+	FUNK_ITERATOR_ARRAY_VIEW,
+	FUNK_ITERATOR_NUMBERS,
+	FUNK_ITERATOR_DEQUE,
+	FUNK_ITERATOR_GENERATOR,
+
+	FUNK_ITERATOR_MAPPED,
+	FUNK_ITERATOR_FILTERED,
+	FUNK_ITERATOR_TAKE
+} FunkIteratorType;
+
+// Iterators are pulled one step at a time, so a chain of combinators
+// is evaluated in a single pass without building intermediate arrays.
+// Map entries produce two values (key and value), everything else produces one.
+typedef struct FunkIteratorData {
+	FunkIteratorType type;
+
+	FunkFunction* source;
+	FunkFunction* callback;
+
+	double index;
+	double limit;
+	double step;
+	bool bounded;
+
+	void* state;
+} FunkIteratorData;
+
+static FunkIteratorData* extract_iterator_data(FunkVm* vm, FunkFunction* function) {
+	if (!is_iterator(function)) {
+		funk_error(vm, "Expected an iterator as argument");
+		return NULL;
+	}
+
+	return (FunkIteratorData*) ((FunkNativeFunction*) function)->data;
+}
+
+static void cleanup_iterator_data(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data != NULL) {
+		FunkIteratorData* data = (FunkIteratorData*) function->data;
+
+		if (data->type == FUNK_ITERATOR_PERSISTENT_MAP) {
+			FUNK_FREE(vm, FunkHamtCursor, data->state);
+		}
+
+		FUNK_FREE(vm, FunkIteratorData, data);
+		function->data = NULL;
+	}
+}
+
+static void trace_iterator_data(FunkVm* vm, FunkNativeFunction* function) {
+	FunkIteratorData* data = (FunkIteratorData*) function->data;
+
+	funk_mark_object(vm, (FunkObject *) data->source);
+	funk_mark_object(vm, (FunkObject *) data->callback);
+}
+
+static uint8_t iterator_next(FunkVm* vm, FunkIteratorData* data, FunkFunction** values) {
+	switch (data->type) {
+		case FUNK_ITERATOR_RANGE: {
+			if (data->bounded && (data->step > 0 ? data->index >= data->limit : data->index <= data->limit)) {
+				return 0;
+			}
+
+			values[0] = funk_number_to_string(vm, data->index);
+			data->index += data->step;
+
+			return 1;
+		}
+
+		case FUNK_ITERATOR_ARRAY: {
+			FunkArrayData* array = extract_array_data(vm, data->source);
+			uint32_t index = (uint32_t) data->index;
+
+			if (index >= array->length) {
+				return 0;
+			}
+
+			values[0] = array->data[index];
+			data->index++;
+
+			return 1;
+		}
+
+		case FUNK_ITERATOR_MAP: {
+			FunkMapData* map = extract_map_data(vm, data->source);
+
+			for (int32_t i = (int32_t) data->index; i <= map->table.capacity; i++) {
+				FunkTableEntry* entry = &map->table.entries[i];
+
+				if (entry->key != NULL) {
+					values[0] = (FunkFunction*) funk_create_basic_function(vm, entry->key);
+					values[1] = (FunkFunction*) entry->value;
+
+					data->index = i + 1;
+					return 2;
+				}
+			}
+
+			data->index = map->table.capacity + 1;
+			return 0;
+		}
+
+		case FUNK_ITERATOR_STRING: {
+			FunkString* string = data->source->name;
+			uint16_t index = (uint16_t) data->index;
+
+			if (index >= string->length) {
+				return 0;
+			}
+
+			char buffer[2] = { string->chars[index], '\0' };
+
+			values[0] = (FunkFunction*) funk_create_empty_function(vm, buffer);
+			data->index++;
+
+			return 1;
+		}
+
+		case FUNK_ITERATOR_FILE: {
+			const char* line;
+			size_t length;
+
+			if (!next_line(extract_file_data(vm, data->source), &line, &length)) {
+				return 0;
+			}
+
+			while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+				length--;
+			}
+
+			values[0] = create_file_string(vm, line, length);
+			return 1;
+		}
+
+		case FUNK_ITERATOR_PERSISTENT_ARRAY: {
+			FunkPersistentArrayData* array = extract_persistent_array_data(vm, data->source);
+
+			if (data->index >= array->length) {
+				return 0;
+			}
+
+			values[0] = vector_get(array, (uint32_t) data->index);
+			data->index++;
+
+			return 1;
+		}
+
+		case FUNK_ITERATOR_PERSISTENT_MAP: {
+			FunkHamtEntry* entry = hamt_cursor_next((FunkHamtCursor*) data->state);
+
+			if (entry == NULL) {
+				return 0;
+			}
+
+			values[0] = (FunkFunction*) funk_create_basic_function(vm, entry->key);
+			values[1] = (FunkFunction*) entry->value;
+
+			return 2;
+		}
+
+		case FUNK_ITERATOR_ARRAY_VIEW: {
+			FunkArrayViewData* view = extract_array_view_data(vm, data->source);
+
+			if (data->index >= get_array_view_length(vm, view)) {
+				return 0;
+			}
+
+			values[0] = extract_array_data(vm, view->array)->data[view->from + (uint32_t) data->index];
+			data->index++;
+
+			return 1;
+		}
+
+		case FUNK_ITERATOR_NUMBERS: {
+			FunkNumbersData* numbers = extract_numbers_data(vm, data->source);
+
+			if (data->index >= numbers->length) {
+				return 0;
+			}
+
+			values[0] = funk_number_to_string(vm, numbers->data[(uint32_t) data->index]);
+			data->index++;
+
+			return 1;
+		}
+
+		case FUNK_ITERATOR_DEQUE: {
+			FunkDequeData* deque = extract_deque_data(vm, data->source);
+
+			if (data->index >= deque->length) {
+				return 0;
+			}
+
+			values[0] = *deque_slot(deque, (uint32_t) data->index);
+			data->index++;
+
+			return 1;
+		}
+
+		case FUNK_ITERATOR_GENERATOR: {
+			return funk_resume_generator(vm, data->source, NULL, &values[0]) ? 1 : 0;
+		}
+
+		case FUNK_ITERATOR_MAPPED: {
+			uint8_t count = iterator_next(vm, extract_iterator_data(vm, data->source), values);
+
+			if (count == 0) {
+				return 0;
+			}
+
+			values[0] = funk_run_function_arged(vm, data->callback, values, count);
+			return 1;
+		}
+
+		case FUNK_ITERATOR_FILTERED: {
+			FunkIteratorData* source = extract_iterator_data(vm, data->source);
+
+			while (true) {
+				uint8_t count = iterator_next(vm, source, values);
+
+				if (count == 0) {
+					return 0;
+				}
+
+				for (uint8_t i = 0; i < count; i++) {
+					funk_push_root(vm, values[i]);
+				}
+
+				bool matches = funk_is_true(vm, funk_run_function_arged(vm, data->callback, values, count));
+				funk_pop_roots(vm, count);
+
+				if (matches) {
+					return count;
+				}
+			}
+		}
+
+		case FUNK_ITERATOR_TAKE: {
+			if (data->index >= data->limit) {
+				return 0;
+			}
+
+			uint8_t count = iterator_next(vm, extract_iterator_data(vm, data->source), values);
+
+			if (count > 0) {
+				data->index++;
+			}
+
+			return count;
+		}
+
+		default: UNREACHABLE;
+	}
+
+	return 0;
+}
+
+static void run_iterator(FunkVm* vm, FunkFunction* iterator, FunkFunction* callback) {
+	FunkIteratorData* data = extract_iterator_data(vm, iterator);
+	FunkFunction* values[2];
+	uint8_t count;
+
+	funk_push_root(vm, iterator);
+
+	while ((count = iterator_next(vm, data, values)) > 0) {
+		funk_run_function_arged(vm, callback, values, count);
+	}
+
+	funk_pop_roots(vm, 1);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(iteratorCallback) {
+	FunkIteratorData* data = extract_iterator_data(vm, (FunkFunction *) self);
+
+	if (argCount == 1 && funk_function_has_code(args[0])) {
+		run_iterator(vm, (FunkFunction *) self, args[0]);
+		return NULL;
+	}
+
+	FunkFunction* values[2];
+	return iterator_next(vm, data, values) > 0 ? values[0] : NULL;
+}
+
+static FunkFunction* create_iterator(FunkVm* vm, FunkIteratorType type, FunkFunction* source) {
+	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, "$iteratorData", 13), (FunkNativeFn) iteratorCallback);
+	FunkIteratorData* data = FUNK_ALLOCATE(vm, FunkIteratorData, 1);
+
+	data->type = type;
+	data->source = source;
+	data->callback = NULL;
+	data->index = 0;
+	data->limit = 0;
+	data->step = 1;
+	data->bounded = true;
+	data->state = NULL;
+
+	function->cleanupFn = cleanup_iterator_data;
+	function->traceFn = trace_iterator_data;
+	function->data = (void*) data;
+
+	return (FunkFunction *) function;
+}
+
+static FunkFunction* to_iterator(FunkVm* vm, FunkFunction* argument) {
+	if (argument == NULL) {
+		funk_error(vm, "Expected an iteratable as argument");
+		return NULL;
+	}
+
+	if (is_iterator(argument)) {
+		return argument;
+	} else if (is_array(argument)) {
+		return create_iterator(vm, FUNK_ITERATOR_ARRAY, argument);
+	} else if (is_map(argument)) {
+		return create_iterator(vm, FUNK_ITERATOR_MAP, argument);
+	} else if (is_file(argument)) {
+		return create_iterator(vm, FUNK_ITERATOR_FILE, argument);
+	} else if (is_persistent_array(argument)) {
+		return create_iterator(vm, FUNK_ITERATOR_PERSISTENT_ARRAY, argument);
+	} else if (is_array_view(argument)) {
+		return create_iterator(vm, FUNK_ITERATOR_ARRAY_VIEW, argument);
+	} else if (is_numbers(argument)) {
+		return create_iterator(vm, FUNK_ITERATOR_NUMBERS, argument);
+	} else if (is_deque(argument)) {
+		return create_iterator(vm, FUNK_ITERATOR_DEQUE, argument);
+	} else if (funk_is_generator(argument)) {
+		return create_iterator(vm, FUNK_ITERATOR_GENERATOR, argument);
+	} else if (is_persistent_map(argument)) {
+		FunkFunction* iterator = create_iterator(vm, FUNK_ITERATOR_PERSISTENT_MAP, argument);
+		FunkHamtCursor* cursor = FUNK_ALLOCATE(vm, FunkHamtCursor, 1);
+
+		init_hamt_cursor(cursor, extract_persistent_map_data(vm, argument)->root);
+		extract_iterator_data(vm, iterator)->state = (void*) cursor;
+
+		return iterator;
+	}
+
+	return create_iterator(vm, FUNK_ITERATOR_STRING, argument);
+}
+
+static inline bool is_iterator(FunkFunction* argument) {
+	return argument != NULL && argument->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) argument)->cleanupFn == cleanup_iterator_data;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(iterate) {
+	FUNK_ENSURE_ARG_COUNT(1);
+	return to_iterator(vm, args[0]);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(range) {
+	FUNK_ENSURE_MIN_ARG_COUNT(1);
+
+	FunkFunction* iterator = create_iterator(vm, FUNK_ITERATOR_RANGE, NULL);
+	FunkIteratorData* data = extract_iterator_data(vm, iterator);
+
+	data->index = funk_to_number(vm, args[0]);
+
+	if (argCount > 1) {
+		data->limit = funk_to_number(vm, args[1]);
+		data->step = data->index < data->limit ? 1 : -1;
+	} else {
+		data->bounded = false;
+	}
+
+	return iterator;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(mapped) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	FunkFunction* iterator = create_iterator(vm, FUNK_ITERATOR_MAPPED, to_iterator(vm, args[0]));
+	extract_iterator_data(vm, iterator)->callback = args[1];
+
+	return iterator;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(filtered) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	FunkFunction* iterator = create_iterator(vm, FUNK_ITERATOR_FILTERED, to_iterator(vm, args[0]));
+	extract_iterator_data(vm, iterator)->callback = args[1];
+
+	return iterator;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(take) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	FunkFunction* iterator = create_iterator(vm, FUNK_ITERATOR_TAKE, to_iterator(vm, args[0]));
+	extract_iterator_data(vm, iterator)->limit = funk_to_number(vm, args[1]);
+
+	return iterator;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(collect) {
+	FUNK_ENSURE_ARG_COUNT(1);
+
+	FunkFunction* iterator = to_iterator(vm, args[0]);
+	FunkIteratorData* data = extract_iterator_data(vm, iterator);
+	FunkFunction* result = create_array(vm, NULL, 0);
+	FunkArrayData* array = extract_array_data(vm, result);
+
+	funk_push_root(vm, iterator);
+	funk_push_root(vm, result);
+
+	if (data->type == FUNK_ITERATOR_RANGE && data->bounded) {
+		double count = fabs(data->limit - data->index);
+		uint32_t length = (uint32_t) ceil(count);
+
+		array->data = FUNK_ALLOCATE(vm, FunkFunction*, length);
+		array->allocated = length;
+	}
+
+	FunkFunction* values[2];
+
+	while (iterator_next(vm, data, values) > 0) {
+		if (array->length == array->allocated) {
+			uint32_t newSize = FUNK_GROW_CAPACITY(array->allocated);
+
+			array->data = FUNK_GROW_ARRAY(vm, FunkFunction*, array->data, array->allocated, newSize);
+			array->allocated = newSize;
+		}
+
+		// The callbacks of the iterator can promote the result, before it is filled
+		array->data[array->length++] = values[0];
+		funk_write_barrier(vm, result, (FunkObject *) values[0]);
+	}
+
+	funk_pop_roots(vm, 2);
+	return result;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(reduce) {
+	FUNK_ENSURE_MIN_ARG_COUNT(2);
+
+	FunkFunction* iterator = to_iterator(vm, args[0]);
+	FunkIteratorData* data = extract_iterator_data(vm, iterator);
+	FunkFunction* callback = args[1];
+	FunkFunction* values[3];
+
+	funk_push_root(vm, iterator);
+
+	if (argCount > 2) {
+		values[0] = args[2];
+	} else if (iterator_next(vm, data, values) == 0) {
+		funk_pop_roots(vm, 1);
+		return NULL;
+	}
+
+	uint8_t count;
+
+	// The accumulated value is only held here, between the callbacks
+	funk_push_root(vm, values[0]);
+
+	while ((count = iterator_next(vm, data, values + 1)) > 0) {
+		values[0] = funk_run_function_arged(vm, callback, values, count + 1);
+
+		funk_pop_roots(vm, 1);
+		funk_push_root(vm, values[0]);
+	}
+
+	funk_pop_roots(vm, 2);
+	return values[0];
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(collectGarbage) {
+	funk_collect_garbage(vm);
+	return NULL;
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(collectNursery) {
+	funk_collect_nursery(vm);
+	return NULL;
+}
+
+// Roman numerals only go up to a quarter million, so the sizes are counted in kilobytes and clamped
+#define FUNK_MAX_STAT 239999
+
+static void set_stat(FunkVm* vm, FunkMapData* data, const char* key, double value) {
+	FunkFunction* number = funk_number_to_string(vm, value > FUNK_MAX_STAT ? FUNK_MAX_STAT : floor(value));
+	funk_table_set(vm, &data->table, funk_create_string(vm, key, strlen(key)), (FunkObject *) number);
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(heapStats) {
+	FunkHeapStats stats;
+	funk_get_heap_stats(vm, &stats);
+
+	FunkFunction* result = map(vm, NULL, NULL, 0);
+	FunkFunction* kinds = map(vm, NULL, NULL, 0);
+	FunkMapData* data = extract_map_data(vm, result);
+	FunkMapData* kindsData = extract_map_data(vm, kinds);
+
+	set_stat(vm, data, "liveKilobytes", stats.liveBytes / 1024.0);
+	set_stat(vm, data, "allocatedKilobytes", stats.allocatedBytes / 1024.0);
+	set_stat(vm, data, "freedKilobytes", stats.freedBytes / 1024.0);
+	set_stat(vm, data, "functions", stats.objects[FUNK_OBJECT_BASIC_FUNCTION]);
+	set_stat(vm, data, "natives", stats.objects[FUNK_OBJECT_NATIVE_FUNCTION]);
+	set_stat(vm, data, "strings", stats.objects[FUNK_OBJECT_STRING]);
+	set_stat(vm, data, "young", stats.youngObjects);
+	set_stat(vm, data, "internedStrings", stats.internedStrings);
+	set_stat(vm, data, "collections", stats.collections);
+	set_stat(vm, data, "nurseryCollections", stats.nurseryCollections);
+	set_stat(vm, data, "lastPauseMicroseconds", stats.lastPauseNanoseconds / 1e3);
+	set_stat(vm, data, "totalPauseMilliseconds", stats.totalPauseNanoseconds / 1e6);
+
+	// "$mapData" is listed as "map"
+	for (uint16_t i = 0; i < stats.nativeKindCount; i++) {
+		const char* name = stats.nativeKinds[i].name;
+		size_t length = strlen(name);
+
+		if (name[0] == '$' && length > 5 && memcmp(name + length - 4, "Data", 4) == 0) {
+			FunkString* kind = funk_create_string(vm, name + 1, length - 5);
+			funk_table_set(vm, &kindsData->table, kind, (FunkObject *) funk_number_to_string(vm, stats.nativeKinds[i].count));
+		}
 	}
 
-	string[length] = '\0';
-	FUNK_RETURN_STRING(string);
+	funk_table_set(vm, &data->table, funk_create_string(vm, "kinds", 5), (FunkObject *) kinds);
+	return result;
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(_char) {
+FUNK_NATIVE_FUNCTION_DEFINITION(dumpHeap) {
 	FUNK_ENSURE_ARG_COUNT(1);
 
-	uint8_t byte = (uint8_t) funk_to_number(vm, args[0]);
-	char buffer[2] = { (char) byte, '\0'};
+	if (args[0] == NULL) {
+		return NULL;
+	}
 
-	FUNK_RETURN_STRING(buffer);
+	FILE* file = fopen(args[0]->name->chars, "w");
+
+	if (file == NULL) {
+		funk_error(vm, "Failed to open %s", args[0]->name->chars);
+		return NULL;
+	}
+
+	funk_dump_heap(vm, file);
+	fclose(file);
+
+	return NULL;
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(add) {
-	FUNK_ENSURE_MIN_ARG_COUNT(2);
-	FUNK_RETURN_NUMBER(funk_to_number(vm, args[0]) + funk_to_number(vm, args[1]));
+FUNK_NATIVE_FUNCTION_DEFINITION(saveSnapshot) {
+	FUNK_ENSURE_ARG_COUNT(1);
+
+	if (args[0] == NULL) {
+		return NULL;
+	}
+
+	bool saved = funk_save_snapshot(vm, args[0]->name->chars);
+	FUNK_RETURN_BOOL(saved);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(subtract) {
-	FUNK_ENSURE_MIN_ARG_COUNT(2);
-	FUNK_RETURN_NUMBER(funk_to_number(vm, args[0]) - funk_to_number(vm, args[1]));
+FUNK_NATIVE_FUNCTION_DEFINITION(loadSnapshot) {
+	FUNK_ENSURE_ARG_COUNT(1);
+
+	if (args[0] == NULL) {
+		return NULL;
+	}
+
+	bool loaded = funk_load_snapshot(vm, args[0]->name->chars);
+	FUNK_RETURN_BOOL(loaded);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(multiply) {
-	FUNK_ENSURE_MIN_ARG_COUNT(2);
-	FUNK_RETURN_NUMBER(funk_to_number(vm, args[0]) * funk_to_number(vm, args[1]));
+FUNK_NATIVE_FUNCTION_DEFINITION(gcThreads) {
+	if (argCount > 0) {
+		funk_set_gc_threads(vm, (uint16_t) funk_to_number(vm, args[0]));
+	}
+
+	FUNK_RETURN_NUMBER(vm->gcThreads);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(divide) {
-	FUNK_ENSURE_MIN_ARG_COUNT(2);
-	FUNK_RETURN_NUMBER(funk_to_number(vm, args[0]) / funk_to_number(vm, args[1]));
+// Caches the results of a function by its arguments. Names are interned, so plain values are keyed by their name,
+// just like equal() compares them, while arrays, maps and lambdas, that share their names, are keyed by themselves
+#define FUNK_MEMO_MIN_BUCKETS 16
+
+typedef struct FunkMemoEntry {
+	FunkObject** keys;
+	uint8_t keyCount;
+	uint32_t hash;
+	FunkFunction* value;
+
+	struct FunkMemoEntry* nextInBucket;
+	// The entries are listed from the most to the least recently used one
+	struct FunkMemoEntry* newer;
+	struct FunkMemoEntry* older;
+} FunkMemoEntry;
+
+typedef struct FunkMemoData {
+	FunkFunction* function;
+
+	FunkMemoEntry** buckets;
+	uint32_t bucketCount;
+	uint32_t count;
+	// Zero keeps every result
+	uint32_t limit;
+
+	FunkMemoEntry* newest;
+	FunkMemoEntry* oldest;
+
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t evictions;
+} FunkMemoData;
+
+static FunkMemoData* extract_memo_data(FunkVm* vm, FunkFunction* function) {
+	if (!is_memo(function)) {
+		funk_error(vm, "Expected a memoized function as argument");
+		return NULL;
+	}
+
+	return (FunkMemoData*) ((FunkNativeFunction*) function)->data;
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(greater) {
-	FUNK_ENSURE_MIN_ARG_COUNT(2);
-	FUNK_RETURN_BOOL(funk_to_number(vm, args[0]) > funk_to_number(vm, args[1]));
+static void free_memo_entry(FunkVm* vm, FunkMemoEntry* entry) {
+	FUNK_FREE_ARRAY(vm, FunkObject*, entry->keys, entry->keyCount);
+	FUNK_FREE(vm, FunkMemoEntry, entry);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(greaterEqual) {
-	FUNK_ENSURE_MIN_ARG_COUNT(2);
-	FUNK_RETURN_BOOL(funk_to_number(vm, args[0]) >= funk_to_number(vm, args[1]));
+static void cleanup_memo_data(FunkVm* vm, FunkNativeFunction* function) {
+	if (function->data != NULL) {
+		FunkMemoData* data = (FunkMemoData*) function->data;
+		FunkMemoEntry* entry = data->newest;
+
+		while (entry != NULL) {
+			FunkMemoEntry* older = entry->older;
+
+			free_memo_entry(vm, entry);
+			entry = older;
+		}
+
+		FUNK_FREE_ARRAY(vm, FunkMemoEntry*, data->buckets, data->bucketCount);
+		FUNK_FREE(vm, FunkMemoData, data);
+
+		function->data = NULL;
+	}
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(less) {
-	FUNK_ENSURE_MIN_ARG_COUNT(2);
-	FUNK_RETURN_BOOL(funk_to_number(vm, args[0]) < funk_to_number(vm, args[1]));
+// The keys are marked too, a collected name could get a new one with the same address otherwise
+static void trace_memo_data(FunkVm* vm, FunkNativeFunction* function) {
+	FunkMemoData* data = (FunkMemoData*) function->data;
+	funk_mark_object(vm, (FunkObject *) data->function);
+
+	for (FunkMemoEntry* entry = data->newest; entry != NULL; entry = entry->older) {
+		for (uint8_t i = 0; i < entry->keyCount; i++) {
+			funk_mark_object(vm, entry->keys[i]);
+		}
+
+		funk_mark_object(vm, (FunkObject *) entry->value);
+	}
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(lessEqual) {
-	FUNK_ENSURE_MIN_ARG_COUNT(2);
-	FUNK_RETURN_BOOL(funk_to_number(vm, args[0]) <= funk_to_number(vm, args[1]));
+static inline FunkObject* get_memo_key(FunkFunction* argument) {
+	if (argument == NULL) {
+		return NULL;
+	}
+
+	return funk_function_has_code(argument) ? (FunkObject *) argument : (FunkObject *) argument->name;
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(and) {
-	FUNK_ENSURE_MIN_ARG_COUNT(2);
-	FUNK_RETURN_BOOL(funk_is_true(vm, args[0]) && funk_is_true(vm, args[1]));
+static uint32_t hash_memo_keys(FunkObject** keys, uint8_t count) {
+	uint64_t hash = count;
+
+	for (uint8_t i = 0; i < count; i++) {
+		hash = (hash ^ ((uintptr_t) keys[i] >> 4)) * 0x9e3779b97f4a7c15ULL;
+	}
+
+	return (uint32_t) (hash >> 32);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(or) {
-	FUNK_ENSURE_MIN_ARG_COUNT(2);
-	FUNK_RETURN_BOOL(funk_is_true(vm, args[0]) || funk_is_true(vm, args[1]));
+static FunkMemoEntry* find_memo_entry(FunkMemoData* data, FunkObject** keys, uint8_t count, uint32_t hash) {
+	if (data->bucketCount == 0) {
+		return NULL;
+	}
+
+	for (FunkMemoEntry* entry = data->buckets[hash & (data->bucketCount - 1)]; entry != NULL; entry = entry->nextInBucket) {
+		if (entry->hash == hash && entry->keyCount == count && memcmp((void*) entry->keys, (void*) keys, sizeof(FunkObject*) * count) == 0) {
+			return entry;
+		}
+	}
+
+	return NULL;
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(_cos) {
-	FUNK_ENSURE_MIN_ARG_COUNT(1);
-	FUNK_RETURN_NUMBER(cos(funk_to_number(vm, args[0])));
+static void unlink_memo_entry(FunkMemoData* data, FunkMemoEntry* entry) {
+	if (entry->newer != NULL) {
+		entry->newer->older = entry->older;
+	} else {
+		data->newest = entry->older;
+	}
+
+	if (entry->older != NULL) {
+		entry->older->newer = entry->newer;
+	} else {
+		data->oldest = entry->newer;
+	}
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(_sin) {
-	FUNK_ENSURE_MIN_ARG_COUNT(1);
-	FUNK_RETURN_NUMBER(sin(funk_to_number(vm, args[0])));
+static void make_memo_entry_newest(FunkMemoData* data, FunkMemoEntry* entry) {
+	entry->newer = NULL;
+	entry->older = data->newest;
+
+	if (data->newest != NULL) {
+		data->newest->newer = entry;
+	} else {
+		data->oldest = entry;
+	}
+
+	data->newest = entry;
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(require) {
-	FUNK_ENSURE_ARG_COUNT(1);
-	FunkString* path = args[0]->name;
+static void evict_oldest_memo_entry(FunkVm* vm, FunkMemoData* data) {
+	FunkMemoEntry* entry = data->oldest;
+	FunkMemoEntry** link = &data->buckets[entry->hash & (data->bucketCount - 1)];
 
-	if (path == NULL) {
-		return NULL;
+	while (*link != entry) {
+		link = &(*link)->nextInBucket;
 	}
 
-	FunkFunction* existingResult;
+	*link = entry->nextInBucket;
+	unlink_memo_entry(data, entry);
+	free_memo_entry(vm, entry);
 
-	if (funk_table_get(&vm->modules, path, (FunkObject **) &existingResult)) {
-		return existingResult;
+	data->count--;
+	data->evictions++;
+}
+
+static void grow_memo_buckets(FunkVm* vm, FunkMemoData* data) {
+	uint32_t bucketCount = data->bucketCount < FUNK_MEMO_MIN_BUCKETS ? FUNK_MEMO_MIN_BUCKETS : data->bucketCount * 2;
+	FunkMemoEntry** buckets = FUNK_ALLOCATE(vm, FunkMemoEntry*, bucketCount);
+
+	memset((void*) buckets, 0, sizeof(FunkMemoEntry*) * bucketCount);
+
+	for (FunkMemoEntry* entry = data->newest; entry != NULL; entry = entry->older) {
+		FunkMemoEntry** bucket = &buckets[entry->hash & (bucketCount - 1)];
+
+		entry->nextInBucket = *bucket;
+		*bucket = entry;
 	}
 
-	uint16_t length = path->length + 6;
-	char buffer[length];
+	FUNK_FREE_ARRAY(vm, FunkMemoEntry*, data->buckets, data->bucketCount);
 
-	memcpy((void*) buffer, path->chars, path->length);
+	data->buckets = buckets;
+	data->bucketCount = bucketCount;
+}
 
-	for (uint16_t i = 0; i < path->length; i++) {
-		if (buffer[i] == '.') {
-			buffer[i] = '/';
-		}
+static void add_memo_entry(FunkVm* vm, FunkFunction* memo, FunkObject** keys, uint8_t count, uint32_t hash, FunkFunction* value) {
+	FunkMemoData* data = (FunkMemoData*) ((FunkNativeFunction*) memo)->data;
+
+	if (data->limit > 0 && data->count >= data->limit) {
+		evict_oldest_memo_entry(vm, data);
 	}
 
-	memcpy((void*) (buffer + path->length), ".funk\0", 6);
-	FunkFunction* result = funk_run_file(vm, buffer);
+	if (data->count + 1 > data->bucketCount * TABLE_MAX_LOAD) {
+		grow_memo_buckets(vm, data);
+	}
+
+	FunkMemoEntry* entry = FUNK_ALLOCATE(vm, FunkMemoEntry, 1);
+	FunkMemoEntry** bucket = &data->buckets[hash & (data->bucketCount - 1)];
+
+	entry->keys = count > 0 ? FUNK_ALLOCATE(vm, FunkObject*, count) : NULL;
+	entry->keyCount = count;
+	entry->hash = hash;
+	entry->value = value;
+	entry->nextInBucket = *bucket;
+
+	if (count > 0) {
+		memcpy((void*) entry->keys, (void*) keys, sizeof(FunkObject*) * count);
+	}
+
+	*bucket = entry;
+	make_memo_entry_newest(data, entry);
+	data->count++;
+
+	for (uint8_t i = 0; i < count; i++) {
+		funk_write_barrier(vm, memo, keys[i]);
+	}
+
+	funk_write_barrier(vm, memo, (FunkObject *) value);
+}
+
+// Null results aren't cached, a failed call returns null too
+FUNK_NATIVE_FUNCTION_DEFINITION(memoCallback) {
+	FunkMemoData* data = (FunkMemoData*) self->data;
+
+	// The cache belongs to the heap of the parent, that workers can't change
+	if (vm->parent != NULL) {
+		return funk_run_function_arged(vm, data->function, args, argCount);
+	}
+
+	FunkObject* keys[UINT8_MAX];
+
+	for (uint8_t i = 0; i < argCount; i++) {
+		keys[i] = get_memo_key(args[i]);
+	}
+
+	uint32_t hash = hash_memo_keys(keys, argCount);
+	FunkMemoEntry* entry = find_memo_entry(data, keys, argCount, hash);
+
+	if (entry != NULL) {
+		data->hits++;
+
+		unlink_memo_entry(data, entry);
+		make_memo_entry_newest(data, entry);
+
+		return entry->value;
+	}
+
+	data->misses++;
+	FunkFunction* result = funk_run_function_arged(vm, data->function, args, argCount);
+
+	// A recursive call could have cached the same arguments in the meantime
+	if (result != NULL && find_memo_entry(data, keys, argCount, hash) == NULL) {
+		add_memo_entry(vm, (FunkFunction *) self, keys, argCount, hash, result);
+	}
 
-	funk_table_set(vm, &vm->modules, path, (FunkObject *) result);
 	return result;
 }
 
-typedef struct FunkFileData {
-	FILE* file;
-	char* path;
-} FunkFileData;
+FUNK_NATIVE_FUNCTION_DEFINITION(memoize) {
+	FUNK_ENSURE_MIN_ARG_COUNT(1);
 
-static FunkFileData* extract_file_data(FunkVm* vm, FunkFunction* function) {
-	if (!is_file(function)) {
-		funk_error(vm, "Expected a file as argument");
+	if (!funk_function_has_code(args[0])) {
+		funk_error(vm, "Expected a function as argument");
 		return NULL;
 	}
 
-	return (FunkFileData*) ((FunkNativeFunction*) function)->data;
+	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, "$memoData", 9), (FunkNativeFn) memoCallback);
+	FunkMemoData* data = FUNK_ALLOCATE(vm, FunkMemoData, 1);
+
+	data->function = args[0];
+	data->buckets = NULL;
+	data->bucketCount = 0;
+	data->count = 0;
+	data->limit = argCount > 1 ? (uint32_t) funk_to_number(vm, args[1]) : 0;
+	data->newest = NULL;
+	data->oldest = NULL;
+	data->hits = 0;
+	data->misses = 0;
+	data->evictions = 0;
+
+	function->cleanupFn = cleanup_memo_data;
+	function->traceFn = trace_memo_data;
+	function->data = (void*) data;
+
+	return (FunkFunction *) function;
 }
 
-static void cleanup_file_data(FunkVm* vm, FunkNativeFunction* function) {
-	if (function->data != NULL) {
-		FunkFileData* fileData = (FunkFileData*) function->data;
+static inline bool is_memo(FunkFunction* argument) {
+	return argument != NULL && argument->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) argument)->cleanupFn == cleanup_memo_data;
+}
 
-		if (fileData->file != NULL) {
-			fclose(fileData->file);
-		}
+FUNK_NATIVE_FUNCTION_DEFINITION(memoStats) {
+	FUNK_ENSURE_ARG_COUNT(1);
 
-		if (fileData->path != NULL) {
-			vm->freeFn(fileData);
-		}
+	FunkMemoData* memo = extract_memo_data(vm, args[0]);
+	FunkFunction* result = map(vm, NULL, NULL, 0);
+	FunkMapData* data = extract_map_data(vm, result);
 
-		function->data = NULL;
+	set_stat(vm, data, "hits", memo->hits);
+	set_stat(vm, data, "misses", memo->misses);
+	set_stat(vm, data, "evictions", memo->evictions);
+	set_stat(vm, data, "size", memo->count);
+
+	return result;
+}
+
+// The generator is called to resume it, with an optional value for the yield(), that it is suspended in
+FUNK_NATIVE_FUNCTION_DEFINITION(generator) {
+	FUNK_ENSURE_MIN_ARG_COUNT(1);
+
+	if (!funk_function_has_code(args[0])) {
+		funk_error(vm, "Expected a function as argument");
+		return NULL;
 	}
+
+	return funk_create_generator(vm, args[0], args + 1, argCount - 1);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(fileCallback) {
-	FunkFileData* data = extract_file_data(vm, (FunkFunction *) self);
-	const char* string = funk_read_file(data->path);
+FUNK_NATIVE_FUNCTION_DEFINITION(yield) {
+	return funk_yield(vm, argCount > 0 ? args[0] : NULL);
+}
+
+static bool ensure_name_argument(FunkVm* vm, FunkFunction* argument) {
+	if (argument == NULL || funk_function_has_code(argument)) {
+		funk_error(vm, "Expected a name as argument");
+		return false;
+	}
+
+	return true;
+}
 
-	if (string == NULL) {
+FUNK_NATIVE_FUNCTION_DEFINITION(listen) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	if (!ensure_name_argument(vm, args[0])) {
 		return NULL;
 	}
 
-	FUNK_RETURN_STRING(string);
+	return funk_loop_listen(vm, args[0]->name->chars, args[1]);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(file) {
-	FUNK_ENSURE_ARG_COUNT(1);
+FUNK_NATIVE_FUNCTION_DEFINITION(_connect) {
+	FUNK_ENSURE_ARG_COUNT(2);
 
-	if (args[0] == NULL) {
+	if (!ensure_name_argument(vm, args[0])) {
 		return NULL;
 	}
 
-	FunkNativeFunction* function = funk_create_native_function(vm, funk_create_string(vm, "$fileData", 9),(FunkNativeFn) fileCallback);
-	FunkFileData* data = (FunkFileData*) vm->allocFn(sizeof(FunkFileData));
+	return funk_loop_connect(vm, args[0]->name->chars, args[1]);
+}
 
-	uint16_t length = args[0]->name->length;
+FUNK_NATIVE_FUNCTION_DEFINITION(_pipe) {
+	FunkFunction* ends[2];
+	funk_loop_pipe(vm, ends);
 
-	data->file = fopen(args[0]->name->chars, "rw");
-	data->path = (char*) vm->allocFn(length);
+	return create_array(vm, ends, 2);
+}
 
-	memcpy((void*) data->path, args[0]->name->chars, length + 1);
+FUNK_NATIVE_FUNCTION_DEFINITION(timeout) {
+	FUNK_ENSURE_ARG_COUNT(2);
+	return funk_loop_timer(vm, funk_to_number(vm, args[0]), false, args[1]);
+}
 
-	function->data = data;
-	function->cleanupFn = cleanup_file_data;
+FUNK_NATIVE_FUNCTION_DEFINITION(interval) {
+	FUNK_ENSURE_ARG_COUNT(2);
+	return funk_loop_timer(vm, funk_to_number(vm, args[0]), true, args[1]);
+}
 
-	return (FunkFunction *) function;
+FUNK_NATIVE_FUNCTION_DEFINITION(readLines) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	if (!ensure_name_argument(vm, args[0])) {
+		return NULL;
+	}
+
+	return funk_loop_read_lines(vm, args[0]->name->chars, args[1]);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(close) {
-	FUNK_ENSURE_ARG_COUNT(1);
-	FunkFileData* data = extract_file_data(vm, args[0]);
+FUNK_NATIVE_FUNCTION_DEFINITION(onData) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	// Channels get a receiver handle of their own, so that they can be listened to by more than one loop
+	if (funk_is_channel(args[0])) {
+		return funk_loop_on_message(vm, args[0], args[1]);
+	}
+
+	funk_loop_on_data(vm, args[0], args[1]);
+	return args[0];
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(onClose) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	funk_loop_on_close(vm, args[0], args[1]);
+	return args[0];
+}
+
+FUNK_NATIVE_FUNCTION_DEFINITION(_send) {
+	FUNK_ENSURE_ARG_COUNT(2);
+
+	if (funk_is_channel(args[0])) {
+		funk_channel_send(vm, args[0], args[1]);
+		return NULL;
+	}
 
-	if (data->file != NULL) {
-		fclose(data->file);
-		data->file = NULL;
+	if (args[1] != NULL) {
+		funk_loop_send(vm, args[0], args[1]->name->chars, args[1]->name->length);
 	}
 
 	return NULL;
 }
 
-static inline bool is_file(FunkFunction* argument) {
-	return argument != NULL && argument->object.type == FUNK_OBJECT_NATIVE_FUNCTION && ((FunkNativeFunction*) argument)->cleanupFn == cleanup_file_data;
+FUNK_NATIVE_FUNCTION_DEFINITION(port) {
+	FUNK_ENSURE_ARG_COUNT(1);
+	FUNK_RETURN_NUMBER(funk_loop_port(vm, args[0]));
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(readLine) {
-	void* stream = stdin;
+FUNK_NATIVE_FUNCTION_DEFINITION(runLoop) {
+	funk_run_loop(vm);
+	return NULL;
+}
 
-	if (argCount > 0 && is_file(args[0])) {
-		stream = extract_file_data(vm, args[0])->file;
+#define FUNK_CHANNEL_DEFAULT_CAPACITY 1024
 
-		if (stream == NULL) {
-			return NULL;
-		}
+FUNK_NATIVE_FUNCTION_DEFINITION(channel) {
+	uint32_t capacity = FUNK_CHANNEL_DEFAULT_CAPACITY;
+
+	if (argCount > 0) {
+		capacity = (uint32_t) fmax(funk_to_number(vm, args[0]), 1);
 	}
 
-	char* line = NULL;
-	size_t length = 0;
+	FunkChannel* channel = funk_create_channel(capacity);
+	FunkFunction* function = funk_wrap_channel(vm, channel);
 
-	length = getline(&line, &length, stream);
-	FunkString* string = funk_create_string(vm, line, length);
+	// The native holds the only reference now
+	funk_release_channel(channel);
+	return function;
+}
 
-	free(line);
-	return (FunkFunction *) funk_create_basic_function(vm, string);
+FUNK_NATIVE_FUNCTION_DEFINITION(receive) {
+	FUNK_ENSURE_ARG_COUNT(1);
+	return funk_channel_receive(vm, args[0]);
 }
 
-FUNK_NATIVE_FUNCTION_DEFINITION(collectGarbage) {
-	funk_collect_garbage(vm);
-	return NULL;
+FUNK_NATIVE_FUNCTION_DEFINITION(tryReceive) {
+	FUNK_ENSURE_ARG_COUNT(1);
+
+	FunkFunction* value = NULL;
+	funk_channel_try_receive(vm, args[0], &value);
+
+	return value;
 }
 
 void funk_open_std(FunkVm* vm) {
+	if (programStart.tv_sec == 0 && programStart.tv_nsec == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &programStart);
+	}
+
 	funk_set_global(vm, "NULLA", (FunkFunction *) funk_create_empty_function(vm, ""));
 
 	FUNK_DEFINE_FUNCTION("array", array);
@@ -738,13 +3911,40 @@ void funk_open_std(FunkVm* vm) {
 	FUNK_DEFINE_FUNCTION("push", push);
 	FUNK_DEFINE_FUNCTION("pop", pop);
 	FUNK_DEFINE_FUNCTION("remove", _remove);
+	FUNK_DEFINE_FUNCTION("slice", slice);
+	FUNK_DEFINE_FUNCTION("view", view);
+	FUNK_DEFINE_FUNCTION("concat", concat);
+	FUNK_DEFINE_FUNCTION("fill", fill);
+	FUNK_DEFINE_FUNCTION("reverse", reverse);
+	FUNK_DEFINE_FUNCTION("indexOf", indexOf);
+	FUNK_DEFINE_FUNCTION("sort", sort);
+	FUNK_DEFINE_FUNCTION("numbers", numbers);
+	FUNK_DEFINE_FUNCTION("sum", sum);
+	FUNK_DEFINE_FUNCTION("min", min);
+	FUNK_DEFINE_FUNCTION("max", max);
+	FUNK_DEFINE_FUNCTION("dotProduct", dotProduct);
+	FUNK_DEFINE_FUNCTION("scale", scale);
+	FUNK_DEFINE_FUNCTION("addNumbers", addNumbers);
+	FUNK_DEFINE_FUNCTION("deque", deque);
+	FUNK_DEFINE_FUNCTION("pushBack", pushBack);
+	FUNK_DEFINE_FUNCTION("pushFront", pushFront);
+	FUNK_DEFINE_FUNCTION("popBack", popBack);
+	FUNK_DEFINE_FUNCTION("popFront", popFront);
+	FUNK_DEFINE_FUNCTION("parallelMap", parallelMap);
+	FUNK_DEFINE_FUNCTION("parallelReduce", parallelReduce);
+	FUNK_DEFINE_FUNCTION("parallelThreads", parallelThreads);
+	FUNK_DEFINE_FUNCTION("persistentArray", persistentArray);
+	FUNK_DEFINE_FUNCTION("persistentMap", persistentMap);
+	FUNK_DEFINE_FUNCTION("persistent", persistent);
 
 	FUNK_DEFINE_FUNCTION("variable", variable);
 
 	FUNK_DEFINE_FUNCTION("print", print);
 	FUNK_DEFINE_FUNCTION("printNumber", printNumber);
 	FUNK_DEFINE_FUNCTION("printChar", printChar);
+	FUNK_DEFINE_FUNCTION("flush", flush);
 	FUNK_DEFINE_FUNCTION("clock", _clock);
+	FUNK_DEFINE_FUNCTION("now", now);
 	FUNK_DEFINE_FUNCTION("readLine", readLine);
 
 	FUNK_DEFINE_FUNCTION("set", set);
@@ -754,9 +3954,9 @@ void funk_open_std(FunkVm* vm) {
 	FUNK_DEFINE_FUNCTION("notNull", notNull);
 	FUNK_DEFINE_FUNCTION("not", not);
 
-	FUNK_DEFINE_FUNCTION("if", _if);
-	FUNK_DEFINE_FUNCTION("while", _while);
-	FUNK_DEFINE_FUNCTION("for", _for);
+	funk_define_intrinsic(vm, FUNK_INTRINSIC_IF, "if", (FunkNativeFn) _if);
+	funk_define_intrinsic(vm, FUNK_INTRINSIC_WHILE, "while", (FunkNativeFn) _while);
+	funk_define_intrinsic(vm, FUNK_INTRINSIC_FOR, "for", (FunkNativeFn) _for);
 
 	FUNK_DEFINE_FUNCTION("space", space);
 	FUNK_DEFINE_FUNCTION("separator", separator);
@@ -783,7 +3983,51 @@ void funk_open_std(FunkVm* vm) {
 	FUNK_DEFINE_FUNCTION("require", require);
 
 	FUNK_DEFINE_FUNCTION("file", file);
-	FUNK_DEFINE_FUNCTION("close", close);
+	FUNK_DEFINE_FUNCTION("close", _close);
+	FUNK_DEFINE_FUNCTION("readAt", readAt);
+	FUNK_DEFINE_FUNCTION("temporaryFile", temporaryFile);
+	FUNK_DEFINE_FUNCTION("deleteFile", deleteFile);
+
+	FUNK_DEFINE_FUNCTION("iterate", iterate);
+	FUNK_DEFINE_FUNCTION("range", range);
+	FUNK_DEFINE_FUNCTION("mapped", mapped);
+	FUNK_DEFINE_FUNCTION("filtered", filtered);
+	FUNK_DEFINE_FUNCTION("take", take);
+	FUNK_DEFINE_FUNCTION("reduce", reduce);
+	FUNK_DEFINE_FUNCTION("collect", collect);
+
+	FUNK_DEFINE_FUNCTION("memoize", memoize);
+	FUNK_DEFINE_FUNCTION("memoStats", memoStats);
+
+	FUNK_DEFINE_FUNCTION("generator", generator);
+	FUNK_DEFINE_FUNCTION("yield", yield);
+
+	FUNK_DEFINE_FUNCTION("listen", listen);
+	FUNK_DEFINE_FUNCTION("connect", _connect);
+	FUNK_DEFINE_FUNCTION("pipe", _pipe);
+	FUNK_DEFINE_FUNCTION("timeout", timeout);
+	FUNK_DEFINE_FUNCTION("interval", interval);
+	FUNK_DEFINE_FUNCTION("readLines", readLines);
+	FUNK_DEFINE_FUNCTION("onData", onData);
+	FUNK_DEFINE_FUNCTION("onClose", onClose);
+	FUNK_DEFINE_FUNCTION("send", _send);
+	FUNK_DEFINE_FUNCTION("port", port);
+	FUNK_DEFINE_FUNCTION("runLoop", runLoop);
+
+	FUNK_DEFINE_FUNCTION("channel", channel);
+	FUNK_DEFINE_FUNCTION("receive", receive);
+	FUNK_DEFINE_FUNCTION("tryReceive", tryReceive);
 
 	FUNK_DEFINE_FUNCTION("collectGarbage", collectGarbage);
+	FUNK_DEFINE_FUNCTION("collectNursery", collectNursery);
+	FUNK_DEFINE_FUNCTION("gcThreads", gcThreads);
+	FUNK_DEFINE_FUNCTION("heapStats", heapStats);
+	FUNK_DEFINE_FUNCTION("dumpHeap", dumpHeap);
+
+	FUNK_DEFINE_FUNCTION("saveSnapshot", saveSnapshot);
+	FUNK_DEFINE_FUNCTION("loadSnapshot", loadSnapshot);
+
+	funk_register_snapshot_type(vm, "$arrayData", cleanup_array_data, save_array_data, load_array_data);
+	funk_register_snapshot_type(vm, "$mapData", cleanup_map_data, save_map_data, load_map_data);
+	funk_register_snapshot_type(vm, "$numbersData", cleanup_numbers_data, save_numbers_data, load_numbers_data);
 }
\ No newline at end of file
@@ -0,0 +1,642 @@
+#include "funk.h"
+#include "funk_std.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Compiles a script and the modules, that it requires, to C. The functions become tables, that funk_run_aot_program()
+// loads, and their bytecode is translated to C, that calls the helpers of the interpreter, just like the jit does
+
+#define FUNKC_MAX_MODULES 256
+
+static const char* instructionNames[FUNK_INSTRUCTION_COUNT] = {
+	[FUNK_INSTRUCTION_RETURN] = "FUNK_INSTRUCTION_RETURN",
+	[FUNK_INSTRUCTION_CALL] = "FUNK_INSTRUCTION_CALL",
+	[FUNK_INSTRUCTION_GET] = "FUNK_INSTRUCTION_GET",
+	[FUNK_INSTRUCTION_GET_STRING] = "FUNK_INSTRUCTION_GET_STRING",
+	[FUNK_INSTRUCTION_DEFINE] = "FUNK_INSTRUCTION_DEFINE",
+	[FUNK_INSTRUCTION_DEFINE_GLOBAL] = "FUNK_INSTRUCTION_DEFINE_GLOBAL",
+	[FUNK_INSTRUCTION_GET_LEXICAL] = "FUNK_INSTRUCTION_GET_LEXICAL",
+	[FUNK_INSTRUCTION_GET_LEXICAL_STRING] = "FUNK_INSTRUCTION_GET_LEXICAL_STRING",
+	[FUNK_INSTRUCTION_DEFINE_LOCAL] = "FUNK_INSTRUCTION_DEFINE_LOCAL",
+	[FUNK_INSTRUCTION_CLOSURE] = "FUNK_INSTRUCTION_CLOSURE",
+	[FUNK_INSTRUCTION_JUMP_IF_FALSE] = "FUNK_INSTRUCTION_JUMP_IF_FALSE",
+	[FUNK_INSTRUCTION_JUMP_IF_REDEFINED] = "FUNK_INSTRUCTION_JUMP_IF_REDEFINED",
+	[FUNK_INSTRUCTION_SET] = "FUNK_INSTRUCTION_SET",
+	[FUNK_INSTRUCTION_FOR_PREPARE] = "FUNK_INSTRUCTION_FOR_PREPARE",
+	[FUNK_INSTRUCTION_FOR_NEXT] = "FUNK_INSTRUCTION_FOR_NEXT",
+	[FUNK_INSTRUCTION_FOR_STEP] = "FUNK_INSTRUCTION_FOR_STEP",
+	[FUNK_INSTRUCTION_PUSH_SCOPE] = "FUNK_INSTRUCTION_PUSH_SCOPE",
+	[FUNK_INSTRUCTION_POP_SCOPE] = "FUNK_INSTRUCTION_POP_SCOPE"
+};
+
+typedef struct FunkcModule {
+	// The argument of require(), that loads the module
+	char* path;
+	uint32_t function;
+} FunkcModule;
+
+typedef struct FunkcProgram {
+	FunkVm* vm;
+
+	FunkString** strings;
+	uint32_t stringCount;
+	uint32_t stringsAllocated;
+
+	FunkBasicFunction** functions;
+	uint32_t functionCount;
+	uint32_t functionsAllocated;
+
+	FunkcModule modules[FUNKC_MAX_MODULES];
+	uint16_t moduleCount;
+
+	// Modules, that were found in the code, but are not compiled yet
+	char* pending[FUNKC_MAX_MODULES];
+	uint16_t pendingCount;
+} FunkcProgram;
+
+static void print_error(FunkVm* vm, const char* error) {
+	fprintf(stderr, "%s\n", error);
+}
+
+static uint32_t add_string(FunkcProgram* program, FunkString* string) {
+	// The strings are interned, so comparing the pointers is enough
+	for (uint32_t i = 0; i < program->stringCount; i++) {
+		if (program->strings[i] == string) {
+			return i;
+		}
+	}
+
+	if (program->stringCount == program->stringsAllocated) {
+		program->stringsAllocated = program->stringsAllocated < 8 ? 8 : program->stringsAllocated * 2;
+		program->strings = (FunkString**) realloc((void*) program->strings, sizeof(FunkString*) * program->stringsAllocated);
+	}
+
+	program->strings[program->stringCount] = string;
+	return program->stringCount++;
+}
+
+static bool is_string(FunkObject* object, const char* chars) {
+	FunkString* string = (FunkString*) object;
+	return string->length == strlen(chars) && memcmp(string->chars, chars, string->length) == 0;
+}
+
+static void add_pending_module(FunkcProgram* program, FunkString* path) {
+	for (uint16_t i = 0; i < program->pendingCount; i++) {
+		if (strcmp(program->pending[i], path->chars) == 0) {
+			return;
+		}
+	}
+
+	for (uint16_t i = 0; i < program->moduleCount; i++) {
+		if (strcmp(program->modules[i].path, path->chars) == 0) {
+			return;
+		}
+	}
+
+	if (program->moduleCount + program->pendingCount < FUNKC_MAX_MODULES) {
+		program->pending[program->pendingCount++] = strdup(path->chars);
+	}
+}
+
+static uint8_t get_instruction_size(uint8_t instruction) {
+	switch (instruction) {
+		case FUNK_INSTRUCTION_RETURN:
+		case FUNK_INSTRUCTION_POP:
+		case FUNK_INSTRUCTION_PUSH_NULL:
+		case FUNK_INSTRUCTION_FOR_PREPARE:
+		case FUNK_INSTRUCTION_FOR_STEP:
+		case FUNK_INSTRUCTION_POP_SCOPE: return 1;
+
+		case FUNK_INSTRUCTION_CALL:
+		case FUNK_INSTRUCTION_GET_LOCAL:
+		case FUNK_INSTRUCTION_GET_UPVALUE:
+		case FUNK_INSTRUCTION_SET_LOCAL: return 2;
+
+		case FUNK_INSTRUCTION_DEFINE_LOCAL:
+		case FUNK_INSTRUCTION_JUMP_IF_REDEFINED:
+		case FUNK_INSTRUCTION_PUSH_SCOPE: return 4;
+		default: return 3;
+	}
+}
+
+// Only require() with a name right in the code can be resolved, the rest is left to the require() of the standard library
+static void find_modules(FunkcProgram* program, FunkBasicFunction* function) {
+	uint8_t* code = function->code;
+	uint8_t* end = function->code + function->codeLength;
+
+	#define CONSTANT(ip) (function->constants[((ip)[1] << 8) | (ip)[2]])
+
+	for (uint8_t* ip = code; ip < end; ip += get_instruction_size(*ip)) {
+		if ((*ip != FUNK_INSTRUCTION_GET && *ip != FUNK_INSTRUCTION_GET_LEXICAL) || !is_string(CONSTANT(ip), "require")) {
+			continue;
+		}
+
+		uint8_t* name = ip + 3;
+		uint8_t* call = ip + 6;
+
+		if (call + 1 < end && (*name == FUNK_INSTRUCTION_GET_STRING || *name == FUNK_INSTRUCTION_GET_LEXICAL_STRING)
+			&& call[0] == FUNK_INSTRUCTION_CALL && call[1] == 1) {
+
+			add_pending_module(program, (FunkString*) CONSTANT(name));
+		}
+	}
+
+	#undef CONSTANT
+}
+
+static uint32_t add_function(FunkcProgram* program, FunkBasicFunction* function) {
+	if (program->functionCount == program->functionsAllocated) {
+		program->functionsAllocated = program->functionsAllocated < 8 ? 8 : program->functionsAllocated * 2;
+		program->functions = (FunkBasicFunction**) realloc((void*) program->functions, sizeof(FunkBasicFunction*) * program->functionsAllocated);
+	}
+
+	uint32_t index = program->functionCount++;
+	program->functions[index] = function;
+
+	add_string(program, function->parent.name);
+
+	for (uint8_t i = 0; i < function->argumentCount; i++) {
+		add_string(program, function->argumentNames[i]);
+	}
+
+	for (uint8_t i = 0; function->localNames != NULL && i < function->localCount; i++) {
+		add_string(program, function->localNames[i]);
+	}
+
+	for (uint16_t i = 0; i < function->constantsLength; i++) {
+		FunkObject* constant = function->constants[i];
+
+		if (constant->type == FUNK_OBJECT_STRING) {
+			add_string(program, (FunkString*) constant);
+		} else {
+			add_function(program, (FunkBasicFunction*) constant);
+		}
+	}
+
+	find_modules(program, function);
+	return index;
+}
+
+// Finds the index of a function, that was added already
+static uint32_t find_function(FunkcProgram* program, FunkBasicFunction* function) {
+	for (uint32_t i = 0; i < program->functionCount; i++) {
+		if (program->functions[i] == function) {
+			return i;
+		}
+	}
+
+	return 0;
+}
+
+static bool compile_file(FunkcProgram* program, const char* path, uint32_t* function) {
+	const char* source = funk_read_file(path);
+
+	if (source == NULL) {
+		return false;
+	}
+
+	FunkFunction* compiled = funk_compile_string(program->vm, path, source);
+	free((void*) source);
+
+	if (compiled == NULL) {
+		exit(65);
+	}
+
+	*function = add_function(program, (FunkBasicFunction*) compiled);
+	return true;
+}
+
+static void compile_modules(FunkcProgram* program) {
+	while (program->pendingCount > 0) {
+		char* path = program->pending[--program->pendingCount];
+		size_t length = strlen(path);
+
+		char* file = (char*) malloc(length + 6);
+		memcpy((void*) file, path, length);
+
+		for (size_t i = 0; i < length; i++) {
+			if (file[i] == '.') {
+				file[i] = '/';
+			}
+		}
+
+		memcpy((void*) (file + length), ".funk\0", 6);
+		// The module is added first, so that requiring itself doesn't compile it again
+		FunkcModule* module = &program->modules[program->moduleCount++];
+		module->path = path;
+
+		// Modules, that can't be read now, might be there, once the program runs
+		if (!compile_file(program, file, &module->function)) {
+			program->moduleCount--;
+			free((void*) path);
+		}
+
+		free((void*) file);
+	}
+}
+
+static void write_string(FILE* file, const char* chars) {
+	fputc('"', file);
+
+	for (const char* c = chars; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') {
+			fprintf(file, "\\%c", *c);
+		} else if (*c < ' ' || *c > '~') {
+			fprintf(file, "\\%03o", (unsigned char) *c);
+		} else {
+			fputc(*c, file);
+		}
+	}
+
+	fputc('"', file);
+}
+
+static void write_names(FILE* file, FunkcProgram* program, const char* kind, uint32_t index, FunkString** names, uint8_t count) {
+	if (count == 0 || names == NULL) {
+		return;
+	}
+
+	fprintf(file, "static const uint32_t %s%u[] = { ", kind, index);
+
+	for (uint8_t i = 0; i < count; i++) {
+		fprintf(file, "%s%u", i == 0 ? "" : ", ", add_string(program, names[i]));
+	}
+
+	fprintf(file, " };\n");
+}
+
+// The jumps of the bytecode become gotos, only the instructions, that are jumped to, get a label
+static bool* find_jump_targets(FunkBasicFunction* function) {
+	bool* targets = (bool*) calloc(function->codeLength + 1, sizeof(bool));
+	uint8_t* end = function->code + function->codeLength;
+
+	// The offset is always the last operand, the jumps go from the next instruction
+	#define OFFSET(next) ((uint16_t) (((next)[-2] << 8) | (next)[-1]))
+
+	for (uint8_t* ip = function->code; ip < end; ip += get_instruction_size(*ip)) {
+		uint8_t* next = ip + get_instruction_size(*ip);
+
+		switch (*ip) {
+			case FUNK_INSTRUCTION_JUMP:
+			case FUNK_INSTRUCTION_JUMP_IF_FALSE:
+			case FUNK_INSTRUCTION_JUMP_IF_REDEFINED:
+			case FUNK_INSTRUCTION_FOR_NEXT: targets[next + OFFSET(next) - function->code] = true; break;
+			case FUNK_INSTRUCTION_LOOP: targets[next - OFFSET(next) - function->code] = true; break;
+			default: break;
+		}
+	}
+
+	#undef OFFSET
+
+	return targets;
+}
+
+static void write_run_function(FILE* file, FunkBasicFunction* function, uint32_t index) {
+	uint8_t* ip = function->code;
+	uint8_t* end = function->code + function->codeLength;
+	bool* targets = find_jump_targets(function);
+
+	#define TARGET(offset) ((uint32_t) (ip - function->code) + (offset))
+
+	fprintf(file, "static void run%u(FunkJitFrame* frame) {\n", index);
+	fprintf(file, "\tFunkVm* vm = frame->vm;\n");
+	fprintf(file, "\tFunkObject** constants = frame->callFrame->function->constants;\n\n");
+	fprintf(file, "\t(void) vm;\n\t(void) constants;\n\n");
+
+	#define READ_UINT8() (*ip++)
+	#define READ_UINT16() (ip += 2, (uint16_t) ((ip[-2] << 8) | ip[-1]))
+
+	while (ip < end) {
+		if (targets[ip - function->code]) {
+			fprintf(file, "l%u:;\n", (uint32_t) (ip - function->code));
+		}
+
+		uint8_t instruction = READ_UINT8();
+
+		switch (instruction) {
+			case FUNK_INSTRUCTION_RETURN: {
+				fprintf(file, "\thelpers[FUNK_INSTRUCTION_RETURN](frame, NULL, 0);\n");
+				fprintf(file, "\treturn;\n");
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_JUMP: {
+				uint16_t offset = READ_UINT16();
+				fprintf(file, "\tgoto l%u;\n", TARGET(offset));
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_LOOP: {
+				uint16_t offset = READ_UINT16();
+				fprintf(file, "\tgoto l%u;\n", TARGET(-offset));
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_JUMP_IF_FALSE:
+			case FUNK_INSTRUCTION_FOR_NEXT: {
+				uint16_t offset = READ_UINT16();
+				fprintf(file, "\tif (!helpers[%s](frame, NULL, 0)) goto l%u;\n", instructionNames[instruction], TARGET(offset));
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_JUMP_IF_REDEFINED: {
+				uint8_t intrinsic = READ_UINT8();
+				uint16_t offset = READ_UINT16();
+				fprintf(file, "\tif (!helpers[FUNK_INSTRUCTION_JUMP_IF_REDEFINED](frame, NULL, %u)) goto l%u;\n", intrinsic, TARGET(offset));
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_SET_LOCAL: {
+				fprintf(file, "\tframe->slots[%u] = *--vm->stackTop;\n", READ_UINT8());
+				break;
+			}
+
+			case FUNK_INSTRUCTION_FOR_PREPARE:
+			case FUNK_INSTRUCTION_FOR_STEP:
+			case FUNK_INSTRUCTION_POP_SCOPE: {
+				fprintf(file, "\thelpers[%s](frame, NULL, 0);\n", instructionNames[instruction]);
+				break;
+			}
+
+			// An error in the lambda goes on in the interpreter, so the code after it needs no label
+			case FUNK_INSTRUCTION_PUSH_SCOPE: {
+				fprintf(file, "\thelpers[FUNK_INSTRUCTION_PUSH_SCOPE](frame, NULL, %u);\n", (uint32_t) (ip - function->code - 1));
+				ip += 3;
+
+				break;
+			}
+
+			case FUNK_INSTRUCTION_CALL: {
+				fprintf(file, "\tif (!helpers[FUNK_INSTRUCTION_CALL](frame, NULL, %u)) return;\n", READ_UINT8());
+				break;
+			}
+
+			case FUNK_INSTRUCTION_PUSH_NULL: {
+				fprintf(file, "\t*vm->stackTop++ = NULL;\n");
+				break;
+			}
+
+			case FUNK_INSTRUCTION_PUSH_CONSTANT: {
+				fprintf(file, "\t*vm->stackTop++ = (FunkFunction*) constants[%u];\n", READ_UINT16());
+				break;
+			}
+
+			case FUNK_INSTRUCTION_POP: {
+				fprintf(file, "\tvm->stackTop--;\n");
+				break;
+			}
+
+			case FUNK_INSTRUCTION_GET_LOCAL: {
+				fprintf(file, "\t*vm->stackTop++ = frame->slots[%u];\n", READ_UINT8());
+				break;
+			}
+
+			case FUNK_INSTRUCTION_GET_UPVALUE: {
+				fprintf(file, "\t*vm->stackTop++ = frame->upvalues[%u];\n", READ_UINT8());
+				break;
+			}
+
+			case FUNK_INSTRUCTION_DEFINE_LOCAL: {
+				uint8_t slot = READ_UINT8();
+				fprintf(file, "\tif (!helpers[FUNK_INSTRUCTION_DEFINE_LOCAL](frame, constants[%u], %u)) return;\n", READ_UINT16(), slot);
+
+				break;
+			}
+
+			default: {
+				fprintf(file, "\tif (!helpers[%s](frame, constants[%u], 0)) return;\n", instructionNames[instruction], READ_UINT16());
+				break;
+			}
+		}
+	}
+
+	#undef READ_UINT8
+	#undef READ_UINT16
+	#undef TARGET
+
+	if (targets[function->codeLength]) {
+		fprintf(file, "l%u:;\n", function->codeLength);
+	}
+
+	fprintf(file, "}\n\n");
+	free((void*) targets);
+}
+
+static void write_function(FILE* file, FunkcProgram* program, uint32_t index) {
+	FunkBasicFunction* function = program->functions[index];
+
+	if (function->codeLength > 0) {
+		fprintf(file, "static const uint8_t code%u[] = {", index);
+
+		for (uint32_t i = 0; i < function->codeLength; i++) {
+			fprintf(file, "%s%u", i % 24 == 0 ? "\n\t" : " ", function->code[i]);
+			fprintf(file, i + 1 < function->codeLength ? "," : "");
+		}
+
+		fprintf(file, "\n};\n");
+	}
+
+	if (function->constantsLength > 0) {
+		fprintf(file, "static const uint32_t constants%u[] = {", index);
+
+		for (uint16_t i = 0; i < function->constantsLength; i++) {
+			FunkObject* constant = function->constants[i];
+
+			if (constant->type == FUNK_OBJECT_STRING) {
+				fprintf(file, "%sFUNK_AOT_STRING(%u)", i % 6 == 0 ? "\n\t" : " ", add_string(program, (FunkString*) constant));
+			} else {
+				fprintf(file, "%sFUNK_AOT_FUNCTION(%u)", i % 6 == 0 ? "\n\t" : " ", find_function(program, (FunkBasicFunction*) constant));
+			}
+
+			fprintf(file, i + 1 < function->constantsLength ? "," : "");
+		}
+
+		fprintf(file, "\n};\n");
+	}
+
+	write_names(file, program, "argumentNames", index, function->argumentNames, function->argumentCount);
+	write_names(file, program, "localNames", index, function->localNames, function->localCount);
+
+	if (function->upvalueCount > 0) {
+		fprintf(file, "static const uint16_t upvalueSources%u[] = { ", index);
+
+		for (uint8_t i = 0; i < function->upvalueCount; i++) {
+			fprintf(file, "%s%u", i == 0 ? "" : ", ", function->upvalueSources[i]);
+		}
+
+		fprintf(file, " };\n");
+	}
+
+	fprintf(file, "\n");
+	write_run_function(file, function, index);
+}
+
+#define WRITE_ARRAY_FIELD(condition, name, index) if (condition) { fprintf(file, name "%u, ", index); } else { fprintf(file, "NULL, "); }
+
+static void write_program(FILE* file, FunkcProgram* program, const char* script, uint32_t mainFunction) {
+	fprintf(file, "// Generated by funkc from %s, do not edit\n\n", script);
+	fprintf(file, "#include \"funk.h\"\n#include \"funk_aot.h\"\n#include \"funk_std.h\"\n\n#include <stdio.h>\n\n");
+	fprintf(file, "static const FunkJitHelper* helpers;\n\n");
+
+	for (uint32_t i = 0; i < program->functionCount; i++) {
+		write_function(file, program, i);
+	}
+
+	fprintf(file, "static const char* const strings[] = {\n");
+
+	for (uint32_t i = 0; i < program->stringCount; i++) {
+		fprintf(file, "\t");
+		write_string(file, program->strings[i]->chars);
+		fprintf(file, ",\n");
+	}
+
+	fprintf(file, "};\n\n");
+	fprintf(file, "static const FunkAotFunction functions[] = {\n");
+
+	for (uint32_t i = 0; i < program->functionCount; i++) {
+		FunkBasicFunction* function = program->functions[i];
+
+		fprintf(file, "\t{ %u, ", add_string(program, function->parent.name));
+		WRITE_ARRAY_FIELD(function->argumentCount > 0, "argumentNames", i)
+		fprintf(file, "%u, ", function->argumentCount);
+		WRITE_ARRAY_FIELD(function->codeLength > 0, "code", i)
+		fprintf(file, "%u, ", function->codeLength);
+		WRITE_ARRAY_FIELD(function->constantsLength > 0, "constants", i)
+		fprintf(file, "%u, %s, ", function->constantsLength, function->lexical ? "true" : "false");
+		WRITE_ARRAY_FIELD(function->localNames != NULL && function->localCount > 0, "localNames", i)
+		fprintf(file, "%u, ", function->localNames != NULL ? function->localCount : 0);
+		WRITE_ARRAY_FIELD(function->upvalueCount > 0, "upvalueSources", i)
+		fprintf(file, "%u, %u, run%u },\n", function->upvalueCount, function->inlineDepth, i);
+	}
+
+	fprintf(file, "};\n\n");
+
+	if (program->moduleCount > 0) {
+		fprintf(file, "static const FunkAotModule modules[] = {\n");
+
+		for (uint16_t i = 0; i < program->moduleCount; i++) {
+			fprintf(file, "\t{ ");
+			write_string(file, program->modules[i].path);
+			fprintf(file, ", %u },\n", program->modules[i].function);
+		}
+
+		fprintf(file, "};\n\n");
+	}
+
+	fprintf(file, "static const FunkAotProgram program = { strings, %u, functions, %u, %s, %u, %u };\n\n",
+		program->stringCount, program->functionCount, program->moduleCount > 0 ? "modules" : "NULL", program->moduleCount, mainFunction);
+
+	fprintf(file, "static void print_error(FunkVm* vm, const char* error) {\n");
+	fprintf(file, "\tfunk_print_stack_trace(vm);\n");
+	fprintf(file, "\tfprintf(stderr, \"%%s\\n\", error);\n");
+	fprintf(file, "}\n\n");
+
+	fprintf(file, "int main(int argc, const char** argv) {\n");
+	fprintf(file, "\tFunkVm* vm = funk_create_vm_ex(NULL, print_error);\n");
+	fprintf(file, "\thelpers = funk_get_jit_helpers();\n\n");
+	fprintf(file, "\tfunk_open_std(vm);\n");
+	fprintf(file, "\tfunk_run_aot_program(vm, &program);\n");
+	fprintf(file, "\tfunk_free_vm(vm);\n\n");
+	fprintf(file, "\treturn 0;\n");
+	fprintf(file, "}\n");
+}
+
+#undef WRITE_ARRAY_FIELD
+
+// Builds the executable with the compiler and the library, that funkc itself was built with
+static int build_executable(const char* source, const char* output) {
+	const char* format = "%s %s -I%s -o %s %s %s -lm -lpthread";
+	size_t length = strlen(format) + strlen(FUNK_CC) + strlen(FUNK_CFLAGS) + strlen(FUNK_INCLUDE_DIR)
+		+ strlen(output) + strlen(source) + strlen(FUNK_LIBRARY);
+
+	char* command = (char*) malloc(length + 1);
+	sprintf(command, format, FUNK_CC, FUNK_CFLAGS, FUNK_INCLUDE_DIR, output, source, FUNK_LIBRARY);
+
+	int status = system(command);
+	free((void*) command);
+
+	return status == 0 ? 0 : 1;
+}
+
+int main(int argc, const char** argv) {
+	const char* output = NULL;
+	const char* script = NULL;
+	bool onlySource = false;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-c") == 0) {
+			onlySource = true;
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			output = argv[++i];
+		} else if (script == NULL) {
+			script = argv[i];
+		} else {
+			script = NULL;
+			break;
+		}
+	}
+
+	if (script == NULL) {
+		printf("funkc [-c] [-o output] file\n");
+		return 0;
+	}
+
+	FunkcProgram program;
+	memset((void*) &program, 0, sizeof(FunkcProgram));
+
+	program.vm = funk_create_vm_ex(NULL, print_error);
+	// The calls to if(), while() and for() are only lowered, when the compiler knows the natives
+	funk_open_std(program.vm);
+
+	uint32_t mainFunction;
+
+	if (!compile_file(&program, script, &mainFunction)) {
+		fprintf(stderr, "Failed to open '%s'\n", script);
+		return 1;
+	}
+
+	compile_modules(&program);
+
+	char defaultOutput[] = "a.out";
+	size_t outputLength = strlen(output != NULL ? output : defaultOutput);
+
+	// Without -c the source is only kept next to the executable, until it is built
+	char* source = (char*) malloc(outputLength + 3);
+	sprintf(source, onlySource ? "%s" : "%s.c", output != NULL ? output : (onlySource ? "a.c" : defaultOutput));
+
+	FILE* file = fopen(source, "w");
+
+	if (file == NULL) {
+		fprintf(stderr, "Failed to open '%s'\n", source);
+		return 1;
+	}
+
+	write_program(file, &program, script, mainFunction);
+	fclose(file);
+
+	int status = 0;
+
+	if (!onlySource) {
+		status = build_executable(source, output != NULL ? output : defaultOutput);
+		remove(source);
+	}
+
+	free((void*) source);
+
+	for (uint16_t i = 0; i < program.moduleCount; i++) {
+		free((void*) program.modules[i].path);
+	}
+
+	free((void*) program.strings);
+	free((void*) program.functions);
+	funk_free_vm(program.vm);
+
+	return status;
+}
@@ -3,15 +3,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 void print_error(FunkVm* vm, const char* error) {
 	funk_print_stack_trace(vm);
 	fprintf(stderr, "%s\n", error);
 }
 
-int run_file(const char* file) {
-	FunkVm* vm = funk_create_vm(malloc, free, print_error);
+int run_file(const char* file, uint32_t jitThreshold) {
+	FunkVm* vm = funk_create_vm_ex(NULL, print_error);
 
+	funk_set_jit_threshold(vm, jitThreshold);
 	funk_open_std(vm);
 	funk_run_file(vm, file);
 	funk_free_vm(vm);
@@ -20,10 +22,23 @@ int run_file(const char* file) {
 }
 
 int main(int argc, const char** argv) {
-	if (argc == 2) {
-		return run_file(argv[1]);
+	uint32_t jitThreshold = FUNK_DEFAULT_JIT_THRESHOLD;
+	int i = 1;
+
+	for (; i < argc - 1; i++) {
+		if (strcmp(argv[i], "--no-jit") == 0) {
+			jitThreshold = 0;
+		} else if (strcmp(argv[i], "--jit-threshold") == 0 && i + 2 < argc) {
+			jitThreshold = (uint32_t) strtoul(argv[++i], NULL, 10);
+		} else {
+			break;
+		}
+	}
+
+	if (i == argc - 1) {
+		return run_file(argv[i], jitThreshold);
 	}
 
-	printf("funk [file]\n");
+	printf("funk [--no-jit] [--jit-threshold calls] [file]\n");
 	return 0;
-}
\ No newline at end of file
+}
@@ -13,6 +13,8 @@ import io
 from subprocess import Popen, PIPE
 import sys
 import os
+import shutil
+import tempfile
 
 # Runs the tests.
 REPO_DIR = dirname(realpath(__file__))
@@ -37,23 +39,37 @@ INTERPRETERS = {}
 C_SUITES = []
 
 class Interpreter:
-    def __init__(self, name, language, args, tests):
+    def __init__(self, name, language, args, tests, compiler=None):
         self.name = name
         self.language = language
         self.args = args
         self.tests = tests
+        # Compiles the test into an executable first, that is run instead
+        self.compiler = compiler
 
 
-def c_interpreter(name, tests):
-    path = name
-
-    INTERPRETERS[name] = Interpreter(name, 'c', [path], tests)
+def c_interpreter(name, tests, flags=[]):
+    INTERPRETERS[name] = Interpreter(name, 'c', ['./dist/funk'] + flags, tests)
     C_SUITES.append(name)
 
 c_interpreter('funk', {
     'test': 'pass'
 })
 
+# The same tests have to pass in the interpreter alone and with every function compiled at its first call
+c_interpreter('funk --no-jit', {
+    'test': 'pass'
+}, ['--no-jit'])
+
+c_interpreter('funk --jit-threshold 1', {
+    'test': 'pass'
+}, ['--jit-threshold', '1'])
+
+INTERPRETERS['funkc'] = Interpreter('funkc', 'c', [], {
+    'test': 'pass'
+}, './dist/funkc')
+C_SUITES.append('funkc')
+
 class Test:
     def __init__(self, path):
         self.path = path
@@ -142,13 +158,38 @@ class Test:
 
     def run(self):
         # Invoke the interpreter and run the test.
-        args = ["./dist/funk", self.path]
+        if interpreter.compiler:
+            self.run_compiled()
+            return
+
+        args = interpreter.args + [self.path]
         proc = Popen(args, stdin=PIPE, stdout=PIPE, stderr=PIPE)
 
         out, err = proc.communicate()
         self.validate(proc.returncode, out, err)
 
 
+    def run_compiled(self):
+        directory = tempfile.mkdtemp()
+        executable = join(directory, splitext(basename(self.path))[0])
+
+        try:
+            proc = Popen([interpreter.compiler, '-o', executable, self.path], stdin=PIPE, stdout=PIPE, stderr=PIPE)
+            out, err = proc.communicate()
+
+            if proc.returncode != 0:
+                self.fail('Failed to compile:')
+                self.failures += err.decode('utf-8').split('\n')
+                return
+
+            proc = Popen([executable], stdin=PIPE, stdout=PIPE, stderr=PIPE)
+
+            out, err = proc.communicate()
+            self.validate(proc.returncode, out, err)
+        finally:
+            shutil.rmtree(directory)
+
+
     def validate(self, exit_code, out, err):
         if self.compile_errors and self.runtime_error_message:
             self.fail("Test error: Cannot expect both compile and runtime errors.")
@@ -0,0 +1,103 @@
+// Throughput of a channel between two vms on their own threads, one sends, the other receives.
+// Prints the kind of message, followed by the messages per second, and the same for the bare queue, that only moves pointers
+
+#include "funk_channel.h"
+#include "funk_std.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#define MESSAGE_COUNT 200000
+#define CAPACITY 1024
+
+typedef struct Side {
+	FunkChannel* channel;
+	const char* script;
+} Side;
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void print_error(FunkVm* vm, const char* error) {
+	fprintf(stderr, "%s\n", error);
+}
+
+static void* run_side(void* argument) {
+	Side* side = (Side*) argument;
+	FunkVm* vm = funk_create_vm_ex(NULL, print_error);
+	funk_open_std(vm);
+
+	funk_set_global(vm, "messages", funk_wrap_channel(vm, side->channel));
+	funk_set_global(vm, "count", funk_number_to_string(vm, MESSAGE_COUNT));
+	funk_run_string(vm, "channel", side->script);
+
+	funk_free_vm(vm);
+	return NULL;
+}
+
+static void measure(const char* kind, const char* message) {
+	char sender[256];
+	snprintf(sender, sizeof(sender), "for(NULLA, count, () => send(messages, %s))", message);
+
+	FunkChannel* channel = funk_create_channel(CAPACITY);
+	Side sending = { channel, sender };
+	Side receiving = { channel, "for(NULLA, count, () => receive(messages))" };
+	pthread_t threads[2];
+
+	double start = now();
+
+	pthread_create(&threads[0], NULL, run_side, (void*) &receiving);
+	pthread_create(&threads[1], NULL, run_side, (void*) &sending);
+	pthread_join(threads[0], NULL);
+	pthread_join(threads[1], NULL);
+
+	double time = now() - start;
+	printf("%s %.0f\n", kind, MESSAGE_COUNT / time);
+
+	funk_release_channel(channel);
+}
+
+static void* pop_all(void* argument) {
+	FunkChannel* channel = (FunkChannel*) argument;
+	void* message;
+	uint32_t size;
+
+	for (int i = 0; i < MESSAGE_COUNT * 10; i++) {
+		funk_channel_pop(channel, &message, &size, true);
+	}
+
+	return NULL;
+}
+
+static void measure_queue() {
+	FunkChannel* channel = funk_create_channel(CAPACITY);
+	pthread_t thread;
+
+	double start = now();
+	pthread_create(&thread, NULL, pop_all, (void*) channel);
+
+	for (int i = 0; i < MESSAGE_COUNT * 10; i++) {
+		funk_channel_push(channel, NULL, 0, true);
+	}
+
+	pthread_join(thread, NULL);
+
+	double time = now() - start;
+	printf("queue %.0f\n", MESSAGE_COUNT * 10 / time);
+
+	funk_release_channel(channel);
+}
+
+int main() {
+	measure("string", "hello");
+	measure("array", "array(I, II, hello)");
+	measure("map", "map(name, funk, count, III)");
+	measure_queue();
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+// Throughput of a job pool over its thread count, every job is a small call into one program, like a request of a server.
+// Prints the thread count, followed by the jobs per second, and the same for a fresh vm, that compiles the script for every job
+
+#include "funk_pool.h"
+#include "funk_std.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define JOB_COUNT 1000
+
+static const char* source =
+	"function fib(n) {\n"
+	"	return if(\n"
+	"		less(n, II),\n"
+	"		n,\n"
+	"		() => add(fib(subtract(n, II)), fib(subtract(n, I)))\n"
+	"	)\n"
+	"}\n";
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void print_error(FunkVm* vm, const char* error) {
+	fprintf(stderr, "%s\n", error);
+}
+
+static void measure(FunkProgram* program, uint16_t threadCount) {
+	FunkJobPool* pool = funk_create_job_pool(threadCount);
+	static FunkJob* jobs[JOB_COUNT];
+	const char* args[] = { "XII" };
+
+	double start = now();
+
+	for (int i = 0; i < JOB_COUNT; i++) {
+		jobs[i] = funk_submit_job(pool, program, "fib", args, 1);
+	}
+
+	for (int i = 0; i < JOB_COUNT; i++) {
+		if (funk_get_job_error(jobs[i]) != NULL) {
+			fprintf(stderr, "%s\n", funk_get_job_error(jobs[i]));
+		}
+
+		funk_free_job(jobs[i]);
+	}
+
+	double time = now() - start;
+	printf("%d %.0f\n", threadCount, JOB_COUNT / time);
+
+	funk_free_job_pool(pool);
+}
+
+static void measure_fresh() {
+	double start = now();
+
+	for (int i = 0; i < JOB_COUNT; i++) {
+		FunkVm* vm = funk_create_vm_ex(NULL, print_error);
+		funk_open_std(vm);
+
+		funk_run_string(vm, "pool", source);
+		funk_run_string(vm, "job", "fib(XII)");
+
+		funk_free_vm(vm);
+	}
+
+	double time = now() - start;
+	printf("fresh %.0f\n", JOB_COUNT / time);
+}
+
+int main() {
+	FunkVm* vm = funk_create_vm_ex(NULL, print_error);
+	funk_open_std(vm);
+
+	FunkProgram* program = funk_create_program(vm, "pool", source);
+
+	if (program == NULL) {
+		return 1;
+	}
+
+	for (uint16_t threads = 1; threads <= 8; threads *= 2) {
+		measure(program, threads);
+	}
+
+	measure_fresh();
+
+	funk_free_program(program);
+	return 0;
+}